@@ -0,0 +1,57 @@
+#version 450
+
+// One copy of the mesh per draw shaders/cull.comp kept. first_instance of every draw is the
+// object index, the copy is centered on the object's sphere. Layouts match culled_mesh.hpp.
+// View space looks down +z, depth is reverse-Z with an infinite far plane like cull.comp.
+
+struct CullObject
+{
+    vec4 sphere;        // world space center, radius
+    uint index_count;
+    uint first_index;
+    int vertex_offset;
+    uint pad;
+};
+
+layout(set = 0, binding = 0) readonly buffer Objects
+{
+    CullObject objects[];
+};
+
+layout(push_constant) uniform View
+{
+    mat4 view;              // world to view
+    float p00;              // projection[0][0]
+    float p11;              // projection[1][1]
+    float znear;
+    float pad;
+    vec4 position_min;      // xyz: where a quantized 0 lands, relative to the object center
+    vec4 position_scale;    // xyz: size of the mesh bounds
+};
+
+layout(location = 0) in vec4 position;      // R16G16B16A16_UNORM within the mesh bounds
+layout(location = 1) in vec2 normal;        // R16G16_SNORM octahedral
+layout(location = 2) in vec2 uv;
+
+layout(location = 0) out vec3 out_normal;
+
+vec3 decode_octahedral(vec2 encoded)
+{
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (n.z < 0.0)
+    {
+        vec2 signs = vec2((n.x >= 0.0) ? 1.0 : -1.0, (n.y >= 0.0) ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
+
+void main()
+{
+    vec3 center = objects[gl_InstanceIndex].sphere.xyz;
+    vec3 world = center + position_min.xyz + position.xyz * position_scale.xyz;
+    vec3 c = (view * vec4(world, 1.0)).xyz;
+    // Vulkan clip space has y down, view space y up.
+    gl_Position = vec4(c.x * p00, -c.y * p11, znear, c.z);
+    out_normal = mat3(view) * decode_octahedral(normal);
+}
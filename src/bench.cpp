@@ -0,0 +1,2140 @@
+// Benchmarks, always run offscreen so they work on any box with a software ICD.
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <stdlib.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "bench_report.hpp"
+#include "culled_mesh.hpp"
+#include "deletion_queue.hpp"
+#include "descriptors.hpp"
+#include "device.hpp"
+#include "device_memory.hpp"
+#include "device_select.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "file_map.hpp"
+#include "gpu_culling.hpp"
+#include "host_allocator.hpp"
+#include "immediate.hpp"
+#include "jobs.hpp"
+#include "mesh.hpp"
+#include "mesh_pack.hpp"
+#include "parallel_record.hpp"
+#include "pipeline_cache.hpp"
+#include "pipeline_manager.hpp"
+#include "render_graph.hpp"
+#include "swap_chain.hpp"
+#include "texture_streaming.hpp"
+#include "tools.hpp"
+#include "upload.hpp"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ms(bench_clock::time_point from, bench_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+struct BenchContext
+{
+    VkInstance instance;
+    DeviceSelection selection;
+    VkDevice device;
+    DrawCommandBuffer draw;
+    SwapChain swap_chain;
+    VkCommandPool command_pool;
+    DeviceAllocator allocator;
+    BenchReport report;
+};
+
+// Device selection with every device queried and scored, against the profile standing in for it.
+// The profile is the one init_Vulkan() saved for this run's device.
+static VkResult bench_device_selection(BenchContext& ctx, uint32_t iterations)
+{
+    double query_ms = 0.0;
+    for (uint32_t iidx = 0; iidx < iterations; ++iidx)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        uint32_t gpu_count = 0;
+        VK_THROW(vkEnumeratePhysicalDevices(ctx.instance, &gpu_count, nullptr));
+        std::vector<VkPhysicalDevice> gpus(gpu_count);
+        VK_THROW(vkEnumeratePhysicalDevices(ctx.instance, &gpu_count, gpus.data()));
+        for (uint32_t gidx = 0; gidx < gpu_count; ++gidx)
+        {
+            DeviceCapabilities capabilities;
+            char const* reason = nullptr;
+            query_device_capabilities(gpus[gidx], ctx.selection.properties2, ctx.selection.device_ids, &capabilities);
+            score_device(capabilities, ctx.selection.requirements, &reason);
+        }
+        query_ms += elapsed_ms(start, bench_clock::now());
+    }
+    query_ms /= std::max<uint32_t>(iterations, 1);
+
+    DeviceSelection selection = ctx.selection;
+    selection.override_device = nullptr;
+    std::vector<DeviceCandidate> candidates;
+    double profile_ms = 0.0;
+    for (uint32_t iidx = 0; iidx < iterations; ++iidx)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        VK_THROW(select_physical_devices(ctx.instance, selection, true, &candidates));
+        profile_ms += elapsed_ms(start, bench_clock::now());
+        if (!selection.profile_hit)
+        {
+            std::cout << "  device profile not used" << ((selection.profile_reject_reason != nullptr) ? ": " : "")
+                      << ((selection.profile_reject_reason != nullptr) ? selection.profile_reject_reason : "") << "\n";
+            return VK_SUCCESS;
+        }
+    }
+    profile_ms /= std::max<uint32_t>(iterations, 1);
+
+    std::cout << "  query every device | " << query_ms << " ms\n";
+    std::cout << "  device profile     | " << profile_ms << " ms\n";
+    add_bench_metric(ctx.report, "device.query", query_ms, "ms", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "device.profile", profile_ms, "ms", BENCH_LOWER_IS_BETTER);
+    return VK_SUCCESS;
+}
+
+// Best of iterations recording job_count secondary buffers into primary, in ms.
+static VkResult time_parallel_record(BenchContext& ctx, JobSystem& jobs, ThreadCommandPools& pools, VkCommandBuffer primary,
+                                     uint32_t job_count, RecordFn const& record, uint32_t iterations, double* out_best_ms)
+{
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    for (uint32_t iter = 0; iter < iterations; ++iter)
+    {
+        VK_THROW(reset_thread_command_pools(ctx.device, pools, 0));
+        VK_THROW(vkResetCommandBuffer(primary, 0));
+        bench_clock::time_point start = bench_clock::now();
+        VK_THROW(vkBeginCommandBuffer(primary, &begin_info));
+        VK_THROW(record_parallel(jobs, ctx.device, pools, 0, primary, nullptr, job_count, record));
+        VK_THROW(vkEndCommandBuffer(primary));
+        double ms = elapsed_ms(start, bench_clock::now());
+        if ((iter == 0) || (ms < *out_best_ms))
+        {
+            *out_best_ms = ms;
+        }
+    }
+    return VK_SUCCESS;
+}
+
+// Secondary buffer recording throughput for 1..N recording threads.
+static VkResult bench_record_scaling(BenchContext& ctx, uint32_t job_count, uint32_t commands_per_job, uint32_t iterations)
+{
+    uint32_t max_threads = std::thread::hardware_concurrency();
+    std::vector<uint32_t> thread_counts;
+    for (uint32_t threads = 1; threads < max_threads; threads *= 2)
+    {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back((max_threads > 0) ? max_threads : 1);
+
+    VkCommandBuffer primary = VK_NULL_HANDLE;
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.pNext = nullptr;
+    command_buffer_allocate_info.commandPool = ctx.command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = 1;
+    VK_THROW(vkAllocateCommandBuffers(ctx.device, &command_buffer_allocate_info, &primary));
+
+    RecordFn record = [commands_per_job](VkCommandBuffer command_buffer, uint32_t job_idx)
+    {
+        VkViewport viewport = { 0.0f, 0.0f, 800.0f, 600.0f, 0.0f, 1.0f };
+        VkRect2D scissor = { { 0, 0 }, { 800, 600 } };
+        for (uint32_t cidx = 0; cidx < commands_per_job; cidx += 2)
+        {
+            viewport.x = static_cast<float>(cidx & 63);
+            scissor.offset.x = static_cast<int32_t>(job_idx & 63);
+            vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+            vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+        }
+    };
+
+    std::cout << "record scaling: " << job_count << " secondary buffers x " << commands_per_job << " commands, " << iterations << " iterations\n";
+    double single_thread_ms = 0.0;
+    for (size_t tidx = 0; tidx < thread_counts.size(); ++tidx)
+    {
+        uint32_t threads = thread_counts[tidx];
+        JobSystem jobs;
+        if (!create_job_system(threads, &jobs))
+        {
+            vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &primary);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        ThreadCommandPools pools;
+        double best_ms = 0.0;
+        VkResult result = create_thread_command_pools(ctx.device, ctx.draw.queue_family_idx, threads, 1, &pools);
+        if (result == VK_SUCCESS)
+        {
+            result = time_parallel_record(ctx, jobs, pools, primary, job_count, record, iterations, &best_ms);
+            destroy_thread_command_pools(ctx.device, pools);
+        }
+        uint64_t steals = jobs.steal_count.load();
+        destroy_job_system(jobs);
+        if (result != VK_SUCCESS)
+        {
+            vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &primary);
+            return result;
+        }
+        if (threads == 1)
+        {
+            single_thread_ms = best_ms;
+        }
+        double commands = static_cast<double>(job_count) * commands_per_job;
+        char metric[64];
+        snprintf(metric, sizeof(metric), "record.threads_%u", threads);
+        add_bench_metric(ctx.report, metric, commands / best_ms / 1000.0, "Mcmd/s", BENCH_HIGHER_IS_BETTER);
+        std::cout << "  threads " << threads
+                  << " | " << best_ms << " ms"
+                  << " | " << commands / best_ms / 1000.0 << " Mcmd/s"
+                  << " | speedup " << single_thread_ms / best_ms
+                  << " | steals " << steals << "\n";
+    }
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &primary);
+    return VK_SUCCESS;
+}
+
+struct FrameTimes
+{
+    double mean_ms;
+    double stddev_ms;
+    double max_ms;
+};
+
+static FrameTimes summarize(std::vector<double> const& samples)
+{
+    FrameTimes times = { 0.0, 0.0, 0.0 };
+    for (size_t sidx = 0; sidx < samples.size(); ++sidx)
+    {
+        times.mean_ms += samples[sidx];
+        times.max_ms = std::max(times.max_ms, samples[sidx]);
+    }
+    times.mean_ms /= std::max<size_t>(samples.size(), 1);
+    for (size_t sidx = 0; sidx < samples.size(); ++sidx)
+    {
+        times.stddev_ms += (samples[sidx] - times.mean_ms) * (samples[sidx] - times.mean_ms);
+    }
+    times.stddev_ms = std::sqrt(times.stddev_ms / std::max<size_t>(samples.size(), 1));
+    return times;
+}
+
+// Simulated frame loop (two frames in flight, a buffer fill as GPU work) that streams
+// upload_bytes every frame, either blocking on the graphics queue or through UploadQueue.
+static VkResult bench_upload_run(BenchContext& ctx, bool async, uint32_t frame_count, VkDeviceSize upload_bytes, GpuAllocation* work, GpuAllocation* target)
+{
+    const uint32_t frames_in_flight = 2;
+    std::vector<char> source(static_cast<size_t>(upload_bytes), 0x5a);
+
+    std::vector<VkCommandBuffer> command_buffers(frames_in_flight + 1);
+    VkCommandBufferAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.commandPool = ctx.command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = frames_in_flight + 1;
+    VK_THROW(vkAllocateCommandBuffers(ctx.device, &allocate_info, command_buffers.data()));
+    VkCommandBuffer sync_upload_cmd = command_buffers[frames_in_flight];
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    std::vector<VkFence> fences(frames_in_flight);
+    for (uint32_t fidx = 0; fidx < frames_in_flight; ++fidx)
+    {
+        VK_THROW(vkCreateFence(ctx.device, &fence_info, host_allocator(), &fences[fidx]));
+    }
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.commandBufferCount = 1;
+
+    // Sync path: a plain staging buffer on the graphics queue, waited on like a naive loader does.
+    UploadQueue upload;
+    GpuAllocation* staging = nullptr;
+    if (async)
+    {
+        VK_THROW(create_upload_queue(ctx.allocator, ctx.device, ctx.swap_chain.gpu, ctx.draw, std::max<VkDeviceSize>(2 * upload_bytes, 16 * 1024 * 1024), &upload));
+    }
+    else
+    {
+        VkBufferCreateInfo buffer_info = {};
+        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_info.size = upload_bytes;
+        buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_CPU_ONLY, &staging));
+    }
+
+    std::vector<double> frame_ms;
+    uint64_t last_ticket = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (uint32_t frame = 0; frame < frame_count; ++frame)
+    {
+        bench_clock::time_point frame_start = bench_clock::now();
+        uint32_t slot = frame % frames_in_flight;
+        VkCommandBuffer cmd = command_buffers[slot];
+        VK_THROW(vkWaitForFences(ctx.device, 1, &fences[slot], VK_TRUE, UINT64_MAX));
+        VK_THROW(vkResetFences(ctx.device, 1, &fences[slot]));
+
+        if (async)
+        {
+            // Overwrites the same target every frame, its contents are never read.
+            VK_THROW(upload_buffer(upload, target->buffer, 0, source.data(), upload_bytes, &last_ticket));
+            VK_THROW(submit_uploads(upload));
+        }
+        else
+        {
+            memcpy(staging->mapped, source.data(), source.size());
+            VK_THROW(vkBeginCommandBuffer(sync_upload_cmd, &begin_info));
+            VkBufferCopy region = { 0, 0, upload_bytes };
+            vkCmdCopyBuffer(sync_upload_cmd, staging->buffer, target->buffer, 1, &region);
+            VK_THROW(vkEndCommandBuffer(sync_upload_cmd));
+            submit_info.pCommandBuffers = &sync_upload_cmd;
+            VK_THROW(vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, VK_NULL_HANDLE));
+            VK_THROW(vkQueueWaitIdle(ctx.draw.draw_queue));
+        }
+
+        VK_THROW(vkBeginCommandBuffer(cmd, &begin_info));
+        if (async)
+        {
+            VK_THROW(poll_uploads(upload, cmd));
+        }
+        for (uint32_t pass = 0; pass < 8; ++pass)
+        {
+            vkCmdFillBuffer(cmd, work->buffer, 0, VK_WHOLE_SIZE, pass);
+        }
+        VK_THROW(vkEndCommandBuffer(cmd));
+        submit_info.pCommandBuffers = &cmd;
+        VK_THROW(vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, fences[slot]));
+        frame_ms.push_back(elapsed_ms(frame_start, bench_clock::now()));
+    }
+    // Bandwidth counts until the last upload has landed on both queues.
+    VK_THROW(vkDeviceWaitIdle(ctx.device));
+    double total_ms = elapsed_ms(start, bench_clock::now());
+    if (async)
+    {
+        VK_THROW(vkBeginCommandBuffer(command_buffers[0], &begin_info));
+        VK_THROW(poll_uploads(upload, command_buffers[0]));
+        VK_THROW(vkEndCommandBuffer(command_buffers[0]));
+        submit_info.pCommandBuffers = &command_buffers[0];
+        VK_THROW(vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, VK_NULL_HANDLE));
+        VK_THROW(vkQueueWaitIdle(ctx.draw.draw_queue));
+        assert(upload_complete(upload, last_ticket));
+    }
+
+    FrameTimes times = summarize(frame_ms);
+    double mib = static_cast<double>(upload_bytes) * frame_count / (1024.0 * 1024.0);
+    add_bench_metric(ctx.report, async ? "upload.async" : "upload.sync", mib / (total_ms / 1000.0), "MiB/s", BENCH_HIGHER_IS_BETTER);
+    add_bench_metric(ctx.report, async ? "upload.async_frame" : "upload.sync_frame", times.mean_ms, "ms", BENCH_LOWER_IS_BETTER);
+    std::cout << "  " << (async ? "async" : "sync ")
+              << " | " << mib / (total_ms / 1000.0) << " MiB/s"
+              << " | frame " << times.mean_ms << " ms avg, " << times.stddev_ms << " stddev, " << times.max_ms << " max\n";
+
+    if (async)
+    {
+        print_upload_stats(upload);
+        destroy_upload_queue(ctx.allocator, upload);
+    }
+    else
+    {
+        destroy_buffer(ctx.allocator, staging);
+    }
+    for (uint32_t fidx = 0; fidx < frames_in_flight; ++fidx)
+    {
+        vkDestroyFence(ctx.device, fences[fidx], host_allocator());
+    }
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, frames_in_flight + 1, command_buffers.data());
+    return VK_SUCCESS;
+}
+
+static VkResult bench_upload(BenchContext& ctx, uint32_t frame_count, VkDeviceSize upload_bytes)
+{
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+
+    GpuAllocation* work = nullptr;
+    buffer_info.size = 64 * 1024 * 1024;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_ONLY, &work));
+    GpuAllocation* target = nullptr;
+    buffer_info.size = upload_bytes;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_ONLY, &target));
+
+    std::cout << "upload: " << frame_count << " frames, " << upload_bytes / 1024 << " KiB per frame, transfer family "
+              << ctx.draw.transfer_family_idx << (ctx.draw.transfer_family_idx == ctx.draw.queue_family_idx ? " (shared with graphics)" : "") << "\n";
+    VkResult err = bench_upload_run(ctx, false, frame_count, upload_bytes, work, target);
+    if (err == VK_SUCCESS)
+    {
+        err = bench_upload_run(ctx, true, frame_count, upload_bytes, work, target);
+    }
+    destroy_buffer(ctx.allocator, target);
+    destroy_buffer(ctx.allocator, work);
+    return err;
+}
+
+// Post-processing style chain of transient images: shows culling, batched barriers and how much
+// transient memory aliasing saves, then times the compiled graph.
+static VkResult bench_render_graph(BenchContext& ctx, uint32_t frame_count)
+{
+    VkExtent2D const extent = { 1920, 1080 };
+    VkFormat const format = VK_FORMAT_R8G8B8A8_UNORM;
+    VkImageSubresourceLayers const layers = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    VkImageCopy copy = {};
+    copy.srcSubresource = layers;
+    copy.dstSubresource = layers;
+    copy.extent.width = extent.width;
+    copy.extent.height = extent.height;
+    copy.extent.depth = 1;
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    GpuAllocation* readback = nullptr;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_TO_CPU, &readback));
+
+    RenderGraph graph;
+    init_render_graph(&graph);
+    GraphState const host_read = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_HOST_BIT, 0 };
+    uint32_t output = import_graph_buffer(graph, "readback", readback->buffer, host_read, host_read);
+    uint32_t chain[4];
+    char const* const names[4] = { "chain 0", "chain 1", "chain 2", "chain 3" };
+    for (uint32_t cidx = 0; cidx < 4; ++cidx)
+    {
+        chain[cidx] = create_graph_image(graph, names[cidx], format, extent, VK_IMAGE_ASPECT_COLOR_BIT);
+    }
+    uint32_t debug_view = create_graph_image(graph, "debug view", format, extent, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    uint32_t clear_pass = add_graph_pass(graph, "clear", [&](VkCommandBuffer command_buffer)
+    {
+        VkClearColorValue clear_color = { { 0.25f, 0.5f, 0.75f, 1.0f } };
+        VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        vkCmdClearColorImage(command_buffer, graph_image(graph, chain[0]), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_color, 1, &range);
+        return VK_SUCCESS;
+    });
+    graph_use(graph, clear_pass, chain[0], GRAPH_TRANSFER_WRITE);
+    for (uint32_t cidx = 1; cidx < 4; ++cidx)
+    {
+        uint32_t src = chain[cidx - 1];
+        uint32_t dst = chain[cidx];
+        uint32_t pass = add_graph_pass(graph, "copy", [&graph, &copy, src, dst](VkCommandBuffer command_buffer)
+        {
+            vkCmdCopyImage(command_buffer, graph_image(graph, src), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                graph_image(graph, dst), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+            return VK_SUCCESS;
+        });
+        graph_use(graph, pass, src, GRAPH_TRANSFER_READ);
+        graph_use(graph, pass, dst, GRAPH_TRANSFER_WRITE);
+    }
+    // Nothing reads its output, compile_render_graph() drops it.
+    uint32_t debug_pass = add_graph_pass(graph, "debug view", [&](VkCommandBuffer command_buffer)
+    {
+        vkCmdCopyImage(command_buffer, graph_image(graph, chain[1]), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            graph_image(graph, debug_view), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+        return VK_SUCCESS;
+    });
+    graph_use(graph, debug_pass, chain[1], GRAPH_TRANSFER_READ);
+    graph_use(graph, debug_pass, debug_view, GRAPH_TRANSFER_WRITE);
+    uint32_t readback_pass = add_graph_pass(graph, "readback", [&](VkCommandBuffer command_buffer)
+    {
+        VkBufferImageCopy region = {};
+        region.imageSubresource = layers;
+        region.imageExtent = copy.extent;
+        vkCmdCopyImageToBuffer(command_buffer, graph_image(graph, chain[3]), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback->buffer, 1, &region);
+        return VK_SUCCESS;
+    });
+    graph_use(graph, readback_pass, chain[3], GRAPH_TRANSFER_READ);
+    graph_use(graph, readback_pass, output, GRAPH_TRANSFER_WRITE);
+
+    VkResult err = compile_render_graph(ctx.allocator, graph);
+    if (err == VK_SUCCESS)
+    {
+        print_render_graph(graph);
+    }
+
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.pNext = nullptr;
+    command_buffer_allocate_info.commandPool = ctx.command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = 1;
+    if (err == VK_SUCCESS)
+    {
+        err = vkAllocateCommandBuffers(ctx.device, &command_buffer_allocate_info, &command_buffer);
+    }
+    if (err == VK_SUCCESS)
+    {
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.pNext = nullptr;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        begin_info.pInheritanceInfo = nullptr;
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.pNext = nullptr;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &command_buffer;
+
+        bench_clock::time_point start = bench_clock::now();
+        vkBeginCommandBuffer(command_buffer, &begin_info);
+        for (uint32_t fidx = 0; (fidx < frame_count) && (err == VK_SUCCESS); ++fidx)
+        {
+            err = execute_render_graph(graph, command_buffer);
+        }
+        vkEndCommandBuffer(command_buffer);
+        if (err == VK_SUCCESS)
+        {
+            err = vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, VK_NULL_HANDLE);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = vkQueueWaitIdle(ctx.draw.draw_queue);
+        }
+        double frame_ms = elapsed_ms(start, bench_clock::now()) / std::max(frame_count, 1u);
+        std::cout << "  " << frame_count << " frames: " << frame_ms << " ms per frame\n";
+        add_bench_metric(ctx.report, "render_graph.frame", frame_ms, "ms", BENCH_LOWER_IS_BETTER);
+        vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &command_buffer);
+    }
+    destroy_render_graph(ctx.allocator, graph);
+    destroy_buffer(ctx.allocator, readback);
+    return err;
+}
+
+// Small one-shot operations (a buffer fill each, like startup layout transitions and copies):
+// a submit and vkQueueWaitIdle per operation against the immediate executor's single batch.
+static VkResult bench_immediate(BenchContext& ctx, uint32_t op_count)
+{
+    GpuAllocation* target = nullptr;
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = 64 * 1024;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_ONLY, &target));
+
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.pNext = nullptr;
+    command_buffer_allocate_info.commandPool = ctx.command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = 1;
+    VK_THROW(vkAllocateCommandBuffers(ctx.device, &command_buffer_allocate_info, &cmd));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmd;
+
+    std::cout << "immediate: " << op_count << " one-shot operations\n";
+    bench_clock::time_point start = bench_clock::now();
+    for (uint32_t oidx = 0; oidx < op_count; ++oidx)
+    {
+        VK_THROW(vkBeginCommandBuffer(cmd, &begin_info));
+        vkCmdFillBuffer(cmd, target->buffer, 0, VK_WHOLE_SIZE, oidx);
+        VK_THROW(vkEndCommandBuffer(cmd));
+        VK_THROW(vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, VK_NULL_HANDLE));
+        VK_THROW(vkQueueWaitIdle(ctx.draw.draw_queue));
+    }
+    double wait_each_ms = elapsed_ms(start, bench_clock::now());
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &cmd);
+
+    ImmediateExecutor immediate;
+    VK_THROW(create_immediate_executor(ctx.device, ctx.draw.draw_queue, ctx.draw.queue_family_idx, &immediate));
+    uint32_t completed = 0;
+    uint64_t ticket = 0;
+    start = bench_clock::now();
+    VkResult err = VK_SUCCESS;
+    for (uint32_t oidx = 0; (oidx < op_count) && (err == VK_SUCCESS); ++oidx)
+    {
+        VkBuffer buffer = target->buffer;
+        err = immediate_submit(immediate, [=](VkCommandBuffer command_buffer)
+        {
+            vkCmdFillBuffer(command_buffer, buffer, 0, VK_WHOLE_SIZE, oidx);
+        }, [&completed]()
+        {
+            completed += 1;
+        }, &ticket);
+    }
+    if (err == VK_SUCCESS)
+    {
+        err = wait_immediate(immediate, ticket);
+    }
+    double batched_ms = elapsed_ms(start, bench_clock::now());
+    assert((err != VK_SUCCESS) || (completed == op_count));
+
+    std::cout << "  submit and wait each | " << wait_each_ms << " ms\n";
+    std::cout << "  immediate executor   | " << batched_ms << " ms\n";
+    add_bench_metric(ctx.report, "immediate.wait_each", wait_each_ms, "ms", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "immediate.batched", batched_ms, "ms", BENCH_LOWER_IS_BETTER);
+    print_immediate_stats(immediate);
+    destroy_immediate_executor(immediate);
+    destroy_buffer(ctx.allocator, target);
+    return err;
+}
+
+// Per call cost of a command recorded through the loader's trampoline (what the exported prototype
+// resolves to) against the driver's own entry point from the device table.
+static VkResult bench_dispatch(BenchContext& ctx, uint32_t call_count, uint32_t iterations)
+{
+    PFN_vkCmdSetViewport through_loader = (PFN_vkCmdSetViewport)vkGetInstanceProcAddr(ctx.instance, "vkCmdSetViewport");
+    PFN_vkCmdSetViewport through_table = ctx.draw.dispatch.vkCmdSetViewport;
+    if ((through_loader == nullptr) || (through_table == nullptr))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.pNext = nullptr;
+    command_buffer_allocate_info.commandPool = ctx.command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = 1;
+    VK_THROW(vkAllocateCommandBuffers(ctx.device, &command_buffer_allocate_info, &command_buffer));
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    std::cout << "dispatch: " << call_count << " vkCmdSetViewport calls, " << iterations << " iterations\n";
+    PFN_vkCmdSetViewport const paths[2] = { through_loader, through_table };
+    char const* const names[2] = { "loader", "table" };
+    char const* const metrics[2] = { "dispatch.loader", "dispatch.table" };
+    double best_ns[2] = { 0.0, 0.0 };
+    VkViewport viewport = { 0.0f, 0.0f, 800.0f, 600.0f, 0.0f, 1.0f };
+    // Interleaved so both paths see the same cache and clock state.
+    for (uint32_t iter = 0; iter < iterations; ++iter)
+    {
+        for (uint32_t path = 0; path < 2; ++path)
+        {
+            VK_THROW(vkResetCommandBuffer(command_buffer, 0));
+            VK_THROW(vkBeginCommandBuffer(command_buffer, &begin_info));
+            PFN_vkCmdSetViewport set_viewport = paths[path];
+            bench_clock::time_point start = bench_clock::now();
+            for (uint32_t cidx = 0; cidx < call_count; ++cidx)
+            {
+                viewport.x = static_cast<float>(cidx & 63);
+                set_viewport(command_buffer, 0, 1, &viewport);
+            }
+            double ns = elapsed_ms(start, bench_clock::now()) * 1e6 / call_count;
+            VK_THROW(vkEndCommandBuffer(command_buffer));
+            if ((iter == 0) || (ns < best_ns[path]))
+            {
+                best_ns[path] = ns;
+            }
+        }
+    }
+    for (uint32_t path = 0; path < 2; ++path)
+    {
+        std::cout << "  " << names[path] << " | " << best_ns[path] << " ns/call\n";
+        add_bench_metric(ctx.report, metrics[path], best_ns[path], "ns/call", BENCH_LOWER_IS_BETTER);
+    }
+    std::cout << "  saved " << best_ns[0] - best_ns[1] << " ns/call\n";
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &command_buffer);
+    return VK_SUCCESS;
+}
+
+static VkResult allocate_bench_command_buffers(BenchContext& ctx, uint32_t count, VkCommandBuffer* out_command_buffers)
+{
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.pNext = nullptr;
+    command_buffer_allocate_info.commandPool = ctx.command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = count;
+    return vkAllocateCommandBuffers(ctx.device, &command_buffer_allocate_info, out_command_buffers);
+}
+
+static VkResult submit_and_wait(BenchContext& ctx, VkCommandBuffer command_buffer)
+{
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    VK_THROW(vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, VK_NULL_HANDLE));
+    return vkQueueWaitIdle(ctx.draw.draw_queue);
+}
+
+// Cost of vkQueueSubmit per command buffer when buffer_count tiny command buffers go out one per
+// submit up to all in one submit. Waits once per round, like a frame would.
+static VkResult bench_submit(BenchContext& ctx, uint32_t buffer_count, uint32_t iterations)
+{
+    if (buffer_count == 0)
+    {
+        return VK_SUCCESS;
+    }
+    GpuAllocation* target = nullptr;
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = 256;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_ONLY, &target));
+
+    // Recorded once and resubmitted, no ONE_TIME_SUBMIT.
+    std::vector<VkCommandBuffer> command_buffers(buffer_count);
+    VK_THROW(allocate_bench_command_buffers(ctx, buffer_count, command_buffers.data()));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = 0;
+    begin_info.pInheritanceInfo = nullptr;
+    for (uint32_t cidx = 0; cidx < buffer_count; ++cidx)
+    {
+        VK_THROW(vkBeginCommandBuffer(command_buffers[cidx], &begin_info));
+        vkCmdFillBuffer(command_buffers[cidx], target->buffer, 0, 4, cidx);
+        VK_THROW(vkEndCommandBuffer(command_buffers[cidx]));
+    }
+
+    std::cout << "submit: " << buffer_count << " command buffers per round, " << iterations << " iterations\n";
+    for (uint32_t batch = 1; batch <= buffer_count; batch *= 4)
+    {
+        double best_ms = 0.0;
+        for (uint32_t iter = 0; iter < iterations; ++iter)
+        {
+            bench_clock::time_point start = bench_clock::now();
+            for (uint32_t first = 0; first < buffer_count; first += batch)
+            {
+                VkSubmitInfo submit_info = {};
+                submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                submit_info.pNext = nullptr;
+                submit_info.commandBufferCount = std::min(batch, buffer_count - first);
+                submit_info.pCommandBuffers = &command_buffers[first];
+                VK_THROW(vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, VK_NULL_HANDLE));
+            }
+            VK_THROW(vkQueueWaitIdle(ctx.draw.draw_queue));
+            double ms = elapsed_ms(start, bench_clock::now());
+            if ((iter == 0) || (ms < best_ms))
+            {
+                best_ms = ms;
+            }
+        }
+        double us_per_buffer = best_ms * 1000.0 / buffer_count;
+        std::cout << "  batch " << batch << " | " << best_ms << " ms | " << us_per_buffer << " us per command buffer\n";
+        char metric[64];
+        snprintf(metric, sizeof(metric), "submit.batch_%u", batch);
+        add_bench_metric(ctx.report, metric, us_per_buffer, "us/cmd", BENCH_LOWER_IS_BETTER);
+    }
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, buffer_count, command_buffers.data());
+    destroy_buffer(ctx.allocator, target);
+    return VK_SUCCESS;
+}
+
+// Device local copy and fill bandwidth, best of iterations single command submits.
+static VkResult bench_transfer(BenchContext& ctx, VkDeviceSize size, uint32_t iterations)
+{
+    if (size == 0)
+    {
+        return VK_SUCCESS;
+    }
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    GpuAllocation* source = nullptr;
+    GpuAllocation* target = nullptr;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_ONLY, &source));
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_ONLY, &target));
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VK_THROW(allocate_bench_command_buffers(ctx, 1, &command_buffer));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    std::cout << "transfer: " << size / (1024 * 1024) << " MiB, " << iterations << " iterations\n";
+    char const* const names[2] = { "copy", "fill" };
+    char const* const metrics[2] = { "transfer.copy", "transfer.fill" };
+    for (uint32_t op = 0; op < 2; ++op)
+    {
+        double best_ms = 0.0;
+        for (uint32_t iter = 0; iter < iterations; ++iter)
+        {
+            VK_THROW(vkResetCommandBuffer(command_buffer, 0));
+            VK_THROW(vkBeginCommandBuffer(command_buffer, &begin_info));
+            if (op == 0)
+            {
+                VkBufferCopy region = { 0, 0, size };
+                vkCmdCopyBuffer(command_buffer, source->buffer, target->buffer, 1, &region);
+            }
+            else
+            {
+                vkCmdFillBuffer(command_buffer, target->buffer, 0, VK_WHOLE_SIZE, iter);
+            }
+            VK_THROW(vkEndCommandBuffer(command_buffer));
+            bench_clock::time_point start = bench_clock::now();
+            VK_THROW(submit_and_wait(ctx, command_buffer));
+            double ms = elapsed_ms(start, bench_clock::now());
+            if ((iter == 0) || (ms < best_ms))
+            {
+                best_ms = ms;
+            }
+        }
+        // A copy reads and writes every byte, counted once like a memcpy benchmark does.
+        double gib_per_s = static_cast<double>(size) / (1024.0 * 1024.0 * 1024.0) / (best_ms / 1000.0);
+        std::cout << "  " << names[op] << " | " << best_ms << " ms | " << gib_per_s << " GiB/s\n";
+        add_bench_metric(ctx.report, metrics[op], gib_per_s, "GiB/s", BENCH_HIGHER_IS_BETTER);
+    }
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &command_buffer);
+    destroy_buffer(ctx.allocator, target);
+    destroy_buffer(ctx.allocator, source);
+    return VK_SUCCESS;
+}
+
+// vkUpdateDescriptorSets throughput for set_count sets of two storage buffers, one call per set
+// against every write in a single call.
+static VkResult bench_descriptor_updates(BenchContext& ctx, uint32_t set_count, uint32_t iterations)
+{
+    if (set_count == 0)
+    {
+        return VK_SUCCESS;
+    }
+    DescriptorLayoutCache layouts;
+    create_descriptor_layout_cache(ctx.device, &layouts);
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    for (uint32_t bidx = 0; bidx < 2; ++bidx)
+    {
+        bindings[bidx].binding = bidx;
+        bindings[bidx].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[bidx].descriptorCount = 1;
+        bindings[bidx].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[bidx].pImmutableSamplers = nullptr;
+    }
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    VK_THROW(get_descriptor_set_layout(layouts, 0, bindings, 2, nullptr, &layout));
+    DescriptorPoolRatio const ratio = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f };
+    DescriptorAllocator descriptors;
+    create_descriptor_allocator(ctx.device, &ratio, 1, set_count, &descriptors);
+    std::vector<VkDescriptorSet> sets(set_count);
+    for (uint32_t sidx = 0; sidx < set_count; ++sidx)
+    {
+        VK_THROW(allocate_descriptor_set(descriptors, layout, &sets[sidx]));
+    }
+    GpuAllocation* buffer = nullptr;
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = 64 * 1024;
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_ONLY, &buffer));
+
+    // Offsets differ per set so the driver can't skip identical writes.
+    VkDeviceSize const alignment = std::max<VkDeviceSize>(ctx.draw.gpu_properties.limits.minStorageBufferOffsetAlignment, 4);
+    std::vector<VkDescriptorBufferInfo> buffer_infos(2 * set_count);
+    std::vector<VkWriteDescriptorSet> writes(set_count);
+    for (uint32_t sidx = 0; sidx < set_count; ++sidx)
+    {
+        for (uint32_t bidx = 0; bidx < 2; ++bidx)
+        {
+            VkDescriptorBufferInfo& info = buffer_infos[2 * sidx + bidx];
+            info.buffer = buffer->buffer;
+            info.offset = ((sidx + bidx) % 64) * alignment;
+            info.range = 256;
+        }
+        VkWriteDescriptorSet& write = writes[sidx];
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.pNext = nullptr;
+        write.dstSet = sets[sidx];
+        write.dstBinding = 0;
+        write.dstArrayElement = 0;
+        write.descriptorCount = 2;      // consecutive bindings of the same type
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.pImageInfo = nullptr;
+        write.pBufferInfo = &buffer_infos[2 * sidx];
+        write.pTexelBufferView = nullptr;
+    }
+
+    std::cout << "descriptor updates: " << set_count << " sets of 2 storage buffers, " << iterations << " iterations\n";
+    char const* const names[2] = { "call per set", "single call " };
+    char const* const metrics[2] = { "descriptors.update_each", "descriptors.update_batched" };
+    for (uint32_t mode = 0; mode < 2; ++mode)
+    {
+        double best_ms = 0.0;
+        for (uint32_t iter = 0; iter < iterations; ++iter)
+        {
+            bench_clock::time_point start = bench_clock::now();
+            if (mode == 0)
+            {
+                for (uint32_t sidx = 0; sidx < set_count; ++sidx)
+                {
+                    vkUpdateDescriptorSets(ctx.device, 1, &writes[sidx], 0, nullptr);
+                }
+            }
+            else
+            {
+                vkUpdateDescriptorSets(ctx.device, set_count, writes.data(), 0, nullptr);
+            }
+            double ms = elapsed_ms(start, bench_clock::now());
+            if ((iter == 0) || (ms < best_ms))
+            {
+                best_ms = ms;
+            }
+        }
+        double rate = 2.0 * set_count / best_ms / 1000.0;
+        std::cout << "  " << names[mode] << " | " << best_ms << " ms | " << rate << " M descriptors/s\n";
+        add_bench_metric(ctx.report, metrics[mode], rate, "Mdesc/s", BENCH_HIGHER_IS_BETTER);
+    }
+    destroy_buffer(ctx.allocator, buffer);
+    destroy_descriptor_allocator(descriptors);
+    destroy_descriptor_layout_cache(layouts);
+    return VK_SUCCESS;
+}
+
+// Compute pipeline creation from shaders/fill.comp.spv without a VkPipelineCache and with one the
+// first creation warmed up. Drivers with their own disk cache (Mesa) narrow the gap.
+static VkResult bench_pipeline_creation(BenchContext& ctx, uint32_t iterations)
+{
+    if (iterations == 0)
+    {
+        return VK_SUCCESS;
+    }
+    ShaderModuleCache shader_cache;
+    create_shader_module_cache(ctx.device, &shader_cache);
+    DescriptorLayoutCache layouts;
+    create_descriptor_layout_cache(ctx.device, &layouts);
+    VkShaderModule module = VK_NULL_HANDLE;
+    VkResult err = load_shader_module(shader_cache, "shaders/fill.comp.spv", &module);
+
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    binding.pImmutableSamplers = nullptr;
+    VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+    if (err == VK_SUCCESS)
+    {
+        err = get_descriptor_set_layout(layouts, 0, &binding, 1, nullptr, &set_layout);
+    }
+    VkPushConstantRange push_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, 2 * sizeof(uint32_t) };
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.pNext = nullptr;
+    layout_info.flags = 0;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    if (err == VK_SUCCESS)
+    {
+        err = vkCreatePipelineLayout(ctx.device, &layout_info, host_allocator(), &layout);
+    }
+    VkPipelineCacheCreateInfo cache_info = {};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.pNext = nullptr;
+    cache_info.flags = 0;
+    cache_info.initialDataSize = 0;
+    cache_info.pInitialData = nullptr;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    if (err == VK_SUCCESS)
+    {
+        err = vkCreatePipelineCache(ctx.device, &cache_info, host_allocator(), &cache);
+    }
+
+    VkComputePipelineCreateInfo pipeline_info = {};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = nullptr;
+    pipeline_info.flags = 0;
+    pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = layout;
+    pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+    pipeline_info.basePipelineIndex = -1;
+
+    std::cout << "pipeline creation: fill.comp, " << iterations << " iterations\n";
+    // Warm the cache, not timed.
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (err == VK_SUCCESS)
+    {
+        err = vkCreateComputePipelines(ctx.device, cache, 1, &pipeline_info, host_allocator(), &pipeline);
+        vkDestroyPipeline(ctx.device, pipeline, host_allocator());
+    }
+    VkPipelineCache const caches[2] = { VK_NULL_HANDLE, cache };
+    char const* const names[2] = { "no cache", "cached  " };
+    char const* const metrics[2] = { "pipeline.no_cache", "pipeline.cached" };
+    for (uint32_t cidx = 0; (cidx < 2) && (err == VK_SUCCESS); ++cidx)
+    {
+        double total_ms = 0.0;
+        for (uint32_t iter = 0; (iter < iterations) && (err == VK_SUCCESS); ++iter)
+        {
+            bench_clock::time_point start = bench_clock::now();
+            err = vkCreateComputePipelines(ctx.device, caches[cidx], 1, &pipeline_info, host_allocator(), &pipeline);
+            total_ms += elapsed_ms(start, bench_clock::now());
+            if (err == VK_SUCCESS)
+            {
+                vkDestroyPipeline(ctx.device, pipeline, host_allocator());
+            }
+        }
+        if (err == VK_SUCCESS)
+        {
+            std::cout << "  " << names[cidx] << " | " << total_ms / iterations << " ms per pipeline\n";
+            add_bench_metric(ctx.report, metrics[cidx], total_ms / iterations, "ms", BENCH_LOWER_IS_BETTER);
+        }
+    }
+    vkDestroyPipelineCache(ctx.device, cache, host_allocator());
+    vkDestroyPipelineLayout(ctx.device, layout, host_allocator());
+    destroy_descriptor_layout_cache(layouts);
+    destroy_shader_module_cache(shader_cache);
+    return err;
+}
+
+// Acquire and present latency through the bench's swap chain (headless surface or offscreen
+// ring), one frame in flight: every frame moves the image to the present layout and nothing else.
+static VkResult bench_present(BenchContext& ctx, uint32_t frame_count)
+{
+    if (frame_count == 0)
+    {
+        return VK_SUCCESS;
+    }
+    uint32_t width = 256;
+    uint32_t height = 256;
+    ctx.swap_chain.allocator = &ctx.allocator;
+    VK_THROW(create_swap_chain(ctx.device, ctx.swap_chain, &width, &height));
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = nullptr;
+    semaphore_info.flags = 0;
+    VkSemaphore image_acquired = VK_NULL_HANDLE;
+    VkSemaphore render_done = VK_NULL_HANDLE;
+    VK_THROW(vkCreateSemaphore(ctx.device, &semaphore_info, host_allocator(), &image_acquired));
+    VK_THROW(vkCreateSemaphore(ctx.device, &semaphore_info, host_allocator(), &render_done));
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+    VkFence fence = VK_NULL_HANDLE;
+    VK_THROW(vkCreateFence(ctx.device, &fence_info, host_allocator(), &fence));
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VK_THROW(allocate_bench_command_buffers(ctx, 1, &command_buffer));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    VkPipelineStageFlags const wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitSemaphores = &image_acquired;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &render_done;
+
+    std::cout << "present: " << frame_count << " frames, " << swap_chain_mode_name(ctx.swap_chain.mode) << ", "
+              << present_mode_name(ctx.swap_chain.present_mode) << ", " << ctx.swap_chain.images.size() << " images\n";
+    std::vector<double> acquire_ms;
+    std::vector<double> present_ms;
+    std::vector<double> frame_ms;
+    VkResult err = VK_SUCCESS;
+    for (uint32_t frame = 0; (frame < frame_count) && (err == VK_SUCCESS); ++frame)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        uint32_t image_idx = 0;
+        err = acquire_next_image(ctx.device, ctx.swap_chain, image_acquired, &image_idx);
+        bench_clock::time_point acquired = bench_clock::now();
+        if (err != VK_SUCCESS)
+        {
+            break;
+        }
+        err = vkBeginCommandBuffer(command_buffer, &begin_info);
+        if (err == VK_SUCCESS)
+        {
+            // Contents are discarded, this only satisfies the present layout.
+            set_image_layout(command_buffer, ctx.swap_chain.images[image_idx], VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, ctx.swap_chain.present_layout);
+            err = vkEndCommandBuffer(command_buffer);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, fence);
+        }
+        bench_clock::time_point present_start = bench_clock::now();
+        if (err == VK_SUCCESS)
+        {
+            err = queue_present(ctx.swap_chain, render_done, image_idx);
+        }
+        bench_clock::time_point presented = bench_clock::now();
+        if (err == VK_SUCCESS)
+        {
+            err = vkWaitForFences(ctx.device, 1, &fence, VK_TRUE, UINT64_MAX);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = vkResetFences(ctx.device, 1, &fence);
+        }
+        acquire_ms.push_back(elapsed_ms(start, acquired));
+        present_ms.push_back(elapsed_ms(present_start, presented));
+        frame_ms.push_back(elapsed_ms(start, bench_clock::now()));
+    }
+    // Presentation may still hold render_done.
+    vkDeviceWaitIdle(ctx.device);
+    if (err == VK_SUCCESS)
+    {
+        FrameTimes acquire = summarize(acquire_ms);
+        FrameTimes present = summarize(present_ms);
+        FrameTimes frame = summarize(frame_ms);
+        std::cout << "  acquire | " << acquire.mean_ms << " ms avg, " << acquire.max_ms << " max\n";
+        std::cout << "  present | " << present.mean_ms << " ms avg, " << present.max_ms << " max\n";
+        std::cout << "  frame   | " << frame.mean_ms << " ms avg, " << frame.stddev_ms << " stddev\n";
+        add_bench_metric(ctx.report, "present.acquire", acquire.mean_ms, "ms", BENCH_LOWER_IS_BETTER);
+        add_bench_metric(ctx.report, "present.present", present.mean_ms, "ms", BENCH_LOWER_IS_BETTER);
+        add_bench_metric(ctx.report, "present.frame", frame.mean_ms, "ms", BENCH_LOWER_IS_BETTER);
+    }
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &command_buffer);
+    vkDestroyFence(ctx.device, fence, host_allocator());
+    vkDestroySemaphore(ctx.device, render_done, host_allocator());
+    vkDestroySemaphore(ctx.device, image_acquired, host_allocator());
+    destroy_swap_chain(ctx.device, ctx.swap_chain);
+    return err;
+}
+
+// Same tests as shaders/cull.comp for an identity view. The synthetic depth buffer is one flat
+// wall, every pyramid level holds wall_depth and occlusion reduces to the nearest point of the
+// sphere being behind it.
+static uint32_t cpu_cull(CullObject const* objects, uint32_t count, CullView const& view, float wall_depth)
+{
+    float const side_x = sqrtf(view.p00 * view.p00 + 1.0f);
+    float const side_y = sqrtf(view.p11 * view.p11 + 1.0f);
+    uint32_t visible = 0;
+    for (uint32_t oidx = 0; oidx < count; ++oidx)
+    {
+        float const* c = objects[oidx].sphere;
+        float r = c[3];
+        bool inside = (c[2] + r > view.znear) && (fabsf(c[0]) * view.p00 - c[2] <= r * side_x) && (fabsf(c[1]) * view.p11 - c[2] <= r * side_y);
+        if (inside && ((view.flags & CULL_OCCLUSION) != 0) && (c[2] - r > view.znear))
+        {
+            inside = !(view.znear / (c[2] - r) < wall_depth);
+        }
+        visible += inside ? 1 : 0;
+    }
+    return visible;
+}
+
+// UV sphere of segments x segments / 2 quads, triangles in row order like most exporters write them.
+static void build_bench_sphere(uint32_t segments, SourceMesh* out_mesh)
+{
+    uint32_t rings = std::max<uint32_t>(segments / 2, 2);
+    float const pi = 3.14159265f;
+    out_mesh->vertices.clear();
+    out_mesh->indices.clear();
+    out_mesh->submeshes.clear();
+    for (uint32_t ring = 0; ring <= rings; ++ring)
+    {
+        float theta = pi * ring / rings;
+        for (uint32_t segment = 0; segment <= segments; ++segment)
+        {
+            float phi = 2.0f * pi * segment / segments;
+            SourceVertex vertex;
+            vertex.normal[0] = std::sin(theta) * std::cos(phi);
+            vertex.normal[1] = std::cos(theta);
+            vertex.normal[2] = std::sin(theta) * std::sin(phi);
+            memcpy(vertex.position, vertex.normal, sizeof(vertex.position));
+            vertex.uv[0] = static_cast<float>(segment) / segments;
+            vertex.uv[1] = static_cast<float>(ring) / rings;
+            out_mesh->vertices.push_back(vertex);
+        }
+    }
+    for (uint32_t ring = 0; ring < rings; ++ring)
+    {
+        for (uint32_t segment = 0; segment < segments; ++segment)
+        {
+            uint32_t a = ring * (segments + 1) + segment;
+            uint32_t b = a + segments + 1;
+            uint32_t const quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+            out_mesh->indices.insert(out_mesh->indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+// Packs a sphere into path and uploads it like vk_test loads --mesh, resident on return.
+static VkResult load_bench_mesh(BenchContext& ctx, char const* path, uint32_t segments, Mesh* out_mesh)
+{
+    SourceMesh source;
+    build_bench_sphere(segments, &source);
+    std::vector<unsigned char> file;
+    MeshPackStats pack_stats;
+    if (!pack_mesh(source, MESH_CACHE_SIZE, &file, &pack_stats) || !write_file_atomic(path, file.data(), file.size()))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    UploadQueue upload;
+    VkResult err = create_upload_queue(ctx.allocator, ctx.device, ctx.swap_chain.gpu, ctx.draw, 1024 * 1024, &upload);
+    if (err != VK_SUCCESS)
+    {
+        remove(path);
+        return err;
+    }
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    err = allocate_bench_command_buffers(ctx, 1, &command_buffer);
+    out_mesh->buffer.reset();
+    if (err == VK_SUCCESS)
+    {
+        err = load_mesh(ctx.allocator, upload, path, out_mesh);
+    }
+    if (err == VK_SUCCESS)
+    {
+        err = submit_uploads(upload);
+    }
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    while ((err == VK_SUCCESS) && !upload_complete(upload, out_mesh->ticket))
+    {
+        err = vkBeginCommandBuffer(command_buffer, &begin_info);
+        if (err == VK_SUCCESS)
+        {
+            err = poll_uploads(upload, command_buffer);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = vkEndCommandBuffer(command_buffer);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = submit_and_wait(ctx, command_buffer);
+        }
+    }
+    if (err != VK_SUCCESS)
+    {
+        vkQueueWaitIdle(ctx.draw.draw_queue);
+        destroy_mesh(*out_mesh);
+    }
+    if (command_buffer != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &command_buffer);
+    }
+    destroy_upload_queue(ctx.allocator, upload);
+    remove(path);
+    return err;
+}
+
+// Everything bench_gpu_culling() makes. release_cull_bench() takes whatever got created, on every
+// path out: handles start out null and the flags say what was never set up.
+struct CullBench
+{
+    ShaderModuleCache shader_cache;
+    PipelineManager pipelines;
+    DescriptorLayoutCache layouts;
+    DescriptorAllocator descriptors;
+    ImmediateExecutor immediate;
+    bool immediate_ready;
+    GpuCulling culling;
+    bool culling_ready;
+    CulledMeshPass mesh_pass;
+    bool mesh_pass_ready;
+    Mesh mesh;                          // drawn at every visible object
+    VkImage wall;                       // depth the pyramid is built from, one flat wall
+    GpuAllocation* wall_memory;
+    VkImageView wall_view;
+    VkImage color;                      // the draw's attachments
+    GpuAllocation* color_memory;
+    VkImageView color_view;
+    VkImage depth;
+    GpuAllocation* depth_memory;
+    VkImageView depth_view;
+    VkFramebuffer framebuffer;
+    GpuAllocation* readback;
+    VkCommandBuffer command_buffer;
+};
+
+static void release_cull_bench(BenchContext& ctx, CullBench& bench)
+{
+    vkQueueWaitIdle(ctx.draw.draw_queue);
+    if (bench.command_buffer != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &bench.command_buffer);
+    }
+    if (bench.immediate_ready)
+    {
+        destroy_immediate_executor(bench.immediate);
+    }
+    destroy_buffer(ctx.allocator, bench.readback);
+    vkDestroyFramebuffer(ctx.device, bench.framebuffer, host_allocator());
+    vkDestroyImageView(ctx.device, bench.depth_view, host_allocator());
+    destroy_image(ctx.allocator, bench.depth, bench.depth_memory);
+    vkDestroyImageView(ctx.device, bench.color_view, host_allocator());
+    destroy_image(ctx.allocator, bench.color, bench.color_memory);
+    vkDestroyImageView(ctx.device, bench.wall_view, host_allocator());
+    destroy_image(ctx.allocator, bench.wall, bench.wall_memory);
+    destroy_mesh(bench.mesh);
+    if (bench.mesh_pass_ready)
+    {
+        destroy_culled_mesh_pass(bench.mesh_pass);
+    }
+    if (bench.culling_ready)
+    {
+        destroy_gpu_culling(ctx.allocator, bench.culling);
+    }
+    destroy_descriptor_allocator(bench.descriptors);
+    destroy_pipeline_manager(bench.pipelines);
+    destroy_descriptor_layout_cache(bench.layouts);
+    destroy_shader_module_cache(bench.shader_cache);
+}
+
+static VkResult create_bench_image(BenchContext& ctx, VkFormat format, uint32_t size, VkImageUsageFlags usage, VkImageAspectFlags aspect,
+    VkImage* out_image, GpuAllocation** out_memory, VkImageView* out_view)
+{
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.pNext = nullptr;
+    image_info.flags = 0;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = format;
+    image_info.extent.width = size;
+    image_info.extent.height = size;
+    image_info.extent.depth = 1;
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = usage;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.queueFamilyIndexCount = 0;
+    image_info.pQueueFamilyIndices = nullptr;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VK_THROW(create_image(ctx.allocator, image_info, MEMORY_GPU_ONLY, out_image, out_memory));
+    return create_image_view(ctx.device, *out_image, format, aspect, out_view);
+}
+
+// Average submit-to-idle time of one cull pass, and of the draw of what it kept when mesh_view
+// is not null, and the visible count it produced.
+static VkResult run_cull(BenchContext& ctx, CullBench& bench, CullView const& view, CulledMeshView const* mesh_view, uint32_t size,
+    uint32_t iterations, double* out_ms, uint32_t* out_visible)
+{
+    VkCommandBuffer command_buffer = bench.command_buffer;
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    VkExtent2D const extent = { size, size };
+
+    double total_ms = 0.0;
+    for (uint32_t iter = 0; iter < iterations; ++iter)
+    {
+        VK_THROW(vkResetCommandBuffer(command_buffer, 0));
+        VK_THROW(vkBeginCommandBuffer(command_buffer, &begin_info));
+        if (!record_cull(command_buffer, bench.pipelines, bench.culling, view))
+        {
+            vkEndCommandBuffer(command_buffer);
+            return VK_NOT_READY;
+        }
+        if (mesh_view != nullptr)
+        {
+            // The draws for the indirect stage, the attachments after the last iteration's pass.
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            vkCmdPipelineBarrier(command_buffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+            if (!record_culled_mesh_pass(command_buffer, bench.pipelines, bench.mesh_pass, bench.culling, bench.mesh, *mesh_view, bench.framebuffer,
+                                         extent, extent))
+            {
+                vkEndCommandBuffer(command_buffer);
+                return VK_NOT_READY;
+            }
+        }
+        if (iter + 1 == iterations)
+        {
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            VkBufferCopy region = { 0, 0, sizeof(uint32_t) };
+            vkCmdCopyBuffer(command_buffer, bench.culling.count->buffer, bench.readback->buffer, 1, &region);
+        }
+        VK_THROW(vkEndCommandBuffer(command_buffer));
+        bench_clock::time_point start = bench_clock::now();
+        VK_THROW(vkQueueSubmit(ctx.draw.draw_queue, 1, &submit_info, VK_NULL_HANDLE));
+        VK_THROW(vkQueueWaitIdle(ctx.draw.draw_queue));
+        total_ms += elapsed_ms(start, bench_clock::now());
+    }
+    VK_THROW(invalidate_allocation(ctx.allocator, bench.readback, 0, sizeof(uint32_t)));
+    memcpy(out_visible, bench.readback->mapped, sizeof(uint32_t));
+    *out_ms = total_ms / std::max(iterations, 1u);
+    return VK_SUCCESS;
+}
+
+static VkResult setup_cull_bench(BenchContext& ctx, uint32_t max_objects, uint32_t size, float wall_depth, CullBench& bench)
+{
+    VK_THROW(create_immediate_executor(ctx.device, ctx.draw.draw_queue, ctx.draw.queue_family_idx, &bench.immediate));
+    bench.immediate_ready = true;
+    VK_THROW(create_gpu_culling(ctx.device, ctx.draw, ctx.allocator, bench.pipelines, bench.shader_cache, bench.layouts, bench.descriptors, max_objects,
+        size, size, &bench.culling));
+    bench.culling_ready = true;
+    VK_THROW(create_culled_mesh_pass(ctx.device, bench.pipelines, bench.shader_cache, bench.layouts, bench.descriptors, bench.culling, VK_FORMAT_R8G8B8A8_UNORM,
+        VK_ATTACHMENT_LOAD_OP_CLEAR, VK_FORMAT_D32_SFLOAT, &bench.mesh_pass));
+    bench.mesh_pass_ready = true;
+    VK_THROW(load_bench_mesh(ctx, "vk_bench.cull.vkmesh", 6, &bench.mesh));
+
+    VK_THROW(create_bench_image(ctx, VK_FORMAT_D32_SFLOAT, size, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_IMAGE_ASPECT_DEPTH_BIT,
+        &bench.wall, &bench.wall_memory, &bench.wall_view));
+    set_cull_depth_source(bench.culling, bench.wall_view);
+    VK_THROW(create_bench_image(ctx, VK_FORMAT_R8G8B8A8_UNORM, size, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+        &bench.color, &bench.color_memory, &bench.color_view));
+    VK_THROW(create_bench_image(ctx, VK_FORMAT_D32_SFLOAT, size, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT,
+        &bench.depth, &bench.depth_memory, &bench.depth_view));
+    VkExtent2D const extent = { size, size };
+    VK_THROW(create_culled_mesh_framebuffer(bench.mesh_pass, bench.color_view, bench.depth_view, extent, &bench.framebuffer));
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = sizeof(uint32_t);
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    VK_THROW(create_buffer(ctx.allocator, buffer_info, MEMORY_GPU_TO_CPU, &bench.readback));
+    VK_THROW(allocate_bench_command_buffers(ctx, 1, &bench.command_buffer));
+
+    // Every shader compiles on the manager's thread.
+    PipelineHandle const handles[3] = { bench.culling.pipeline, bench.culling.reduce_pipeline, bench.mesh_pass.pipeline };
+    for (uint32_t hidx = 0; hidx < 3; ++hidx)
+    {
+        while (pipeline_state(bench.pipelines, handles[hidx]) == PIPELINE_PENDING)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (pipeline_state(bench.pipelines, handles[hidx]) != PIPELINE_READY)
+        {
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+    }
+
+    // Clear the wall into its depth buffer and reduce it once, the pyramid stays valid for every
+    // run. The draw's attachments go to the layouts the pass keeps them in.
+    VkImage wall = bench.wall;
+    VkImage color = bench.color;
+    VkImage depth = bench.depth;
+    PipelineManager* pipeline_manager = &bench.pipelines;
+    GpuCulling* cull = &bench.culling;
+    uint64_t ticket = 0;
+    VK_THROW(immediate_submit(bench.immediate, [wall, color, depth, wall_depth, pipeline_manager, cull](VkCommandBuffer command_buffer)
+    {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = wall;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        VkClearDepthStencilValue clear_value = { wall_depth, 0 };
+        vkCmdClearDepthStencilImage(command_buffer, wall, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_value, 1, &barrier.subresourceRange);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        build_depth_pyramid(command_buffer, *pipeline_manager, *cull);
+        set_image_layout(command_buffer, color, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+        set_image_layout(command_buffer, depth, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    }, ImmediateCallback(), &ticket));
+    return wait_immediate(bench.immediate, ticket);
+}
+
+// GPU frustum and Hi-Z culling from 1k objects up to max_objects against the same tests on one
+// CPU thread, then the cull with the draw of what it kept. Random spheres in front of the camera,
+// half of them behind a wall.
+static VkResult bench_gpu_culling(BenchContext& ctx, uint32_t max_objects, uint32_t iterations)
+{
+    uint32_t const size = 1024;
+    float const znear = 0.1f;
+    float const wall_depth = 0.001f;       // reverse-Z, the wall is at znear / wall_depth = 100
+    if ((max_objects == 0) || (iterations == 0))
+    {
+        return VK_SUCCESS;
+    }
+
+    CullBench bench;
+    bench.immediate_ready = false;
+    bench.culling_ready = false;
+    bench.mesh_pass_ready = false;
+    bench.wall = VK_NULL_HANDLE;
+    bench.wall_memory = nullptr;
+    bench.wall_view = VK_NULL_HANDLE;
+    bench.color = VK_NULL_HANDLE;
+    bench.color_memory = nullptr;
+    bench.color_view = VK_NULL_HANDLE;
+    bench.depth = VK_NULL_HANDLE;
+    bench.depth_memory = nullptr;
+    bench.depth_view = VK_NULL_HANDLE;
+    bench.framebuffer = VK_NULL_HANDLE;
+    bench.readback = nullptr;
+    bench.command_buffer = VK_NULL_HANDLE;
+    create_shader_module_cache(ctx.device, &bench.shader_cache);
+    create_pipeline_manager(ctx.device, VK_NULL_HANDLE, 1, &bench.pipelines);
+    create_descriptor_layout_cache(ctx.device, &bench.layouts);
+    DescriptorPoolRatio const ratios[3] = {
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f }
+    };
+    create_descriptor_allocator(ctx.device, ratios, 3, 16, &bench.descriptors);
+    VkResult err = setup_cull_bench(ctx, max_objects, size, wall_depth, bench);
+    if (err == VK_ERROR_FEATURE_NOT_PRESENT)
+    {
+        std::cout << "gpu culling: skipped, the device has no drawIndirectFirstInstance\n";
+        release_cull_bench(ctx, bench);
+        return VK_SUCCESS;
+    }
+
+    // Small LCG, the same scene on every run. Every object is a copy of the mesh.
+    std::vector<CullObject> objects(max_objects);
+    uint32_t seed = 12345;
+    for (uint32_t oidx = 0; (oidx < max_objects) && (err == VK_SUCCESS); ++oidx)
+    {
+        float random[3];
+        for (uint32_t ridx = 0; ridx < 3; ++ridx)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            random[ridx] = static_cast<float>(seed >> 8) / 16777216.0f;
+        }
+        float const center[3] = { random[0] * 100.0f - 50.0f, random[1] * 100.0f - 50.0f, 1.0f + random[2] * 199.0f };
+        make_mesh_cull_object(bench.mesh, center, &objects[oidx]);
+    }
+    float const identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    CullView views[2];
+    make_cull_view(identity, 1.0471976f, 1.0f, znear, CULL_FRUSTUM, &views[0]);
+    make_cull_view(identity, 1.0471976f, 1.0f, znear, CULL_FRUSTUM | CULL_OCCLUSION, &views[1]);
+    CulledMeshView mesh_view;
+    if (err == VK_SUCCESS)
+    {
+        make_culled_mesh_view(views[1], bench.mesh, &mesh_view);
+    }
+    char const* const names[3] = { "frustum", "frustum + hi-z", "frustum + hi-z + draw" };
+    char const* const metrics[3] = { "frustum", "occlusion", "draw" };
+
+    if (err == VK_SUCCESS)
+    {
+        std::cout << "gpu culling: up to " << max_objects << " objects, " << iterations << " iterations, " << bench.mesh.index_count / 3
+            << " triangles per draw, "
+            << (bench.culling.compact ? "draw indirect count" : (bench.culling.multi_draw ? "multi-draw indirect" : "one indirect draw per object")) << "\n";
+    }
+    uint64_t ticket = 0;
+    for (uint32_t count = 1000; (count <= max_objects) && (err == VK_SUCCESS); count *= 10)
+    {
+        err = upload_cull_objects(bench.culling, ctx.allocator, bench.immediate, objects.data(), count, &ticket);
+        if (err == VK_SUCCESS)
+        {
+            err = wait_immediate(bench.immediate, ticket);
+        }
+        for (uint32_t vidx = 0; (vidx < 3) && (err == VK_SUCCESS); ++vidx)
+        {
+            double gpu_ms = 0.0;
+            uint32_t gpu_visible = 0;
+            CullView const& view = views[std::min(vidx, 1u)];
+            err = run_cull(ctx, bench, view, (vidx == 2) ? &mesh_view : nullptr, size, iterations, &gpu_ms, &gpu_visible);
+            bench_clock::time_point start = bench_clock::now();
+            uint32_t cpu_visible = cpu_cull(objects.data(), count, view, wall_depth);
+            double cpu_ms = elapsed_ms(start, bench_clock::now());
+            if (err == VK_SUCCESS)
+            {
+                char metric[64];
+                snprintf(metric, sizeof(metric), "cull.%u.%s", count, metrics[vidx]);
+                add_bench_metric(ctx.report, metric, gpu_ms, "ms", BENCH_LOWER_IS_BETTER);
+                std::cout << "  " << count << " " << names[vidx] << " | gpu " << gpu_ms << " ms, " << gpu_visible << " visible | cpu "
+                    << cpu_ms << " ms, " << cpu_visible << " visible" << ((gpu_visible == cpu_visible) ? "" : " MISMATCH") << "\n";
+            }
+        }
+    }
+
+    release_cull_bench(ctx, bench);
+    return err;
+}
+
+static void put_u32(std::vector<unsigned char>& bytes, size_t offset, uint32_t value)
+{
+    for (uint32_t bidx = 0; bidx < 4; ++bidx)
+    {
+        bytes[offset + bidx] = static_cast<unsigned char>(value >> (8 * bidx));
+    }
+}
+
+static void put_u64(std::vector<unsigned char>& bytes, size_t offset, uint64_t value)
+{
+    put_u32(bytes, offset, static_cast<uint32_t>(value));
+    put_u32(bytes, offset + 4, static_cast<uint32_t>(value >> 32));
+}
+
+// Square R8G8B8A8_UNORM texture with its whole mip chain, laid out like an exporter writes KTX2:
+// basic data format descriptor, no key/value data, levels stored coarsest first.
+static std::vector<unsigned char> build_bench_ktx2(uint32_t size)
+{
+    uint32_t level_count = 1;
+    while ((size >> level_count) > 0)
+    {
+        ++level_count;
+    }
+    size_t const dfd_offset = 80 + level_count * 24;
+    size_t const dfd_size = 4 + 24 + 4 * 16;
+    size_t data_size = 0;
+    for (uint32_t level = 0; level < level_count; ++level)
+    {
+        data_size += static_cast<size_t>(std::max<uint32_t>(size >> level, 1)) * std::max<uint32_t>(size >> level, 1) * 4;
+    }
+    std::vector<unsigned char> bytes(dfd_offset + dfd_size + data_size, 0);
+    static unsigned char const identifier[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+    memcpy(bytes.data(), identifier, sizeof(identifier));
+    put_u32(bytes, 12, VK_FORMAT_R8G8B8A8_UNORM);
+    put_u32(bytes, 16, 1);                  // typeSize
+    put_u32(bytes, 20, size);
+    put_u32(bytes, 24, size);
+    put_u32(bytes, 28, 0);                  // depth
+    put_u32(bytes, 32, 0);                  // layers
+    put_u32(bytes, 36, 1);                  // faces
+    put_u32(bytes, 40, level_count);
+    put_u32(bytes, 44, 0);                  // no supercompression
+    put_u32(bytes, 48, static_cast<uint32_t>(dfd_offset));
+    put_u32(bytes, 52, static_cast<uint32_t>(dfd_size));
+
+    // Basic descriptor block: RGBSDA, BT.709, linear, four 8 bit samples.
+    size_t dfd = dfd_offset;
+    put_u32(bytes, dfd, static_cast<uint32_t>(dfd_size));
+    put_u32(bytes, dfd + 4, 0);             // Khronos vendor, basic descriptor type
+    put_u32(bytes, dfd + 8, 2 | ((24 + 4 * 16) << 16));    // version 2, block size
+    bytes[dfd + 12] = 1;
+    bytes[dfd + 13] = 1;
+    bytes[dfd + 14] = 1;
+    bytes[dfd + 20] = 4;                    // bytesPlane0
+    unsigned char const channels[4] = { 0, 1, 2, 15 };
+    for (uint32_t sidx = 0; sidx < 4; ++sidx)
+    {
+        size_t sample = dfd + 28 + sidx * 16;
+        put_u32(bytes, sample, (sidx * 8) | (7 << 16) | (static_cast<uint32_t>(channels[sidx]) << 24));
+        put_u32(bytes, sample + 12, 255);
+    }
+
+    size_t offset = dfd_offset + dfd_size;
+    for (uint32_t level = level_count; level-- > 0;)
+    {
+        uint32_t extent = std::max<uint32_t>(size >> level, 1);
+        size_t level_size = static_cast<size_t>(extent) * extent * 4;
+        put_u64(bytes, 80 + level * 24, offset);
+        put_u64(bytes, 80 + level * 24 + 8, level_size);
+        put_u64(bytes, 80 + level * 24 + 16, level_size);
+        memset(bytes.data() + offset, static_cast<int>(32 * level), level_size);
+        offset += level_size;
+    }
+    return bytes;
+}
+
+// texture_count textures streamed from one synthetic file, demanded at full resolution: time
+// until every texture shows its mip tail and until all are at level 0, then how long evicting
+// down to half that takes.
+static VkResult bench_texture_streaming(BenchContext& ctx, uint32_t texture_count, uint32_t texture_size)
+{
+    if ((texture_count == 0) || (texture_size == 0))
+    {
+        return VK_SUCCESS;
+    }
+    char const* path = "vk_bench.stream.ktx2";
+    std::vector<unsigned char> file = build_bench_ktx2(texture_size);
+    if (!write_file_atomic(path, file.data(), file.size()))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    UploadQueue upload;
+    VK_THROW(create_upload_queue(ctx.allocator, ctx.device, ctx.swap_chain.gpu, ctx.draw, 32 * 1024 * 1024, &upload));
+    DeletionQueue deletion_queue;
+    init_deletion_queue(&deletion_queue);
+    TextureStreamer streamer;
+    create_texture_streamer(ctx.device, ctx.swap_chain.gpu, ctx.allocator, upload, deletion_queue, ctx.draw.memory_budget, 0, &streamer);
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VK_THROW(allocate_bench_command_buffers(ctx, 1, &command_buffer));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    bench_clock::time_point start = bench_clock::now();
+    for (uint32_t tidx = 0; tidx < texture_count; ++tidx)
+    {
+        uint32_t texture = 0;
+        VK_THROW(load_streamed_texture(streamer, path, &texture));
+    }
+    double load_ms = elapsed_ms(start, bench_clock::now());
+
+    double visible_ms = -1.0;
+    double full_ms = -1.0;
+    double evict_ms = -1.0;
+    bench_clock::time_point evict_start;
+    for (uint64_t frame = 0; (frame < 100000) && (evict_ms < 0.0); ++frame)
+    {
+        VK_THROW(submit_uploads(upload));
+        VK_THROW(vkBeginCommandBuffer(command_buffer, &begin_info));
+        VK_THROW(poll_uploads(upload, command_buffer));
+        for (uint32_t tidx = 0; tidx < texture_count; ++tidx)
+        {
+            note_texture_demand(streamer, tidx, static_cast<float>(texture_size), frame);
+        }
+        VK_THROW(update_texture_streaming(streamer, command_buffer, frame, frame));
+        VK_THROW(vkEndCommandBuffer(command_buffer));
+        VK_THROW(submit_and_wait(ctx, command_buffer));
+        flush_deletion_queue(deletion_queue, frame + 1);
+
+        bool visible = true;
+        bool full = true;
+        bool settled = true;
+        for (uint32_t tidx = 0; tidx < texture_count; ++tidx)
+        {
+            StreamedTexture const& texture = streamer.textures[tidx];
+            visible = visible && (texture.view != VK_NULL_HANDLE);
+            full = full && (texture.resident_mip == 0);
+            settled = settled && (texture.pending_image == VK_NULL_HANDLE);
+        }
+        if (visible && (visible_ms < 0.0))
+        {
+            visible_ms = elapsed_ms(start, bench_clock::now());
+        }
+        if (full && (full_ms < 0.0))
+        {
+            full_ms = elapsed_ms(start, bench_clock::now());
+            // Half the memory the full set takes, whatever the heap would allow.
+            streamer.budget_limit = streamer.stats.resident_bytes / 2;
+            evict_start = bench_clock::now();
+        }
+        else if ((full_ms >= 0.0) && settled && (streamer.stats.resident_bytes <= streamer.budget_limit))
+        {
+            evict_ms = elapsed_ms(evict_start, bench_clock::now());
+        }
+    }
+    VK_THROW(vkDeviceWaitIdle(ctx.device));
+
+    double file_mib = file.size() / (1024.0 * 1024.0);
+    std::cout << "texture streaming: " << texture_count << " x " << texture_size << "^2 RGBA8 (" << file_mib << " MiB each)"
+              << " | load " << load_ms << " ms | all visible " << visible_ms << " ms | full resolution " << full_ms << " ms"
+              << " | evict to half " << evict_ms << " ms\n";
+    print_texture_streaming_stats(streamer);
+    add_bench_metric(ctx.report, "stream.load", load_ms, "ms", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "stream.visible", visible_ms, "ms", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "stream.full_resolution", full_ms, "ms", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "stream.evict", evict_ms, "ms", BENCH_LOWER_IS_BETTER);
+
+    destroy_texture_streamer(streamer);
+    drain_deletion_queue(deletion_queue);
+    destroy_upload_queue(ctx.allocator, upload);
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &command_buffer);
+    remove(path);
+    return VK_SUCCESS;
+}
+
+// A sphere packed like tools/meshpack does it: load is mapping and copying into staging, resident
+// is until the ranges can be used on the graphics queue. Vertices shaded per triangle are
+// simulated on the indices as stored in the file.
+static VkResult bench_mesh_loading(BenchContext& ctx, uint32_t segments, uint32_t iterations)
+{
+    if ((segments == 0) || (iterations == 0))
+    {
+        return VK_SUCCESS;
+    }
+    char const* path = "vk_bench.mesh.vkmesh";
+    SourceMesh source;
+    build_bench_sphere(segments, &source);
+    std::vector<unsigned char> file;
+    MeshPackStats pack_stats;
+    bench_clock::time_point pack_start = bench_clock::now();
+    if (!pack_mesh(source, MESH_CACHE_SIZE, &file, &pack_stats))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    double pack_ms = elapsed_ms(pack_start, bench_clock::now());
+    if (!write_file_atomic(path, file.data(), file.size()))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    MappedFile mapped;
+    MeshFileHeader header;
+    if (!map_file(path, &mapped))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if (!parse_mesh_file(mapped, &header))
+    {
+        unmap_file(mapped);
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    double shaded = vertices_shaded_per_triangle(static_cast<unsigned char const*>(mapped.data) + header.index_offset, header.index_size,
+                                                 header.index_count, header.vertex_count, MESH_CACHE_SIZE);
+    unmap_file(mapped);
+
+    UploadQueue upload;
+    VK_THROW(create_upload_queue(ctx.allocator, ctx.device, ctx.swap_chain.gpu, ctx.draw, 16 * 1024 * 1024, &upload));
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VK_THROW(allocate_bench_command_buffers(ctx, 1, &command_buffer));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    double load_ms = 0.0;
+    double resident_ms = 0.0;
+    for (uint32_t iidx = 0; iidx < iterations; ++iidx)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        Mesh mesh;
+        VK_THROW(load_mesh(ctx.allocator, upload, path, &mesh));
+        load_ms += elapsed_ms(start, bench_clock::now());
+        VK_THROW(submit_uploads(upload));
+        while (!upload_complete(upload, mesh.ticket))
+        {
+            VK_THROW(vkBeginCommandBuffer(command_buffer, &begin_info));
+            VK_THROW(poll_uploads(upload, command_buffer));
+            VK_THROW(vkEndCommandBuffer(command_buffer));
+            VK_THROW(submit_and_wait(ctx, command_buffer));
+        }
+        resident_ms += elapsed_ms(start, bench_clock::now());
+        destroy_mesh(mesh);
+    }
+    load_ms /= iterations;
+    resident_ms /= iterations;
+    double bytes_per_vertex = static_cast<double>(header.vertex_bytes) / header.vertex_count;
+
+    std::cout << "mesh: " << pack_stats.vertex_count << " vertices, " << pack_stats.triangle_count << " triangles, "
+              << file.size() / 1024 << " KiB, packed in " << pack_ms << " ms\n";
+    std::cout << "  load " << load_ms << " ms | resident " << resident_ms << " ms | " << bytes_per_vertex << " bytes per vertex ("
+              << sizeof(SourceVertex) << " as floats) | vertices shaded per triangle " << pack_stats.shaded_before << " -> " << shaded
+              << " (FIFO " << MESH_CACHE_SIZE << ", " << pack_stats.clusters << " overdraw clusters)\n";
+    add_bench_metric(ctx.report, "mesh.load", load_ms, "ms", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "mesh.resident", resident_ms, "ms", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "mesh.bytes_per_vertex", bytes_per_vertex, "bytes", BENCH_LOWER_IS_BETTER);
+    add_bench_metric(ctx.report, "mesh.shaded_per_triangle", shaded, "vertices", BENCH_LOWER_IS_BETTER);
+
+    destroy_upload_queue(ctx.allocator, upload);
+    vkFreeCommandBuffers(ctx.device, ctx.command_pool, 1, &command_buffer);
+    remove(path);
+    return VK_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchContext ctx;
+    ctx.instance = VK_NULL_HANDLE;
+    ctx.device = VK_NULL_HANDLE;
+    ctx.command_pool = VK_NULL_HANDLE;
+    init_device_selection(&ctx.selection);
+    ctx.selection.profile_path = "vk_bench.device_profile";
+
+    uint32_t job_count = 256;
+    uint32_t commands_per_job = 2000;
+    uint32_t iterations = 10;
+    uint32_t upload_frames = 300;
+    uint32_t upload_kib = 4096;
+    uint32_t dispatch_calls = 1000000;
+    uint32_t graph_frames = 100;
+    uint32_t immediate_ops = 200;
+    uint32_t cull_objects = 1000000;
+    uint32_t submit_buffers = 256;
+    uint32_t transfer_mib = 64;
+    uint32_t descriptor_sets = 1024;
+    uint32_t present_frames = 300;
+    uint32_t stream_textures = 32;
+    uint32_t stream_size = 1024;
+    uint32_t mesh_segments = 512;
+    SwapChainMode mode = SWAP_CHAIN_OFFSCREEN;
+    HostAllocatorMode host_mode = HOST_ALLOCATOR_ARENA;
+    char const* json_path = nullptr;
+    char const* baseline_path = nullptr;
+    double tolerance = 0.1;
+    for (int aidx = 1; aidx < argc; ++aidx)
+    {
+        if ((strcmp(argv[aidx], "--jobs") == 0) && (aidx + 1 < argc))
+        {
+            job_count = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--commands") == 0) && (aidx + 1 < argc))
+        {
+            commands_per_job = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--iterations") == 0) && (aidx + 1 < argc))
+        {
+            iterations = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--upload-frames") == 0) && (aidx + 1 < argc))
+        {
+            upload_frames = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--upload-kib") == 0) && (aidx + 1 < argc))
+        {
+            upload_kib = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--graph-frames") == 0) && (aidx + 1 < argc))
+        {
+            graph_frames = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--dispatch-calls") == 0) && (aidx + 1 < argc))
+        {
+            dispatch_calls = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--immediate-ops") == 0) && (aidx + 1 < argc))
+        {
+            immediate_ops = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--cull-objects") == 0) && (aidx + 1 < argc))
+        {
+            cull_objects = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--submit-buffers") == 0) && (aidx + 1 < argc))
+        {
+            submit_buffers = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--transfer-mib") == 0) && (aidx + 1 < argc))
+        {
+            transfer_mib = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--descriptor-sets") == 0) && (aidx + 1 < argc))
+        {
+            descriptor_sets = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--present-frames") == 0) && (aidx + 1 < argc))
+        {
+            present_frames = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--stream-textures") == 0) && (aidx + 1 < argc))
+        {
+            stream_textures = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--gpu") == 0) && (aidx + 1 < argc))
+        {
+            ctx.selection.override_device = argv[++aidx];
+        }
+        else if ((strcmp(argv[aidx], "--stream-size") == 0) && (aidx + 1 < argc))
+        {
+            stream_size = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--mesh-segments") == 0) && (aidx + 1 < argc))
+        {
+            mesh_segments = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if (strcmp(argv[aidx], "--headless") == 0)
+        {
+            mode = SWAP_CHAIN_HEADLESS_SURFACE;     // present through VK_EXT_headless_surface, falls back to offscreen
+        }
+        else if ((strcmp(argv[aidx], "--host-allocator") == 0) && (aidx + 1 < argc))
+        {
+            char const* name = argv[++aidx];
+            host_mode = (strcmp(name, "driver") == 0) ? HOST_ALLOCATOR_DRIVER : ((strcmp(name, "tracking") == 0) ? HOST_ALLOCATOR_TRACKING : HOST_ALLOCATOR_ARENA);
+        }
+        else if ((strcmp(argv[aidx], "--json") == 0) && (aidx + 1 < argc))
+        {
+            json_path = argv[++aidx];
+        }
+        else if ((strcmp(argv[aidx], "--baseline") == 0) && (aidx + 1 < argc))
+        {
+            baseline_path = argv[++aidx];
+        }
+        else if ((strcmp(argv[aidx], "--tolerance") == 0) && (aidx + 1 < argc))
+        {
+            tolerance = atof(argv[++aidx]) / 100.0;    // percent
+        }
+    }
+
+    init_host_allocator(host_mode);
+    // The offscreen ring needs nothing from the window system, --headless measures a real swap chain.
+    init_swap_chain(mode, &ctx.swap_chain);
+    if (VkResult err = init_Vulkan(ctx.instance, ctx.selection, &ctx.device, &ctx.draw, &ctx.swap_chain))
+    {
+        print_vk_error_code("Unable to initialize Vulkan: ", err);
+        return 1;
+    }
+    if (VkResult err = create_command_pool(ctx.device, ctx.draw.queue_family_idx, &ctx.command_pool))
+    {
+        print_vk_error_code("Unable to create the command pool: ", err);
+        return 1;
+    }
+    create_device_allocator(ctx.swap_chain.gpu, ctx.device, &ctx.allocator);
+    VkPhysicalDeviceProperties const& properties = ctx.draw.gpu_properties;
+    char driver[64];
+    snprintf(driver, sizeof(driver), "driver 0x%x, api %u.%u.%u", properties.driverVersion, VK_VERSION_MAJOR(properties.apiVersion),
+        VK_VERSION_MINOR(properties.apiVersion), VK_VERSION_PATCH(properties.apiVersion));
+    ctx.report.device = properties.deviceName;
+    ctx.report.driver = driver;
+
+    if (VkResult err = bench_device_selection(ctx, iterations))
+    {
+        print_vk_error_code("device selection failed: ", err);
+    }
+    if (VkResult err = bench_record_scaling(ctx, job_count, commands_per_job, iterations))
+    {
+        print_vk_error_code("record scaling failed: ", err);
+    }
+    if (VkResult err = bench_upload(ctx, upload_frames, static_cast<VkDeviceSize>(upload_kib) * 1024))
+    {
+        print_vk_error_code("upload failed: ", err);
+    }
+    if (VkResult err = bench_render_graph(ctx, graph_frames))
+    {
+        print_vk_error_code("render graph failed: ", err);
+    }
+    if (VkResult err = bench_dispatch(ctx, dispatch_calls, iterations))
+    {
+        print_vk_error_code("dispatch failed: ", err);
+    }
+    if (VkResult err = bench_immediate(ctx, immediate_ops))
+    {
+        print_vk_error_code("immediate failed: ", err);
+    }
+    if (VkResult err = bench_submit(ctx, submit_buffers, iterations))
+    {
+        print_vk_error_code("submit failed: ", err);
+    }
+    if (VkResult err = bench_transfer(ctx, static_cast<VkDeviceSize>(transfer_mib) * 1024 * 1024, iterations))
+    {
+        print_vk_error_code("transfer failed: ", err);
+    }
+    if (VkResult err = bench_descriptor_updates(ctx, descriptor_sets, iterations))
+    {
+        print_vk_error_code("descriptor updates failed: ", err);
+    }
+    if (VkResult err = bench_pipeline_creation(ctx, iterations))
+    {
+        print_vk_error_code("pipeline creation failed: ", err);
+    }
+    if (VkResult err = bench_present(ctx, present_frames))
+    {
+        print_vk_error_code("present failed: ", err);
+    }
+    if (VkResult err = bench_gpu_culling(ctx, cull_objects, iterations))
+    {
+        print_vk_error_code("gpu culling failed: ", err);
+    }
+    if (VkResult err = bench_texture_streaming(ctx, stream_textures, stream_size))
+    {
+        print_vk_error_code("texture streaming failed: ", err);
+    }
+    if (VkResult err = bench_mesh_loading(ctx, mesh_segments, iterations))
+    {
+        print_vk_error_code("mesh loading failed: ", err);
+    }
+
+    // Driver host memory over the whole run: churn is what reached the system allocator.
+    if (host_mode != HOST_ALLOCATOR_DRIVER)
+    {
+        HostAllocatorStats host_stats;
+        get_host_allocator_stats(&host_stats);
+        uint64_t peak_bytes = 0;
+        for (uint32_t sidx = 0; sidx < HOST_SCOPE_COUNT; ++sidx)
+        {
+            peak_bytes += host_stats.scopes[sidx].peak_bytes;
+        }
+        add_bench_metric(ctx.report, "host.system_allocations", static_cast<double>(host_stats.system_allocations), "calls", BENCH_LOWER_IS_BETTER);
+        add_bench_metric(ctx.report, "host.peak_reserved", host_stats.peak_reserved_bytes / 1024.0, "KiB", BENCH_LOWER_IS_BETTER);
+        add_bench_metric(ctx.report, "host.peak_requested", peak_bytes / 1024.0, "KiB", BENCH_LOWER_IS_BETTER);
+    }
+
+    int exit_code = 0;
+    if ((json_path != nullptr) && !write_bench_report(json_path, ctx.report))
+    {
+        std::cout << "Unable to write " << json_path << "\n";
+        exit_code = 1;
+    }
+    if (baseline_path != nullptr)
+    {
+        BenchReport baseline;
+        if (!read_bench_report(baseline_path, &baseline))
+        {
+            std::cout << "Unable to read the baseline " << baseline_path << "\n";
+            exit_code = 1;
+        }
+        else if (uint32_t regressions = compare_bench_reports(ctx.report, baseline, tolerance))
+        {
+            std::cout << regressions << " regressions\n";
+            exit_code = 2;
+        }
+    }
+
+    destroy_device_allocator(ctx.allocator);
+    vkDestroyCommandPool(ctx.device, ctx.command_pool, host_allocator());
+    vkDestroyDevice(ctx.device, host_allocator());
+    release_device_dispatch(ctx.device);
+    if (ctx.swap_chain.surface != VK_NULL_HANDLE)
+    {
+        vkDestroySurfaceKHR(ctx.instance, ctx.swap_chain.surface, host_allocator());
+    }
+    vkDestroyInstance(ctx.instance, host_allocator());
+    print_host_allocator_stats();
+    unload_vulkan_library();
+    return exit_code;
+}
@@ -0,0 +1,401 @@
+#include "config.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "bench_report.hpp"
+#include "file_map.hpp"
+
+void add_bench_metric(BenchReport& report, char const* name, double value, char const* unit, BenchDirection direction)
+{
+    BenchMetric metric;
+    metric.name = name;
+    metric.value = value;
+    metric.unit = unit;
+    metric.direction = direction;
+    report.metrics.push_back(metric);
+}
+
+static void append_json_string(std::string& json, std::string const& value)
+{
+    json += '"';
+    for (size_t cidx = 0; cidx < value.size(); ++cidx)
+    {
+        char c = value[cidx];
+        if ((c == '"') || (c == '\\'))
+        {
+            json += '\\';
+            json += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            json += escaped;
+        }
+        else
+        {
+            json += c;
+        }
+    }
+    json += '"';
+}
+
+bool write_bench_report(char const* path, BenchReport const& report)
+{
+    std::string json = "{\n  \"device\": ";
+    append_json_string(json, report.device);
+    json += ",\n  \"driver\": ";
+    append_json_string(json, report.driver);
+    json += ",\n  \"metrics\": [";
+    for (size_t midx = 0; midx < report.metrics.size(); ++midx)
+    {
+        BenchMetric const& metric = report.metrics[midx];
+        json += (midx > 0) ? ",\n    { \"name\": " : "\n    { \"name\": ";
+        append_json_string(json, metric.name);
+        char value[64];
+        // NaN and infinities are not JSON, a broken measurement reads as 0.
+        snprintf(value, sizeof(value), ", \"value\": %.9g, \"unit\": ", std::isfinite(metric.value) ? metric.value : 0.0);
+        json += value;
+        append_json_string(json, metric.unit);
+        json += (metric.direction == BENCH_HIGHER_IS_BETTER) ? ", \"better\": \"higher\" }" : ", \"better\": \"lower\" }";
+    }
+    json += "\n  ]\n}\n";
+    return write_file_atomic(path, json.data(), json.size());
+}
+
+// Just enough JSON to read reports back: strings without \u escapes beyond ASCII, numbers, and
+// skipping whatever else a tool may have added.
+struct JsonCursor
+{
+    char const* at;
+    char const* end;
+};
+
+static void skip_json_space(JsonCursor& cursor)
+{
+    while ((cursor.at < cursor.end) && ((*cursor.at == ' ') || (*cursor.at == '\t') || (*cursor.at == '\n') || (*cursor.at == '\r')))
+    {
+        ++cursor.at;
+    }
+}
+
+static bool expect_json(JsonCursor& cursor, char c)
+{
+    skip_json_space(cursor);
+    if ((cursor.at < cursor.end) && (*cursor.at == c))
+    {
+        ++cursor.at;
+        return true;
+    }
+    return false;
+}
+
+static bool peek_json(JsonCursor& cursor, char c)
+{
+    skip_json_space(cursor);
+    return (cursor.at < cursor.end) && (*cursor.at == c);
+}
+
+static bool parse_json_string(JsonCursor& cursor, std::string* out_value)
+{
+    if (!expect_json(cursor, '"'))
+    {
+        return false;
+    }
+    out_value->clear();
+    while (cursor.at < cursor.end)
+    {
+        char c = *cursor.at++;
+        if (c == '"')
+        {
+            return true;
+        }
+        if (c != '\\')
+        {
+            *out_value += c;
+            continue;
+        }
+        if (cursor.at >= cursor.end)
+        {
+            return false;
+        }
+        char escape = *cursor.at++;
+        switch (escape)
+        {
+        case 'n': *out_value += '\n'; break;
+        case 't': *out_value += '\t'; break;
+        case 'r': *out_value += '\r'; break;
+        case 'b': *out_value += '\b'; break;
+        case 'f': *out_value += '\f'; break;
+        case 'u':
+            if (cursor.end - cursor.at < 4)
+            {
+                return false;
+            }
+            *out_value += static_cast<char>(strtoul(std::string(cursor.at, 4).c_str(), nullptr, 16) & 0x7f);
+            cursor.at += 4;
+            break;
+        default: *out_value += escape; break;
+        }
+    }
+    return false;
+}
+
+static bool parse_json_number(JsonCursor& cursor, double* out_value)
+{
+    skip_json_space(cursor);
+    // The file is mapped, not null terminated: copy the token before strtod() sees it.
+    char const* first = cursor.at;
+    while ((cursor.at < cursor.end) && (strchr("+-0123456789.eE", *cursor.at) != nullptr))
+    {
+        ++cursor.at;
+    }
+    if (cursor.at == first)
+    {
+        return false;
+    }
+    std::string token(first, cursor.at);
+    char* parsed_end = nullptr;
+    *out_value = strtod(token.c_str(), &parsed_end);
+    return *parsed_end == '\0';
+}
+
+static bool skip_json_value(JsonCursor& cursor, uint32_t depth)
+{
+    if (depth > 64)
+    {
+        return false;
+    }
+    skip_json_space(cursor);
+    if (cursor.at >= cursor.end)
+    {
+        return false;
+    }
+    std::string ignored;
+    char c = *cursor.at;
+    if (c == '"')
+    {
+        return parse_json_string(cursor, &ignored);
+    }
+    if ((c == '{') || (c == '['))
+    {
+        char close = (c == '{') ? '}' : ']';
+        ++cursor.at;
+        if (expect_json(cursor, close))
+        {
+            return true;
+        }
+        do
+        {
+            if ((c == '{') && !(parse_json_string(cursor, &ignored) && expect_json(cursor, ':')))
+            {
+                return false;
+            }
+            if (!skip_json_value(cursor, depth + 1))
+            {
+                return false;
+            }
+        } while (expect_json(cursor, ','));
+        return expect_json(cursor, close);
+    }
+    // true, false, null and numbers
+    char const* first = cursor.at;
+    while ((cursor.at < cursor.end) && (strchr(",}] \t\r\n", *cursor.at) == nullptr))
+    {
+        ++cursor.at;
+    }
+    return cursor.at != first;
+}
+
+static bool parse_bench_metric(JsonCursor& cursor, BenchMetric* out_metric)
+{
+    out_metric->value = 0.0;
+    out_metric->direction = BENCH_HIGHER_IS_BETTER;
+    bool has_name = false;
+    bool has_value = false;
+    if (!expect_json(cursor, '{'))
+    {
+        return false;
+    }
+    if (expect_json(cursor, '}'))
+    {
+        return false;
+    }
+    do
+    {
+        std::string key;
+        if (!parse_json_string(cursor, &key) || !expect_json(cursor, ':'))
+        {
+            return false;
+        }
+        bool ok = true;
+        if (key == "name")
+        {
+            ok = parse_json_string(cursor, &out_metric->name);
+            has_name = ok;
+        }
+        else if (key == "value")
+        {
+            ok = parse_json_number(cursor, &out_metric->value);
+            has_value = ok;
+        }
+        else if (key == "unit")
+        {
+            ok = parse_json_string(cursor, &out_metric->unit);
+        }
+        else if (key == "better")
+        {
+            std::string better;
+            ok = parse_json_string(cursor, &better);
+            out_metric->direction = (better == "lower") ? BENCH_LOWER_IS_BETTER : BENCH_HIGHER_IS_BETTER;
+        }
+        else
+        {
+            ok = skip_json_value(cursor, 1);
+        }
+        if (!ok)
+        {
+            return false;
+        }
+    } while (expect_json(cursor, ','));
+    return expect_json(cursor, '}') && has_name && has_value;
+}
+
+static bool parse_bench_report(JsonCursor& cursor, BenchReport* out_report)
+{
+    if (!expect_json(cursor, '{'))
+    {
+        return false;
+    }
+    bool has_metrics = false;
+    if (expect_json(cursor, '}'))
+    {
+        return false;
+    }
+    do
+    {
+        std::string key;
+        if (!parse_json_string(cursor, &key) || !expect_json(cursor, ':'))
+        {
+            return false;
+        }
+        if (key == "device")
+        {
+            if (!parse_json_string(cursor, &out_report->device))
+            {
+                return false;
+            }
+        }
+        else if (key == "driver")
+        {
+            if (!parse_json_string(cursor, &out_report->driver))
+            {
+                return false;
+            }
+        }
+        else if (key == "metrics")
+        {
+            if (!expect_json(cursor, '['))
+            {
+                return false;
+            }
+            if (!peek_json(cursor, ']'))
+            {
+                do
+                {
+                    BenchMetric metric;
+                    if (!parse_bench_metric(cursor, &metric))
+                    {
+                        return false;
+                    }
+                    out_report->metrics.push_back(metric);
+                } while (expect_json(cursor, ','));
+            }
+            if (!expect_json(cursor, ']'))
+            {
+                return false;
+            }
+            has_metrics = true;
+        }
+        else if (!skip_json_value(cursor, 1))
+        {
+            return false;
+        }
+    } while (expect_json(cursor, ','));
+    return expect_json(cursor, '}') && has_metrics;
+}
+
+bool read_bench_report(char const* path, BenchReport* out_report)
+{
+    out_report->device.clear();
+    out_report->driver.clear();
+    out_report->metrics.clear();
+    MappedFile file;
+    if (!map_file(path, &file))
+    {
+        return false;
+    }
+    char const* data = static_cast<char const*>(file.data);
+    JsonCursor cursor = { data, data + file.size };
+    bool ok = (data != nullptr) && parse_bench_report(cursor, out_report);
+    unmap_file(file);
+    return ok;
+}
+
+static BenchMetric const* find_bench_metric(BenchReport const& report, std::string const& name)
+{
+    for (size_t midx = 0; midx < report.metrics.size(); ++midx)
+    {
+        if (report.metrics[midx].name == name)
+        {
+            return &report.metrics[midx];
+        }
+    }
+    return nullptr;
+}
+
+uint32_t compare_bench_reports(BenchReport const& report, BenchReport const& baseline, double tolerance)
+{
+    std::cout << "baseline: " << baseline.device << " (" << baseline.driver << "), tolerance " << tolerance * 100.0 << "%\n";
+    if ((baseline.device != report.device) || (baseline.driver != report.driver))
+    {
+        std::cout << "  recorded on another device or driver, the numbers may not be comparable\n";
+    }
+    uint32_t regressions = 0;
+    for (size_t midx = 0; midx < report.metrics.size(); ++midx)
+    {
+        BenchMetric const& metric = report.metrics[midx];
+        BenchMetric const* base = find_bench_metric(baseline, metric.name);
+        if (base == nullptr)
+        {
+            std::cout << "  " << metric.name << " | " << metric.value << " " << metric.unit << " | new\n";
+            continue;
+        }
+        // Positive change is an improvement whichever way the metric goes.
+        double change = 0.0;
+        if (base->value != 0.0)
+        {
+            change = (metric.value - base->value) / std::fabs(base->value);
+            if (metric.direction == BENCH_LOWER_IS_BETTER)
+            {
+                change = -change;
+            }
+        }
+        bool regressed = change < -tolerance;
+        regressions += regressed ? 1 : 0;
+        std::cout << "  " << metric.name << " | " << metric.value << " " << metric.unit << " | baseline " << base->value
+                  << " | " << ((change >= 0.0) ? "+" : "") << change * 100.0 << "%" << (regressed ? " REGRESSION" : "") << "\n";
+    }
+    for (size_t midx = 0; midx < baseline.metrics.size(); ++midx)
+    {
+        if (find_bench_metric(report, baseline.metrics[midx].name) == nullptr)
+        {
+            std::cout << "  " << baseline.metrics[midx].name << " | not measured\n";
+        }
+    }
+    return regressions;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <string>
+#include <vector>
+
+// Results of one vk_bench run. Written as JSON so runs can be archived, and compared against a
+// stored baseline: a metric that moved the wrong way by more than the tolerance is a regression.
+enum BenchDirection
+{
+    BENCH_HIGHER_IS_BETTER,         // throughput
+    BENCH_LOWER_IS_BETTER           // time, latency
+};
+
+struct BenchMetric
+{
+    std::string name;               // dotted, e.g. "submit.batch_16"
+    double value;
+    std::string unit;
+    BenchDirection direction;
+};
+
+struct BenchReport
+{
+    std::string device;
+    std::string driver;
+    std::vector<BenchMetric> metrics;
+};
+
+void add_bench_metric(BenchReport& report, char const* name, double value, char const* unit, BenchDirection direction);
+
+bool write_bench_report(char const* path, BenchReport const& report);
+// Reads a file written by write_bench_report(), reformatting it is fine. False when the file is
+// missing or not a report.
+bool read_bench_report(char const* path, BenchReport* out_report);
+
+// Prints every metric next to its baseline value. tolerance is a fraction (0.1 is 10%), metrics
+// missing on either side are listed but never count. Returns the number of regressions.
+uint32_t compare_bench_reports(BenchReport const& report, BenchReport const& baseline, double tolerance);
@@ -1,7 +1,12 @@
+#pragma once
+
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
 #define VK_USE_PLATFORM_WIN32_KHR
-//#define VK_NO_PROTOTYPES
+#endif
+// Entry points are loaded at runtime, see dispatch.hpp.
+#define VK_NO_PROTOTYPES
 
 // types
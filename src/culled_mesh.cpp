@@ -0,0 +1,242 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <cmath>
+#include <cstring>
+
+#include "culled_mesh.hpp"
+#include "descriptors.hpp"
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "mesh.hpp"
+#include "pipeline_cache.hpp"
+
+static VkResult create_culled_mesh_render_pass(VkDevice device, VkFormat color_format, VkAttachmentLoadOp color_load, VkFormat depth_format,
+    VkRenderPass* out_render_pass)
+{
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = color_format;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = color_load;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachments[1].format = depth_format;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference color_reference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    VkAttachmentReference depth_reference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_reference;
+    subpass.pDepthStencilAttachment = &depth_reference;
+
+    // No dependencies, the layouts don't change: the barriers around the pass are the caller's.
+    VkRenderPassCreateInfo render_pass_info = {};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.pNext = nullptr;
+    render_pass_info.flags = 0;
+    render_pass_info.attachmentCount = 2;
+    render_pass_info.pAttachments = attachments;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = 0;
+    render_pass_info.pDependencies = nullptr;
+    return vkCreateRenderPass(device, &render_pass_info, host_allocator(), out_render_pass);
+}
+
+static VkResult setup_culled_mesh_pass(VkDevice device, PipelineManager& pipelines, ShaderModuleCache& shader_cache, DescriptorLayoutCache& layouts,
+    DescriptorAllocator& descriptors, GpuCulling const& culling, VkFormat color_format, VkAttachmentLoadOp color_load, VkFormat depth_format,
+    CulledMeshPass* out_pass)
+{
+    VK_THROW(create_culled_mesh_render_pass(device, color_format, color_load, depth_format, &out_pass->render_pass));
+
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    binding.pImmutableSamplers = nullptr;
+    VK_THROW(get_descriptor_set_layout(layouts, 0, &binding, 1, nullptr, &out_pass->set_layout));
+
+    VkPushConstantRange push_range = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(CulledMeshView) };
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.pNext = nullptr;
+    layout_info.flags = 0;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &out_pass->set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    VK_THROW(vkCreatePipelineLayout(device, &layout_info, host_allocator(), &out_pass->layout));
+
+    VkShaderModule vertex_module = VK_NULL_HANDLE;
+    VkShaderModule fragment_module = VK_NULL_HANDLE;
+    VK_THROW(load_shader_module(shader_cache, "shaders/culled_mesh.vert.spv", &vertex_module));
+    VK_THROW(load_shader_module(shader_cache, "shaders/culled_mesh.frag.spv", &fragment_module));
+    GraphicsPipelineDesc pipeline_desc;
+    init_graphics_pipeline_desc(&pipeline_desc);
+    pipeline_desc.name = "culled mesh";
+    ShaderStageDesc stage;
+    stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stage.module = vertex_module;
+    stage.entry = "main";
+    pipeline_desc.stages.push_back(stage);
+    stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stage.module = fragment_module;
+    pipeline_desc.stages.push_back(stage);
+    VkVertexInputBindingDescription vertex_binding;
+    VkVertexInputAttributeDescription vertex_attributes[MESH_VERTEX_ATTRIBUTE_COUNT];
+    describe_mesh_vertex_input(0, &vertex_binding, vertex_attributes);
+    pipeline_desc.vertex_bindings.push_back(vertex_binding);
+    pipeline_desc.vertex_attributes.assign(vertex_attributes, vertex_attributes + MESH_VERTEX_ATTRIBUTE_COUNT);
+    // meshpack keeps the winding of the source, which is not always the same.
+    pipeline_desc.rasterization.cullMode = VK_CULL_MODE_NONE;
+    pipeline_desc.depth_stencil.depthTestEnable = VK_TRUE;
+    pipeline_desc.depth_stencil.depthWriteEnable = VK_TRUE;
+    pipeline_desc.depth_stencil.depthCompareOp = VK_COMPARE_OP_GREATER;     // reverse-Z
+    pipeline_desc.layout = out_pass->layout;
+    pipeline_desc.render_pass = out_pass->render_pass;
+    pipeline_desc.subpass = 0;
+    out_pass->pipeline = request_graphics_pipeline(pipelines, pipeline_desc, 0);
+
+    VK_THROW(allocate_descriptor_set(descriptors, out_pass->set_layout, &out_pass->set));
+    VkDescriptorBufferInfo objects_info = { culling.objects->buffer, 0, VK_WHOLE_SIZE };
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = out_pass->set;
+    write.dstBinding = 0;
+    write.dstArrayElement = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &objects_info;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    return VK_SUCCESS;
+}
+
+VkResult create_culled_mesh_pass(VkDevice device, PipelineManager& pipelines, ShaderModuleCache& shader_cache, DescriptorLayoutCache& layouts,
+    DescriptorAllocator& descriptors, GpuCulling const& culling, VkFormat color_format, VkAttachmentLoadOp color_load, VkFormat depth_format,
+    CulledMeshPass* out_pass)
+{
+    out_pass->device = device;
+    out_pass->render_pass = VK_NULL_HANDLE;
+    out_pass->set_layout = VK_NULL_HANDLE;
+    out_pass->layout = VK_NULL_HANDLE;
+    out_pass->pipeline = 0;
+    out_pass->set = VK_NULL_HANDLE;
+    VkResult result = setup_culled_mesh_pass(device, pipelines, shader_cache, layouts, descriptors, culling, color_format, color_load, depth_format, out_pass);
+    if (result != VK_SUCCESS)
+    {
+        destroy_culled_mesh_pass(*out_pass);
+    }
+    return result;
+}
+
+void destroy_culled_mesh_pass(CulledMeshPass& pass)
+{
+    // The set goes back with the descriptor allocator, the set layout with the layout cache and
+    // the pipeline with the pipeline manager.
+    vkDestroyPipelineLayout(pass.device, pass.layout, host_allocator());
+    vkDestroyRenderPass(pass.device, pass.render_pass, host_allocator());
+    pass.layout = VK_NULL_HANDLE;
+    pass.render_pass = VK_NULL_HANDLE;
+}
+
+VkResult create_culled_mesh_framebuffer(CulledMeshPass const& pass, VkImageView color, VkImageView depth, VkExtent2D extent, VkFramebuffer* out_framebuffer)
+{
+    VkImageView attachments[2] = { color, depth };
+    VkFramebufferCreateInfo framebuffer_info = {};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.pNext = nullptr;
+    framebuffer_info.flags = 0;
+    framebuffer_info.renderPass = pass.render_pass;
+    framebuffer_info.attachmentCount = 2;
+    framebuffer_info.pAttachments = attachments;
+    framebuffer_info.width = extent.width;
+    framebuffer_info.height = extent.height;
+    framebuffer_info.layers = 1;
+    return vkCreateFramebuffer(pass.device, &framebuffer_info, host_allocator(), out_framebuffer);
+}
+
+void make_mesh_cull_object(Mesh const& mesh, float const center[3], CullObject* out_object)
+{
+    float extent_squared = 0.0f;
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        float half = 0.5f * (mesh.bounds_max[axis] - mesh.bounds_min[axis]);
+        extent_squared += half * half;
+        out_object->sphere[axis] = center[axis];
+    }
+    out_object->sphere[3] = std::sqrt(extent_squared);
+    // The index range is bound at index_offset.
+    out_object->index_count = mesh.index_count;
+    out_object->first_index = 0;
+    out_object->vertex_offset = 0;
+    out_object->pad = 0;
+}
+
+void make_culled_mesh_view(CullView const& view, Mesh const& mesh, CulledMeshView* out_view)
+{
+    memcpy(out_view->view, view.view, sizeof(out_view->view));
+    out_view->p00 = view.p00;
+    out_view->p11 = view.p11;
+    out_view->znear = view.znear;
+    out_view->pad = 0.0f;
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        out_view->position_min[axis] = -0.5f * (mesh.bounds_max[axis] - mesh.bounds_min[axis]);
+        out_view->position_scale[axis] = mesh.bounds_max[axis] - mesh.bounds_min[axis];
+    }
+    out_view->position_min[3] = 0.0f;
+    out_view->position_scale[3] = 0.0f;
+}
+
+bool record_culled_mesh_pass(VkCommandBuffer command_buffer, PipelineManager& pipelines, CulledMeshPass const& pass, GpuCulling const& culling,
+    Mesh const& mesh, CulledMeshView const& view, VkFramebuffer framebuffer, VkExtent2D framebuffer_extent, VkExtent2D viewport_extent)
+{
+    VkPipeline pipeline = resolve_pipeline(pipelines, pass.pipeline);
+    if (pipeline == VK_NULL_HANDLE)
+    {
+        return false;
+    }
+    VkClearValue clear_values[2] = {};
+    clear_values[0].color.float32[3] = 1.0f;
+    clear_values[1].depthStencil.depth = 0.0f;      // reverse-Z, nothing drawn is infinitely far
+    VkRenderPassBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.renderPass = pass.render_pass;
+    begin_info.framebuffer = framebuffer;
+    begin_info.renderArea.offset.x = 0;
+    begin_info.renderArea.offset.y = 0;
+    begin_info.renderArea.extent = framebuffer_extent;
+    begin_info.clearValueCount = 2;
+    begin_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(command_buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(viewport_extent.width), static_cast<float>(viewport_extent.height), 0.0f, 1.0f };
+    VkRect2D scissor = { { 0, 0 }, framebuffer_extent };
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pass.layout, 0, 1, &pass.set, 0, nullptr);
+    vkCmdPushConstants(command_buffer, pass.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(view), &view);
+    VkDeviceSize vertex_offset = 0;
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &mesh.buffer->buffer, &vertex_offset);
+    vkCmdBindIndexBuffer(command_buffer, mesh.buffer->buffer, mesh.index_offset, mesh.index_type);
+    draw_culled(command_buffer, culling);
+    vkCmdEndRenderPass(command_buffer);
+    return true;
+}
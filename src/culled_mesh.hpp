@@ -0,0 +1,60 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include "gpu_culling.hpp"
+#include "pipeline_manager.hpp"
+
+struct DescriptorAllocator;
+struct DescriptorLayoutCache;
+struct Mesh;
+struct ShaderModuleCache;
+
+// Graphics half of the GPU culling: one mesh drawn at every object record_cull() kept, all of them
+// through draw_culled(). shaders/culled_mesh.vert finds its object with gl_InstanceIndex. One
+// subpass with a color and a reverse-Z depth attachment.
+
+// Push constants of shaders/culled_mesh.vert, 112 bytes. view, p00, p11 and znear are CullView's.
+struct CulledMeshView
+{
+    float view[16];
+    float p00;
+    float p11;
+    float znear;
+    float pad;
+    float position_min[4];      // xyz: where quantized position 0 lands, relative to the object center
+    float position_scale[4];    // xyz: size of the mesh bounds
+};
+
+struct CulledMeshPass
+{
+    VkDevice device;
+    VkRenderPass render_pass;
+    VkDescriptorSetLayout set_layout;   // owned by the layout cache
+    VkPipelineLayout layout;
+    PipelineHandle pipeline;
+    VkDescriptorSet set;                // the cull objects
+};
+
+// color_load is VK_ATTACHMENT_LOAD_OP_LOAD to draw over the image, CLEAR clears it to black.
+// Color stays in COLOR_ATTACHMENT_OPTIMAL and depth in DEPTH_STENCIL_ATTACHMENT_OPTIMAL, the
+// caller moves them in and out. Depth is cleared and stored for build_depth_pyramid().
+VkResult create_culled_mesh_pass(VkDevice device, PipelineManager& pipelines, ShaderModuleCache& shader_cache, DescriptorLayoutCache& layouts,
+    DescriptorAllocator& descriptors, GpuCulling const& culling, VkFormat color_format, VkAttachmentLoadOp color_load, VkFormat depth_format,
+    CulledMeshPass* out_pass);
+void destroy_culled_mesh_pass(CulledMeshPass& pass);
+
+VkResult create_culled_mesh_framebuffer(CulledMeshPass const& pass, VkImageView color, VkImageView depth, VkExtent2D extent, VkFramebuffer* out_framebuffer);
+
+// A copy of the whole mesh in the bounding sphere of its bounds, moved to center.
+void make_mesh_cull_object(Mesh const& mesh, float const center[3], CullObject* out_object);
+// view is the one the objects are culled with.
+void make_culled_mesh_view(CullView const& view, Mesh const& mesh, CulledMeshView* out_view);
+
+// Begins and ends the render pass over framebuffer_extent. The viewport covers viewport_extent,
+// the size of the depth the pyramid is built from, so the projection is the one cull.comp tests
+// against even when the framebuffer is smaller. Returns false, with nothing recorded, while the
+// pipeline is compiling. Draws and count must be visible to VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT.
+bool record_culled_mesh_pass(VkCommandBuffer command_buffer, PipelineManager& pipelines, CulledMeshPass const& pass, GpuCulling const& culling,
+    Mesh const& mesh, CulledMeshView const& view, VkFramebuffer framebuffer, VkExtent2D framebuffer_extent, VkExtent2D viewport_extent);
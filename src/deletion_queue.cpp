@@ -0,0 +1,75 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <iostream>
+
+#include "deletion_queue.hpp"
+
+void init_deletion_queue(DeletionQueue* out_queue)
+{
+    out_queue->pending.clear();
+    out_queue->deferred = 0;
+    out_queue->destroyed = 0;
+}
+
+void defer_destroy(DeletionQueue& queue, uint64_t last_use_frame, std::function<void()> const& destroy)
+{
+    DeferredDestroy entry;
+    entry.last_use_frame = last_use_frame;
+    entry.destroy = destroy;
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.pending.push_back(entry);
+    queue.deferred += 1;
+}
+
+// Destroys run without the lock held, they may defer more objects.
+static void run_destroys(DeletionQueue& queue, std::vector<DeferredDestroy>& ready)
+{
+    for (size_t didx = 0; didx < ready.size(); ++didx)
+    {
+        ready[didx].destroy();
+    }
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.destroyed += ready.size();
+}
+
+void flush_deletion_queue(DeletionQueue& queue, uint64_t frames_completed)
+{
+    std::vector<DeferredDestroy> ready;
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        size_t kept = 0;
+        for (size_t didx = 0; didx < queue.pending.size(); ++didx)
+        {
+            if (queue.pending[didx].last_use_frame < frames_completed)
+            {
+                ready.push_back(queue.pending[didx]);
+            }
+            else
+            {
+                queue.pending[kept++] = queue.pending[didx];
+            }
+        }
+        queue.pending.resize(kept);
+    }
+    run_destroys(queue, ready);
+}
+
+void drain_deletion_queue(DeletionQueue& queue)
+{
+    // Until nothing is left, a destroy may defer more.
+    for (;;)
+    {
+        std::vector<DeferredDestroy> ready;
+        {
+            std::lock_guard<std::mutex> guard(queue.lock);
+            ready.swap(queue.pending);
+        }
+        if (ready.empty())
+        {
+            break;
+        }
+        run_destroys(queue, ready);
+    }
+    std::cout << "deletion queue: " << queue.destroyed << " of " << queue.deferred << " deferred objects destroyed\n";
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Objects the GPU may still be using are handed over with the number of the last frame that
+// recorded them and destroyed once that frame's fence has been seen signaled, so nothing freed at
+// runtime needs the device to go idle. The frame loop owns one and flushes it every frame.
+
+struct DeferredDestroy
+{
+    uint64_t last_use_frame;
+    std::function<void()> destroy;
+};
+
+struct DeletionQueue
+{
+    std::mutex lock;                    // defer_destroy() may be called from any thread
+    std::vector<DeferredDestroy> pending;
+    uint64_t deferred;
+    uint64_t destroyed;
+};
+
+void init_deletion_queue(DeletionQueue* out_queue);
+void defer_destroy(DeletionQueue& queue, uint64_t last_use_frame, std::function<void()> const& destroy);
+// Runs the destroys of every object whose last frame is below frames_completed.
+void flush_deletion_queue(DeletionQueue& queue, uint64_t frames_completed);
+// Shutdown only, the device must be idle.
+void drain_deletion_queue(DeletionQueue& queue);
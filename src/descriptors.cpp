@@ -0,0 +1,422 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "deletion_queue.hpp"
+#include "descriptors.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "pipeline_cache.hpp"
+
+void create_descriptor_allocator(VkDevice device, DescriptorPoolRatio const* ratios, uint32_t ratio_count, uint32_t initial_sets, DescriptorAllocator* out_allocator)
+{
+    out_allocator->device = device;
+    out_allocator->ratios.assign(ratios, ratios + ratio_count);
+    out_allocator->sets_per_pool = std::max<uint32_t>(initial_sets, 1);
+    out_allocator->max_sets_per_pool = 4096;
+    out_allocator->current = VK_NULL_HANDLE;
+    out_allocator->ready_pools.clear();
+    out_allocator->full_pools.clear();
+    out_allocator->stats.pools = 0;
+    out_allocator->stats.sets = 0;
+    out_allocator->stats.resets = 0;
+}
+
+void destroy_descriptor_allocator(DescriptorAllocator& allocator)
+{
+    // Frees the sets with the pools.
+    if (allocator.current != VK_NULL_HANDLE)
+    {
+        allocator.full_pools.push_back(allocator.current);
+        allocator.current = VK_NULL_HANDLE;
+    }
+    for (size_t pidx = 0; pidx < allocator.full_pools.size(); ++pidx)
+    {
+        vkDestroyDescriptorPool(allocator.device, allocator.full_pools[pidx], host_allocator());
+    }
+    for (size_t pidx = 0; pidx < allocator.ready_pools.size(); ++pidx)
+    {
+        vkDestroyDescriptorPool(allocator.device, allocator.ready_pools[pidx], host_allocator());
+    }
+    allocator.full_pools.clear();
+    allocator.ready_pools.clear();
+}
+
+// Makes an empty pool current: a reset one when there is one, otherwise a new pool twice the size
+// of the last, so a scene that needs many sets ends up with few big pools.
+static VkResult next_pool(DescriptorAllocator& allocator)
+{
+    if (!allocator.ready_pools.empty())
+    {
+        allocator.current = allocator.ready_pools.back();
+        allocator.ready_pools.pop_back();
+        return VK_SUCCESS;
+    }
+    uint32_t set_count = allocator.sets_per_pool;
+    std::vector<VkDescriptorPoolSize> sizes(allocator.ratios.size());
+    for (size_t ridx = 0; ridx < allocator.ratios.size(); ++ridx)
+    {
+        sizes[ridx].type = allocator.ratios[ridx].type;
+        sizes[ridx].descriptorCount = std::max<uint32_t>(static_cast<uint32_t>(allocator.ratios[ridx].per_set * set_count), 1);
+    }
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = 0;    // no FREE_DESCRIPTOR_SET_BIT, sets only go back with the whole pool
+    pool_info.maxSets = set_count;
+    pool_info.poolSizeCount = static_cast<uint32_t>(sizes.size());
+    pool_info.pPoolSizes = sizes.data();
+    VK_THROW(vkCreateDescriptorPool(allocator.device, &pool_info, host_allocator(), &allocator.current));
+    allocator.sets_per_pool = std::min(set_count * 2, std::max(allocator.max_sets_per_pool, set_count));
+    allocator.stats.pools += 1;
+    return VK_SUCCESS;
+}
+
+VkResult allocate_descriptor_set(DescriptorAllocator& allocator, VkDescriptorSetLayout layout, VkDescriptorSet* out_set)
+{
+    if (allocator.current == VK_NULL_HANDLE)
+    {
+        VK_THROW(next_pool(allocator));
+    }
+    VkDescriptorSetAllocateInfo set_info = {};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.pNext = nullptr;
+    set_info.descriptorPool = allocator.current;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &layout;
+    VkResult allocated = vkAllocateDescriptorSets(allocator.device, &set_info, out_set);
+    if ((allocated == VK_ERROR_OUT_OF_POOL_MEMORY) || (allocated == VK_ERROR_FRAGMENTED_POOL))
+    {
+        // The current pool is done until the next reset, retry once in an empty one.
+        allocator.full_pools.push_back(allocator.current);
+        allocator.current = VK_NULL_HANDLE;
+        VK_THROW(next_pool(allocator));
+        set_info.descriptorPool = allocator.current;
+        allocated = vkAllocateDescriptorSets(allocator.device, &set_info, out_set);
+    }
+    if (allocated == VK_SUCCESS)
+    {
+        allocator.stats.sets += 1;
+    }
+    return allocated;
+}
+
+VkResult reset_descriptor_allocator(DescriptorAllocator& allocator)
+{
+    if (allocator.current != VK_NULL_HANDLE)
+    {
+        allocator.full_pools.push_back(allocator.current);
+        allocator.current = VK_NULL_HANDLE;
+    }
+    for (size_t pidx = 0; pidx < allocator.full_pools.size(); ++pidx)
+    {
+        VK_THROW(vkResetDescriptorPool(allocator.device, allocator.full_pools[pidx], 0));
+        allocator.ready_pools.push_back(allocator.full_pools[pidx]);
+    }
+    allocator.full_pools.clear();
+    allocator.stats.resets += 1;
+    return VK_SUCCESS;
+}
+
+void create_frame_descriptors(VkDevice device, DescriptorPoolRatio const* ratios, uint32_t ratio_count, uint32_t initial_sets, uint32_t frames_in_flight, FrameDescriptors* out_descriptors)
+{
+    out_descriptors->slots.resize(frames_in_flight);
+    for (uint32_t fidx = 0; fidx < frames_in_flight; ++fidx)
+    {
+        create_descriptor_allocator(device, ratios, ratio_count, initial_sets, &out_descriptors->slots[fidx]);
+    }
+    out_descriptors->slot = 0;
+}
+
+void destroy_frame_descriptors(FrameDescriptors& descriptors)
+{
+    for (size_t fidx = 0; fidx < descriptors.slots.size(); ++fidx)
+    {
+        destroy_descriptor_allocator(descriptors.slots[fidx]);
+    }
+    descriptors.slots.clear();
+}
+
+VkResult begin_frame_descriptors(FrameDescriptors& descriptors, uint32_t frame_idx)
+{
+    descriptors.slot = frame_idx;
+    return reset_descriptor_allocator(descriptors.slots[frame_idx]);
+}
+
+VkResult allocate_frame_descriptor_set(FrameDescriptors& descriptors, VkDescriptorSetLayout layout, VkDescriptorSet* out_set)
+{
+    return allocate_descriptor_set(descriptors.slots[descriptors.slot], layout, out_set);
+}
+
+void print_descriptor_stats(char const* name, DescriptorAllocator const& allocator)
+{
+    std::cout << name << ": " << allocator.stats.sets << " sets from " << allocator.stats.pools << " pools"
+              << " | " << allocator.stats.resets << " resets\n";
+}
+
+void print_frame_descriptor_stats(FrameDescriptors const& descriptors)
+{
+    DescriptorAllocatorStats total = {};
+    for (size_t fidx = 0; fidx < descriptors.slots.size(); ++fidx)
+    {
+        total.pools += descriptors.slots[fidx].stats.pools;
+        total.sets += descriptors.slots[fidx].stats.sets;
+        total.resets += descriptors.slots[fidx].stats.resets;
+    }
+    std::cout << "frame descriptors: " << total.sets << " sets from " << total.pools << " pools"
+              << " | " << total.resets << " resets\n";
+}
+
+void create_descriptor_layout_cache(VkDevice device, DescriptorLayoutCache* out_cache)
+{
+    out_cache->device = device;
+    out_cache->layouts.clear();
+    out_cache->hits = 0;
+    out_cache->misses = 0;
+}
+
+void destroy_descriptor_layout_cache(DescriptorLayoutCache& cache)
+{
+    for (std::unordered_map<uint64_t, DescriptorLayoutEntry>::iterator it = cache.layouts.begin(); it != cache.layouts.end(); ++it)
+    {
+        vkDestroyDescriptorSetLayout(cache.device, it->second.layout, host_allocator());
+    }
+    cache.layouts.clear();
+}
+
+VkResult get_descriptor_set_layout(DescriptorLayoutCache& cache, VkDescriptorSetLayoutCreateFlags flags, VkDescriptorSetLayoutBinding const* bindings,
+    uint32_t binding_count, uint32_t const* binding_flags, VkDescriptorSetLayout* out_layout)
+{
+    // Bindings in binding number order, the same set declared in another order is the same layout.
+    std::vector<uint32_t> order(binding_count);
+    for (uint32_t bidx = 0; bidx < binding_count; ++bidx)
+    {
+        order[bidx] = bidx;
+    }
+    std::sort(order.begin(), order.end(), [bindings](uint32_t a, uint32_t b) { return bindings[a].binding < bindings[b].binding; });
+    std::vector<uint32_t> key;
+    key.reserve(2 + 5 * binding_count);
+    key.push_back(flags);
+    key.push_back(binding_count);
+    for (uint32_t bidx = 0; bidx < binding_count; ++bidx)
+    {
+        VkDescriptorSetLayoutBinding const& binding = bindings[order[bidx]];
+        if (binding.pImmutableSamplers != nullptr)
+        {
+            return VK_ERROR_FEATURE_NOT_PRESENT;
+        }
+        key.push_back(binding.binding);
+        key.push_back(binding.descriptorType);
+        key.push_back(binding.descriptorCount);
+        key.push_back(binding.stageFlags);
+        key.push_back((binding_flags != nullptr) ? binding_flags[order[bidx]] : 0);
+    }
+
+    size_t key_size = key.size() * sizeof(uint32_t);
+    uint64_t hash = hash_bytes(key.data(), key_size);
+    std::unordered_map<uint64_t, DescriptorLayoutEntry>::iterator it = cache.layouts.find(hash);
+    while ((it != cache.layouts.end()) && (it->second.key != key))
+    {
+        // Collision, probe the next key.
+        it = cache.layouts.find(++hash);
+    }
+    if (it != cache.layouts.end())
+    {
+        cache.hits += 1;
+        *out_layout = it->second.layout;
+        return VK_SUCCESS;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.pNext = nullptr;
+    layout_info.flags = flags;
+    layout_info.bindingCount = binding_count;
+    layout_info.pBindings = bindings;
+    if (binding_flags != nullptr)
+    {
+#ifdef VK_EXT_descriptor_indexing
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flags_info = {};
+        flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        flags_info.pNext = nullptr;
+        flags_info.bindingCount = binding_count;
+        flags_info.pBindingFlags = binding_flags;
+        layout_info.pNext = &flags_info;
+        VK_THROW(vkCreateDescriptorSetLayout(cache.device, &layout_info, host_allocator(), out_layout));
+#else
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+#endif
+    }
+    else
+    {
+        VK_THROW(vkCreateDescriptorSetLayout(cache.device, &layout_info, host_allocator(), out_layout));
+    }
+    DescriptorLayoutEntry entry;
+    entry.layout = *out_layout;
+    entry.key.swap(key);
+    cache.layouts[hash] = entry;
+    cache.misses += 1;
+    return VK_SUCCESS;
+}
+
+VkResult create_bindless_table(VkDevice device, DescriptorLayoutCache& layouts, VkPhysicalDeviceLimits const& limits, bool descriptor_indexing,
+    uint32_t texture_capacity, uint32_t buffer_capacity, BindlessTable* out_table)
+{
+    out_table->device = device;
+    out_table->layout = VK_NULL_HANDLE;
+    out_table->pool = VK_NULL_HANDLE;
+    out_table->set = VK_NULL_HANDLE;
+    for (uint32_t bidx = 0; bidx < BINDLESS_BINDING_COUNT; ++bidx)
+    {
+        out_table->capacity[bidx] = 0;
+        out_table->next_index[bidx] = 0;
+        out_table->free_indices[bidx].clear();
+        out_table->live[bidx] = 0;
+    }
+#ifdef VK_EXT_descriptor_indexing
+    if (!descriptor_indexing)
+    {
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+    // The update-after-bind limits need a properties2 query, the core ones are a safe lower bound.
+    texture_capacity = std::min(texture_capacity, std::min(limits.maxPerStageDescriptorSampledImages, limits.maxPerStageDescriptorSamplers));
+    texture_capacity = std::min(texture_capacity, std::min(limits.maxDescriptorSetSampledImages, limits.maxDescriptorSetSamplers));
+    buffer_capacity = std::min(buffer_capacity, std::min(limits.maxPerStageDescriptorStorageBuffers, limits.maxDescriptorSetStorageBuffers));
+    out_table->capacity[BINDLESS_TEXTURES] = texture_capacity;
+    out_table->capacity[BINDLESS_BUFFERS] = buffer_capacity;
+
+    VkDescriptorSetLayoutBinding bindings[BINDLESS_BINDING_COUNT] = {};
+    bindings[BINDLESS_TEXTURES].binding = BINDLESS_TEXTURES;
+    bindings[BINDLESS_TEXTURES].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[BINDLESS_TEXTURES].descriptorCount = texture_capacity;
+    bindings[BINDLESS_TEXTURES].stageFlags = VK_SHADER_STAGE_ALL;
+    bindings[BINDLESS_TEXTURES].pImmutableSamplers = nullptr;
+    bindings[BINDLESS_BUFFERS].binding = BINDLESS_BUFFERS;
+    bindings[BINDLESS_BUFFERS].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[BINDLESS_BUFFERS].descriptorCount = buffer_capacity;
+    bindings[BINDLESS_BUFFERS].stageFlags = VK_SHADER_STAGE_ALL;
+    bindings[BINDLESS_BUFFERS].pImmutableSamplers = nullptr;
+    // Unused entries stay unwritten, and entries no pending frame reads are rewritten in flight.
+    uint32_t const binding_flags[BINDLESS_BINDING_COUNT] = {
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT,
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT
+    };
+    VK_THROW(get_descriptor_set_layout(layouts, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT, bindings, BINDLESS_BINDING_COUNT,
+        binding_flags, &out_table->layout));
+
+    VkDescriptorPoolSize pool_sizes[BINDLESS_BINDING_COUNT] = {
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texture_capacity },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffer_capacity }
+    };
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = BINDLESS_BINDING_COUNT;
+    pool_info.pPoolSizes = pool_sizes;
+    VK_THROW(vkCreateDescriptorPool(device, &pool_info, host_allocator(), &out_table->pool));
+
+    VkDescriptorSetAllocateInfo set_info = {};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.pNext = nullptr;
+    set_info.descriptorPool = out_table->pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &out_table->layout;
+    VK_THROW(vkAllocateDescriptorSets(device, &set_info, &out_table->set));
+    return VK_SUCCESS;
+#else
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+#endif
+}
+
+void destroy_bindless_table(BindlessTable& table)
+{
+    vkDestroyDescriptorPool(table.device, table.pool, host_allocator());
+    table.pool = VK_NULL_HANDLE;
+    table.set = VK_NULL_HANDLE;
+}
+
+// Lock held.
+static uint32_t take_index(BindlessTable& table, BindlessBinding binding)
+{
+    std::vector<uint32_t>& free_indices = table.free_indices[binding];
+    if (!free_indices.empty())
+    {
+        uint32_t index = free_indices.back();
+        free_indices.pop_back();
+        return index;
+    }
+    if (table.next_index[binding] < table.capacity[binding])
+    {
+        return table.next_index[binding]++;
+    }
+    return UINT32_MAX;
+}
+
+uint32_t register_bindless_texture(BindlessTable& table, VkImageView view, VkSampler sampler, VkImageLayout layout)
+{
+    std::lock_guard<std::mutex> guard(table.lock);
+    uint32_t index = take_index(table, BINDLESS_TEXTURES);
+    if (index == UINT32_MAX)
+    {
+        return UINT32_MAX;
+    }
+    VkDescriptorImageInfo image_info = { sampler, view, layout };
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = table.set;
+    write.dstBinding = BINDLESS_TEXTURES;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image_info;
+    // The set is shared, writes to it are serialized by the lock.
+    vkUpdateDescriptorSets(table.device, 1, &write, 0, nullptr);
+    table.live[BINDLESS_TEXTURES] += 1;
+    return index;
+}
+
+uint32_t register_bindless_buffer(BindlessTable& table, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    std::lock_guard<std::mutex> guard(table.lock);
+    uint32_t index = take_index(table, BINDLESS_BUFFERS);
+    if (index == UINT32_MAX)
+    {
+        return UINT32_MAX;
+    }
+    VkDescriptorBufferInfo buffer_info = { buffer, offset, range };
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = table.set;
+    write.dstBinding = BINDLESS_BUFFERS;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(table.device, 1, &write, 0, nullptr);
+    table.live[BINDLESS_BUFFERS] += 1;
+    return index;
+}
+
+void release_bindless(BindlessTable& table, BindlessBinding binding, uint32_t index, DeletionQueue& queue, uint64_t last_use_frame)
+{
+    BindlessTable* owner = &table;
+    defer_destroy(queue, last_use_frame, [owner, binding, index]()
+    {
+        std::lock_guard<std::mutex> guard(owner->lock);
+        owner->free_indices[binding].push_back(index);
+        owner->live[binding] -= 1;
+    });
+}
+
+void print_bindless_stats(BindlessTable const& table)
+{
+    std::cout << "bindless: " << table.live[BINDLESS_TEXTURES] << " of " << table.capacity[BINDLESS_TEXTURES] << " textures"
+              << " | " << table.live[BINDLESS_BUFFERS] << " of " << table.capacity[BINDLESS_BUFFERS] << " buffers\n";
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct DeletionQueue;
+
+// Descriptor sets come from a growable list of pools and are never freed one by one: a pool that
+// runs out is put aside and a bigger one is created, reset_descriptor_allocator() hands every set
+// back at once. Long lived sets use an allocator that is never reset, per-frame sets one
+// allocator per frame slot (FrameDescriptors).
+struct DescriptorPoolRatio
+{
+    VkDescriptorType type;
+    float per_set;                  // descriptors of type reserved for every set of a pool
+};
+
+struct DescriptorAllocatorStats
+{
+    uint32_t pools;                 // created so far
+    uint64_t sets;                  // allocated since creation
+    uint32_t resets;
+};
+
+struct DescriptorAllocator
+{
+    VkDevice device;
+    std::vector<DescriptorPoolRatio> ratios;
+    uint32_t sets_per_pool;         // of the next pool, doubles up to max_sets_per_pool
+    uint32_t max_sets_per_pool;
+    VkDescriptorPool current;       // VK_NULL_HANDLE until the first allocation
+    std::vector<VkDescriptorPool> ready_pools;  // empty, reused before creating new ones
+    std::vector<VkDescriptorPool> full_pools;
+    DescriptorAllocatorStats stats;
+};
+
+// ratios sizes every pool, a type missing from it can't be allocated.
+void create_descriptor_allocator(VkDevice device, DescriptorPoolRatio const* ratios, uint32_t ratio_count, uint32_t initial_sets, DescriptorAllocator* out_allocator);
+void destroy_descriptor_allocator(DescriptorAllocator& allocator);
+VkResult allocate_descriptor_set(DescriptorAllocator& allocator, VkDescriptorSetLayout layout, VkDescriptorSet* out_set);
+// Frees every set of the allocator, the GPU must be done with all of them.
+VkResult reset_descriptor_allocator(DescriptorAllocator& allocator);
+
+struct FrameDescriptors
+{
+    std::vector<DescriptorAllocator> slots;
+    uint32_t slot;
+};
+
+void create_frame_descriptors(VkDevice device, DescriptorPoolRatio const* ratios, uint32_t ratio_count, uint32_t initial_sets, uint32_t frames_in_flight, FrameDescriptors* out_descriptors);
+void destroy_frame_descriptors(FrameDescriptors& descriptors);
+// Call once the fence of frame_idx has been waited on, resets the pools of the slot in bulk.
+VkResult begin_frame_descriptors(FrameDescriptors& descriptors, uint32_t frame_idx);
+// Valid until begin_frame_descriptors() runs again for the same slot.
+VkResult allocate_frame_descriptor_set(FrameDescriptors& descriptors, VkDescriptorSetLayout layout, VkDescriptorSet* out_set);
+
+void print_descriptor_stats(char const* name, DescriptorAllocator const& allocator);
+void print_frame_descriptor_stats(FrameDescriptors const& descriptors);
+
+// Set layouts keyed by a hash of their bindings, asking twice for the same bindings returns the
+// same layout. Layouts live until the cache is destroyed. Immutable samplers are not supported.
+struct DescriptorLayoutEntry
+{
+    VkDescriptorSetLayout layout;
+    std::vector<uint32_t> key;      // compared on hit, a hash collision must not alias two layouts
+};
+
+struct DescriptorLayoutCache
+{
+    VkDevice device;
+    std::unordered_map<uint64_t, DescriptorLayoutEntry> layouts;
+    uint32_t hits;
+    uint32_t misses;
+};
+
+void create_descriptor_layout_cache(VkDevice device, DescriptorLayoutCache* out_cache);
+void destroy_descriptor_layout_cache(DescriptorLayoutCache& cache);
+// binding_flags is nullptr or one VkDescriptorBindingFlagsEXT per binding.
+VkResult get_descriptor_set_layout(DescriptorLayoutCache& cache, VkDescriptorSetLayoutCreateFlags flags, VkDescriptorSetLayoutBinding const* bindings,
+    uint32_t binding_count, uint32_t const* binding_flags, VkDescriptorSetLayout* out_layout);
+
+// Bindless: one update-after-bind set holding every texture and storage buffer in two big
+// partially bound arrays. Shaders index them with an integer from push constants or a material
+// buffer, the set is bound once per command buffer. Needs VK_EXT_descriptor_indexing
+// (DrawCommandBuffer::descriptor_indexing); descriptors are written while the set is bound.
+enum BindlessBinding
+{
+    BINDLESS_TEXTURES,              // combined image samplers, set 0 binding 0
+    BINDLESS_BUFFERS,               // storage buffers, set 0 binding 1
+    BINDLESS_BINDING_COUNT
+};
+
+struct BindlessTable
+{
+    VkDevice device;
+    VkDescriptorSetLayout layout;   // owned by the layout cache
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    std::mutex lock;                // indices may be registered and released from any thread
+    uint32_t capacity[BINDLESS_BINDING_COUNT];
+    uint32_t next_index[BINDLESS_BINDING_COUNT];     // never used above this
+    std::vector<uint32_t> free_indices[BINDLESS_BINDING_COUNT];
+    uint32_t live[BINDLESS_BINDING_COUNT];
+};
+
+// Capacities are clamped to the device limits. VK_ERROR_FEATURE_NOT_PRESENT without descriptor indexing.
+VkResult create_bindless_table(VkDevice device, DescriptorLayoutCache& layouts, VkPhysicalDeviceLimits const& limits, bool descriptor_indexing,
+    uint32_t texture_capacity, uint32_t buffer_capacity, BindlessTable* out_table);
+void destroy_bindless_table(BindlessTable& table);
+// Return the array index to hand to shaders, UINT32_MAX when the array is full.
+uint32_t register_bindless_texture(BindlessTable& table, VkImageView view, VkSampler sampler, VkImageLayout layout);
+uint32_t register_bindless_buffer(BindlessTable& table, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+// The index is reused once last_use_frame has finished on the GPU, queue is the frame loop's.
+void release_bindless(BindlessTable& table, BindlessBinding binding, uint32_t index, DeletionQueue& queue, uint64_t last_use_frame);
+void print_bindless_stats(BindlessTable const& table);
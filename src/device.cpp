@@ -0,0 +1,478 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "device.hpp"
+#include "device_select.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "handles.hpp"
+#include "host_allocator.hpp"
+#include "platform.hpp"
+#include "swap_chain.hpp"
+#include "tools.hpp"
+
+bool has_instance_extension(char const* name)
+{
+    uint32_t extension_count = 0;
+    if (vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, nullptr) != VK_SUCCESS)
+    {
+        return false;
+    }
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    if (vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, extensions.data()) != VK_SUCCESS)
+    {
+        return false;
+    }
+    for (uint32_t eidx = 0; eidx < extension_count; ++eidx)
+    {
+        if (strcmp(extensions[eidx].extensionName, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool has_device_extension(VkPhysicalDevice gpu, char const* name)
+{
+    uint32_t extension_count = 0;
+    if (vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extension_count, nullptr) != VK_SUCCESS)
+    {
+        return false;
+    }
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    if (vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extension_count, extensions.data()) != VK_SUCCESS)
+    {
+        return false;
+    }
+    for (uint32_t eidx = 0; eidx < extension_count; ++eidx)
+    {
+        if (strcmp(extensions[eidx].extensionName, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+VkResult create_device(VkPhysicalDevice gpu, uint32_t const* queue_families, uint32_t family_count, std::vector<char const*> const& extensions, VkPhysicalDeviceFeatures const* enabled_features, void const* feature_chain, VkDevice* out_device)
+{
+    const float queuePriority = 1.0f;
+    std::vector<VkDeviceQueueCreateInfo> requested_queues;
+    for (uint32_t fidx = 0; fidx < family_count; ++fidx)
+    {
+        bool duplicate = false;
+        for (size_t ridx = 0; ridx < requested_queues.size(); ++ridx)
+        {
+            duplicate = duplicate || (requested_queues[ridx].queueFamilyIndex == queue_families[fidx]);
+        }
+        if (duplicate)
+        {
+            continue;
+        }
+        VkDeviceQueueCreateInfo queue_info = {};
+        queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_info.pNext = nullptr;
+        queue_info.flags = 0;
+        queue_info.queueFamilyIndex = queue_families[fidx];
+        queue_info.queueCount = 1;
+        queue_info.pQueuePriorities = &queuePriority;
+        requested_queues.push_back(queue_info);
+    }
+
+    VkDeviceCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    info.pNext = feature_chain;
+    info.flags = 0;
+    info.queueCreateInfoCount = static_cast<uint32_t>(requested_queues.size());
+    info.pQueueCreateInfos = requested_queues.data();
+    info.enabledLayerCount = 0;
+    info.ppEnabledLayerNames = nullptr;
+    info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    info.ppEnabledExtensionNames = extensions.empty() ? nullptr : extensions.data();
+    info.pEnabledFeatures = enabled_features;
+    VK_THROW(vkCreateDevice(gpu, &info, host_allocator(), out_device));
+    return VK_SUCCESS;
+}
+
+uint32_t find_queue_family(std::vector<VkQueueFamilyProperties> const& properties, VkQueueFlags required, VkQueueFlags excluded)
+{
+    for (uint32_t qidx = 0; qidx < properties.size(); ++qidx)
+    {
+        VkQueueFlags flags = properties[qidx].queueFlags;
+        if (check_flag(flags, required) && ((flags & excluded) == 0) && (properties[qidx].queueCount > 0))
+        {
+            return qidx;
+        }
+    }
+    return UINT32_MAX;
+}
+
+VkResult select_surface_format(SwapChain* out_swap_chain)
+{
+    VkPhysicalDevice gpu = out_swap_chain->gpu;
+    uint32_t format_count;
+    VK_THROW(vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, out_swap_chain->surface, &format_count, NULL));
+
+    std::vector<VkSurfaceFormatKHR> surface_formats(format_count);
+    VK_THROW(vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, out_swap_chain->surface, &format_count, surface_formats.data()));
+
+    // If the format list includes just one entry of VK_FORMAT_UNDEFINED,
+    // the surface has no preferred format. Otherwise, at least one
+    // supported format will be returned
+    if (format_count == 1 && surface_formats[0].format == VK_FORMAT_UNDEFINED)
+    {
+        out_swap_chain->surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
+        out_swap_chain->surface_format.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+    }
+    else
+    {
+        assert(format_count > 0);
+        out_swap_chain->surface_format = surface_formats[0];
+    }
+    return VK_SUCCESS;
+}
+
+VkResult create_surface(VkInstance vk_instance, DeviceCandidate const& candidate, VkDevice* out_device, DrawCommandBuffer* out_draw_command_buffer, SwapChain* out_swap_chain)
+{
+    if ((out_swap_chain == nullptr) || (out_draw_command_buffer == nullptr))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    VkPhysicalDevice gpu = candidate.gpu;
+    DeviceCapabilities const& capabilities = candidate.capabilities;
+    switch (out_swap_chain->mode)
+    {
+    case SWAP_CHAIN_WINDOW:
+        if (out_swap_chain->window == nullptr)
+        {
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        VK_THROW(create_window_surface(vk_instance, *out_swap_chain->window, &(out_swap_chain->surface)));
+        break;
+#ifdef VK_EXT_headless_surface
+    case SWAP_CHAIN_HEADLESS_SURFACE:
+    {
+        VkHeadlessSurfaceCreateInfoEXT surfaceCreateInfo = {};
+        surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+        surfaceCreateInfo.pNext = nullptr;
+        surfaceCreateInfo.flags = 0;
+        PFN_vkCreateHeadlessSurfaceEXT create_headless_surface = (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(vk_instance, "vkCreateHeadlessSurfaceEXT");
+        if (create_headless_surface == nullptr)
+        {
+            return VK_ERROR_EXTENSION_NOT_PRESENT;
+        }
+        VK_THROW(create_headless_surface(vk_instance, &surfaceCreateInfo, host_allocator(), &(out_swap_chain->surface)));
+        track_handle(HANDLE_SURFACE, 1);
+        break;
+    }
+#endif
+    case SWAP_CHAIN_OFFSCREEN:
+        out_swap_chain->surface = VK_NULL_HANDLE;
+        break;
+    default:
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+    }
+    bool offscreen = (out_swap_chain->mode == SWAP_CHAIN_OFFSCREEN);
+
+
+    uint32_t queue_count = capabilities.queue_family_count;
+    assert(queue_count > 0);
+    std::vector<VkBool32> support_presentable_swap_chain(queue_count);
+    std::vector<VkQueueFamilyProperties> properties(capabilities.queue_families, capabilities.queue_families + queue_count);
+
+    for (uint32_t qidx = 0; qidx < queue_count; ++qidx)
+    {
+        if (offscreen)
+        {
+            // Nothing is presented, "present" only needs to reach the images we render to.
+            support_presentable_swap_chain[qidx] = check_flag(properties[qidx].queueFlags, VK_QUEUE_GRAPHICS_BIT);
+        }
+        else
+        {
+            vkGetPhysicalDeviceSurfaceSupportKHR(gpu, qidx, out_swap_chain->surface, &(support_presentable_swap_chain[qidx]));
+        }
+    }
+    uint32_t graphics_queue = UINT32_MAX;
+    uint32_t swap_chain_queue = UINT32_MAX;
+    for (uint32_t qidx = 0; qidx < queue_count; ++qidx)
+    {
+        if (check_flag(properties[qidx].queueFlags, VK_QUEUE_GRAPHICS_BIT) && properties[qidx].queueCount > 0)
+        {
+            graphics_queue = qidx;
+            if (support_presentable_swap_chain[qidx])
+            {
+                swap_chain_queue = qidx;
+                break;
+            }
+        }
+    }
+    if (swap_chain_queue == UINT32_MAX)   // Can't find a graphic queue that also support swap chain. Select two different queue.
+    {
+        for (uint32_t qidx = 0; qidx < queue_count; ++qidx)
+        {
+            if (support_presentable_swap_chain[qidx] && (properties[qidx].queueCount > 0))
+            {
+                swap_chain_queue = qidx;
+                break;
+            }
+        }
+    }
+
+    // Generate error if could not find both a graphics and a present queue
+    if ((graphics_queue == UINT32_MAX) || (swap_chain_queue == UINT32_MAX) || (!offscreen && !check_flag(capabilities.extensions, DEVICE_EXTENSION_SWAPCHAIN)))
+    {
+        if (!offscreen)
+        {
+            vkDestroySurfaceKHR(vk_instance, out_swap_chain->surface, host_allocator());
+        }
+        out_swap_chain->surface = VK_NULL_HANDLE;
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    out_swap_chain->gpu = gpu;
+    if (offscreen)
+    {
+        // We pick the format, B8G8R8A8 is what most presentable surfaces hand out.
+        out_swap_chain->surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
+        out_swap_chain->surface_format.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+    }
+    else
+    {
+        VK_THROW(select_surface_format(out_swap_chain));
+    }
+
+    // Transfer-only families are the DMA engines, graphics and compute families can transfer
+    // too but copies there compete with rendering.
+    uint32_t transfer_queue = find_queue_family(properties, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+    uint32_t compute_queue = find_queue_family(properties, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+    if (transfer_queue == UINT32_MAX)
+    {
+        transfer_queue = (compute_queue != UINT32_MAX) ? compute_queue : graphics_queue;
+    }
+    if (compute_queue == UINT32_MAX)
+    {
+        compute_queue = graphics_queue;
+    }
+
+    // Only what we use: pipeline statistics feed the profiler, the indirect features GPU culling.
+    VkPhysicalDeviceFeatures const& supported_features = capabilities.features;
+    VkPhysicalDeviceFeatures enabled_features = {};
+    enabled_features.pipelineStatisticsQuery = supported_features.pipelineStatisticsQuery;
+    enabled_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+    enabled_features.drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance;
+
+    std::vector<char const*> device_extensions;
+    if (!offscreen)
+    {
+        device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+    bool draw_indirect_count = false;
+#ifdef VK_KHR_draw_indirect_count
+    if (check_flag(capabilities.extensions, DEVICE_EXTENSION_DRAW_INDIRECT_COUNT))
+    {
+        device_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        draw_indirect_count = true;
+    }
+#endif
+    bool memory_budget = false;
+#if defined(VK_EXT_memory_budget) && defined(VK_KHR_get_physical_device_properties2)
+    // Heap budgets for texture streaming, queried through VK_KHR_get_physical_device_properties2.
+    if ((vkGetPhysicalDeviceMemoryProperties2KHR != nullptr) && check_flag(capabilities.extensions, DEVICE_EXTENSION_MEMORY_BUDGET))
+    {
+        device_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        memory_budget = true;
+    }
+#endif
+    void const* feature_chain = nullptr;
+    bool descriptor_indexing = false;
+#if defined(VK_EXT_descriptor_indexing) && defined(VK_KHR_maintenance3)
+    // What BindlessTable needs, see query_device_capabilities(). The extension depends on
+    // VK_KHR_maintenance3, without it there is no bindless.
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+    descriptor_indexing = (capabilities.bindless_indexing != VK_FALSE) && check_flag(capabilities.extensions, DEVICE_EXTENSION_MAINTENANCE3);
+    if (descriptor_indexing)
+    {
+        indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        indexing_features.pNext = nullptr;
+        indexing_features.runtimeDescriptorArray = VK_TRUE;
+        indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+        indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexing_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        indexing_features.shaderStorageBufferArrayNonUniformIndexing = capabilities.storage_buffer_non_uniform;
+        device_extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        device_extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        feature_chain = &indexing_features;
+    }
+#endif
+
+    uint32_t const queue_families[] = { graphics_queue, swap_chain_queue, transfer_queue, compute_queue };
+    VK_THROW(create_device(gpu, queue_families, 4, device_extensions, &enabled_features, feature_chain, out_device));
+    load_device_dispatch(*out_device, &out_draw_command_buffer->dispatch);
+    if (!use_device_dispatch(out_draw_command_buffer->dispatch))
+    {
+        // The global pointers belong to another device, this one is destroyed through its own table.
+        out_draw_command_buffer->dispatch.vkDestroyDevice(*out_device, host_allocator());
+        track_handle(HANDLE_DEVICE, -1);
+        *out_device = VK_NULL_HANDLE;
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    vkGetDeviceQueue(*out_device, graphics_queue, 0, &out_draw_command_buffer->draw_queue);
+    vkGetDeviceQueue(*out_device, swap_chain_queue, 0, &out_swap_chain->present_queue);
+    vkGetDeviceQueue(*out_device, transfer_queue, 0, &out_draw_command_buffer->transfer_queue);
+    vkGetDeviceQueue(*out_device, compute_queue, 0, &out_draw_command_buffer->compute_queue);
+    out_draw_command_buffer->queue_family_idx = graphics_queue;
+    out_draw_command_buffer->transfer_family_idx = transfer_queue;
+    out_draw_command_buffer->transfer_granularity = properties[transfer_queue].minImageTransferGranularity;
+    out_draw_command_buffer->compute_family_idx = compute_queue;
+    out_draw_command_buffer->timestamp_valid_bits = properties[graphics_queue].timestampValidBits;
+    out_draw_command_buffer->enabled_features = enabled_features;
+    out_draw_command_buffer->descriptor_indexing = descriptor_indexing;
+    out_draw_command_buffer->draw_indirect_count = draw_indirect_count;
+    out_draw_command_buffer->memory_budget = memory_budget;
+    out_swap_chain->queue_family_idx = swap_chain_queue;
+
+    std::cout << "Queue families: graphics " << graphics_queue << ", present " << swap_chain_queue
+              << ", transfer " << transfer_queue << ", compute " << compute_queue << "\n";
+
+    return VK_SUCCESS;
+}
+
+VkResult init_Vulkan(VkInstance& vk_instance, DeviceSelection& selection, VkDevice* out_device, DrawCommandBuffer* out_draw_command_buffer, SwapChain* out_swap_chain)
+{
+    if ((out_device == nullptr) || (out_swap_chain == nullptr))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if (!load_vulkan_library())
+    {
+        std::cout << "Unable to load the Vulkan library\n";
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    VkApplicationInfo app_info = {};
+    app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app_info.pNext = nullptr;
+    app_info.pApplicationName = "VT Test";
+    app_info.applicationVersion = 0x00000001;
+    app_info.pEngineName = "Noengine";
+    app_info.engineVersion = 0x00;
+    app_info.apiVersion = VK_MAKE_VERSION(1, 0, 2);
+
+    std::vector<const char *> enabledExtensions;
+#ifdef VK_EXT_headless_surface
+    if ((out_swap_chain->mode == SWAP_CHAIN_HEADLESS_SURFACE) && !has_instance_extension(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME))
+#else
+    if (out_swap_chain->mode == SWAP_CHAIN_HEADLESS_SURFACE)
+#endif
+    {
+        // The driver can't give us a headless surface, render into our own images instead.
+        out_swap_chain->mode = SWAP_CHAIN_OFFSCREEN;
+    }
+    switch (out_swap_chain->mode)
+    {
+    case SWAP_CHAIN_WINDOW:
+        enabledExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        if (window_surface_extension() != nullptr)
+        {
+            enabledExtensions.push_back(window_surface_extension());
+        }
+        break;
+#ifdef VK_EXT_headless_surface
+    case SWAP_CHAIN_HEADLESS_SURFACE:
+        enabledExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        enabledExtensions.push_back(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+        break;
+#endif
+    default:
+        break;
+    }
+#ifdef VK_KHR_get_physical_device_properties2
+    // Extended feature queries, descriptor indexing is only detected through them.
+    bool properties2 = has_instance_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if (properties2)
+    {
+        enabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+    selection.properties2 = properties2;
+#endif
+#if defined(VK_KHR_external_memory_capabilities) && defined(VK_KHR_get_physical_device_properties2)
+    // Device UUIDs for --gpu, they come with the external memory capabilities.
+    selection.device_ids = properties2 && has_instance_extension(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+    if (selection.device_ids)
+    {
+        enabledExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+    }
+#endif
+
+    VkInstanceCreateInfo instance_info = {};
+    instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instance_info.pNext = nullptr;
+    instance_info.flags = 0;
+    instance_info.pApplicationInfo = &app_info;
+    instance_info.enabledLayerCount = 0;
+    instance_info.ppEnabledLayerNames = nullptr;
+    instance_info.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+    instance_info.ppEnabledExtensionNames = enabledExtensions.empty() ? nullptr : enabledExtensions.data();
+
+    VK_THROW(vkCreateInstance(&instance_info, host_allocator(), &vk_instance)); // Create Vulkan library instance
+    load_instance_functions(vk_instance);
+#ifdef VK_KHR_get_physical_device_properties2
+    if (!properties2)
+    {
+        // The loader may hand out a trampoline for an extension that is not enabled.
+        vkGetPhysicalDeviceFeatures2KHR = nullptr;
+        vkGetPhysicalDeviceProperties2KHR = nullptr;
+        vkGetPhysicalDeviceMemoryProperties2KHR = nullptr;
+    }
+#endif
+
+    std::cout << "Swap chain mode: " << swap_chain_mode_name(out_swap_chain->mode) << "\n";
+
+    // Best device first; a profile hit that can't drive this swap chain mode falls back to the full query.
+    std::vector<DeviceCandidate> candidates;
+    VK_THROW(select_physical_devices(vk_instance, selection, selection.load_profile, &candidates));
+    for (uint32_t attempt = 0; attempt < 2; ++attempt)
+    {
+        for (size_t cidx = 0; cidx < candidates.size(); ++cidx)
+        {
+            if (create_surface(vk_instance, candidates[cidx], out_device, out_draw_command_buffer, out_swap_chain) == VK_SUCCESS)
+            {
+                out_draw_command_buffer->gpu_properties = candidates[cidx].capabilities.properties;
+                print_device_selection(selection, candidates[cidx]);
+                save_device_profile(selection, candidates[cidx]);
+                return VK_SUCCESS;
+            }
+            // The next candidate creates its own surface.
+            if (out_swap_chain->surface != VK_NULL_HANDLE)
+            {
+                vkDestroySurfaceKHR(vk_instance, out_swap_chain->surface, host_allocator());
+                out_swap_chain->surface = VK_NULL_HANDLE;
+            }
+        }
+        if (!selection.profile_hit)
+        {
+            break;
+        }
+        VK_THROW(select_physical_devices(vk_instance, selection, false, &candidates));
+        selection.profile_reject_reason = "the device failed to start";
+    }
+    return VK_ERROR_INITIALIZATION_FAILED;
+}
+
+VkResult create_command_pool(VkDevice device, uint32_t queue_family_idx, VkCommandPool* out_command_pool)
+{
+    VkCommandPoolCreateInfo command_pool_info = {};
+    command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    command_pool_info.pNext = nullptr;
+    command_pool_info.queueFamilyIndex = queue_family_idx;
+    command_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    return vkCreateCommandPool(device, &command_pool_info, host_allocator(), out_command_pool);
+}
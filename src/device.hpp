@@ -0,0 +1,50 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "dispatch.hpp"
+
+struct DeviceCandidate;
+struct DeviceSelection;
+struct SwapChain;
+
+struct DrawCommandBuffer
+{
+    VkQueue draw_queue;
+    uint32_t queue_family_idx;
+
+    // Dedicated transfer-only / async compute families when the device exposes them, otherwise
+    // the best family that can do the job (the graphics one at worst, then the queues alias).
+    VkQueue transfer_queue;
+    uint32_t transfer_family_idx;
+    VkExtent3D transfer_granularity;    // minImageTransferGranularity of the transfer family
+    VkQueue compute_queue;
+    uint32_t compute_family_idx;
+
+    uint32_t timestamp_valid_bits;      // of the graphics family, 0 when it can't write timestamps
+
+    VkPhysicalDeviceProperties gpu_properties;  // of the device init_Vulkan() picked
+    VkPhysicalDeviceFeatures enabled_features;
+    bool descriptor_indexing;   // VK_EXT_descriptor_indexing enabled with what BindlessTable needs
+    bool draw_indirect_count;   // VK_KHR_draw_indirect_count enabled
+    bool memory_budget;         // VK_EXT_memory_budget enabled, see get_memory_budget()
+    DeviceDispatch dispatch;    // the global device functions point at these
+};
+
+bool has_instance_extension(char const* name);
+bool has_device_extension(VkPhysicalDevice gpu, char const* name);
+// One queue is created for every distinct family in queue_families. feature_chain is the pNext
+// chain of extension feature structs, nullptr when there is none.
+VkResult create_device(VkPhysicalDevice gpu, uint32_t const* queue_families, uint32_t family_count, std::vector<char const*> const& extensions, VkPhysicalDeviceFeatures const* enabled_features, void const* feature_chain, VkDevice* out_device);
+// Family with all of required and none of excluded set, UINT32_MAX when there is none.
+uint32_t find_queue_family(std::vector<VkQueueFamilyProperties> const& properties, VkQueueFlags required, VkQueueFlags excluded);
+VkResult select_surface_format(SwapChain* out_swap_chain);
+VkResult create_surface(VkInstance vk_instance, DeviceCandidate const& candidate, VkDevice* out_device, DrawCommandBuffer* out_draw_command_buffer, SwapChain* out_swap_chain);
+
+// out_swap_chain->mode selects the presentation backend, see init_swap_chain(). The device is
+// picked as selection says, see device_select.hpp.
+VkResult init_Vulkan(VkInstance& vk_instance, DeviceSelection& selection, VkDevice* out_device, DrawCommandBuffer* out_draw_command_buffer, SwapChain* out_swap_chain);
+VkResult create_command_pool(VkDevice device, uint32_t queue_family_idx, VkCommandPool* out_command_pool);
@@ -0,0 +1,1010 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "tools.hpp"
+
+static const uint32_t NO_CHUNK = UINT32_MAX;
+static const VkDeviceSize MIN_SPLIT_SIZE = 256;    // smaller tails stay attached to the allocation
+
+static uint32_t count_bits(uint32_t v)
+{
+    uint32_t count = 0;
+    for (; v != 0; v &= v - 1)
+    {
+        ++count;
+    }
+    return count;
+}
+
+static uint32_t lowest_bit(uint32_t v)
+{
+    assert(v != 0);
+    uint32_t idx = 0;
+    while ((v & 1) == 0)
+    {
+        v >>= 1;
+        ++idx;
+    }
+    return idx;
+}
+
+static uint32_t highest_bit(VkDeviceSize v)
+{
+    assert(v != 0);
+    uint32_t idx = 0;
+    while (v >>= 1)
+    {
+        ++idx;
+    }
+    return idx;
+}
+
+static VkDeviceSize align_up(VkDeviceSize v, VkDeviceSize alignment)
+{
+    return (alignment > 1) ? ((v + alignment - 1) / alignment) * alignment : v;
+}
+
+// --- TLSF -----------------------------------------------------------------------------------
+
+static void tlsf_mapping(VkDeviceSize size, uint32_t* fl, uint32_t* sl)
+{
+    if (size < (VkDeviceSize(1) << TLSF_FL_SHIFT))
+    {
+        *fl = 0;
+        *sl = static_cast<uint32_t>(size >> (TLSF_FL_SHIFT - TLSF_SL_LOG2));
+    }
+    else
+    {
+        uint32_t top = highest_bit(size);
+        *fl = top - TLSF_FL_SHIFT + 1;
+        *sl = static_cast<uint32_t>(size >> (top - TLSF_SL_LOG2)) & (TLSF_SL_COUNT - 1);
+    }
+    assert(*fl < TLSF_FL_COUNT);
+}
+
+// Rounds up to the next class so any chunk found in the returned list is big enough.
+static void tlsf_mapping_search(VkDeviceSize size, uint32_t* fl, uint32_t* sl)
+{
+    if (size >= (VkDeviceSize(1) << TLSF_FL_SHIFT))
+    {
+        size += (VkDeviceSize(1) << (highest_bit(size) - TLSF_SL_LOG2)) - 1;
+    }
+    else
+    {
+        // First level 0 classes are linear, (1 << (TLSF_FL_SHIFT - TLSF_SL_LOG2)) bytes wide.
+        size += (VkDeviceSize(1) << (TLSF_FL_SHIFT - TLSF_SL_LOG2)) - 1;
+    }
+    tlsf_mapping(size, fl, sl);
+}
+
+static void insert_free(MemoryBlock& block, uint32_t cidx)
+{
+    MemoryChunk& chunk = block.chunks[cidx];
+    uint32_t fl, sl;
+    tlsf_mapping(chunk.size, &fl, &sl);
+    chunk.free = true;
+    chunk.owner = nullptr;
+    chunk.prev_free = NO_CHUNK;
+    chunk.next_free = block.free_heads[fl][sl];
+    if (chunk.next_free != NO_CHUNK)
+    {
+        block.chunks[chunk.next_free].prev_free = cidx;
+    }
+    block.free_heads[fl][sl] = cidx;
+    block.fl_bitmap |= 1u << fl;
+    block.sl_bitmap[fl] |= 1u << sl;
+}
+
+static void remove_free(MemoryBlock& block, uint32_t cidx)
+{
+    MemoryChunk& chunk = block.chunks[cidx];
+    uint32_t fl, sl;
+    tlsf_mapping(chunk.size, &fl, &sl);
+    if (chunk.prev_free != NO_CHUNK)
+    {
+        block.chunks[chunk.prev_free].next_free = chunk.next_free;
+    }
+    else
+    {
+        block.free_heads[fl][sl] = chunk.next_free;
+    }
+    if (chunk.next_free != NO_CHUNK)
+    {
+        block.chunks[chunk.next_free].prev_free = chunk.prev_free;
+    }
+    if (block.free_heads[fl][sl] == NO_CHUNK)
+    {
+        block.sl_bitmap[fl] &= ~(1u << sl);
+        if (block.sl_bitmap[fl] == 0)
+        {
+            block.fl_bitmap &= ~(1u << fl);
+        }
+    }
+    chunk.free = false;
+    chunk.prev_free = NO_CHUNK;
+    chunk.next_free = NO_CHUNK;
+}
+
+static uint32_t new_chunk(MemoryBlock& block)
+{
+    if (!block.unused_chunks.empty())
+    {
+        uint32_t cidx = block.unused_chunks.back();
+        block.unused_chunks.pop_back();
+        return cidx;
+    }
+    block.chunks.push_back(MemoryChunk());
+    return static_cast<uint32_t>(block.chunks.size() - 1);
+}
+
+// Splits size bytes off the front of cidx into a new chunk placed before it, returns the new chunk.
+static uint32_t split_front(MemoryBlock& block, uint32_t cidx, VkDeviceSize size)
+{
+    uint32_t front = new_chunk(block);
+    MemoryChunk& chunk = block.chunks[cidx];
+    MemoryChunk& head = block.chunks[front];
+    head.offset = chunk.offset;
+    head.size = size;
+    head.prev_phys = chunk.prev_phys;
+    head.next_phys = cidx;
+    head.prev_free = NO_CHUNK;
+    head.next_free = NO_CHUNK;
+    head.free = false;
+    head.owner = nullptr;
+    if (chunk.prev_phys != NO_CHUNK)
+    {
+        block.chunks[chunk.prev_phys].next_phys = front;
+    }
+    chunk.prev_phys = front;
+    chunk.offset += size;
+    chunk.size -= size;
+    return front;
+}
+
+static void release_chunk(MemoryBlock& block, uint32_t cidx)
+{
+    MemoryChunk& chunk = block.chunks[cidx];
+    if (chunk.prev_phys != NO_CHUNK)
+    {
+        block.chunks[chunk.prev_phys].next_phys = chunk.next_phys;
+    }
+    if (chunk.next_phys != NO_CHUNK)
+    {
+        block.chunks[chunk.next_phys].prev_phys = chunk.prev_phys;
+    }
+    chunk.free = false;
+    chunk.owner = nullptr;
+    block.unused_chunks.push_back(cidx);
+}
+
+static uint32_t block_allocate(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, GpuAllocation* owner)
+{
+    // Ask for the worst case alignment padding so the first chunk of the list always fits.
+    VkDeviceSize search_size = size + ((alignment > 1) ? alignment - 1 : 0);
+    uint32_t fl, sl;
+    tlsf_mapping_search(search_size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT)
+    {
+        return NO_CHUNK;
+    }
+    uint32_t sl_map = block.sl_bitmap[fl] & (~0u << sl);
+    if (sl_map == 0)
+    {
+        uint32_t fl_map = (fl + 1 < TLSF_FL_COUNT) ? (block.fl_bitmap & (~0u << (fl + 1))) : 0;
+        if (fl_map == 0)
+        {
+            return NO_CHUNK;
+        }
+        fl = lowest_bit(fl_map);
+        sl_map = block.sl_bitmap[fl];
+    }
+    sl = lowest_bit(sl_map);
+    uint32_t cidx = block.free_heads[fl][sl];
+    assert(cidx != NO_CHUNK);
+    VkDeviceSize padding = align_up(block.chunks[cidx].offset, alignment) - block.chunks[cidx].offset;
+    // The rounded up search guarantees it, splitting a chunk too small would overlap its neighbour.
+    assert(block.chunks[cidx].size >= padding + size);
+    if (block.chunks[cidx].size < padding + size)
+    {
+        return NO_CHUNK;
+    }
+    remove_free(block, cidx);
+    if (padding > 0)
+    {
+        uint32_t front = split_front(block, cidx, padding);
+        insert_free(block, front);
+        // Merge the padding back into a free predecessor so it is not lost as a tiny chunk.
+        uint32_t prev = block.chunks[front].prev_phys;
+        if ((prev != NO_CHUNK) && block.chunks[prev].free)
+        {
+            remove_free(block, prev);
+            remove_free(block, front);
+            block.chunks[prev].size += block.chunks[front].size;
+            release_chunk(block, front);
+            insert_free(block, prev);
+        }
+    }
+    if (block.chunks[cidx].size - size >= MIN_SPLIT_SIZE)
+    {
+        uint32_t used = split_front(block, cidx, size);
+        insert_free(block, cidx);
+        cidx = used;
+    }
+
+    MemoryChunk& chunk = block.chunks[cidx];
+    chunk.free = false;
+    chunk.owner = owner;
+    block.used += chunk.size;
+    block.allocation_count += 1;
+    return cidx;
+}
+
+static void block_free(MemoryBlock& block, uint32_t cidx)
+{
+    block.used -= block.chunks[cidx].size;
+    block.allocation_count -= 1;
+
+    uint32_t prev = block.chunks[cidx].prev_phys;
+    if ((prev != NO_CHUNK) && block.chunks[prev].free)
+    {
+        remove_free(block, prev);
+        block.chunks[prev].size += block.chunks[cidx].size;
+        release_chunk(block, cidx);
+        cidx = prev;
+    }
+    uint32_t next = block.chunks[cidx].next_phys;
+    if ((next != NO_CHUNK) && block.chunks[next].free)
+    {
+        remove_free(block, next);
+        block.chunks[cidx].size += block.chunks[next].size;
+        release_chunk(block, next);
+    }
+    insert_free(block, cidx);
+}
+
+static VkDeviceSize block_largest_free(MemoryBlock const& block)
+{
+    VkDeviceSize largest = 0;
+    for (size_t cidx = 0; cidx < block.chunks.size(); ++cidx)
+    {
+        MemoryChunk const& chunk = block.chunks[cidx];
+        if (chunk.free && (chunk.size > largest))
+        {
+            largest = chunk.size;
+        }
+    }
+    return largest;
+}
+
+// --- blocks and pools -------------------------------------------------------------------------
+
+static bool is_host_visible(DeviceAllocator const& allocator, uint32_t memory_type)
+{
+    return check_flag(allocator.memory_properties.memoryTypes[memory_type].propertyFlags, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+}
+
+static VkResult allocate_device_memory(DeviceAllocator& allocator, VkDeviceSize size, uint32_t memory_type, VkDeviceMemory* out_memory, void** out_mapped)
+{
+    if (allocator.vk_allocation_count >= allocator.max_allocation_count)
+    {
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+    VkMemoryAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.allocationSize = size;
+    allocate_info.memoryTypeIndex = memory_type;
+    VK_THROW(vkAllocateMemory(allocator.device, &allocate_info, host_allocator(), out_memory));
+    allocator.vk_allocation_count += 1;
+
+    *out_mapped = nullptr;
+    if (is_host_visible(allocator, memory_type))
+    {
+        // Persistently mapped, mapping per use is not free on every driver.
+        if (VkResult err = vkMapMemory(allocator.device, *out_memory, 0, VK_WHOLE_SIZE, 0, out_mapped))
+        {
+            vkFreeMemory(allocator.device, *out_memory, host_allocator());
+            allocator.vk_allocation_count -= 1;
+            return err;
+        }
+    }
+    return VK_SUCCESS;
+}
+
+static void free_device_memory(DeviceAllocator& allocator, VkDeviceMemory memory, void* mapped)
+{
+    if (mapped != nullptr)
+    {
+        vkUnmapMemory(allocator.device, memory);
+    }
+    vkFreeMemory(allocator.device, memory, host_allocator());
+    allocator.vk_allocation_count -= 1;
+}
+
+static VkResult create_block(DeviceAllocator& allocator, uint32_t pool_idx, MemoryBlock** out_block)
+{
+    MemoryPool& pool = allocator.pools[pool_idx];
+    MemoryBlock* block = new MemoryBlock();
+    block->size = pool.block_size;
+    block->used = 0;
+    block->allocation_count = 0;
+    block->pool_idx = pool_idx;
+    block->fl_bitmap = 0;
+    for (uint32_t fl = 0; fl < TLSF_FL_COUNT; ++fl)
+    {
+        block->sl_bitmap[fl] = 0;
+        for (uint32_t sl = 0; sl < TLSF_SL_COUNT; ++sl)
+        {
+            block->free_heads[fl][sl] = NO_CHUNK;
+        }
+    }
+    if (VkResult err = allocate_device_memory(allocator, block->size, pool.memory_type, &block->memory, &block->mapped))
+    {
+        delete block;
+        return err;
+    }
+
+    uint32_t cidx = new_chunk(*block);
+    MemoryChunk& chunk = block->chunks[cidx];
+    chunk.offset = 0;
+    chunk.size = block->size;
+    chunk.prev_phys = NO_CHUNK;
+    chunk.next_phys = NO_CHUNK;
+    insert_free(*block, cidx);
+
+    pool.blocks.push_back(block);
+    *out_block = block;
+    return VK_SUCCESS;
+}
+
+static void destroy_block(DeviceAllocator& allocator, MemoryBlock* block)
+{
+    MemoryPool& pool = allocator.pools[block->pool_idx];
+    pool.blocks.erase(std::find(pool.blocks.begin(), pool.blocks.end(), block));
+    free_device_memory(allocator, block->memory, block->mapped);
+    delete block;
+}
+
+static uint32_t pool_index(DeviceAllocator const& allocator, uint32_t memory_type, ResourceKind kind, bool small)
+{
+    if (allocator.buffer_image_granularity <= 1)
+    {
+        kind = RESOURCE_LINEAR;     // no page sharing hazard, no need to keep kinds apart
+    }
+    return ((memory_type * RESOURCE_KIND_COUNT) + kind) * 2 + (small ? 1 : 0);
+}
+
+static void fill_allocation(GpuAllocation* allocation, MemoryBlock* block, uint32_t cidx)
+{
+    MemoryChunk const& chunk = block->chunks[cidx];
+    allocation->memory = block->memory;
+    allocation->offset = chunk.offset;
+    allocation->mapped = (block->mapped != nullptr) ? static_cast<char*>(block->mapped) + chunk.offset : nullptr;
+    allocation->block = block;
+    allocation->chunk_idx = cidx;
+}
+
+// --- public -----------------------------------------------------------------------------------
+
+VkResult create_device_allocator(VkPhysicalDevice gpu, VkDevice device, DeviceAllocator* out_allocator)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+
+    out_allocator->device = device;
+    vkGetPhysicalDeviceMemoryProperties(gpu, &out_allocator->memory_properties);
+    out_allocator->buffer_image_granularity = properties.limits.bufferImageGranularity;
+    out_allocator->non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+    out_allocator->max_allocation_count = properties.limits.maxMemoryAllocationCount;
+    out_allocator->large_block_size = 64 * 1024 * 1024;
+    out_allocator->small_block_size = 4 * 1024 * 1024;
+    out_allocator->small_threshold = 256 * 1024;
+    out_allocator->vk_allocation_count = 0;
+    out_allocator->total_allocations = 0;
+
+    VkPhysicalDeviceMemoryProperties const& memory_properties = out_allocator->memory_properties;
+    out_allocator->pools.clear();
+    for (uint32_t midx = 0; midx < memory_properties.memoryTypeCount; ++midx)
+    {
+        VkDeviceSize heap_size = memory_properties.memoryHeaps[memory_properties.memoryTypes[midx].heapIndex].size;
+        for (uint32_t kind = 0; kind < RESOURCE_KIND_COUNT; ++kind)
+        {
+            for (uint32_t small = 0; small < 2; ++small)
+            {
+                MemoryPool pool;
+                pool.memory_type = midx;
+                pool.kind = static_cast<ResourceKind>(kind);
+                pool.block_size = small ? out_allocator->small_block_size : out_allocator->large_block_size;
+                // Small heaps (BAR memory, integrated parts) should not be eaten by a single block.
+                if (pool.block_size > heap_size / 8)
+                {
+                    pool.block_size = std::max<VkDeviceSize>(heap_size / 8, 1024 * 1024);
+                }
+                out_allocator->pools.push_back(pool);
+            }
+        }
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_device_allocator(DeviceAllocator& allocator)
+{
+    std::lock_guard<std::mutex> guard(allocator.lock);
+    uint32_t leaked = static_cast<uint32_t>(allocator.dedicated.size());
+    for (size_t pidx = 0; pidx < allocator.pools.size(); ++pidx)
+    {
+        MemoryPool& pool = allocator.pools[pidx];
+        while (!pool.blocks.empty())
+        {
+            leaked += pool.blocks.back()->allocation_count;
+            destroy_block(allocator, pool.blocks.back());
+        }
+    }
+    for (size_t didx = 0; didx < allocator.dedicated.size(); ++didx)
+    {
+        free_device_memory(allocator, allocator.dedicated[didx]->memory, allocator.dedicated[didx]->mapped);
+        delete allocator.dedicated[didx];
+    }
+    allocator.dedicated.clear();
+    if (leaked > 0)
+    {
+        std::cout << "device allocator: " << leaked << " allocations leaked\n";
+    }
+}
+
+uint32_t select_memory_type(DeviceAllocator const& allocator, uint32_t type_bits, MemoryUsage usage)
+{
+    VkMemoryPropertyFlags required = 0;
+    VkMemoryPropertyFlags preferred = 0;
+    VkMemoryPropertyFlags avoided = 0;
+    switch (usage)
+    {
+    case MEMORY_GPU_ONLY:
+        preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        break;
+    case MEMORY_CPU_TO_GPU:
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        avoided = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        break;
+    case MEMORY_GPU_TO_CPU:
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        break;
+    case MEMORY_CPU_ONLY:
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        break;
+    }
+
+    uint32_t best_type = UINT32_MAX;
+    int32_t best_score = INT32_MIN;
+    VkPhysicalDeviceMemoryProperties const& memory_properties = allocator.memory_properties;
+    for (uint32_t midx = 0; midx < memory_properties.memoryTypeCount; ++midx)
+    {
+        VkMemoryPropertyFlags flags = memory_properties.memoryTypes[midx].propertyFlags;
+        if (((type_bits >> midx) & 1) == 0 || !check_flag(flags, required))
+        {
+            continue;
+        }
+        int32_t score = 2 * static_cast<int32_t>(count_bits(flags & preferred)) - static_cast<int32_t>(count_bits(flags & avoided));
+        if (score > best_score)
+        {
+            best_score = score;
+            best_type = midx;
+        }
+    }
+    return best_type;
+}
+
+static VkResult allocate_locked(DeviceAllocator& allocator, VkMemoryRequirements const& requirements, uint32_t memory_type, ResourceKind kind, GpuAllocation* allocation)
+{
+    bool small = requirements.size <= allocator.small_threshold;
+    uint32_t pool_idx = pool_index(allocator, memory_type, kind, small);
+    MemoryPool& pool = allocator.pools[pool_idx];
+
+    allocation->size = requirements.size;
+    allocation->memory_type = memory_type;
+
+    if (requirements.size > pool.block_size / 2)
+    {
+        void* mapped = nullptr;
+        VK_THROW(allocate_device_memory(allocator, requirements.size, memory_type, &allocation->memory, &mapped));
+        allocation->offset = 0;
+        allocation->mapped = mapped;
+        allocation->block = nullptr;
+        allocation->chunk_idx = NO_CHUNK;
+        allocator.dedicated.push_back(allocation);
+        return VK_SUCCESS;
+    }
+
+    for (size_t bidx = 0; bidx < pool.blocks.size(); ++bidx)
+    {
+        MemoryBlock* block = pool.blocks[bidx];
+        if (block->size - block->used < requirements.size)
+        {
+            continue;
+        }
+        uint32_t cidx = block_allocate(*block, requirements.size, requirements.alignment, allocation);
+        if (cidx != NO_CHUNK)
+        {
+            fill_allocation(allocation, block, cidx);
+            return VK_SUCCESS;
+        }
+    }
+
+    MemoryBlock* block = nullptr;
+    VK_THROW(create_block(allocator, pool_idx, &block));
+    uint32_t cidx = block_allocate(*block, requirements.size, requirements.alignment, allocation);
+    assert(cidx != NO_CHUNK);
+    fill_allocation(allocation, block, cidx);
+    return VK_SUCCESS;
+}
+
+VkResult allocate_memory(DeviceAllocator& allocator, VkMemoryRequirements const& requirements, MemoryUsage usage, ResourceKind kind, GpuAllocation** out_allocation)
+{
+    uint32_t memory_type = select_memory_type(allocator, requirements.memoryTypeBits, usage);
+    if (memory_type == UINT32_MAX)
+    {
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    GpuAllocation* allocation = new GpuAllocation();
+    allocation->buffer = VK_NULL_HANDLE;
+    allocation->buffer_info = VkBufferCreateInfo();
+
+    std::lock_guard<std::mutex> guard(allocator.lock);
+    if (VkResult err = allocate_locked(allocator, requirements, memory_type, kind, allocation))
+    {
+        delete allocation;
+        return err;
+    }
+    allocator.total_allocations += 1;
+    *out_allocation = allocation;
+    return VK_SUCCESS;
+}
+
+static void free_locked(DeviceAllocator& allocator, GpuAllocation* allocation)
+{
+    MemoryBlock* block = allocation->block;
+    if (block == nullptr)
+    {
+        allocator.dedicated.erase(std::find(allocator.dedicated.begin(), allocator.dedicated.end(), allocation));
+        free_device_memory(allocator, allocation->memory, allocation->mapped);
+        return;
+    }
+
+    block_free(*block, allocation->chunk_idx);
+    if (block->allocation_count == 0)
+    {
+        // Keep one empty block per pool around so alloc/free patterns do not thrash vkAllocateMemory.
+        MemoryPool& pool = allocator.pools[block->pool_idx];
+        for (size_t bidx = 0; bidx < pool.blocks.size(); ++bidx)
+        {
+            if ((pool.blocks[bidx] != block) && (pool.blocks[bidx]->allocation_count == 0))
+            {
+                destroy_block(allocator, block);
+                break;
+            }
+        }
+    }
+}
+
+void free_memory(DeviceAllocator& allocator, GpuAllocation* allocation)
+{
+    if (allocation == nullptr)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(allocator.lock);
+        free_locked(allocator, allocation);
+    }
+    delete allocation;
+}
+
+VkResult create_buffer(DeviceAllocator& allocator, VkBufferCreateInfo const& info, MemoryUsage usage, GpuAllocation** out_allocation)
+{
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VK_THROW(vkCreateBuffer(allocator.device, &info, host_allocator(), &buffer));
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(allocator.device, buffer, &requirements);
+
+    GpuAllocation* allocation = nullptr;
+    VkResult err = allocate_memory(allocator, requirements, usage, RESOURCE_LINEAR, &allocation);
+    if (err == VK_SUCCESS)
+    {
+        err = vkBindBufferMemory(allocator.device, buffer, allocation->memory, allocation->offset);
+    }
+    if (err != VK_SUCCESS)
+    {
+        free_memory(allocator, allocation);
+        vkDestroyBuffer(allocator.device, buffer, host_allocator());
+        return err;
+    }
+    allocation->buffer = buffer;
+    allocation->buffer_info = info;
+    allocation->buffer_info.pNext = nullptr;
+    allocation->buffer_info.pQueueFamilyIndices = nullptr;  // not kept alive, concurrent buffers are never moved
+    *out_allocation = allocation;
+    return VK_SUCCESS;
+}
+
+void destroy_buffer(DeviceAllocator& allocator, GpuAllocation* allocation)
+{
+    if (allocation == nullptr)
+    {
+        return;
+    }
+    vkDestroyBuffer(allocator.device, allocation->buffer, host_allocator());
+    free_memory(allocator, allocation);
+}
+
+VkResult create_image(DeviceAllocator& allocator, VkImageCreateInfo const& info, MemoryUsage usage, VkImage* out_image, GpuAllocation** out_allocation)
+{
+    VK_THROW(vkCreateImage(allocator.device, &info, host_allocator(), out_image));
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(allocator.device, *out_image, &requirements);
+
+    ResourceKind kind = (info.tiling == VK_IMAGE_TILING_OPTIMAL) ? RESOURCE_OPTIMAL : RESOURCE_LINEAR;
+    GpuAllocation* allocation = nullptr;
+    VkResult err = allocate_memory(allocator, requirements, usage, kind, &allocation);
+    if ((err != VK_SUCCESS) && (usage == MEMORY_GPU_ONLY))
+    {
+        // Some software implementations have no memory type that is not host visible.
+        err = allocate_memory(allocator, requirements, MEMORY_CPU_TO_GPU, kind, &allocation);
+    }
+    if (err == VK_SUCCESS)
+    {
+        err = vkBindImageMemory(allocator.device, *out_image, allocation->memory, allocation->offset);
+    }
+    if (err != VK_SUCCESS)
+    {
+        free_memory(allocator, allocation);
+        vkDestroyImage(allocator.device, *out_image, host_allocator());
+        *out_image = VK_NULL_HANDLE;
+        return err;
+    }
+    *out_allocation = allocation;
+    return VK_SUCCESS;
+}
+
+void destroy_image(DeviceAllocator& allocator, VkImage image, GpuAllocation* allocation)
+{
+    vkDestroyImage(allocator.device, image, host_allocator());
+    free_memory(allocator, allocation);
+}
+
+// Ranges must be aligned to nonCoherentAtomSize and stay inside the VkDeviceMemory.
+static void mapped_range(DeviceAllocator const& allocator, GpuAllocation const* allocation, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange* out_range)
+{
+    VkDeviceSize atom = std::max<VkDeviceSize>(allocator.non_coherent_atom_size, 1);
+    VkDeviceSize memory_size = (allocation->block != nullptr) ? allocation->block->size : allocation->size;
+    VkDeviceSize begin = allocation->offset + offset;
+    VkDeviceSize end = (size == VK_WHOLE_SIZE) ? allocation->offset + allocation->size : begin + size;
+
+    out_range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    out_range->pNext = nullptr;
+    out_range->memory = allocation->memory;
+    out_range->offset = (begin / atom) * atom;
+    end = align_up(end, atom);
+    out_range->size = (end >= memory_size) ? VK_WHOLE_SIZE : end - out_range->offset;
+}
+
+VkResult flush_allocation(DeviceAllocator& allocator, GpuAllocation const* allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (check_flag(allocator.memory_properties.memoryTypes[allocation->memory_type].propertyFlags, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+        return VK_SUCCESS;
+    }
+    VkMappedMemoryRange range;
+    mapped_range(allocator, allocation, offset, size, &range);
+    return vkFlushMappedMemoryRanges(allocator.device, 1, &range);
+}
+
+VkResult invalidate_allocation(DeviceAllocator& allocator, GpuAllocation const* allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (check_flag(allocator.memory_properties.memoryTypes[allocation->memory_type].propertyFlags, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+        return VK_SUCCESS;
+    }
+    VkMappedMemoryRange range;
+    mapped_range(allocator, allocation, offset, size, &range);
+    return vkInvalidateMappedMemoryRanges(allocator.device, 1, &range);
+}
+
+void get_memory_stats(DeviceAllocator& allocator, MemoryStats* out_stats)
+{
+    std::lock_guard<std::mutex> guard(allocator.lock);
+    MemoryStats stats = {};
+    for (size_t pidx = 0; pidx < allocator.pools.size(); ++pidx)
+    {
+        MemoryPool const& pool = allocator.pools[pidx];
+        for (size_t bidx = 0; bidx < pool.blocks.size(); ++bidx)
+        {
+            MemoryBlock const& block = *pool.blocks[bidx];
+            stats.bytes_reserved += block.size;
+            stats.bytes_used += block.used;
+            stats.block_count += 1;
+            stats.allocation_count += block.allocation_count;
+            stats.largest_free = std::max(stats.largest_free, block_largest_free(block));
+        }
+    }
+    for (size_t didx = 0; didx < allocator.dedicated.size(); ++didx)
+    {
+        stats.bytes_reserved += allocator.dedicated[didx]->size;
+        stats.bytes_used += allocator.dedicated[didx]->size;
+    }
+    stats.dedicated_count = static_cast<uint32_t>(allocator.dedicated.size());
+    stats.allocation_count += stats.dedicated_count;
+    stats.bytes_free = stats.bytes_reserved - stats.bytes_used;
+    stats.vk_allocation_count = allocator.vk_allocation_count;
+    stats.total_allocations = allocator.total_allocations;
+    stats.fragmentation = (stats.bytes_free > 0) ? 1.0f - float(stats.largest_free) / float(stats.bytes_free) : 0.0f;
+    *out_stats = stats;
+}
+
+void print_memory_stats(DeviceAllocator& allocator)
+{
+    MemoryStats stats;
+    get_memory_stats(allocator, &stats);
+    double const mib = 1.0 / (1024.0 * 1024.0);
+    std::cout << "device memory: " << stats.bytes_used * mib << " / " << stats.bytes_reserved * mib << " MiB used, "
+        << stats.allocation_count << " allocations in " << stats.block_count << " blocks + " << stats.dedicated_count << " dedicated, "
+        << stats.vk_allocation_count << "/" << allocator.max_allocation_count << " vkAllocateMemory, "
+        << "fragmentation " << stats.fragmentation * 100.0f << "%\n";
+}
+
+void get_memory_budget(DeviceAllocator& allocator, VkPhysicalDevice gpu, bool use_extension, HeapBudget* out_heaps)
+{
+    VkPhysicalDeviceMemoryProperties const& memory_properties = allocator.memory_properties;
+#if defined(VK_EXT_memory_budget) && defined(VK_KHR_get_physical_device_properties2)
+    if (use_extension && (vkGetPhysicalDeviceMemoryProperties2KHR != nullptr))
+    {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+        budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        budget.pNext = nullptr;
+        VkPhysicalDeviceMemoryProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &budget;
+        vkGetPhysicalDeviceMemoryProperties2KHR(gpu, &properties2);
+        for (uint32_t hidx = 0; hidx < VK_MAX_MEMORY_HEAPS; ++hidx)
+        {
+            out_heaps[hidx].budget = (hidx < memory_properties.memoryHeapCount) ? budget.heapBudget[hidx] : 0;
+            out_heaps[hidx].usage = (hidx < memory_properties.memoryHeapCount) ? budget.heapUsage[hidx] : 0;
+        }
+        return;
+    }
+#endif
+    for (uint32_t hidx = 0; hidx < VK_MAX_MEMORY_HEAPS; ++hidx)
+    {
+        out_heaps[hidx].budget = (hidx < memory_properties.memoryHeapCount) ? memory_properties.memoryHeaps[hidx].size / 10 * 8 : 0;
+        out_heaps[hidx].usage = 0;
+    }
+    std::lock_guard<std::mutex> guard(allocator.lock);
+    for (size_t pidx = 0; pidx < allocator.pools.size(); ++pidx)
+    {
+        MemoryPool const& pool = allocator.pools[pidx];
+        uint32_t heap_idx = memory_properties.memoryTypes[pool.memory_type].heapIndex;
+        for (size_t bidx = 0; bidx < pool.blocks.size(); ++bidx)
+        {
+            out_heaps[heap_idx].usage += pool.blocks[bidx]->size;
+        }
+    }
+    for (size_t didx = 0; didx < allocator.dedicated.size(); ++didx)
+    {
+        out_heaps[memory_properties.memoryTypes[allocator.dedicated[didx]->memory_type].heapIndex].usage += allocator.dedicated[didx]->size;
+    }
+}
+
+struct PendingMove
+{
+    GpuAllocation* allocation;
+    VkBuffer old_buffer;
+    MemoryBlock* old_block;
+    uint32_t old_chunk;
+};
+
+static bool block_is_movable(MemoryBlock const& block)
+{
+    for (size_t cidx = 0; cidx < block.chunks.size(); ++cidx)
+    {
+        MemoryChunk const& chunk = block.chunks[cidx];
+        if (!chunk.free && (chunk.owner != nullptr) &&
+            ((chunk.owner->buffer == VK_NULL_HANDLE) || (chunk.owner->buffer_info.sharingMode != VK_SHARING_MODE_EXCLUSIVE)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Moves one buffer into one of the target blocks and records the copy. The old buffer and chunk
+// stay alive until the copy has executed.
+static VkResult move_buffer(DeviceAllocator& allocator, VkCommandBuffer cmd, MemoryBlock* source, uint32_t cidx, std::vector<MemoryBlock*> const& targets, std::vector<PendingMove>& moves)
+{
+    GpuAllocation* allocation = source->chunks[cidx].owner;
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VK_THROW(vkCreateBuffer(allocator.device, &allocation->buffer_info, host_allocator(), &buffer));
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(allocator.device, buffer, &requirements);
+
+    MemoryBlock* target = nullptr;
+    uint32_t target_chunk = NO_CHUNK;
+    for (size_t tidx = 0; (tidx < targets.size()) && (target_chunk == NO_CHUNK); ++tidx)
+    {
+        target = targets[tidx];
+        if (target->size - target->used >= requirements.size)
+        {
+            target_chunk = block_allocate(*target, requirements.size, requirements.alignment, allocation);
+        }
+    }
+    VkResult err = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    if (target_chunk != NO_CHUNK)
+    {
+        err = vkBindBufferMemory(allocator.device, buffer, target->memory, target->chunks[target_chunk].offset);
+        if (err != VK_SUCCESS)
+        {
+            block_free(*target, target_chunk);
+        }
+    }
+    if (err != VK_SUCCESS)
+    {
+        vkDestroyBuffer(allocator.device, buffer, host_allocator());
+        return err;
+    }
+
+    VkBufferCopy region = {0, 0, allocation->buffer_info.size};
+    vkCmdCopyBuffer(cmd, allocation->buffer, buffer, 1, &region);
+
+    PendingMove move = {allocation, allocation->buffer, source, cidx};
+    moves.push_back(move);
+    fill_allocation(allocation, target, target_chunk);
+    allocation->size = requirements.size;
+    allocation->buffer = buffer;
+    return VK_SUCCESS;
+}
+
+static bool emptier_block(MemoryBlock const* a, MemoryBlock const* b)
+{
+    return a->used < b->used;
+}
+
+VkResult defragment(DeviceAllocator& allocator, VkQueue queue, VkCommandPool command_pool, DefragStats* out_stats)
+{
+    DefragStats stats = {};
+    std::lock_guard<std::mutex> guard(allocator.lock);
+
+    VkCommandBuffer cmd;
+    VkCommandBufferAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+    VK_THROW(vkAllocateCommandBuffers(allocator.device, &allocate_info, &cmd));
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (VkResult result = vkBeginCommandBuffer(cmd, &begin_info))
+    {
+        vkFreeCommandBuffers(allocator.device, command_pool, 1, &cmd);
+        return result;
+    }
+
+    std::vector<PendingMove> moves;
+    std::vector<MemoryBlock*> drained;
+    for (size_t pidx = 0; pidx < allocator.pools.size(); ++pidx)
+    {
+        MemoryPool& pool = allocator.pools[pidx];
+        if (pool.blocks.size() < 2)
+        {
+            continue;
+        }
+
+        // Drain the emptiest blocks for as long as the remaining ones can take their contents.
+        // Sources and targets never overlap so every buffer is copied at most once.
+        std::vector<MemoryBlock*> order(pool.blocks);
+        std::sort(order.begin(), order.end(), emptier_block);
+        VkDeviceSize room = 0;
+        for (size_t bidx = 0; bidx < order.size(); ++bidx)
+        {
+            room += order[bidx]->size - order[bidx]->used;
+        }
+        std::vector<MemoryBlock*> sources;
+        std::vector<MemoryBlock*> targets;
+        VkDeviceSize moving = 0;
+        for (size_t bidx = 0; bidx < order.size(); ++bidx)
+        {
+            MemoryBlock* block = order[bidx];
+            VkDeviceSize block_free_bytes = block->size - block->used;
+            if ((block->allocation_count > 0) && (sources.size() + 1 < order.size()) && block_is_movable(*block) &&
+                (moving + block->used <= room - block_free_bytes))
+            {
+                sources.push_back(block);
+                moving += block->used;
+                room -= block_free_bytes;
+            }
+            else
+            {
+                targets.push_back(block);
+            }
+        }
+        // Fill the fullest targets first, it keeps the free space of the others in one piece.
+        std::reverse(targets.begin(), targets.end());
+
+        for (size_t sidx = 0; sidx < sources.size(); ++sidx)
+        {
+            MemoryBlock* source = sources[sidx];
+            bool complete = true;
+            for (uint32_t cidx = 0; (cidx < source->chunks.size()) && complete; ++cidx)
+            {
+                MemoryChunk const& chunk = source->chunks[cidx];
+                if (chunk.free || (chunk.owner == nullptr) || (chunk.owner->block != source) || (chunk.owner->chunk_idx != cidx))
+                {
+                    continue;   // free or a recycled chunk slot
+                }
+                complete = (move_buffer(allocator, cmd, source, cidx, targets, moves) == VK_SUCCESS);
+            }
+            if (complete)
+            {
+                drained.push_back(source);
+            }
+        }
+    }
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    VkResult result = vkEndCommandBuffer(cmd);
+    if ((result == VK_SUCCESS) && !moves.empty())
+    {
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &cmd;
+        result = vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+        if (result == VK_SUCCESS)
+        {
+            result = vkQueueWaitIdle(queue);
+        }
+    }
+    // Freed on every path, the pool may be reset or destroyed long after.
+    vkFreeCommandBuffers(allocator.device, command_pool, 1, &cmd);
+    VK_THROW(result);
+
+    for (size_t midx = 0; midx < moves.size(); ++midx)
+    {
+        PendingMove const& move = moves[midx];
+        vkDestroyBuffer(allocator.device, move.old_buffer, host_allocator());
+        stats.moved_bytes += move.old_block->chunks[move.old_chunk].size;
+        block_free(*move.old_block, move.old_chunk);
+        stats.moved_allocations += 1;
+    }
+    for (size_t didx = 0; didx < drained.size(); ++didx)
+    {
+        assert(drained[didx]->allocation_count == 0);
+        stats.freed_blocks += 1;
+        stats.freed_bytes += drained[didx]->size;
+        destroy_block(allocator, drained[didx]);
+    }
+    if (out_stats != nullptr)
+    {
+        *out_stats = stats;
+    }
+    return VK_SUCCESS;
+}
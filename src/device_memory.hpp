@@ -0,0 +1,169 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <vector>
+
+// Suballocator for VkDeviceMemory. Large blocks per (memory type, resource kind, size class)
+// are carved with a TLSF free list (O(1) allocate and free, immediate coalescing); resources
+// bigger than half a block get their own vkAllocateMemory.
+
+enum MemoryUsage
+{
+    MEMORY_GPU_ONLY,        // device local, never mapped
+    MEMORY_CPU_TO_GPU,      // host visible and mapped, device local when the implementation offers it
+    MEMORY_GPU_TO_CPU,      // host visible, cached when possible, mapped (readback)
+    MEMORY_CPU_ONLY         // host visible, coherent, mapped (staging)
+};
+
+// Linear and optimal-tiling resources are never mixed in one block when the device reports a
+// bufferImageGranularity above 1, so neighbours can never share a granularity page.
+enum ResourceKind
+{
+    RESOURCE_LINEAR,        // buffers and linear images
+    RESOURCE_OPTIMAL,       // optimal tiling images
+    RESOURCE_KIND_COUNT
+};
+
+struct MemoryBlock;
+
+// Allocator owned record, the address stays valid until free_memory(). defragment() may move
+// buffers created with create_buffer(): memory, offset, mapped and buffer are updated in place.
+struct GpuAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;               // null when not host visible
+    uint32_t memory_type;
+
+    VkBuffer buffer;            // set by create_buffer(), makes the allocation movable
+    VkBufferCreateInfo buffer_info;
+
+    // internal
+    MemoryBlock* block;         // null for dedicated allocations
+    uint32_t chunk_idx;
+};
+
+struct MemoryChunk
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t prev_phys;
+    uint32_t next_phys;
+    uint32_t prev_free;
+    uint32_t next_free;
+    bool free;
+    GpuAllocation* owner;
+};
+
+const uint32_t TLSF_SL_LOG2 = 4;
+const uint32_t TLSF_SL_COUNT = 1 << TLSF_SL_LOG2;
+const uint32_t TLSF_FL_SHIFT = 8;           // sizes below 256 bytes share first level 0
+const uint32_t TLSF_FL_COUNT = 32;
+
+struct MemoryBlock
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    uint32_t allocation_count;
+    uint32_t pool_idx;
+    void* mapped;
+
+    std::vector<MemoryChunk> chunks;
+    std::vector<uint32_t> unused_chunks;    // recycled chunk slots
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[TLSF_FL_COUNT];
+    uint32_t free_heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+};
+
+struct MemoryPool
+{
+    uint32_t memory_type;
+    ResourceKind kind;
+    VkDeviceSize block_size;
+    std::vector<MemoryBlock*> blocks;
+};
+
+struct MemoryStats
+{
+    VkDeviceSize bytes_reserved;    // sum of VkDeviceMemory sizes
+    VkDeviceSize bytes_used;        // sum of live suballocation sizes
+    VkDeviceSize bytes_free;
+    VkDeviceSize largest_free;      // biggest contiguous free range of any block
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    uint32_t allocation_count;      // live GpuAllocations
+    uint32_t vk_allocation_count;   // live vkAllocateMemory, bounded by maxMemoryAllocationCount
+    uint64_t total_allocations;     // allocate_memory() calls since creation
+    float fragmentation;            // 1 - largest_free / bytes_free, 0 when free space is one range
+};
+
+// Per heap, what this process should stay under and what it uses.
+struct HeapBudget
+{
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+};
+
+struct DefragStats
+{
+    uint32_t moved_allocations;
+    VkDeviceSize moved_bytes;
+    uint32_t freed_blocks;
+    VkDeviceSize freed_bytes;
+};
+
+struct DeviceAllocator
+{
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize buffer_image_granularity;
+    VkDeviceSize non_coherent_atom_size;
+    uint32_t max_allocation_count;
+    VkDeviceSize large_block_size;
+    VkDeviceSize small_block_size;
+    VkDeviceSize small_threshold;           // allocations up to this size use the small block pools
+
+    std::mutex lock;
+    std::vector<MemoryPool> pools;
+    std::vector<GpuAllocation*> dedicated;
+    uint32_t vk_allocation_count;
+    uint64_t total_allocations;
+};
+
+VkResult create_device_allocator(VkPhysicalDevice gpu, VkDevice device, DeviceAllocator* out_allocator);
+// Every allocation must have been freed, reports leaks on stdout.
+void destroy_device_allocator(DeviceAllocator& allocator);
+
+// UINT32_MAX when no memory type in type_bits fits the usage.
+uint32_t select_memory_type(DeviceAllocator const& allocator, uint32_t type_bits, MemoryUsage usage);
+
+VkResult allocate_memory(DeviceAllocator& allocator, VkMemoryRequirements const& requirements, MemoryUsage usage, ResourceKind kind, GpuAllocation** out_allocation);
+void free_memory(DeviceAllocator& allocator, GpuAllocation* allocation);
+
+VkResult create_buffer(DeviceAllocator& allocator, VkBufferCreateInfo const& info, MemoryUsage usage, GpuAllocation** out_allocation);
+void destroy_buffer(DeviceAllocator& allocator, GpuAllocation* allocation);
+VkResult create_image(DeviceAllocator& allocator, VkImageCreateInfo const& info, MemoryUsage usage, VkImage* out_image, GpuAllocation** out_allocation);
+void destroy_image(DeviceAllocator& allocator, VkImage image, GpuAllocation* allocation);
+
+// Non coherent host visible memory needs explicit flush/invalidate, no-op on coherent types.
+VkResult flush_allocation(DeviceAllocator& allocator, GpuAllocation const* allocation, VkDeviceSize offset, VkDeviceSize size);
+VkResult invalidate_allocation(DeviceAllocator& allocator, GpuAllocation const* allocation, VkDeviceSize offset, VkDeviceSize size);
+
+void get_memory_stats(DeviceAllocator& allocator, MemoryStats* out_stats);
+void print_memory_stats(DeviceAllocator& allocator);
+
+// out_heaps has VK_MAX_MEMORY_HEAPS entries, indexed like memory_properties.memoryHeaps. With
+// VK_EXT_memory_budget enabled (use_extension) the driver's numbers, which account for other
+// processes and the driver's own allocations. Otherwise 80% of the heap size, and the blocks this
+// allocator holds in it.
+void get_memory_budget(DeviceAllocator& allocator, VkPhysicalDevice gpu, bool use_extension, HeapBudget* out_heaps);
+
+// Compacts movable (create_buffer) allocations out of the emptiest blocks and frees the blocks
+// that end up empty. Only call while the GPU is idle and nothing records: it submits the copies
+// on queue, waits for them, and replaces GpuAllocation::buffer.
+VkResult defragment(DeviceAllocator& allocator, VkQueue queue, VkCommandPool command_pool, DefragStats* out_stats);
@@ -0,0 +1,489 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "device_select.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "file_map.hpp"
+#include "pipeline_cache.hpp"
+#include "tools.hpp"
+
+static const uint32_t DEVICE_PROFILE_MAGIC = 0x50444b56;    // "VKDP"
+static const uint32_t DEVICE_PROFILE_VERSION = 2;           // bumped whenever DeviceCapabilities changes
+
+struct DeviceProfileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capabilities_size;     // catches a profile written by a build against other Vulkan headers
+    uint32_t device_index;
+    uint64_t device_set_hash;
+    double query_ms;
+};
+
+static double elapsed_ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static char const* device_type_name(VkPhysicalDeviceType type)
+{
+    switch (type)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+    default: return "other";
+    }
+}
+
+void init_device_selection(DeviceSelection* out_selection)
+{
+    out_selection->override_device = nullptr;
+    out_selection->profile_path = "vk_test.device_profile";
+    out_selection->load_profile = true;
+    out_selection->requirements.min_image_dimension_2d = 4096;
+    out_selection->requirements.min_compute_group_size = 64;
+    out_selection->requirements.min_device_local = 256 * 1024 * 1024;
+    out_selection->properties2 = false;
+    out_selection->device_ids = false;
+    out_selection->profile_hit = false;
+    out_selection->profile_reject_reason = nullptr;
+    out_selection->device_set_hash = 0;
+    out_selection->select_ms = 0.0;
+    out_selection->query_ms = 0.0;
+}
+
+void query_device_capabilities(VkPhysicalDevice gpu, bool properties2, bool device_ids, DeviceCapabilities* out_capabilities)
+{
+    // Zeroed as a whole, padding included: the profile is written as bytes.
+    memset(out_capabilities, 0, sizeof(*out_capabilities));
+    vkGetPhysicalDeviceProperties(gpu, &out_capabilities->properties);
+    vkGetPhysicalDeviceFeatures(gpu, &out_capabilities->features);
+    vkGetPhysicalDeviceMemoryProperties(gpu, &out_capabilities->memory);
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &family_count, nullptr);
+    family_count = std::min(family_count, MAX_PROFILE_QUEUE_FAMILIES);
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &family_count, out_capabilities->queue_families);
+    out_capabilities->queue_family_count = family_count;
+
+    // One enumeration for every extension we look for.
+    uint32_t extension_count = 0;
+    std::vector<VkExtensionProperties> extensions;
+    if (vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extension_count, nullptr) == VK_SUCCESS)
+    {
+        extensions.resize(extension_count);
+        if (vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extension_count, extensions.data()) != VK_SUCCESS)
+        {
+            extension_count = 0;
+        }
+    }
+    for (uint32_t eidx = 0; eidx < extension_count; ++eidx)
+    {
+        char const* name = extensions[eidx].extensionName;
+        if (strcmp(name, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0)
+        {
+            out_capabilities->extensions |= DEVICE_EXTENSION_SWAPCHAIN;
+        }
+#ifdef VK_KHR_draw_indirect_count
+        if (strcmp(name, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+        {
+            out_capabilities->extensions |= DEVICE_EXTENSION_DRAW_INDIRECT_COUNT;
+        }
+#endif
+#ifdef VK_EXT_memory_budget
+        if (strcmp(name, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+        {
+            out_capabilities->extensions |= DEVICE_EXTENSION_MEMORY_BUDGET;
+        }
+#endif
+#ifdef VK_EXT_descriptor_indexing
+        if (strcmp(name, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0)
+        {
+            out_capabilities->extensions |= DEVICE_EXTENSION_DESCRIPTOR_INDEXING;
+        }
+#endif
+#ifdef VK_KHR_maintenance3
+        if (strcmp(name, VK_KHR_MAINTENANCE3_EXTENSION_NAME) == 0)
+        {
+            out_capabilities->extensions |= DEVICE_EXTENSION_MAINTENANCE3;
+        }
+#endif
+    }
+
+#if defined(VK_EXT_descriptor_indexing) && defined(VK_KHR_maintenance3)
+    // Bindless needs partially bound arrays of sampled images and storage buffers that can be
+    // written while bound; the feature query goes through VK_KHR_get_physical_device_properties2.
+    // VK_EXT_descriptor_indexing requires VK_KHR_maintenance3 to be enabled with it.
+    if (properties2 && check_flag(out_capabilities->extensions, DEVICE_EXTENSION_DESCRIPTOR_INDEXING | DEVICE_EXTENSION_MAINTENANCE3))
+    {
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+        indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        indexing_features.pNext = nullptr;
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &indexing_features;
+        vkGetPhysicalDeviceFeatures2KHR(gpu, &features2);
+        out_capabilities->bindless_indexing = indexing_features.runtimeDescriptorArray && indexing_features.descriptorBindingPartiallyBound &&
+            indexing_features.descriptorBindingSampledImageUpdateAfterBind && indexing_features.descriptorBindingStorageBufferUpdateAfterBind &&
+            indexing_features.descriptorBindingUpdateUnusedWhilePending && indexing_features.shaderSampledImageArrayNonUniformIndexing;
+        out_capabilities->storage_buffer_non_uniform = indexing_features.shaderStorageBufferArrayNonUniformIndexing;
+    }
+#endif
+#ifdef VK_KHR_external_memory_capabilities
+    if (device_ids)
+    {
+        VkPhysicalDeviceIDPropertiesKHR id_properties = {};
+        id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+        id_properties.pNext = nullptr;
+        VkPhysicalDeviceProperties2 properties2_query = {};
+        properties2_query.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2_query.pNext = &id_properties;
+        vkGetPhysicalDeviceProperties2KHR(gpu, &properties2_query);
+        memcpy(out_capabilities->device_uuid, id_properties.deviceUUID, VK_UUID_SIZE);
+        out_capabilities->has_device_uuid = VK_TRUE;
+    }
+#endif
+}
+
+static VkDeviceSize largest_device_local_heap(VkPhysicalDeviceMemoryProperties const& memory)
+{
+    VkDeviceSize largest = 0;
+    for (uint32_t hidx = 0; hidx < memory.memoryHeapCount; ++hidx)
+    {
+        if (check_flag(memory.memoryHeaps[hidx].flags, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+        {
+            largest = std::max(largest, memory.memoryHeaps[hidx].size);
+        }
+    }
+    return largest;
+}
+
+static bool has_family(DeviceCapabilities const& capabilities, VkQueueFlags required, VkQueueFlags excluded)
+{
+    for (uint32_t fidx = 0; fidx < capabilities.queue_family_count; ++fidx)
+    {
+        VkQueueFlags flags = capabilities.queue_families[fidx].queueFlags;
+        if (check_flag(flags, required) && ((flags & excluded) == 0) && (capabilities.queue_families[fidx].queueCount > 0))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t score_device(DeviceCapabilities const& capabilities, DeviceRequirements const& requirements, char const** out_reason)
+{
+    VkPhysicalDeviceLimits const& limits = capabilities.properties.limits;
+    VkDeviceSize device_local = largest_device_local_heap(capabilities.memory);
+    // Compute passes (fill, culling) are recorded on the graphics queue.
+    if (!has_family(capabilities, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT, 0))
+    {
+        *out_reason = "no graphics and compute queue family";
+        return -1;
+    }
+    if (limits.maxImageDimension2D < requirements.min_image_dimension_2d)
+    {
+        *out_reason = "maxImageDimension2D too small";
+        return -1;
+    }
+    if ((limits.maxComputeWorkGroupSize[0] < requirements.min_compute_group_size) || (limits.maxComputeWorkGroupInvocations < requirements.min_compute_group_size))
+    {
+        *out_reason = "compute work groups too small";
+        return -1;
+    }
+    if (device_local < requirements.min_device_local)
+    {
+        *out_reason = "not enough device local memory";
+        return -1;
+    }
+    *out_reason = nullptr;
+
+    // The type dominates, everything else only orders devices of the same type.
+    int64_t score = 0;
+    switch (capabilities.properties.deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        score += 10000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        score += 5000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        score += 2500;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        score += 1000;
+        break;
+    default:
+        break;
+    }
+    score += static_cast<int64_t>(std::min<VkDeviceSize>(device_local / (128 * 1024 * 1024), 1000));
+    // DMA engines for the uploads, a compute family for async compute.
+    if (has_family(capabilities, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+    {
+        score += 300;
+    }
+    if (has_family(capabilities, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT))
+    {
+        score += 200;
+    }
+    if (limits.timestampComputeAndGraphics)
+    {
+        score += 100;
+    }
+    score += capabilities.features.multiDrawIndirect ? 100 : 0;
+    score += capabilities.features.drawIndirectFirstInstance ? 50 : 0;
+    score += capabilities.features.pipelineStatisticsQuery ? 50 : 0;
+    score += check_flag(capabilities.extensions, DEVICE_EXTENSION_DRAW_INDIRECT_COUNT) ? 100 : 0;
+    score += capabilities.bindless_indexing ? 100 : 0;
+    score += check_flag(capabilities.extensions, DEVICE_EXTENSION_MEMORY_BUDGET) ? 50 : 0;
+    return score;
+}
+
+static bool parse_uuid(char const* text, uint8_t* out_uuid)
+{
+    // 32 hex digits, dashes anywhere are skipped.
+    uint32_t digits = 0;
+    for (char const* c = text; *c != '\0'; ++c)
+    {
+        if (*c == '-')
+        {
+            continue;
+        }
+        if (!isxdigit(static_cast<unsigned char>(*c)) || (digits == 2 * VK_UUID_SIZE))
+        {
+            return false;
+        }
+        uint8_t value = static_cast<uint8_t>(isdigit(static_cast<unsigned char>(*c)) ? (*c - '0') : (tolower(static_cast<unsigned char>(*c)) - 'a' + 10));
+        out_uuid[digits / 2] = static_cast<uint8_t>((digits % 2 == 0) ? (value << 4) : (out_uuid[digits / 2] | value));
+        digits += 1;
+    }
+    return digits == 2 * VK_UUID_SIZE;
+}
+
+bool match_device_override(char const* override_device, uint32_t index, VkPhysicalDeviceProperties const& properties, uint8_t const* uuid)
+{
+    char* end = nullptr;
+    unsigned long override_index = strtoul(override_device, &end, 10);
+    if ((end != override_device) && (*end == '\0'))
+    {
+        return override_index == index;
+    }
+    uint8_t override_uuid[VK_UUID_SIZE];
+    if (parse_uuid(override_device, override_uuid))
+    {
+        return (uuid != nullptr) && (memcmp(uuid, override_uuid, VK_UUID_SIZE) == 0);
+    }
+    // Part of the name, case insensitive.
+    std::string name = properties.deviceName;
+    std::string part = override_device;
+    std::transform(name.begin(), name.end(), name.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    std::transform(part.begin(), part.end(), part.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return name.find(part) != std::string::npos;
+}
+
+static uint64_t hash_device_set(DeviceSelection const& selection, std::vector<VkPhysicalDeviceProperties> const& properties)
+{
+    // What the capabilities depend on: the devices, their drivers and the instance level queries.
+    std::vector<uint8_t> identity;
+    for (size_t gidx = 0; gidx < properties.size(); ++gidx)
+    {
+        VkPhysicalDeviceProperties const& device = properties[gidx];
+        uint32_t const ids[4] = { device.vendorID, device.deviceID, device.driverVersion, device.apiVersion };
+        identity.insert(identity.end(), reinterpret_cast<uint8_t const*>(ids), reinterpret_cast<uint8_t const*>(ids + 4));
+        identity.insert(identity.end(), device.pipelineCacheUUID, device.pipelineCacheUUID + VK_UUID_SIZE);
+        identity.insert(identity.end(), device.deviceName, device.deviceName + strlen(device.deviceName));
+    }
+    identity.push_back(selection.properties2 ? 1 : 0);
+    identity.push_back(selection.device_ids ? 1 : 0);
+    return hash_bytes(identity.data(), identity.size());
+}
+
+static char const* load_device_profile(DeviceSelection const& selection, std::vector<VkPhysicalDeviceProperties> const& properties,
+                                       DeviceProfileHeader* out_header, DeviceCapabilities* out_capabilities)
+{
+    MappedFile file;
+    if (!map_file(selection.profile_path, &file))
+    {
+        return "missing";
+    }
+    char const* reason = nullptr;
+    if (file.size != sizeof(DeviceProfileHeader) + sizeof(DeviceCapabilities))
+    {
+        reason = "bad size";
+    }
+    else
+    {
+        memcpy(out_header, file.data, sizeof(DeviceProfileHeader));
+        memcpy(out_capabilities, static_cast<char const*>(file.data) + sizeof(DeviceProfileHeader), sizeof(DeviceCapabilities));
+        if ((out_header->magic != DEVICE_PROFILE_MAGIC) || (out_header->version != DEVICE_PROFILE_VERSION) ||
+            (out_header->capabilities_size != sizeof(DeviceCapabilities)))
+        {
+            reason = "unknown format";
+        }
+        else if ((out_header->device_set_hash != selection.device_set_hash) || (out_header->device_index >= properties.size()))
+        {
+            reason = "devices or drivers changed";
+        }
+        else
+        {
+            // Same set of devices, the index still has to point at the same one.
+            VkPhysicalDeviceProperties const& saved = out_capabilities->properties;
+            VkPhysicalDeviceProperties const& current = properties[out_header->device_index];
+            if ((saved.vendorID != current.vendorID) || (saved.deviceID != current.deviceID) || (saved.driverVersion != current.driverVersion) ||
+                (memcmp(saved.pipelineCacheUUID, current.pipelineCacheUUID, VK_UUID_SIZE) != 0) || (strcmp(saved.deviceName, current.deviceName) != 0))
+            {
+                reason = "devices reordered";
+            }
+        }
+    }
+    unmap_file(file);
+    return reason;
+}
+
+VkResult select_physical_devices(VkInstance instance, DeviceSelection& selection, bool use_profile, std::vector<DeviceCandidate>* out_candidates)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    out_candidates->clear();
+    selection.profile_hit = false;
+    selection.profile_reject_reason = nullptr;
+
+    uint32_t gpu_count = 0;
+    VK_THROW(vkEnumeratePhysicalDevices(instance, &gpu_count, nullptr));
+    std::vector<VkPhysicalDevice> gpus(gpu_count);
+    VK_THROW(vkEnumeratePhysicalDevices(instance, &gpu_count, gpus.data()));
+    if (gpu_count == 0)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    // Read every launch, they tell whether the profile still describes these devices.
+    std::vector<VkPhysicalDeviceProperties> properties(gpu_count);
+    for (uint32_t gidx = 0; gidx < gpu_count; ++gidx)
+    {
+        memset(&properties[gidx], 0, sizeof(VkPhysicalDeviceProperties));
+        vkGetPhysicalDeviceProperties(gpus[gidx], &properties[gidx]);
+    }
+    selection.device_set_hash = hash_device_set(selection, properties);
+
+    if (use_profile && (selection.profile_path != nullptr))
+    {
+        DeviceCandidate cached;
+        DeviceProfileHeader header;
+        char const* reason = load_device_profile(selection, properties, &header, &cached.capabilities);
+        if ((reason == nullptr) && (selection.override_device != nullptr) &&
+            !match_device_override(selection.override_device, header.device_index, cached.capabilities.properties,
+                                   cached.capabilities.has_device_uuid ? cached.capabilities.device_uuid : nullptr))
+        {
+            reason = "--gpu names another device";
+        }
+        if (reason == nullptr)
+        {
+            // The properties were read anyway, the fresh ones win.
+            cached.capabilities.properties = properties[header.device_index];
+            cached.gpu = gpus[header.device_index];
+            cached.index = header.device_index;
+            cached.score = 0;
+            out_candidates->push_back(cached);
+            selection.profile_hit = true;
+            selection.query_ms = header.query_ms;
+            selection.select_ms = elapsed_ms(start, std::chrono::steady_clock::now());
+            return VK_SUCCESS;
+        }
+        // A missing profile is a first launch, not worth reporting.
+        selection.profile_reject_reason = (strcmp(reason, "missing") == 0) ? nullptr : reason;
+    }
+
+    bool any_match = false;
+    std::vector<DeviceCandidate> candidates(gpu_count);
+    for (uint32_t gidx = 0; gidx < gpu_count; ++gidx)
+    {
+        DeviceCandidate& candidate = candidates[gidx];
+        candidate.gpu = gpus[gidx];
+        candidate.index = gidx;
+        query_device_capabilities(gpus[gidx], selection.properties2, selection.device_ids, &candidate.capabilities);
+        char const* reason = nullptr;
+        candidate.score = score_device(candidate.capabilities, selection.requirements, &reason);
+        DeviceCapabilities const& capabilities = candidate.capabilities;
+        std::cout << "GPU " << gidx << ": " << capabilities.properties.deviceName << ", " << device_type_name(capabilities.properties.deviceType)
+                  << ", api " << VK_VERSION_MAJOR(capabilities.properties.apiVersion) << "." << VK_VERSION_MINOR(capabilities.properties.apiVersion)
+                  << "." << VK_VERSION_PATCH(capabilities.properties.apiVersion) << ", driver 0x" << std::hex << capabilities.properties.driverVersion << std::dec;
+        if (candidate.score < 0)
+        {
+            std::cout << ", unusable: " << reason << "\n";
+            continue;
+        }
+        std::cout << ", score " << candidate.score << "\n";
+        if ((selection.override_device != nullptr) &&
+            match_device_override(selection.override_device, gidx, capabilities.properties, capabilities.has_device_uuid ? capabilities.device_uuid : nullptr))
+        {
+            any_match = true;
+            candidate.score = INT64_MAX;
+        }
+    }
+    if ((selection.override_device != nullptr) && !any_match)
+    {
+        std::cout << "--gpu " << selection.override_device << " matches no usable device, going by score\n";
+    }
+    for (uint32_t gidx = 0; gidx < gpu_count; ++gidx)
+    {
+        if (candidates[gidx].score >= 0)
+        {
+            out_candidates->push_back(candidates[gidx]);
+        }
+    }
+    // Ties keep the enumeration order.
+    std::stable_sort(out_candidates->begin(), out_candidates->end(), [](DeviceCandidate const& a, DeviceCandidate const& b) { return a.score > b.score; });
+    selection.select_ms = elapsed_ms(start, std::chrono::steady_clock::now());
+    selection.query_ms = selection.select_ms;
+    return out_candidates->empty() ? VK_ERROR_INCOMPATIBLE_DRIVER : VK_SUCCESS;
+}
+
+bool save_device_profile(DeviceSelection const& selection, DeviceCandidate const& candidate)
+{
+    if ((selection.profile_path == nullptr) || selection.profile_hit)
+    {
+        return true;
+    }
+    DeviceProfileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DEVICE_PROFILE_MAGIC;
+    header.version = DEVICE_PROFILE_VERSION;
+    header.capabilities_size = sizeof(DeviceCapabilities);
+    header.device_index = candidate.index;
+    header.device_set_hash = selection.device_set_hash;
+    header.query_ms = selection.query_ms;
+    std::vector<char> data(sizeof(header) + sizeof(DeviceCapabilities));
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + sizeof(header), &candidate.capabilities, sizeof(DeviceCapabilities));
+    if (!write_file_atomic(selection.profile_path, data.data(), data.size()))
+    {
+        std::cout << "Unable to write the device profile to " << selection.profile_path << "\n";
+        return false;
+    }
+    return true;
+}
+
+void print_device_selection(DeviceSelection const& selection, DeviceCandidate const& candidate)
+{
+    std::cout << "Device: " << candidate.capabilities.properties.deviceName << " (GPU " << candidate.index << "), selected in " << selection.select_ms << " ms";
+    if (selection.profile_hit)
+    {
+        // query_ms is what the full query took on the launch that saved the profile.
+        std::cout << " from the profile, " << selection.query_ms - selection.select_ms << " ms saved";
+    }
+    std::cout << "\n";
+    if (selection.profile_reject_reason != nullptr)
+    {
+        std::cout << "Device profile ignored: " << selection.profile_reject_reason << "\n";
+    }
+}
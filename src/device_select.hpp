@@ -0,0 +1,87 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+// Physical device selection. Every device is queried and scored: by type, device local memory,
+// queue family layout and the optional features and extensions the renderer makes use of; devices
+// missing a hard requirement are left out. --gpu overrides the score by index, device UUID or name.
+//
+// The capabilities of the device that got created are saved to a profile. On later launches, while
+// the devices and drivers enumerated are the same, the profile stands in for the queries and the
+// scoring: only the properties every launch needs to recognize the devices are read.
+
+enum DeviceExtensionBits
+{
+    DEVICE_EXTENSION_SWAPCHAIN = 0x1,
+    DEVICE_EXTENSION_DRAW_INDIRECT_COUNT = 0x2,
+    DEVICE_EXTENSION_MEMORY_BUDGET = 0x4,
+    DEVICE_EXTENSION_DESCRIPTOR_INDEXING = 0x8,
+    DEVICE_EXTENSION_MAINTENANCE3 = 0x10
+};
+
+static const uint32_t MAX_PROFILE_QUEUE_FAMILIES = 16;
+
+// What device creation needs to know about a device. Plain data, the profile is a copy of it.
+struct DeviceCapabilities
+{
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceFeatures features;
+    VkPhysicalDeviceMemoryProperties memory;
+    uint32_t queue_family_count;    // the first MAX_PROFILE_QUEUE_FAMILIES, no device has more
+    VkQueueFamilyProperties queue_families[MAX_PROFILE_QUEUE_FAMILIES];
+    uint32_t extensions;            // DeviceExtensionBits
+    VkBool32 bindless_indexing;     // every descriptor indexing feature BindlessTable needs, and VK_KHR_maintenance3
+    VkBool32 storage_buffer_non_uniform;
+    VkBool32 has_device_uuid;
+    uint8_t device_uuid[VK_UUID_SIZE];
+};
+
+struct DeviceRequirements
+{
+    uint32_t min_image_dimension_2d;
+    uint32_t min_compute_group_size;    // x, the compute shaders run 64 wide
+    VkDeviceSize min_device_local;      // largest device local heap
+};
+
+struct DeviceCandidate
+{
+    VkPhysicalDevice gpu;
+    uint32_t index;                 // in the enumeration order
+    int64_t score;
+    DeviceCapabilities capabilities;
+};
+
+struct DeviceSelection
+{
+    char const* override_device;    // index, device UUID in hex or part of the name, nullptr to go by score
+    char const* profile_path;       // nullptr for no profile at all
+    bool load_profile;              // false queries every device, the profile is still written
+    DeviceRequirements requirements;
+    bool properties2;               // set by init_Vulkan(): extended feature queries are available
+    bool device_ids;                // set by init_Vulkan(): device UUIDs can be queried
+
+    bool profile_hit;
+    char const* profile_reject_reason;  // why the profile on disk was ignored, nullptr on a hit or without one
+    uint64_t device_set_hash;       // identifies the devices and drivers enumerated
+    double select_ms;               // enumerate, query and rank
+    double query_ms;                // full query and rank: this launch's, or on a hit the one saved with the profile
+};
+
+// Scores every device, profile in vk_test.device_profile.
+void init_device_selection(DeviceSelection* out_selection);
+
+void query_device_capabilities(VkPhysicalDevice gpu, bool properties2, bool device_ids, DeviceCapabilities* out_capabilities);
+// Negative with out_reason set when a requirement isn't met.
+int64_t score_device(DeviceCapabilities const& capabilities, DeviceRequirements const& requirements, char const** out_reason);
+// uuid is nullptr when unknown.
+bool match_device_override(char const* override_device, uint32_t index, VkPhysicalDeviceProperties const& properties, uint8_t const* uuid);
+
+// Devices to try, best first; a profile hit is the single device it names. use_profile false
+// skips the profile even when selection.load_profile is set.
+VkResult select_physical_devices(VkInstance instance, DeviceSelection& selection, bool use_profile, std::vector<DeviceCandidate>* out_candidates);
+// For the candidate the device was created on, skipped on a profile hit.
+bool save_device_profile(DeviceSelection const& selection, DeviceCandidate const& candidate);
+void print_device_selection(DeviceSelection const& selection, DeviceCandidate const& candidate);
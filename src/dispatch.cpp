@@ -0,0 +1,112 @@
+#include "dispatch.hpp"
+#include "handles.hpp"
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#define VK_DEFINE_FUNCTION(name) PFN_##name name = nullptr;
+PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr = nullptr;
+VK_GLOBAL_FUNCTIONS(VK_DEFINE_FUNCTION)
+VK_INSTANCE_FUNCTIONS(VK_DEFINE_FUNCTION)
+VK_DEVICE_FUNCTIONS(VK_DEFINE_FUNCTION)
+#undef VK_DEFINE_FUNCTION
+
+#ifdef _WIN32
+static HMODULE vulkan_library = nullptr;
+#else
+static void* vulkan_library = nullptr;
+#endif
+
+bool load_vulkan_library()
+{
+    if (vulkan_library != nullptr)
+    {
+        return true;
+    }
+#ifdef _WIN32
+    vulkan_library = LoadLibraryA("vulkan-1.dll");
+    if (vulkan_library == nullptr)
+    {
+        return false;
+    }
+    vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr)GetProcAddress(vulkan_library, "vkGetInstanceProcAddr");
+#else
+    vulkan_library = dlopen("libvulkan.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (vulkan_library == nullptr)
+    {
+        vulkan_library = dlopen("libvulkan.so", RTLD_NOW | RTLD_LOCAL);
+    }
+    if (vulkan_library == nullptr)
+    {
+        return false;
+    }
+    vkGetInstanceProcAddr = (PFN_vkGetInstanceProcAddr)dlsym(vulkan_library, "vkGetInstanceProcAddr");
+#endif
+    if (vkGetInstanceProcAddr == nullptr)
+    {
+        unload_vulkan_library();
+        return false;
+    }
+#define VK_LOAD_GLOBAL(name) name = (PFN_##name)vkGetInstanceProcAddr(VK_NULL_HANDLE, #name);
+    VK_GLOBAL_FUNCTIONS(VK_LOAD_GLOBAL)
+#undef VK_LOAD_GLOBAL
+    track_handle_functions();
+    return true;
+}
+
+void unload_vulkan_library()
+{
+    if (vulkan_library == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    FreeLibrary(vulkan_library);
+#else
+    dlclose(vulkan_library);
+#endif
+    vulkan_library = nullptr;
+    vkGetInstanceProcAddr = nullptr;
+}
+
+void load_instance_functions(VkInstance instance)
+{
+#define VK_LOAD_INSTANCE(name) name = (PFN_##name)vkGetInstanceProcAddr(instance, #name);
+    VK_INSTANCE_FUNCTIONS(VK_LOAD_INSTANCE)
+#undef VK_LOAD_INSTANCE
+    track_handle_functions();
+}
+
+void load_device_dispatch(VkDevice device, DeviceDispatch* out_dispatch)
+{
+    out_dispatch->device = device;
+#define VK_LOAD_DEVICE(name) out_dispatch->name = (PFN_##name)vkGetDeviceProcAddr(device, #name);
+    VK_DEVICE_FUNCTIONS(VK_LOAD_DEVICE)
+#undef VK_LOAD_DEVICE
+}
+
+// Owner of the global device pointers, null while none uses them.
+static VkDevice global_device = VK_NULL_HANDLE;
+
+bool use_device_dispatch(DeviceDispatch const& dispatch)
+{
+    if ((global_device != VK_NULL_HANDLE) && (global_device != dispatch.device))
+    {
+        return false;
+    }
+    global_device = dispatch.device;
+#define VK_USE_DEVICE(name) name = dispatch.name;
+    VK_DEVICE_FUNCTIONS(VK_USE_DEVICE)
+#undef VK_USE_DEVICE
+    track_handle_functions();
+    return true;
+}
+
+void release_device_dispatch(VkDevice device)
+{
+    if (global_device == device)
+    {
+        global_device = VK_NULL_HANDLE;
+    }
+}
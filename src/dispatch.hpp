@@ -0,0 +1,195 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+// The Vulkan library is opened at runtime and every entry point is a function pointer with the
+// prototype's name, so the rest of the code calls vkFoo() as before (config.hpp defines
+// VK_NO_PROTOTYPES). Device level pointers come from vkGetDeviceProcAddr and go straight to the
+// driver instead of through the loader trampoline that looks the dispatch table up on every call.
+// Each device gets its own DeviceDispatch; the global pointers are process wide and a copy of the
+// table of a single device at a time, see use_device_dispatch(). Code that drives a second device
+// calls through its table.
+
+// Adding an entry point: put it in the list of the level it is loaded at.
+#define VK_GLOBAL_FUNCTIONS(X) \
+    X(vkCreateInstance) \
+    X(vkEnumerateInstanceExtensionProperties) \
+    X(vkEnumerateInstanceLayerProperties)
+
+#define VK_INSTANCE_FUNCTIONS(X) \
+    X(vkDestroyInstance) \
+    X(vkEnumeratePhysicalDevices) \
+    X(vkGetPhysicalDeviceProperties) \
+    X(vkGetPhysicalDeviceFeatures) \
+    X(vkGetPhysicalDeviceFormatProperties) \
+    X(vkGetPhysicalDeviceMemoryProperties) \
+    X(vkGetPhysicalDeviceQueueFamilyProperties) \
+    X(vkEnumerateDeviceExtensionProperties) \
+    X(vkCreateDevice) \
+    X(vkGetDeviceProcAddr) \
+    X(vkDestroySurfaceKHR) \
+    X(vkGetPhysicalDeviceSurfaceSupportKHR) \
+    X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR) \
+    X(vkGetPhysicalDeviceSurfaceFormatsKHR) \
+    X(vkGetPhysicalDeviceSurfacePresentModesKHR) \
+    VK_PROPERTIES2_INSTANCE_FUNCTIONS(X) \
+    VK_PLATFORM_INSTANCE_FUNCTIONS(X)
+
+// Left null when the instance extension is missing.
+#ifdef VK_KHR_get_physical_device_properties2
+#define VK_PROPERTIES2_INSTANCE_FUNCTIONS(X) \
+    X(vkGetPhysicalDeviceFeatures2KHR) \
+    X(vkGetPhysicalDeviceProperties2KHR) \
+    X(vkGetPhysicalDeviceMemoryProperties2KHR)
+#else
+#define VK_PROPERTIES2_INSTANCE_FUNCTIONS(X)
+#endif
+
+#if defined(VK_USE_PLATFORM_WIN32_KHR)
+#define VK_PLATFORM_INSTANCE_FUNCTIONS(X) \
+    X(vkCreateWin32SurfaceKHR)
+#elif defined(VK_USE_PLATFORM_XLIB_KHR)
+#define VK_PLATFORM_INSTANCE_FUNCTIONS(X) \
+    X(vkCreateXlibSurfaceKHR)
+#else
+#define VK_PLATFORM_INSTANCE_FUNCTIONS(X)
+#endif
+
+#ifdef VK_KHR_draw_indirect_count
+#define VK_DRAW_INDIRECT_COUNT_FUNCTIONS(X) \
+    X(vkCmdDrawIndexedIndirectCountKHR)
+#else
+#define VK_DRAW_INDIRECT_COUNT_FUNCTIONS(X)
+#endif
+
+#define VK_DEVICE_FUNCTIONS(X) \
+    X(vkDestroyDevice) \
+    X(vkGetDeviceQueue) \
+    X(vkDeviceWaitIdle) \
+    X(vkQueueSubmit) \
+    X(vkQueueWaitIdle) \
+    X(vkAllocateMemory) \
+    X(vkFreeMemory) \
+    X(vkMapMemory) \
+    X(vkUnmapMemory) \
+    X(vkFlushMappedMemoryRanges) \
+    X(vkInvalidateMappedMemoryRanges) \
+    X(vkBindBufferMemory) \
+    X(vkBindImageMemory) \
+    X(vkGetBufferMemoryRequirements) \
+    X(vkGetImageMemoryRequirements) \
+    X(vkCreateFence) \
+    X(vkDestroyFence) \
+    X(vkResetFences) \
+    X(vkGetFenceStatus) \
+    X(vkWaitForFences) \
+    X(vkCreateSemaphore) \
+    X(vkDestroySemaphore) \
+    X(vkCreateQueryPool) \
+    X(vkDestroyQueryPool) \
+    X(vkGetQueryPoolResults) \
+    X(vkCreateBuffer) \
+    X(vkDestroyBuffer) \
+    X(vkCreateImage) \
+    X(vkDestroyImage) \
+    X(vkCreateImageView) \
+    X(vkDestroyImageView) \
+    X(vkCreateSampler) \
+    X(vkDestroySampler) \
+    X(vkCreateShaderModule) \
+    X(vkDestroyShaderModule) \
+    X(vkCreatePipelineCache) \
+    X(vkDestroyPipelineCache) \
+    X(vkGetPipelineCacheData) \
+    X(vkCreateGraphicsPipelines) \
+    X(vkCreateComputePipelines) \
+    X(vkDestroyPipeline) \
+    X(vkCreatePipelineLayout) \
+    X(vkDestroyPipelineLayout) \
+    X(vkCreateDescriptorSetLayout) \
+    X(vkDestroyDescriptorSetLayout) \
+    X(vkCreateDescriptorPool) \
+    X(vkDestroyDescriptorPool) \
+    X(vkResetDescriptorPool) \
+    X(vkAllocateDescriptorSets) \
+    X(vkFreeDescriptorSets) \
+    X(vkUpdateDescriptorSets) \
+    X(vkCreateFramebuffer) \
+    X(vkDestroyFramebuffer) \
+    X(vkCreateRenderPass) \
+    X(vkDestroyRenderPass) \
+    X(vkCreateCommandPool) \
+    X(vkDestroyCommandPool) \
+    X(vkResetCommandPool) \
+    X(vkAllocateCommandBuffers) \
+    X(vkFreeCommandBuffers) \
+    X(vkBeginCommandBuffer) \
+    X(vkEndCommandBuffer) \
+    X(vkResetCommandBuffer) \
+    X(vkCmdBindPipeline) \
+    X(vkCmdSetViewport) \
+    X(vkCmdSetScissor) \
+    X(vkCmdSetLineWidth) \
+    X(vkCmdBindDescriptorSets) \
+    X(vkCmdBindIndexBuffer) \
+    X(vkCmdBindVertexBuffers) \
+    X(vkCmdDraw) \
+    X(vkCmdDrawIndexed) \
+    X(vkCmdDrawIndirect) \
+    X(vkCmdDrawIndexedIndirect) \
+    VK_DRAW_INDIRECT_COUNT_FUNCTIONS(X) \
+    X(vkCmdDispatch) \
+    X(vkCmdDispatchIndirect) \
+    X(vkCmdCopyBuffer) \
+    X(vkCmdCopyImage) \
+    X(vkCmdBlitImage) \
+    X(vkCmdCopyBufferToImage) \
+    X(vkCmdCopyImageToBuffer) \
+    X(vkCmdUpdateBuffer) \
+    X(vkCmdFillBuffer) \
+    X(vkCmdClearColorImage) \
+    X(vkCmdClearDepthStencilImage) \
+    X(vkCmdClearAttachments) \
+    X(vkCmdPipelineBarrier) \
+    X(vkCmdBeginQuery) \
+    X(vkCmdEndQuery) \
+    X(vkCmdResetQueryPool) \
+    X(vkCmdWriteTimestamp) \
+    X(vkCmdPushConstants) \
+    X(vkCmdBeginRenderPass) \
+    X(vkCmdNextSubpass) \
+    X(vkCmdEndRenderPass) \
+    X(vkCmdExecuteCommands) \
+    X(vkCreateSwapchainKHR) \
+    X(vkDestroySwapchainKHR) \
+    X(vkGetSwapchainImagesKHR) \
+    X(vkAcquireNextImageKHR) \
+    X(vkQueuePresentKHR)
+
+#define VK_DECLARE_FUNCTION(name) extern PFN_##name name;
+extern PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr;
+VK_GLOBAL_FUNCTIONS(VK_DECLARE_FUNCTION)
+VK_INSTANCE_FUNCTIONS(VK_DECLARE_FUNCTION)
+VK_DEVICE_FUNCTIONS(VK_DECLARE_FUNCTION)
+#undef VK_DECLARE_FUNCTION
+
+struct DeviceDispatch
+{
+    VkDevice device;
+#define VK_DECLARE_MEMBER(name) PFN_##name name;
+    VK_DEVICE_FUNCTIONS(VK_DECLARE_MEMBER)
+#undef VK_DECLARE_MEMBER
+};
+
+// False when the Vulkan library or vkGetInstanceProcAddr can't be found.
+bool load_vulkan_library();
+void unload_vulkan_library();
+void load_instance_functions(VkInstance instance);
+// Entry points of extensions the device was created without are null.
+void load_device_dispatch(VkDevice device, DeviceDispatch* out_dispatch);
+// Points the global vkFoo() device functions at dispatch. False, with nothing changed, while they
+// belong to another device that has not been released.
+bool use_device_dispatch(DeviceDispatch const& dispatch);
+// Once device is destroyed, another device may take the global pointers.
+void release_device_dispatch(VkDevice device);
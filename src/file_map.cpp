@@ -0,0 +1,144 @@
+#include "config.hpp"
+
+#include <cstdio>
+#include <string>
+
+#include "file_map.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool map_file(char const* path, MappedFile* out_file)
+{
+    out_file->data = nullptr;
+    out_file->size = 0;
+    out_file->mapping = NULL;
+    out_file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (out_file->file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(out_file->file, &size))
+    {
+        CloseHandle(out_file->file);
+        return false;
+    }
+    out_file->size = static_cast<size_t>(size.QuadPart);
+    if (out_file->size == 0)
+    {
+        return true;
+    }
+    out_file->mapping = CreateFileMappingA(out_file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (out_file->mapping == NULL)
+    {
+        CloseHandle(out_file->file);
+        return false;
+    }
+    out_file->data = MapViewOfFile(out_file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (out_file->data == nullptr)
+    {
+        CloseHandle(out_file->mapping);
+        CloseHandle(out_file->file);
+        return false;
+    }
+    return true;
+}
+
+void unmap_file(MappedFile& file)
+{
+    if (file.data != nullptr)
+    {
+        UnmapViewOfFile(file.data);
+    }
+    if (file.mapping != NULL)
+    {
+        CloseHandle(file.mapping);
+    }
+    CloseHandle(file.file);
+    file.data = nullptr;
+    file.size = 0;
+}
+
+static bool replace_file(char const* from, char const* to)
+{
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+#else
+
+bool map_file(char const* path, MappedFile* out_file)
+{
+    out_file->data = nullptr;
+    out_file->size = 0;
+    out_file->fd = open(path, O_RDONLY);
+    if (out_file->fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(out_file->fd, &info) != 0)
+    {
+        close(out_file->fd);
+        return false;
+    }
+    out_file->size = static_cast<size_t>(info.st_size);
+    if (out_file->size == 0)
+    {
+        return true;
+    }
+    void* data = mmap(nullptr, out_file->size, PROT_READ, MAP_PRIVATE, out_file->fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(out_file->fd);
+        return false;
+    }
+    out_file->data = data;
+    return true;
+}
+
+void unmap_file(MappedFile& file)
+{
+    if (file.data != nullptr)
+    {
+        munmap(const_cast<void*>(file.data), file.size);
+    }
+    close(file.fd);
+    file.data = nullptr;
+    file.size = 0;
+}
+
+static bool replace_file(char const* from, char const* to)
+{
+    return rename(from, to) == 0;
+}
+
+#endif
+
+bool write_file_atomic(char const* path, void const* data, size_t size)
+{
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool written = (fwrite(data, 1, size, file) == size);
+    written = (fflush(file) == 0) && written;
+#ifndef _WIN32
+    written = (fsync(fileno(file)) == 0) && written;
+#endif
+    written = (fclose(file) == 0) && written;
+    if (!written || !replace_file(tmp_path.c_str(), path))
+    {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file.
+struct MappedFile
+{
+    void const* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+// False when the file does not exist or can't be mapped. Empty files map to data == nullptr.
+bool map_file(char const* path, MappedFile* out_file);
+void unmap_file(MappedFile& file);
+
+// Writes to path.tmp then renames over path, readers never see a partially written file.
+bool write_file_atomic(char const* path, void const* data, size_t size);
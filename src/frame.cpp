@@ -0,0 +1,201 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <cassert>
+#include <iostream>
+
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "frame.hpp"
+#include "host_allocator.hpp"
+#include "swap_chain.hpp"
+
+static double elapsed_ms(frame_clock::time_point from, frame_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static void reset_window(FrameStats& stats, frame_clock::time_point now)
+{
+    stats.window_start = now;
+    stats.window_frames = 0;
+    stats.window_cpu_ms = 0.0;
+    stats.window_cpu_max_ms = 0.0;
+    stats.window_gpu_wait_ms = 0.0;
+}
+
+VkResult create_frame_loop(VkDevice device, VkCommandPool command_pool, uint32_t frames_in_flight, uint32_t image_count, FrameLoop* out_loop)
+{
+    assert(frames_in_flight > 0);
+    out_loop->frames.resize(frames_in_flight);
+    out_loop->image_fences.assign(image_count, VK_NULL_HANDLE);
+    out_loop->frame_idx = 0;
+    out_loop->image_idx = 0;
+    out_loop->frame_number = 0;
+    out_loop->frames_completed = 0;
+    init_deletion_queue(&out_loop->deletion_queue);
+    out_loop->stats.cpu_frame_ms = 0.0;
+    out_loop->stats.gpu_wait_ms = 0.0;
+    reset_window(out_loop->stats, frame_clock::now());
+
+    std::vector<VkCommandBuffer> command_buffers(frames_in_flight);
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_allocate_info.pNext = nullptr;
+    command_buffer_allocate_info.commandPool = command_pool;
+    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_allocate_info.commandBufferCount = frames_in_flight;
+    VK_THROW(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, command_buffers.data()));
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;   // first wait on every slot returns immediately
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = nullptr;
+    semaphore_info.flags = 0;
+
+    for (uint32_t fidx = 0; fidx < frames_in_flight; ++fidx)
+    {
+        FrameData& frame = out_loop->frames[fidx];
+        frame.command_buffer = command_buffers[fidx];
+        frame.fence = VK_NULL_HANDLE;
+        frame.image_acquired = VK_NULL_HANDLE;
+        frame.render_done = VK_NULL_HANDLE;
+        frame.frame_number = 0;
+        VK_THROW(vkCreateFence(device, &fence_info, host_allocator(), &frame.fence));
+        VK_THROW(vkCreateSemaphore(device, &semaphore_info, host_allocator(), &frame.image_acquired));
+        VK_THROW(vkCreateSemaphore(device, &semaphore_info, host_allocator(), &frame.render_done));
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_frame_loop(VkDevice device, VkCommandPool command_pool, FrameLoop& loop)
+{
+    drain_deletion_queue(loop.deletion_queue);
+    for (size_t fidx = 0; fidx < loop.frames.size(); ++fidx)
+    {
+        FrameData& frame = loop.frames[fidx];
+        vkDestroySemaphore(device, frame.render_done, host_allocator());
+        vkDestroySemaphore(device, frame.image_acquired, host_allocator());
+        vkDestroyFence(device, frame.fence, host_allocator());
+        vkFreeCommandBuffers(device, command_pool, 1, &frame.command_buffer);
+    }
+    loop.frames.clear();
+    loop.image_fences.clear();
+}
+
+static VkResult rebuild_swap_chain(VkDevice device, SwapChain& swap_chain, FrameLoop& loop)
+{
+    // Frames before this one may still use the old images. Their fences don't cover the
+    // presentation engine, so the release also waits for one more round of frames.
+    uint64_t last_use_frame = loop.frame_number + loop.frames.size() - 1;
+    VK_THROW(recreate_swap_chain(device, swap_chain, loop.deletion_queue, last_use_frame));
+    loop.image_fences.assign(swap_chain.images.size(), VK_NULL_HANDLE);
+    return VK_SUCCESS;
+}
+
+VkResult begin_frame(VkDevice device, SwapChain& swap_chain, FrameLoop& loop, FrameData** out_frame)
+{
+    loop.frame_start = frame_clock::now();
+    FrameData& frame = loop.frames[loop.frame_idx];
+
+    // Only block when the GPU is frames_in_flight frames behind.
+    VK_THROW(vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX));
+    frame_clock::time_point waited = frame_clock::now();
+    loop.stats.gpu_wait_ms = elapsed_ms(loop.frame_start, waited);
+    // The slot fence covers the frame that last used it, and every frame before that one.
+    uint64_t slot_count = loop.frames.size();
+    loop.frames_completed = (loop.frame_number >= slot_count) ? (loop.frame_number - slot_count + 1) : 0;
+    flush_deletion_queue(loop.deletion_queue, loop.frames_completed);
+
+    if (swap_chain.out_of_date)
+    {
+        VK_THROW(rebuild_swap_chain(device, swap_chain, loop));
+    }
+    VkResult acquired = acquire_next_image(device, swap_chain, frame.image_acquired, &loop.image_idx);
+    if (acquired == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        // Nothing was acquired and the semaphore is untouched, retry on the new swap chain.
+        VK_THROW(rebuild_swap_chain(device, swap_chain, loop));
+        acquired = acquire_next_image(device, swap_chain, frame.image_acquired, &loop.image_idx);
+    }
+    VK_THROW(acquired);
+
+    // The image may still be used by an older frame when there are fewer images than frames in flight.
+    VkFence image_fence = loop.image_fences[loop.image_idx];
+    if ((image_fence != VK_NULL_HANDLE) && (image_fence != frame.fence))
+    {
+        VK_THROW(vkWaitForFences(device, 1, &image_fence, VK_TRUE, UINT64_MAX));
+        loop.stats.gpu_wait_ms += elapsed_ms(waited, frame_clock::now());
+    }
+    loop.image_fences[loop.image_idx] = frame.fence;
+
+    VK_THROW(vkResetFences(device, 1, &frame.fence));
+    VK_THROW(vkResetCommandBuffer(frame.command_buffer, 0));
+
+    VkCommandBufferBeginInfo command_buffer_begin_info = {};
+    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.pNext = nullptr;
+    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    command_buffer_begin_info.pInheritanceInfo = nullptr;
+    VK_THROW(vkBeginCommandBuffer(frame.command_buffer, &command_buffer_begin_info));
+
+    frame.frame_number = loop.frame_number;
+    *out_frame = &frame;
+    return VK_SUCCESS;
+}
+
+VkResult end_frame(VkQueue draw_queue, SwapChain& swap_chain, FrameLoop& loop, VkPipelineStageFlags acquire_wait_stage)
+{
+    FrameData& frame = loop.frames[loop.frame_idx];
+    VK_THROW(vkEndCommandBuffer(frame.command_buffer));
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitSemaphores = &frame.image_acquired;
+    submit_info.pWaitDstStageMask = &acquire_wait_stage;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &frame.command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &frame.render_done;
+    VK_THROW(vkQueueSubmit(draw_queue, 1, &submit_info, frame.fence));
+
+    // Suboptimal and out of date only flag the swap chain, begin_frame() recreates it.
+    VK_THROW(queue_present(swap_chain, frame.render_done, loop.image_idx));
+
+    loop.frame_idx = (loop.frame_idx + 1) % static_cast<uint32_t>(loop.frames.size());
+    ++loop.frame_number;
+
+    FrameStats& stats = loop.stats;
+    stats.cpu_frame_ms = elapsed_ms(loop.frame_start, frame_clock::now());
+    stats.window_frames += 1;
+    stats.window_cpu_ms += stats.cpu_frame_ms;
+    stats.window_gpu_wait_ms += stats.gpu_wait_ms;
+    if (stats.cpu_frame_ms > stats.window_cpu_max_ms)
+    {
+        stats.window_cpu_max_ms = stats.cpu_frame_ms;
+    }
+    return VK_SUCCESS;
+}
+
+void report_frame_stats(FrameLoop& loop, double interval_s)
+{
+    FrameStats& stats = loop.stats;
+    frame_clock::time_point now = frame_clock::now();
+    double window_ms = elapsed_ms(stats.window_start, now);
+    if ((window_ms < interval_s * 1000.0) || (stats.window_frames == 0))
+    {
+        return;
+    }
+    double frames = static_cast<double>(stats.window_frames);
+    std::cout << "frames in flight " << loop.frames.size()
+              << " | fps " << frames * 1000.0 / window_ms
+              << " | cpu " << stats.window_cpu_ms / frames << " ms (max " << stats.window_cpu_max_ms << ")"
+              << " | gpu wait " << stats.window_gpu_wait_ms / frames << " ms\n";
+    reset_window(stats, now);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <vector>
+
+#include "deletion_queue.hpp"
+
+struct SwapChain;
+
+typedef std::chrono::steady_clock frame_clock;
+
+struct FrameData
+{
+    VkCommandBuffer command_buffer;
+    VkFence fence;                  // signaled once the GPU is done with this slot
+    VkSemaphore image_acquired;
+    VkSemaphore render_done;
+    uint64_t frame_number;          // last frame recorded in this slot
+};
+
+struct FrameStats
+{
+    // last frame
+    double cpu_frame_ms;            // begin_frame() to end_frame() return, including gpu_wait_ms
+    double gpu_wait_ms;             // time blocked on the slot fence (CPU ran ahead of the GPU)
+
+    // current report window
+    frame_clock::time_point window_start;
+    uint32_t window_frames;
+    double window_cpu_ms;
+    double window_cpu_max_ms;
+    double window_gpu_wait_ms;
+};
+
+struct FrameLoop
+{
+    std::vector<FrameData> frames;
+    std::vector<VkFence> image_fences;  // fence of the frame currently using each swap chain image
+    uint32_t frame_idx;                 // slot of the frame being recorded
+    uint32_t image_idx;                 // swap chain image of the frame being recorded
+    uint64_t frame_number;
+    uint64_t frames_completed;          // frames known to have finished on the GPU
+    frame_clock::time_point frame_start;
+    FrameStats stats;
+    // Flushed by begin_frame(), defer with the frame_number of the frame being recorded.
+    DeletionQueue deletion_queue;
+};
+
+VkResult create_frame_loop(VkDevice device, VkCommandPool command_pool, uint32_t frames_in_flight, uint32_t image_count, FrameLoop* out_loop);
+// Runs every deferred destroy, the device must be idle.
+void destroy_frame_loop(VkDevice device, VkCommandPool command_pool, FrameLoop& loop);
+
+// Waits for the slot to be free, acquires a swap chain image and begins the slot command buffer.
+// An out of date swap chain is recreated here, before the acquire, without waiting for the
+// device; its old images go through the deletion queue. VK_NOT_READY while
+// the window is minimized, call again later.
+VkResult begin_frame(VkDevice device, SwapChain& swap_chain, FrameLoop& loop, FrameData** out_frame);
+// Ends the command buffer, submits it on draw_queue and presents.
+VkResult end_frame(VkQueue draw_queue, SwapChain& swap_chain, FrameLoop& loop, VkPipelineStageFlags acquire_wait_stage);
+
+// Prints and resets the window statistics once every interval_s seconds.
+void report_frame_stats(FrameLoop& loop, double interval_s);
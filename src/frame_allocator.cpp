@@ -0,0 +1,137 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "frame_allocator.hpp"
+
+static VkDeviceSize align_up(VkDeviceSize v, VkDeviceSize alignment)
+{
+    return ((v + alignment - 1) / alignment) * alignment;
+}
+
+VkResult create_frame_allocator(DeviceAllocator& allocator, VkPhysicalDevice gpu, VkDeviceSize capacity, uint32_t frames_in_flight, FrameAllocator* out_frame_allocator)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+    out_frame_allocator->uniform_alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+    out_frame_allocator->storage_alignment = std::max<VkDeviceSize>(properties.limits.minStorageBufferOffsetAlignment, 16);
+
+    // Wrapping skips to the start of the ring, keep the start aligned for every kind of use.
+    VkDeviceSize max_alignment = std::max(out_frame_allocator->uniform_alignment, out_frame_allocator->storage_alignment);
+    assert(capacity <= UINT32_MAX);     // dynamic offsets are 32 bit
+    out_frame_allocator->capacity = align_up(capacity, max_alignment);
+    out_frame_allocator->head = 0;
+    out_frame_allocator->tail = 0;
+    out_frame_allocator->frame_begin = 0;
+    out_frame_allocator->slot_end.assign(frames_in_flight, 0);
+    out_frame_allocator->slot = 0;
+    out_frame_allocator->stats.frame_bytes = 0;
+    out_frame_allocator->stats.frame_high_water = 0;
+    out_frame_allocator->stats.ring_high_water = 0;
+    out_frame_allocator->stats.failed_allocations = 0;
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = out_frame_allocator->capacity;
+    buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    VK_THROW(create_buffer(allocator, buffer_info, MEMORY_CPU_TO_GPU, &out_frame_allocator->memory));
+    out_frame_allocator->buffer = out_frame_allocator->memory->buffer;
+    out_frame_allocator->mapped = static_cast<char*>(out_frame_allocator->memory->mapped);
+    assert(out_frame_allocator->mapped != nullptr);
+    return VK_SUCCESS;
+}
+
+void destroy_frame_allocator(DeviceAllocator& allocator, FrameAllocator& frame_allocator)
+{
+    destroy_buffer(allocator, frame_allocator.memory);
+    frame_allocator.memory = nullptr;
+    frame_allocator.buffer = VK_NULL_HANDLE;
+    frame_allocator.mapped = nullptr;
+}
+
+void begin_frame_allocations(FrameAllocator& frame_allocator, uint32_t frame_idx)
+{
+    assert(frame_idx < frame_allocator.slot_end.size());
+    // Frames retire in submission order: once this slot's fence signaled, every byte allocated
+    // up to the end of its previous frame is free again.
+    frame_allocator.tail = std::max(frame_allocator.tail, frame_allocator.slot_end[frame_idx]);
+    frame_allocator.slot = frame_idx;
+    frame_allocator.frame_begin = frame_allocator.head;
+    frame_allocator.stats.frame_bytes = 0;
+}
+
+VkResult end_frame_allocations(DeviceAllocator& allocator, FrameAllocator& frame_allocator)
+{
+    FrameAllocatorStats& stats = frame_allocator.stats;
+    stats.frame_high_water = std::max(stats.frame_high_water, stats.frame_bytes);
+    stats.ring_high_water = std::max(stats.ring_high_water, frame_allocator.head - frame_allocator.tail);
+    frame_allocator.slot_end[frame_allocator.slot] = frame_allocator.head;
+
+    if (frame_allocator.head == frame_allocator.frame_begin)
+    {
+        return VK_SUCCESS;
+    }
+    // The frame range may wrap, flush_allocation() is a no-op on coherent memory.
+    VkDeviceSize begin = frame_allocator.frame_begin % frame_allocator.capacity;
+    VkDeviceSize end = frame_allocator.head % frame_allocator.capacity;
+    if ((end > begin) && (frame_allocator.head - frame_allocator.frame_begin < frame_allocator.capacity))
+    {
+        return flush_allocation(allocator, frame_allocator.memory, begin, end - begin);
+    }
+    return flush_allocation(allocator, frame_allocator.memory, 0, VK_WHOLE_SIZE);
+}
+
+VkResult transient_allocate(FrameAllocator& frame_allocator, VkDeviceSize size, VkDeviceSize alignment, TransientAllocation* out_allocation)
+{
+    VkDeviceSize const capacity = frame_allocator.capacity;
+    VkDeviceSize offset = align_up(frame_allocator.head, std::max<VkDeviceSize>(alignment, 1));
+    if ((offset % capacity) + size > capacity)
+    {
+        offset = align_up(offset, capacity);    // does not fit before the end, restart at the beginning
+    }
+    if ((size > capacity) || (offset + size - frame_allocator.tail > capacity))
+    {
+        frame_allocator.stats.failed_allocations += 1;
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+    frame_allocator.stats.frame_bytes += offset + size - frame_allocator.head;
+    frame_allocator.head = offset + size;
+
+    VkDeviceSize ring_offset = offset % capacity;
+    out_allocation->buffer = frame_allocator.buffer;
+    out_allocation->offset = ring_offset;
+    out_allocation->data = frame_allocator.mapped + ring_offset;
+    out_allocation->dynamic_offset = static_cast<uint32_t>(ring_offset);
+    return VK_SUCCESS;
+}
+
+VkResult transient_uniform(FrameAllocator& frame_allocator, VkDeviceSize size, TransientAllocation* out_allocation)
+{
+    return transient_allocate(frame_allocator, size, frame_allocator.uniform_alignment, out_allocation);
+}
+
+VkResult transient_storage(FrameAllocator& frame_allocator, VkDeviceSize size, TransientAllocation* out_allocation)
+{
+    return transient_allocate(frame_allocator, size, frame_allocator.storage_alignment, out_allocation);
+}
+
+void print_frame_allocator_stats(FrameAllocator const& frame_allocator)
+{
+    FrameAllocatorStats const& stats = frame_allocator.stats;
+    std::cout << "frame allocator: " << frame_allocator.capacity / 1024 << " KiB ring"
+              << " | frame high water " << stats.frame_high_water / 1024 << " KiB"
+              << " | ring high water " << stats.ring_high_water / 1024 << " KiB"
+              << " | failed " << stats.failed_allocations << "\n";
+}
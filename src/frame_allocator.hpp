@@ -0,0 +1,62 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+struct DeviceAllocator;
+struct GpuAllocation;
+
+// Ring of per-frame transient data (uniforms, dynamic vertices, staging) in one persistently
+// mapped buffer. Every frame bumps a head pointer; the space a frame used is handed back when
+// begin_frame_allocations() runs again for its slot, i.e. after the slot fence has signaled.
+struct TransientAllocation
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void* data;                     // write only, host visible mapping of offset
+    uint32_t dynamic_offset;        // offset for a *_DYNAMIC descriptor bound at offset 0
+};
+
+struct FrameAllocatorStats
+{
+    VkDeviceSize frame_bytes;       // allocated by the frame being recorded
+    VkDeviceSize frame_high_water;  // biggest single frame so far
+    VkDeviceSize ring_high_water;   // most bytes ever in flight at once, size the ring from this
+    uint32_t failed_allocations;    // allocations refused because the ring was full
+};
+
+struct FrameAllocator
+{
+    GpuAllocation* memory;
+    VkBuffer buffer;
+    char* mapped;
+    VkDeviceSize capacity;
+    VkDeviceSize uniform_alignment;     // minUniformBufferOffsetAlignment
+    VkDeviceSize storage_alignment;     // minStorageBufferOffsetAlignment
+
+    // Monotonic byte counters, the ring position is counter % capacity.
+    VkDeviceSize head;
+    VkDeviceSize tail;                  // everything before tail is no longer read by the GPU
+    VkDeviceSize frame_begin;
+    std::vector<VkDeviceSize> slot_end; // head when each frame slot was last submitted
+    uint32_t slot;
+
+    FrameAllocatorStats stats;
+};
+
+VkResult create_frame_allocator(DeviceAllocator& allocator, VkPhysicalDevice gpu, VkDeviceSize capacity, uint32_t frames_in_flight, FrameAllocator* out_frame_allocator);
+void destroy_frame_allocator(DeviceAllocator& allocator, FrameAllocator& frame_allocator);
+
+// Call once the fence of frame_idx has been waited on, before the first allocation of the frame.
+void begin_frame_allocations(FrameAllocator& frame_allocator, uint32_t frame_idx);
+// Call before submitting the frame, flushes the frame range when the memory is not coherent.
+VkResult end_frame_allocations(DeviceAllocator& allocator, FrameAllocator& frame_allocator);
+
+// VK_ERROR_OUT_OF_DEVICE_MEMORY when the ring is full, the caller decides whether to skip work.
+VkResult transient_allocate(FrameAllocator& frame_allocator, VkDeviceSize size, VkDeviceSize alignment, TransientAllocation* out_allocation);
+VkResult transient_uniform(FrameAllocator& frame_allocator, VkDeviceSize size, TransientAllocation* out_allocation);
+VkResult transient_storage(FrameAllocator& frame_allocator, VkDeviceSize size, TransientAllocation* out_allocation);
+
+void print_frame_allocator_stats(FrameAllocator const& frame_allocator);
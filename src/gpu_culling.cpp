@@ -0,0 +1,488 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "descriptors.hpp"
+#include "device.hpp"
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "gpu_culling.hpp"
+#include "host_allocator.hpp"
+#include "immediate.hpp"
+#include "pipeline_cache.hpp"
+
+static VkResult create_cull_buffer(DeviceAllocator& allocator, VkDeviceSize size, VkBufferUsageFlags usage, UniqueBuffer* out_buffer)
+{
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = size;
+    buffer_info.usage = usage;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    GpuAllocation* allocation = nullptr;
+    VK_THROW(create_buffer(allocator, buffer_info, MEMORY_GPU_ONLY, &allocation));
+    *out_buffer = UniqueBuffer(&allocator, allocation);
+    return VK_SUCCESS;
+}
+
+static VkResult create_pyramid_view(VkDevice device, VkImage image, uint32_t base_level, uint32_t level_count, VkImageView* out_view)
+{
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.pNext = nullptr;
+    view_info.flags = 0;
+    view_info.image = image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = VK_FORMAT_R32_SFLOAT;
+    view_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.baseMipLevel = base_level;
+    view_info.subresourceRange.levelCount = level_count;
+    view_info.subresourceRange.baseArrayLayer = 0;
+    view_info.subresourceRange.layerCount = 1;
+    return vkCreateImageView(device, &view_info, host_allocator(), out_view);
+}
+
+static VkResult create_depth_pyramid(VkDevice device, DeviceAllocator& allocator, uint32_t depth_width, uint32_t depth_height, DepthPyramid* out_pyramid)
+{
+    // Rounded down so every level below 0 halves exactly, the reduction into level 0 takes care
+    // of the footprints that are not 2x2.
+    uint32_t width = 1;
+    while (width * 2 <= depth_width)
+    {
+        width *= 2;
+    }
+    uint32_t height = 1;
+    while (height * 2 <= depth_height)
+    {
+        height *= 2;
+    }
+    uint32_t levels = 1;
+    while ((std::max(width, height) >> levels) > 0)
+    {
+        ++levels;
+    }
+    out_pyramid->width = width;
+    out_pyramid->height = height;
+    out_pyramid->levels = levels;
+    out_pyramid->has_source = false;
+    out_pyramid->initialized = false;
+    out_pyramid->built = false;
+
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.pNext = nullptr;
+    image_info.flags = 0;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R32_SFLOAT;
+    image_info.extent.width = width;
+    image_info.extent.height = height;
+    image_info.extent.depth = 1;
+    image_info.mipLevels = levels;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.queueFamilyIndexCount = 0;
+    image_info.pQueueFamilyIndices = nullptr;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VK_THROW(create_image(allocator, image_info, MEMORY_GPU_ONLY, &out_pyramid->image, &out_pyramid->memory));
+
+    VK_THROW(create_pyramid_view(device, out_pyramid->image, 0, levels, &out_pyramid->view));
+    out_pyramid->level_views.assign(levels, VK_NULL_HANDLE);
+    for (uint32_t lidx = 0; lidx < levels; ++lidx)
+    {
+        VK_THROW(create_pyramid_view(device, out_pyramid->image, lidx, 1, &out_pyramid->level_views[lidx]));
+    }
+    return VK_SUCCESS;
+}
+
+static VkResult request_cull_pipeline(PipelineManager& pipelines, ShaderModuleCache& shader_cache, char const* name, char const* path, VkPipelineLayout layout,
+    PipelineHandle* out_pipeline)
+{
+    VkShaderModule module = VK_NULL_HANDLE;
+    VK_THROW(load_shader_module(shader_cache, path, &module));
+    ComputePipelineDesc pipeline_desc;
+    pipeline_desc.name = name;
+    pipeline_desc.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_desc.stage.module = module;
+    pipeline_desc.stage.entry = "main";
+    pipeline_desc.layout = layout;
+    *out_pipeline = request_compute_pipeline(pipelines, pipeline_desc, 0);
+    return VK_SUCCESS;
+}
+
+static VkResult setup_gpu_culling(VkDevice device, DrawCommandBuffer const& draw, DeviceAllocator& allocator, PipelineManager& pipelines, ShaderModuleCache& shader_cache,
+    DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors, uint32_t capacity, uint32_t pyramid_width, uint32_t pyramid_height, GpuCulling* out_culling)
+{
+    out_culling->capacity = capacity;
+    out_culling->object_count = 0;
+    out_culling->objects_uploaded = false;
+    out_culling->compact = draw.draw_indirect_count;
+    out_culling->multi_draw = (draw.enabled_features.multiDrawIndirect == VK_TRUE);
+    out_culling->max_draw_count = out_culling->multi_draw ? std::max(draw.gpu_properties.limits.maxDrawIndirectCount, 1u) : 1;
+
+    VkSamplerCreateInfo sampler_info = {};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.pNext = nullptr;
+    sampler_info.flags = 0;
+    sampler_info.magFilter = VK_FILTER_NEAREST;
+    sampler_info.minFilter = VK_FILTER_NEAREST;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = 1000.0f;
+    VK_THROW(vkCreateSampler(device, &sampler_info, host_allocator(), &out_culling->sampler));
+
+    VkDescriptorSetLayoutBinding bindings[4] = {};
+    for (uint32_t bidx = 0; bidx < 4; ++bidx)
+    {
+        bindings[bidx].binding = bidx;
+        bindings[bidx].descriptorType = (bidx < 3) ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[bidx].descriptorCount = 1;
+        bindings[bidx].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[bidx].pImmutableSamplers = nullptr;
+    }
+    VK_THROW(get_descriptor_set_layout(layouts, 0, bindings, 4, nullptr, &out_culling->set_layout));
+    VkDescriptorSetLayoutBinding reduce_bindings[2] = {};
+    reduce_bindings[0].binding = 0;
+    reduce_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    reduce_bindings[0].descriptorCount = 1;
+    reduce_bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    reduce_bindings[1].binding = 1;
+    reduce_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    reduce_bindings[1].descriptorCount = 1;
+    reduce_bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    VK_THROW(get_descriptor_set_layout(layouts, 0, reduce_bindings, 2, nullptr, &out_culling->reduce_set_layout));
+
+    VkPushConstantRange push_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullView) };
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.pNext = nullptr;
+    layout_info.flags = 0;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &out_culling->set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    VK_THROW(vkCreatePipelineLayout(device, &layout_info, host_allocator(), &out_culling->layout));
+    layout_info.pSetLayouts = &out_culling->reduce_set_layout;
+    layout_info.pushConstantRangeCount = 0;
+    layout_info.pPushConstantRanges = nullptr;
+    VK_THROW(vkCreatePipelineLayout(device, &layout_info, host_allocator(), &out_culling->reduce_layout));
+    VK_THROW(request_cull_pipeline(pipelines, shader_cache, "cull", "shaders/cull.comp.spv", out_culling->layout, &out_culling->pipeline));
+    VK_THROW(request_cull_pipeline(pipelines, shader_cache, "depth reduce", "shaders/depth_reduce.comp.spv", out_culling->reduce_layout,
+        &out_culling->reduce_pipeline));
+
+    VK_THROW(create_cull_buffer(allocator, capacity * sizeof(CullObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        &out_culling->objects));
+    VK_THROW(create_cull_buffer(allocator, capacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        &out_culling->draws));
+    VK_THROW(create_cull_buffer(allocator, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &out_culling->count));
+    VK_THROW(create_depth_pyramid(device, allocator, pyramid_width, pyramid_height, &out_culling->pyramid));
+
+    VK_THROW(allocate_descriptor_set(descriptors, out_culling->set_layout, &out_culling->set));
+    VkDescriptorBufferInfo buffer_infos[3] = {
+        { out_culling->objects->buffer, 0, VK_WHOLE_SIZE },
+        { out_culling->draws->buffer, 0, VK_WHOLE_SIZE },
+        { out_culling->count->buffer, 0, VK_WHOLE_SIZE }
+    };
+    VkDescriptorImageInfo pyramid_info = { out_culling->sampler, out_culling->pyramid.view, VK_IMAGE_LAYOUT_GENERAL };
+    VkWriteDescriptorSet writes[2] = {};
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].dstSet = out_culling->set;
+    writes[0].dstBinding = 0;
+    writes[0].descriptorCount = 3;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[0].pBufferInfo = buffer_infos;
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].dstSet = out_culling->set;
+    writes[1].dstBinding = 3;
+    writes[1].descriptorCount = 1;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[1].pImageInfo = &pyramid_info;
+    vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+
+    // Level i reads level i - 1, the source of level 0 is set with set_cull_depth_source().
+    DepthPyramid& pyramid = out_culling->pyramid;
+    pyramid.reduce_sets.assign(pyramid.levels, VK_NULL_HANDLE);
+    for (uint32_t lidx = 0; lidx < pyramid.levels; ++lidx)
+    {
+        VK_THROW(allocate_descriptor_set(descriptors, out_culling->reduce_set_layout, &pyramid.reduce_sets[lidx]));
+        VkDescriptorImageInfo image_infos[2] = {
+            { out_culling->sampler, (lidx > 0) ? pyramid.level_views[lidx - 1] : VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL },
+            { VK_NULL_HANDLE, pyramid.level_views[lidx], VK_IMAGE_LAYOUT_GENERAL }
+        };
+        VkWriteDescriptorSet level_writes[2] = {};
+        level_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        level_writes[0].dstSet = pyramid.reduce_sets[lidx];
+        level_writes[0].dstBinding = 1;
+        level_writes[0].descriptorCount = 1;
+        level_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        level_writes[0].pImageInfo = &image_infos[1];
+        level_writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        level_writes[1].dstSet = pyramid.reduce_sets[lidx];
+        level_writes[1].dstBinding = 0;
+        level_writes[1].descriptorCount = 1;
+        level_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        level_writes[1].pImageInfo = &image_infos[0];
+        vkUpdateDescriptorSets(device, (lidx > 0) ? 2 : 1, level_writes, 0, nullptr);
+    }
+    return VK_SUCCESS;
+}
+
+VkResult create_gpu_culling(VkDevice device, DrawCommandBuffer const& draw, DeviceAllocator& allocator, PipelineManager& pipelines, ShaderModuleCache& shader_cache,
+    DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors, uint32_t capacity, uint32_t pyramid_width, uint32_t pyramid_height, GpuCulling* out_culling)
+{
+    // The draws carry the object index in first_instance, without the feature it has to be 0.
+    if (draw.enabled_features.drawIndirectFirstInstance != VK_TRUE)
+    {
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+    // Null until created: destroy_gpu_culling() undoes a failed setup.
+    out_culling->device = device;
+    out_culling->sampler = VK_NULL_HANDLE;
+    out_culling->layout = VK_NULL_HANDLE;
+    out_culling->reduce_layout = VK_NULL_HANDLE;
+    out_culling->objects.reset();
+    out_culling->draws.reset();
+    out_culling->count.reset();
+    out_culling->pyramid.image = VK_NULL_HANDLE;
+    out_culling->pyramid.memory = nullptr;
+    out_culling->pyramid.view = VK_NULL_HANDLE;
+    out_culling->pyramid.level_views.clear();
+    VkResult result = setup_gpu_culling(device, draw, allocator, pipelines, shader_cache, layouts, descriptors, capacity, pyramid_width, pyramid_height, out_culling);
+    if (result != VK_SUCCESS)
+    {
+        destroy_gpu_culling(allocator, *out_culling);
+    }
+    return result;
+}
+
+void destroy_gpu_culling(DeviceAllocator& allocator, GpuCulling& culling)
+{
+    // Sets go back with the descriptor allocator, set layouts with the layout cache and the
+    // pipelines with the pipeline manager.
+    DepthPyramid& pyramid = culling.pyramid;
+    for (size_t lidx = 0; lidx < pyramid.level_views.size(); ++lidx)
+    {
+        vkDestroyImageView(culling.device, pyramid.level_views[lidx], host_allocator());
+    }
+    pyramid.level_views.clear();
+    pyramid.reduce_sets.clear();
+    vkDestroyImageView(culling.device, pyramid.view, host_allocator());
+    destroy_image(allocator, pyramid.image, pyramid.memory);
+    culling.objects.reset();
+    culling.draws.reset();
+    culling.count.reset();
+    vkDestroyPipelineLayout(culling.device, culling.layout, host_allocator());
+    vkDestroyPipelineLayout(culling.device, culling.reduce_layout, host_allocator());
+    vkDestroySampler(culling.device, culling.sampler, host_allocator());
+}
+
+VkResult upload_cull_objects(GpuCulling& culling, DeviceAllocator& allocator, ImmediateExecutor& immediate, CullObject const* objects, uint32_t count,
+    uint64_t* out_ticket)
+{
+    count = std::min(count, culling.capacity);
+    culling.object_count = count;
+    if (count == 0)
+    {
+        return VK_SUCCESS;
+    }
+    VkDeviceSize size = count * sizeof(CullObject);
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    GpuAllocation* staging = nullptr;
+    VK_THROW(create_buffer(allocator, buffer_info, MEMORY_CPU_ONLY, &staging));
+    memcpy(staging->mapped, objects, static_cast<size_t>(size));
+
+    VkBuffer source = staging->buffer;
+    VkBuffer target = culling.objects->buffer;
+    DeviceAllocator* owner = &allocator;
+    culling.objects_uploaded = true;
+    return immediate_submit(immediate, [source, target, size](VkCommandBuffer command_buffer)
+    {
+        VkBufferCopy region = { 0, 0, size };
+        vkCmdCopyBuffer(command_buffer, source, target, 1, &region);
+    }, [owner, staging]()
+    {
+        destroy_buffer(*owner, staging);
+    }, out_ticket);
+}
+
+void set_cull_depth_source(GpuCulling& culling, VkImageView depth_view)
+{
+    DepthPyramid& pyramid = culling.pyramid;
+    VkDescriptorImageInfo depth_info = { culling.sampler, depth_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = pyramid.reduce_sets[0];
+    write.dstBinding = 0;
+    write.dstArrayElement = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &depth_info;
+    // The set is only used by command buffers recorded after this, the caller waits for the old ones.
+    vkUpdateDescriptorSets(culling.device, 1, &write, 0, nullptr);
+    pyramid.has_source = true;
+}
+
+static void compute_barrier(VkCommandBuffer command_buffer, VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// First use of the pyramid, its contents are undefined until a build.
+static void initialize_pyramid(VkCommandBuffer command_buffer, DepthPyramid& pyramid)
+{
+    if (pyramid.initialized)
+    {
+        return;
+    }
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = pyramid.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = pyramid.levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    pyramid.initialized = true;
+}
+
+bool build_depth_pyramid(VkCommandBuffer command_buffer, PipelineManager& pipelines, GpuCulling& culling)
+{
+    DepthPyramid& pyramid = culling.pyramid;
+    VkPipeline pipeline = resolve_pipeline(pipelines, culling.reduce_pipeline);
+    if ((pipeline == VK_NULL_HANDLE) || !pyramid.has_source)
+    {
+        return false;
+    }
+    if (pyramid.initialized)
+    {
+        // The last cull still reads the levels about to be rewritten.
+        compute_barrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
+    }
+    initialize_pyramid(command_buffer, pyramid);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    for (uint32_t lidx = 0; lidx < pyramid.levels; ++lidx)
+    {
+        uint32_t width = std::max(pyramid.width >> lidx, 1u);
+        uint32_t height = std::max(pyramid.height >> lidx, 1u);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.reduce_layout, 0, 1, &pyramid.reduce_sets[lidx], 0, nullptr);
+        vkCmdDispatch(command_buffer, (width + 7) / 8, (height + 7) / 8, 1);
+        // Read by the next level, after the last one by the cull pass.
+        compute_barrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+    pyramid.built = true;
+    return true;
+}
+
+void make_cull_view(float const view[16], float vertical_fov, float aspect, float znear, uint32_t flags, CullView* out_view)
+{
+    float focal = 1.0f / tanf(vertical_fov * 0.5f);
+    memcpy(out_view->view, view, sizeof(out_view->view));
+    out_view->p00 = focal / aspect;
+    out_view->p11 = focal;
+    out_view->znear = znear;
+    out_view->pad = 0.0f;
+    out_view->pyramid_size[0] = 0.0f;
+    out_view->pyramid_size[1] = 0.0f;
+    out_view->object_count = 0;
+    out_view->flags = flags;
+}
+
+bool record_cull(VkCommandBuffer command_buffer, PipelineManager& pipelines, GpuCulling& culling, CullView const& view)
+{
+    VkPipeline pipeline = resolve_pipeline(pipelines, culling.pipeline);
+    if (pipeline == VK_NULL_HANDLE)
+    {
+        return false;
+    }
+    initialize_pyramid(command_buffer, culling.pyramid);
+    if (culling.objects_uploaded)
+    {
+        // The copy ran in an earlier submission on this queue, barriers reach back to it. The
+        // draws read the objects too, from the vertex shader.
+        compute_barrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        culling.objects_uploaded = false;
+    }
+    // The last draw_culled() may still be reading count and draws.
+    compute_barrier(command_buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
+    vkCmdFillBuffer(command_buffer, culling.count->buffer, 0, sizeof(uint32_t), 0);
+    compute_barrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    CullView constants = view;
+    constants.pyramid_size[0] = static_cast<float>(culling.pyramid.width);
+    constants.pyramid_size[1] = static_cast<float>(culling.pyramid.height);
+    constants.object_count = culling.object_count;
+    constants.flags = view.flags & (CULL_FRUSTUM | CULL_OCCLUSION);
+    if (!culling.pyramid.built)
+    {
+        constants.flags &= ~CULL_OCCLUSION;
+    }
+    if (culling.compact)
+    {
+        constants.flags |= CULL_COMPACT;
+    }
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.layout, 0, 1, &culling.set, 0, nullptr);
+    vkCmdPushConstants(command_buffer, culling.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(command_buffer, (culling.object_count + 63) / 64, 1, 1);
+    return true;
+}
+
+void draw_culled(VkCommandBuffer command_buffer, GpuCulling const& culling)
+{
+    uint32_t const stride = sizeof(VkDrawIndexedIndirectCommand);
+#ifdef VK_KHR_draw_indirect_count
+    if (culling.compact)
+    {
+        uint32_t max_draws = std::min(culling.object_count, culling.max_draw_count);
+        vkCmdDrawIndexedIndirectCountKHR(command_buffer, culling.draws->buffer, 0, culling.count->buffer, 0, max_draws, stride);
+        return;
+    }
+#endif
+    // Every object keeps its slot, culled ones draw zero instances. Without multiDrawIndirect
+    // max_draw_count is 1 and this is one call per object.
+    for (uint32_t first = 0; first < culling.object_count; first += culling.max_draw_count)
+    {
+        uint32_t draw_count = std::min(culling.object_count - first, culling.max_draw_count);
+        vkCmdDrawIndexedIndirect(command_buffer, culling.draws->buffer, static_cast<VkDeviceSize>(first) * stride, draw_count, stride);
+    }
+}
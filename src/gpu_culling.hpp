@@ -0,0 +1,125 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "handles.hpp"
+#include "pipeline_manager.hpp"
+
+struct DescriptorAllocator;
+struct DescriptorLayoutCache;
+struct DeviceAllocator;
+struct DrawCommandBuffer;
+struct GpuAllocation;
+struct ImmediateExecutor;
+struct ShaderModuleCache;
+
+// GPU driven culling: object bounds live in a storage buffer, a compute pass (shaders/cull.comp)
+// tests them against the frustum and against a Hi-Z pyramid built from the previous frame's
+// depth, and writes the indexed indirect draws of the survivors plus their count. draw_culled()
+// then issues all of them with one vkCmdDrawIndexedIndirectCount (or one multi-draw indirect),
+// the CPU never touches individual objects. Every draw has the object index as first_instance,
+// gl_InstanceIndex finds the object's data: drawIndirectFirstInstance is required.
+// View space looks down +z and depth is reverse-Z with an infinite far plane, see cull.comp.
+
+// std430, matches CullObject in shaders/cull.comp.
+struct CullObject
+{
+    float sphere[4];            // world space center, radius
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t pad;
+};
+
+enum CullFlags
+{
+    CULL_FRUSTUM = 1,
+    CULL_OCCLUSION = 2,         // ignored until build_depth_pyramid() has run once
+    CULL_COMPACT = 4            // set by record_cull() when the count draw is available
+};
+
+// Push constants of shaders/cull.comp, 96 bytes.
+struct CullView
+{
+    float view[16];             // world to view, column major
+    float p00;                  // projection[0][0]
+    float p11;                  // projection[1][1]
+    float znear;
+    float pad;
+    float pyramid_size[2];      // filled in by record_cull()
+    uint32_t object_count;      // filled in by record_cull()
+    uint32_t flags;             // CullFlags
+};
+
+// R32F min-depth mip chain. Level 0 is the depth size rounded down to a power of two, every
+// texel holds the farthest depth of its footprint. Always in VK_IMAGE_LAYOUT_GENERAL.
+struct DepthPyramid
+{
+    VkImage image;
+    GpuAllocation* memory;
+    VkImageView view;                           // every level, sampled by the cull pass
+    std::vector<VkImageView> level_views;       // storage writes of the reduction
+    std::vector<VkDescriptorSet> reduce_sets;   // level i reads level i - 1, level 0 the depth
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    bool has_source;            // set_cull_depth_source() was called
+    bool initialized;           // moved out of UNDEFINED
+    bool built;                 // holds depth from at least one frame
+};
+
+struct GpuCulling
+{
+    VkDevice device;
+    VkSampler sampler;          // nearest, clamped; the shaders only use texelFetch
+
+    VkDescriptorSetLayout set_layout;           // owned by the layout cache
+    VkPipelineLayout layout;
+    PipelineHandle pipeline;
+    VkDescriptorSetLayout reduce_set_layout;
+    VkPipelineLayout reduce_layout;
+    PipelineHandle reduce_pipeline;
+    VkDescriptorSet set;
+
+    UniqueBuffer objects;       // CullObject per object
+    UniqueBuffer draws;         // VkDrawIndexedIndirectCommand per object
+    UniqueBuffer count;         // uint32_t visible draws
+    uint32_t capacity;
+    uint32_t object_count;
+    bool objects_uploaded;      // the next record_cull() makes the upload copy visible
+
+    bool compact;               // VK_KHR_draw_indirect_count, draws are packed at the front
+    bool multi_draw;            // multiDrawIndirect, else one indirect draw per object
+    uint32_t max_draw_count;    // maxDrawIndirectCount, longer lists are split
+    DepthPyramid pyramid;
+};
+
+// pyramid_width/height is the size of the depth buffer occlusion culling will read.
+// VK_ERROR_FEATURE_NOT_PRESENT, with nothing created, when drawIndirectFirstInstance is not enabled.
+VkResult create_gpu_culling(VkDevice device, DrawCommandBuffer const& draw, DeviceAllocator& allocator, PipelineManager& pipelines, ShaderModuleCache& shader_cache,
+    DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors, uint32_t capacity, uint32_t pyramid_width, uint32_t pyramid_height, GpuCulling* out_culling);
+void destroy_gpu_culling(DeviceAllocator& allocator, GpuCulling& culling);
+
+// Copies the objects through a staging buffer on the immediate executor, the staging buffer is
+// released once the copy has completed. count is clamped to the capacity, out_ticket may be nullptr.
+VkResult upload_cull_objects(GpuCulling& culling, DeviceAllocator& allocator, ImmediateExecutor& immediate, CullObject const* objects, uint32_t count,
+    uint64_t* out_ticket);
+
+// Depth buffer the pyramid is built from, sampled in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+void set_cull_depth_source(GpuCulling& culling, VkImageView depth_view);
+// Reduces the depth source into the pyramid, compute to compute barriers included. Returns false
+// (nothing recorded) while the reduction pipeline is still compiling.
+bool build_depth_pyramid(VkCommandBuffer command_buffer, PipelineManager& pipelines, GpuCulling& culling);
+
+// Symmetric perspective: fills p00, p11 and znear, view is copied.
+void make_cull_view(float const view[16], float vertical_fov, float aspect, float znear, uint32_t flags, CullView* out_view);
+// Resets the count and culls every object. The pass writes count from the transfer and compute
+// stages and draws from compute, after the indirect reads of the previous draw_culled(). Returns false (nothing recorded) while the pipeline is compiling,
+// draw_culled() must then be skipped too.
+bool record_cull(VkCommandBuffer command_buffer, PipelineManager& pipelines, GpuCulling& culling, CullView const& view);
+// Inside a render pass, with the pipeline and index buffer bound. Reads draws and count at
+// VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT.
+void draw_culled(VkCommandBuffer command_buffer, GpuCulling const& culling);
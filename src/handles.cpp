@@ -0,0 +1,247 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <iostream>
+
+#include "device_memory.hpp"
+#include "handles.hpp"
+
+// Zero initialized, handles may be made from any thread.
+static std::atomic<int32_t> live_handles[HANDLE_TYPE_COUNT];
+
+void track_handle(HandleType type, int32_t delta)
+{
+    live_handles[type] += delta;
+}
+
+void BufferTraits::destroy(Parent allocator, Handle handle)
+{
+    destroy_buffer(*allocator, handle);
+}
+
+void ImageTraits::destroy(Parent memory, Handle handle)
+{
+    destroy_image(*memory.allocator, handle, memory.allocation);
+}
+
+// (parent, create info, allocator, out handle) and (parent, handle, allocator) entry points.
+#define TRACKED_DEVICE_OBJECTS(X) \
+    X(VkDevice, vkAllocateMemory, vkFreeMemory, VkMemoryAllocateInfo, VkDeviceMemory, HANDLE_DEVICE_MEMORY) \
+    X(VkDevice, vkCreateBuffer, vkDestroyBuffer, VkBufferCreateInfo, VkBuffer, HANDLE_BUFFER) \
+    X(VkDevice, vkCreateImage, vkDestroyImage, VkImageCreateInfo, VkImage, HANDLE_IMAGE) \
+    X(VkDevice, vkCreateImageView, vkDestroyImageView, VkImageViewCreateInfo, VkImageView, HANDLE_IMAGE_VIEW) \
+    X(VkDevice, vkCreateSampler, vkDestroySampler, VkSamplerCreateInfo, VkSampler, HANDLE_SAMPLER) \
+    X(VkDevice, vkCreateFramebuffer, vkDestroyFramebuffer, VkFramebufferCreateInfo, VkFramebuffer, HANDLE_FRAMEBUFFER) \
+    X(VkDevice, vkCreateRenderPass, vkDestroyRenderPass, VkRenderPassCreateInfo, VkRenderPass, HANDLE_RENDER_PASS) \
+    X(VkDevice, vkCreateShaderModule, vkDestroyShaderModule, VkShaderModuleCreateInfo, VkShaderModule, HANDLE_SHADER_MODULE) \
+    X(VkDevice, vkCreatePipelineCache, vkDestroyPipelineCache, VkPipelineCacheCreateInfo, VkPipelineCache, HANDLE_PIPELINE_CACHE) \
+    X(VkDevice, vkCreatePipelineLayout, vkDestroyPipelineLayout, VkPipelineLayoutCreateInfo, VkPipelineLayout, HANDLE_PIPELINE_LAYOUT) \
+    X(VkDevice, vkCreateDescriptorSetLayout, vkDestroyDescriptorSetLayout, VkDescriptorSetLayoutCreateInfo, VkDescriptorSetLayout, \
+        HANDLE_DESCRIPTOR_SET_LAYOUT) \
+    X(VkDevice, vkCreateDescriptorPool, vkDestroyDescriptorPool, VkDescriptorPoolCreateInfo, VkDescriptorPool, HANDLE_DESCRIPTOR_POOL) \
+    X(VkDevice, vkCreateCommandPool, vkDestroyCommandPool, VkCommandPoolCreateInfo, VkCommandPool, HANDLE_COMMAND_POOL) \
+    X(VkDevice, vkCreateFence, vkDestroyFence, VkFenceCreateInfo, VkFence, HANDLE_FENCE) \
+    X(VkDevice, vkCreateSemaphore, vkDestroySemaphore, VkSemaphoreCreateInfo, VkSemaphore, HANDLE_SEMAPHORE) \
+    X(VkDevice, vkCreateQueryPool, vkDestroyQueryPool, VkQueryPoolCreateInfo, VkQueryPool, HANDLE_QUERY_POOL) \
+    X(VkDevice, vkCreateSwapchainKHR, vkDestroySwapchainKHR, VkSwapchainCreateInfoKHR, VkSwapchainKHR, HANDLE_SWAP_CHAIN)
+
+#if defined(VK_USE_PLATFORM_WIN32_KHR)
+#define TRACKED_SURFACE_CREATE(X) \
+    X(VkInstance, vkCreateWin32SurfaceKHR, VkWin32SurfaceCreateInfoKHR, VkSurfaceKHR, HANDLE_SURFACE)
+#elif defined(VK_USE_PLATFORM_XLIB_KHR)
+#define TRACKED_SURFACE_CREATE(X) \
+    X(VkInstance, vkCreateXlibSurfaceKHR, VkXlibSurfaceCreateInfoKHR, VkSurfaceKHR, HANDLE_SURFACE)
+#else
+#define TRACKED_SURFACE_CREATE(X)
+#endif
+
+#define TRACKED_CREATES(X) \
+    X(VkPhysicalDevice, vkCreateDevice, VkDeviceCreateInfo, VkDevice, HANDLE_DEVICE) \
+    TRACKED_SURFACE_CREATE(X)
+
+#define TRACKED_DESTROYS(X) \
+    X(VkInstance, vkDestroySurfaceKHR, VkSurfaceKHR, HANDLE_SURFACE)
+
+// The driver's pointers, captured by track_handle_functions().
+#define DEFINE_CREATE(Parent, create, Info, Handle, type) \
+    static PFN_##create driver_##create = nullptr; \
+    static VKAPI_ATTR VkResult VKAPI_CALL tracked_##create(Parent parent, Info const* info, VkAllocationCallbacks const* allocator, Handle* out_handle) \
+    { \
+        VkResult result = driver_##create(parent, info, allocator, out_handle); \
+        if (result == VK_SUCCESS) \
+        { \
+            track_handle(type, 1); \
+        } \
+        return result; \
+    }
+#define DEFINE_DESTROY(Parent, destroy, Handle, type) \
+    static PFN_##destroy driver_##destroy = nullptr; \
+    static VKAPI_ATTR void VKAPI_CALL tracked_##destroy(Parent parent, Handle handle, VkAllocationCallbacks const* allocator) \
+    { \
+        if (handle != VK_NULL_HANDLE) \
+        { \
+            track_handle(type, -1); \
+        } \
+        driver_##destroy(parent, handle, allocator); \
+    }
+#define DEFINE_OBJECT(Parent, create, destroy, Info, Handle, type) \
+    DEFINE_CREATE(Parent, create, Info, Handle, type) \
+    DEFINE_DESTROY(Parent, destroy, Handle, type)
+
+TRACKED_DEVICE_OBJECTS(DEFINE_OBJECT)
+TRACKED_CREATES(DEFINE_CREATE)
+TRACKED_DESTROYS(DEFINE_DESTROY)
+
+#undef DEFINE_OBJECT
+#undef DEFINE_DESTROY
+#undef DEFINE_CREATE
+
+// The entry points that don't fit the two shapes above.
+static PFN_vkCreateInstance driver_vkCreateInstance = nullptr;
+static PFN_vkDestroyInstance driver_vkDestroyInstance = nullptr;
+static PFN_vkDestroyDevice driver_vkDestroyDevice = nullptr;
+static PFN_vkCreateGraphicsPipelines driver_vkCreateGraphicsPipelines = nullptr;
+static PFN_vkCreateComputePipelines driver_vkCreateComputePipelines = nullptr;
+static PFN_vkDestroyPipeline driver_vkDestroyPipeline = nullptr;
+
+static VKAPI_ATTR VkResult VKAPI_CALL tracked_vkCreateInstance(VkInstanceCreateInfo const* info, VkAllocationCallbacks const* allocator, VkInstance* out_instance)
+{
+    VkResult result = driver_vkCreateInstance(info, allocator, out_instance);
+    if (result == VK_SUCCESS)
+    {
+        track_handle(HANDLE_INSTANCE, 1);
+    }
+    return result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL tracked_vkDestroyInstance(VkInstance instance, VkAllocationCallbacks const* allocator)
+{
+    if (instance != VK_NULL_HANDLE)
+    {
+        track_handle(HANDLE_INSTANCE, -1);
+    }
+    driver_vkDestroyInstance(instance, allocator);
+}
+
+static VKAPI_ATTR void VKAPI_CALL tracked_vkDestroyDevice(VkDevice device, VkAllocationCallbacks const* allocator)
+{
+    if (device != VK_NULL_HANDLE)
+    {
+        track_handle(HANDLE_DEVICE, -1);
+    }
+    driver_vkDestroyDevice(device, allocator);
+}
+
+// Failed batches may still return some pipelines, only non-null ones are counted.
+static void track_pipelines(uint32_t count, VkPipeline const* pipelines)
+{
+    for (uint32_t pidx = 0; pidx < count; ++pidx)
+    {
+        if (pipelines[pidx] != VK_NULL_HANDLE)
+        {
+            track_handle(HANDLE_PIPELINE, 1);
+        }
+    }
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL tracked_vkCreateGraphicsPipelines(VkDevice device, VkPipelineCache cache, uint32_t count,
+    VkGraphicsPipelineCreateInfo const* infos, VkAllocationCallbacks const* allocator, VkPipeline* out_pipelines)
+{
+    VkResult result = driver_vkCreateGraphicsPipelines(device, cache, count, infos, allocator, out_pipelines);
+    track_pipelines(count, out_pipelines);
+    return result;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL tracked_vkCreateComputePipelines(VkDevice device, VkPipelineCache cache, uint32_t count,
+    VkComputePipelineCreateInfo const* infos, VkAllocationCallbacks const* allocator, VkPipeline* out_pipelines)
+{
+    VkResult result = driver_vkCreateComputePipelines(device, cache, count, infos, allocator, out_pipelines);
+    track_pipelines(count, out_pipelines);
+    return result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL tracked_vkDestroyPipeline(VkDevice device, VkPipeline pipeline, VkAllocationCallbacks const* allocator)
+{
+    if (pipeline != VK_NULL_HANDLE)
+    {
+        track_handle(HANDLE_PIPELINE, -1);
+    }
+    driver_vkDestroyPipeline(device, pipeline, allocator);
+}
+
+// Null pointers (extension not enabled) stay null, pointers already wrapped are left alone.
+template <typename Function>
+static void wrap_function(Function& global, Function& driver, Function tracked)
+{
+    if ((global != nullptr) && (global != tracked))
+    {
+        driver = global;
+        global = tracked;
+    }
+}
+
+void track_handle_functions()
+{
+#define WRAP(name) wrap_function(name, driver_##name, tracked_##name);
+#define WRAP_CREATE(Parent, create, Info, Handle, type) WRAP(create)
+#define WRAP_DESTROY(Parent, destroy, Handle, type) WRAP(destroy)
+#define WRAP_OBJECT(Parent, create, destroy, Info, Handle, type) WRAP(create) WRAP(destroy)
+    TRACKED_DEVICE_OBJECTS(WRAP_OBJECT)
+    TRACKED_CREATES(WRAP_CREATE)
+    TRACKED_DESTROYS(WRAP_DESTROY)
+    WRAP(vkCreateInstance)
+    WRAP(vkDestroyInstance)
+    WRAP(vkDestroyDevice)
+    WRAP(vkCreateGraphicsPipelines)
+    WRAP(vkCreateComputePipelines)
+    WRAP(vkDestroyPipeline)
+#undef WRAP_OBJECT
+#undef WRAP_DESTROY
+#undef WRAP_CREATE
+#undef WRAP
+}
+
+char const* handle_type_name(HandleType type)
+{
+    switch (type)
+    {
+    case HANDLE_INSTANCE: return "instance";
+    case HANDLE_DEVICE: return "device";
+    case HANDLE_SURFACE: return "surface";
+    case HANDLE_SWAP_CHAIN: return "swap chain";
+    case HANDLE_DEVICE_MEMORY: return "device memory";
+    case HANDLE_BUFFER: return "buffer";
+    case HANDLE_IMAGE: return "image";
+    case HANDLE_IMAGE_VIEW: return "image view";
+    case HANDLE_SAMPLER: return "sampler";
+    case HANDLE_FRAMEBUFFER: return "framebuffer";
+    case HANDLE_RENDER_PASS: return "render pass";
+    case HANDLE_SHADER_MODULE: return "shader module";
+    case HANDLE_PIPELINE_CACHE: return "pipeline cache";
+    case HANDLE_PIPELINE_LAYOUT: return "pipeline layout";
+    case HANDLE_PIPELINE: return "pipeline";
+    case HANDLE_DESCRIPTOR_SET_LAYOUT: return "descriptor set layout";
+    case HANDLE_DESCRIPTOR_POOL: return "descriptor pool";
+    case HANDLE_COMMAND_POOL: return "command pool";
+    case HANDLE_FENCE: return "fence";
+    case HANDLE_SEMAPHORE: return "semaphore";
+    case HANDLE_QUERY_POOL: return "query pool";
+    default: return "unknown";
+    }
+}
+
+uint32_t report_handle_leaks()
+{
+    uint32_t leaked = 0;
+    for (uint32_t tidx = 0; tidx < HANDLE_TYPE_COUNT; ++tidx)
+    {
+        int32_t live = live_handles[tidx];
+        if (live != 0)
+        {
+            std::cout << "leaked " << live << " " << handle_type_name(static_cast<HandleType>(tidx)) << " handles\n";
+            leaked += static_cast<uint32_t>(live);
+        }
+    }
+    return leaked;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include "deletion_queue.hpp"
+#include "dispatch.hpp"
+#include "host_allocator.hpp"
+
+struct DeviceAllocator;
+struct GpuAllocation;
+
+// Move-only owners of Vulkan handles: reset() or the destructor destroys right away, defer() hands
+// the handle to a DeletionQueue instead when the GPU may still use it. Buffers and images made by
+// the device allocator are owned together with their memory.
+//
+// Handles are counted per type where they are made: every create and destroy entry point of the
+// dispatch lists is wrapped, so report_handle_leaks() sees what any module, owner or not, never
+// destroyed.
+
+enum HandleType
+{
+    HANDLE_INSTANCE,
+    HANDLE_DEVICE,
+    HANDLE_SURFACE,
+    HANDLE_SWAP_CHAIN,
+    HANDLE_DEVICE_MEMORY,
+    HANDLE_BUFFER,
+    HANDLE_IMAGE,
+    HANDLE_IMAGE_VIEW,
+    HANDLE_SAMPLER,
+    HANDLE_FRAMEBUFFER,
+    HANDLE_RENDER_PASS,
+    HANDLE_SHADER_MODULE,
+    HANDLE_PIPELINE_CACHE,
+    HANDLE_PIPELINE_LAYOUT,
+    HANDLE_PIPELINE,
+    HANDLE_DESCRIPTOR_SET_LAYOUT,
+    HANDLE_DESCRIPTOR_POOL,
+    HANDLE_COMMAND_POOL,
+    HANDLE_FENCE,
+    HANDLE_SEMAPHORE,
+    HANDLE_QUERY_POOL,
+    HANDLE_TYPE_COUNT
+};
+
+// For handles made through an entry point that is not in the dispatch lists.
+void track_handle(HandleType type, int32_t delta);
+// Swaps the global create and destroy pointers for counting wrappers, the loaders in dispatch.cpp
+// call it after every (re)load.
+void track_handle_functions();
+char const* handle_type_name(HandleType type);
+// Prints the handles still alive, returns how many there are.
+uint32_t report_handle_leaks();
+
+// Instances and devices are destroyed without a parent.
+struct NoParent
+{
+};
+
+struct InstanceTraits
+{
+    typedef VkInstance Handle;
+    typedef NoParent Parent;
+    static void destroy(Parent, Handle handle) { vkDestroyInstance(handle, host_allocator()); }
+};
+
+struct DeviceTraits
+{
+    typedef VkDevice Handle;
+    typedef NoParent Parent;
+    static void destroy(Parent, Handle handle)
+    {
+        vkDestroyDevice(handle, host_allocator());
+        release_device_dispatch(handle);
+    }
+};
+
+struct SurfaceTraits
+{
+    typedef VkSurfaceKHR Handle;
+    typedef VkInstance Parent;
+    static void destroy(Parent instance, Handle handle) { vkDestroySurfaceKHR(instance, handle, host_allocator()); }
+};
+
+struct SwapChainTraits
+{
+    typedef VkSwapchainKHR Handle;
+    typedef VkDevice Parent;
+    static void destroy(Parent device, Handle handle) { vkDestroySwapchainKHR(device, handle, host_allocator()); }
+};
+
+struct CommandPoolTraits
+{
+    typedef VkCommandPool Handle;
+    typedef VkDevice Parent;
+    static void destroy(Parent device, Handle handle) { vkDestroyCommandPool(device, handle, host_allocator()); }
+};
+
+// create_buffer() allocation, the VkBuffer is handle->buffer.
+struct BufferTraits
+{
+    typedef GpuAllocation* Handle;
+    typedef DeviceAllocator* Parent;
+    static void destroy(Parent allocator, Handle handle);
+};
+
+// create_image() image, the memory rides along with the allocator.
+struct ImageMemory
+{
+    DeviceAllocator* allocator;
+    GpuAllocation* allocation;
+};
+
+struct ImageTraits
+{
+    typedef VkImage Handle;
+    typedef ImageMemory Parent;
+    static void destroy(Parent memory, Handle handle);
+};
+
+template <typename Traits>
+class UniqueHandle
+{
+public:
+    typedef typename Traits::Handle Handle;
+    typedef typename Traits::Parent Parent;
+
+    UniqueHandle() : parent(), handle() {}
+    explicit UniqueHandle(Handle owned) : parent(), handle(owned) {}
+    UniqueHandle(Parent owner, Handle owned) : parent(owner), handle(owned) {}
+    ~UniqueHandle() { reset(); }
+
+    UniqueHandle(UniqueHandle&& other) : parent(other.parent), handle(other.handle)
+    {
+        other.handle = Handle();
+    }
+    UniqueHandle& operator=(UniqueHandle&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            parent = other.parent;
+            handle = other.handle;
+            other.handle = Handle();
+        }
+        return *this;
+    }
+    UniqueHandle(UniqueHandle const&) = delete;
+    UniqueHandle& operator=(UniqueHandle const&) = delete;
+
+    Handle get() const { return handle; }
+    // Owners of GpuAllocation pointers read through like the pointer did.
+    Handle operator->() const { return handle; }
+    explicit operator bool() const { return handle != Handle(); }
+
+    // Gives up ownership without destroying, the caller is responsible for the handle again.
+    Handle release()
+    {
+        Handle owned = handle;
+        handle = Handle();
+        return owned;
+    }
+
+    void reset()
+    {
+        if (handle != Handle())
+        {
+            Traits::destroy(parent, handle);
+            handle = Handle();
+        }
+    }
+
+    // Destroyed by the queue once last_use_frame has finished on the GPU.
+    void defer(DeletionQueue& queue, uint64_t last_use_frame)
+    {
+        if (handle == Handle())
+        {
+            return;
+        }
+        Parent owner = parent;
+        Handle owned = handle;
+        handle = Handle();
+        defer_destroy(queue, last_use_frame, [owner, owned]()
+        {
+            Traits::destroy(owner, owned);
+        });
+    }
+
+private:
+    Parent parent;
+    Handle handle;
+};
+
+typedef UniqueHandle<InstanceTraits> UniqueInstance;
+typedef UniqueHandle<DeviceTraits> UniqueDevice;
+typedef UniqueHandle<SurfaceTraits> UniqueSurface;
+typedef UniqueHandle<SwapChainTraits> UniqueSwapChain;
+typedef UniqueHandle<CommandPoolTraits> UniqueCommandPool;
+typedef UniqueHandle<BufferTraits> UniqueBuffer;
+typedef UniqueHandle<ImageTraits> UniqueImage;
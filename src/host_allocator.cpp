@@ -0,0 +1,485 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "host_allocator.hpp"
+
+static size_t const chunk_size = 64 * 1024;
+static size_t const chunk_alignment = 4096;        // every block is aligned to its own size
+static uint32_t const min_block_shift = 5;          // 32 bytes
+static uint32_t const class_count = 8;              // 32 .. 4096 bytes
+static size_t const max_block_size = static_cast<size_t>(1) << (min_block_shift + class_count - 1);
+static uint16_t const large_class = 0xffff;         // straight from the system
+static uint32_t const pool_cache_limit = 256;       // command scope blocks a thread keeps per class
+static uint32_t const pool_refill_count = 64;
+
+// Right before every pointer handed to the driver.
+struct BlockHeader
+{
+    uint64_t size;          // as requested
+    uint32_t offset;        // from the start of the block
+    uint16_t size_class;
+    uint8_t scope;
+    uint8_t pad;
+};
+static_assert(sizeof(BlockHeader) == 16, "the header must keep 16 byte alignment");
+
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+struct HostArena
+{
+    std::mutex lock;
+    FreeBlock* free_blocks[class_count];
+    uint32_t free_count[class_count];
+};
+
+struct ScopeCounters
+{
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> reallocations;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> live_bytes;
+    std::atomic<uint64_t> peak_bytes;
+    std::atomic<uint64_t> internal_bytes;
+};
+
+struct HostRegistry
+{
+    HostAllocatorMode mode;
+    bool initialized;
+    VkAllocationCallbacks callbacks;
+    // The command scope one only holds blocks handed back by pools over their limit or exiting threads.
+    HostArena arenas[HOST_SCOPE_COUNT];
+    std::mutex chunk_lock;
+    std::vector<void*> chunks;          // never freed, blocks move between arenas of the same class
+    ScopeCounters scopes[HOST_SCOPE_COUNT];
+    std::atomic<uint64_t> system_allocations;
+    std::atomic<uint64_t> system_frees;
+    std::atomic<uint64_t> reserved_bytes;
+    std::atomic<uint64_t> peak_reserved_bytes;
+};
+
+// Never destroyed: the driver may free from static destructors of its own, and the chunks stay reachable.
+static HostRegistry& registry()
+{
+    static HostRegistry* instance = new HostRegistry();
+    return *instance;
+}
+
+static void raise_peak(std::atomic<uint64_t>& peak, uint64_t value)
+{
+    uint64_t current = peak.load(std::memory_order_relaxed);
+    while ((value > current) && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+static void* system_allocate(size_t size, size_t alignment)
+{
+    HostRegistry& reg = registry();
+    void* memory = nullptr;
+#ifdef _WIN32
+    memory = _aligned_malloc(size, alignment);
+#else
+    if (posix_memalign(&memory, std::max(alignment, sizeof(void*)), size) != 0)
+    {
+        memory = nullptr;
+    }
+#endif
+    if (memory != nullptr)
+    {
+        reg.system_allocations.fetch_add(1, std::memory_order_relaxed);
+        raise_peak(reg.peak_reserved_bytes, reg.reserved_bytes.fetch_add(size, std::memory_order_relaxed) + size);
+    }
+    return memory;
+}
+
+static void system_free(void* memory, size_t size)
+{
+    HostRegistry& reg = registry();
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+    reg.system_frees.fetch_add(1, std::memory_order_relaxed);
+    reg.reserved_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+static size_t block_size(uint32_t size_class)
+{
+    return static_cast<size_t>(1) << (min_block_shift + size_class);
+}
+
+// Splits a new chunk into blocks of one class and pushes them on list.
+static bool carve_chunk(uint32_t size_class, FreeBlock** list, uint32_t* count)
+{
+    HostRegistry& reg = registry();
+    char* chunk = static_cast<char*>(system_allocate(chunk_size, chunk_alignment));
+    if (chunk == nullptr)
+    {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(reg.chunk_lock);
+        reg.chunks.push_back(chunk);
+    }
+    size_t size = block_size(size_class);
+    for (size_t offset = chunk_size; offset >= size; offset -= size)
+    {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + offset - size);
+        block->next = *list;
+        *list = block;
+        *count += 1;
+    }
+    return true;
+}
+
+static FreeBlock* pop_block(FreeBlock** list, uint32_t* count)
+{
+    FreeBlock* block = *list;
+    if (block != nullptr)
+    {
+        *list = block->next;
+        *count -= 1;
+    }
+    return block;
+}
+
+static void push_block(FreeBlock** list, uint32_t* count, void* memory)
+{
+    FreeBlock* block = static_cast<FreeBlock*>(memory);
+    block->next = *list;
+    *list = block;
+    *count += 1;
+}
+
+static void* arena_take(HostArena& arena, uint32_t size_class)
+{
+    std::lock_guard<std::mutex> guard(arena.lock);
+    if ((arena.free_blocks[size_class] == nullptr) && !carve_chunk(size_class, &arena.free_blocks[size_class], &arena.free_count[size_class]))
+    {
+        return nullptr;
+    }
+    return pop_block(&arena.free_blocks[size_class], &arena.free_count[size_class]);
+}
+
+static void arena_give(HostArena& arena, uint32_t size_class, void* memory)
+{
+    std::lock_guard<std::mutex> guard(arena.lock);
+    push_block(&arena.free_blocks[size_class], &arena.free_count[size_class], memory);
+}
+
+// Command scope blocks of one thread. Allocated and freed within the same Vulkan call, so this
+// is almost always the thread that frees them too; a block freed elsewhere just joins that
+// thread's pool.
+struct CommandPool
+{
+    FreeBlock* free_blocks[class_count];
+    uint32_t free_count[class_count];
+
+    CommandPool()
+    {
+        memset(free_blocks, 0, sizeof(free_blocks));
+        memset(free_count, 0, sizeof(free_count));
+    }
+
+    ~CommandPool()
+    {
+        HostArena& shared = registry().arenas[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND];
+        std::lock_guard<std::mutex> guard(shared.lock);
+        for (uint32_t cidx = 0; cidx < class_count; ++cidx)
+        {
+            while (FreeBlock* block = pop_block(&free_blocks[cidx], &free_count[cidx]))
+            {
+                push_block(&shared.free_blocks[cidx], &shared.free_count[cidx], block);
+            }
+        }
+    }
+};
+
+static thread_local CommandPool tls_command_pool;
+
+static void* pool_take(uint32_t size_class)
+{
+    CommandPool& pool = tls_command_pool;
+    if (pool.free_blocks[size_class] == nullptr)
+    {
+        HostArena& shared = registry().arenas[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND];
+        std::lock_guard<std::mutex> guard(shared.lock);
+        for (uint32_t bidx = 0; bidx < pool_refill_count; ++bidx)
+        {
+            FreeBlock* block = pop_block(&shared.free_blocks[size_class], &shared.free_count[size_class]);
+            if (block == nullptr)
+            {
+                break;
+            }
+            push_block(&pool.free_blocks[size_class], &pool.free_count[size_class], block);
+        }
+    }
+    if ((pool.free_blocks[size_class] == nullptr) && !carve_chunk(size_class, &pool.free_blocks[size_class], &pool.free_count[size_class]))
+    {
+        return nullptr;
+    }
+    return pop_block(&pool.free_blocks[size_class], &pool.free_count[size_class]);
+}
+
+static void pool_give(uint32_t size_class, void* memory)
+{
+    CommandPool& pool = tls_command_pool;
+    push_block(&pool.free_blocks[size_class], &pool.free_count[size_class], memory);
+    if (pool.free_count[size_class] > pool_cache_limit)
+    {
+        HostArena& shared = registry().arenas[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND];
+        std::lock_guard<std::mutex> guard(shared.lock);
+        while (pool.free_count[size_class] > pool_cache_limit / 2)
+        {
+            push_block(&shared.free_blocks[size_class], &shared.free_count[size_class], pop_block(&pool.free_blocks[size_class], &pool.free_count[size_class]));
+        }
+    }
+}
+
+static BlockHeader* header_of(void* memory)
+{
+    return reinterpret_cast<BlockHeader*>(static_cast<char*>(memory) - sizeof(BlockHeader));
+}
+
+// Uncounted, the callbacks keep the per scope numbers.
+static void* take_memory(size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    HostRegistry& reg = registry();
+    // The header sits in the alignment padding in front of the pointer.
+    size_t offset = std::max(std::max<size_t>(alignment, 1), sizeof(BlockHeader));
+    size_t needed = size + offset;
+    uint16_t size_class = large_class;
+    char* block = nullptr;
+    if ((reg.mode == HOST_ALLOCATOR_ARENA) && (needed <= max_block_size))
+    {
+        size_class = 0;
+        while (block_size(size_class) < needed)
+        {
+            ++size_class;
+        }
+        block = static_cast<char*>((scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) ? pool_take(size_class) : arena_take(reg.arenas[scope], size_class));
+    }
+    else
+    {
+        block = static_cast<char*>(system_allocate(needed, offset));
+    }
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+    char* memory = block + offset;
+    BlockHeader* header = header_of(memory);
+    header->size = size;
+    header->offset = static_cast<uint32_t>(offset);
+    header->size_class = size_class;
+    header->scope = static_cast<uint8_t>(scope);
+    header->pad = 0;
+    return memory;
+}
+
+static void give_memory(void* memory)
+{
+    HostRegistry& reg = registry();
+    BlockHeader* header = header_of(memory);
+    char* block = static_cast<char*>(memory) - header->offset;
+    if (header->size_class == large_class)
+    {
+        system_free(block, static_cast<size_t>(header->size) + header->offset);
+    }
+    else if (header->scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND)
+    {
+        pool_give(header->size_class, block);
+    }
+    else
+    {
+        arena_give(reg.arenas[header->scope], header->size_class, block);
+    }
+}
+
+static void count_allocation(VkSystemAllocationScope scope, uint64_t size)
+{
+    ScopeCounters& counters = registry().scopes[scope];
+    raise_peak(counters.peak_bytes, counters.live_bytes.fetch_add(size, std::memory_order_relaxed) + size);
+}
+
+static void* VKAPI_CALL host_allocation(void* user_data, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if ((size == 0) || (static_cast<uint32_t>(scope) >= HOST_SCOPE_COUNT))
+    {
+        return nullptr;
+    }
+    void* memory = take_memory(size, alignment, scope);
+    if (memory != nullptr)
+    {
+        registry().scopes[scope].allocations.fetch_add(1, std::memory_order_relaxed);
+        count_allocation(scope, size);
+    }
+    return memory;
+}
+
+static void VKAPI_CALL host_free(void* user_data, void* memory)
+{
+    if (memory == nullptr)
+    {
+        return;
+    }
+    BlockHeader* header = header_of(memory);
+    ScopeCounters& counters = registry().scopes[header->scope];
+    counters.frees.fetch_add(1, std::memory_order_relaxed);
+    counters.live_bytes.fetch_sub(header->size, std::memory_order_relaxed);
+    give_memory(memory);
+}
+
+static void* VKAPI_CALL host_reallocation(void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if (original == nullptr)
+    {
+        return host_allocation(user_data, size, alignment, scope);
+    }
+    if (size == 0)
+    {
+        host_free(user_data, original);
+        return nullptr;
+    }
+    BlockHeader* header = header_of(original);
+    VkSystemAllocationScope old_scope = static_cast<VkSystemAllocationScope>(header->scope);
+    uint64_t old_size = header->size;
+    // Large blocks are always moved, their header size is also what goes back to the system.
+    size_t capacity = (header->size_class == large_class) ? 0 : block_size(header->size_class) - header->offset;
+    bool aligned = (alignment == 0) || ((reinterpret_cast<uintptr_t>(original) & (alignment - 1)) == 0);
+    void* memory = original;
+    if (!aligned || (size > capacity) || (old_scope != scope))
+    {
+        // On failure the original allocation must stay untouched.
+        memory = take_memory(size, alignment, scope);
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        memcpy(memory, original, static_cast<size_t>(std::min<uint64_t>(old_size, size)));
+        give_memory(original);
+    }
+    header_of(memory)->size = size;
+    registry().scopes[old_scope].live_bytes.fetch_sub(old_size, std::memory_order_relaxed);
+    registry().scopes[scope].reallocations.fetch_add(1, std::memory_order_relaxed);
+    count_allocation(scope, size);
+    return memory;
+}
+
+static void VKAPI_CALL host_internal_allocation(void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+    if (static_cast<uint32_t>(scope) < HOST_SCOPE_COUNT)
+    {
+        registry().scopes[scope].internal_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+static void VKAPI_CALL host_internal_free(void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+    if (static_cast<uint32_t>(scope) < HOST_SCOPE_COUNT)
+    {
+        registry().scopes[scope].internal_bytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+}
+
+void init_host_allocator(HostAllocatorMode mode)
+{
+    HostRegistry& reg = registry();
+    if (reg.initialized)
+    {
+        return;
+    }
+    reg.initialized = true;
+    reg.mode = mode;
+    reg.callbacks.pUserData = nullptr;
+    reg.callbacks.pfnAllocation = host_allocation;
+    reg.callbacks.pfnReallocation = host_reallocation;
+    reg.callbacks.pfnFree = host_free;
+    reg.callbacks.pfnInternalAllocation = host_internal_allocation;
+    reg.callbacks.pfnInternalFree = host_internal_free;
+}
+
+HostAllocatorMode host_allocator_mode()
+{
+    return registry().mode;
+}
+
+VkAllocationCallbacks const* host_allocator()
+{
+    HostRegistry& reg = registry();
+    return (reg.mode == HOST_ALLOCATOR_DRIVER) ? nullptr : &reg.callbacks;
+}
+
+char const* host_allocator_mode_name(HostAllocatorMode mode)
+{
+    switch (mode)
+    {
+    case HOST_ALLOCATOR_DRIVER: return "driver";
+    case HOST_ALLOCATOR_TRACKING: return "tracking";
+    case HOST_ALLOCATOR_ARENA: return "arena";
+    default: return "unknown";
+    }
+}
+
+void get_host_allocator_stats(HostAllocatorStats* out_stats)
+{
+    HostRegistry& reg = registry();
+    for (uint32_t sidx = 0; sidx < HOST_SCOPE_COUNT; ++sidx)
+    {
+        ScopeCounters const& counters = reg.scopes[sidx];
+        HostScopeStats& stats = out_stats->scopes[sidx];
+        stats.allocations = counters.allocations.load(std::memory_order_relaxed);
+        stats.reallocations = counters.reallocations.load(std::memory_order_relaxed);
+        stats.frees = counters.frees.load(std::memory_order_relaxed);
+        stats.live_bytes = counters.live_bytes.load(std::memory_order_relaxed);
+        stats.peak_bytes = counters.peak_bytes.load(std::memory_order_relaxed);
+        stats.internal_bytes = counters.internal_bytes.load(std::memory_order_relaxed);
+    }
+    out_stats->system_allocations = reg.system_allocations.load(std::memory_order_relaxed);
+    out_stats->system_frees = reg.system_frees.load(std::memory_order_relaxed);
+    out_stats->reserved_bytes = reg.reserved_bytes.load(std::memory_order_relaxed);
+    out_stats->peak_reserved_bytes = reg.peak_reserved_bytes.load(std::memory_order_relaxed);
+}
+
+void print_host_allocator_stats()
+{
+    HostAllocatorMode mode = host_allocator_mode();
+    if (mode == HOST_ALLOCATOR_DRIVER)
+    {
+        std::cout << "Host allocator: driver default, not tracked\n";
+        return;
+    }
+    char const* const scope_names[HOST_SCOPE_COUNT] = { "command", "object", "cache", "device", "instance" };
+    HostAllocatorStats stats;
+    get_host_allocator_stats(&stats);
+    std::cout << "Host allocator: " << host_allocator_mode_name(mode) << ", " << stats.system_allocations << " system allocations, "
+              << stats.system_frees << " frees, " << stats.reserved_bytes / 1024 << " KiB reserved (peak " << stats.peak_reserved_bytes / 1024 << " KiB)\n";
+    for (uint32_t sidx = 0; sidx < HOST_SCOPE_COUNT; ++sidx)
+    {
+        HostScopeStats const& scope = stats.scopes[sidx];
+        std::cout << "  " << scope_names[sidx] << ": " << scope.allocations << " allocations, " << scope.reallocations << " reallocations, "
+                  << scope.frees << " frees, peak " << scope.peak_bytes << " bytes, internal " << scope.internal_bytes << " bytes";
+        if (scope.live_bytes != 0)
+        {
+            std::cout << ", " << scope.live_bytes << " bytes still live";
+        }
+        std::cout << "\n";
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+// Host memory the driver asks for through VkAllocationCallbacks. host_allocator() is what every
+// vkCreate*, vkDestroy*, vkAllocateMemory and vkFreeMemory call passes as pAllocator.
+//
+// In arena mode allocations up to 4 KiB are power of two blocks carved from 64 KiB chunks that
+// are only given back to the system at exit. Each long lived scope (object, cache, device,
+// instance) keeps its own free lists, so short lived objects don't fragment around long lived
+// ones. Command scope allocations only live for the duration of one Vulkan call and come from a
+// thread local pool without any locking. Bigger blocks go to the system allocator.
+enum HostAllocatorMode
+{
+    HOST_ALLOCATOR_DRIVER,          // pAllocator is nullptr, nothing is counted
+    HOST_ALLOCATOR_TRACKING,        // system allocator, every call counted
+    HOST_ALLOCATOR_ARENA            // arenas and pools, every call counted
+};
+
+uint32_t const HOST_SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+struct HostScopeStats
+{
+    uint64_t allocations;
+    uint64_t reallocations;
+    uint64_t frees;
+    uint64_t live_bytes;            // as requested by the driver
+    uint64_t peak_bytes;
+    uint64_t internal_bytes;        // driver allocations it only notifies us about
+};
+
+struct HostAllocatorStats
+{
+    HostScopeStats scopes[HOST_SCOPE_COUNT];
+    uint64_t system_allocations;    // churn: calls that reached malloc / free
+    uint64_t system_frees;
+    uint64_t reserved_bytes;        // held from the system, arenas included
+    uint64_t peak_reserved_bytes;
+};
+
+// Once, before the instance is created: every object must be destroyed with the callbacks it was
+// created with. Later calls are ignored.
+void init_host_allocator(HostAllocatorMode mode);
+HostAllocatorMode host_allocator_mode();
+// nullptr in driver mode.
+VkAllocationCallbacks const* host_allocator();
+
+char const* host_allocator_mode_name(HostAllocatorMode mode);
+void get_host_allocator_stats(HostAllocatorStats* out_stats);
+// Per scope counters; allocations still live are listed as leaks once the instance is gone.
+void print_host_allocator_stats();
@@ -0,0 +1,289 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <cassert>
+#include <iostream>
+
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "immediate.hpp"
+
+VkResult create_immediate_executor(VkDevice device, VkQueue queue, uint32_t queue_family_idx, ImmediateExecutor* out_executor)
+{
+    out_executor->device = device;
+    out_executor->queue = queue;
+    out_executor->recording = nullptr;
+    out_executor->next_ticket = 1;
+    out_executor->completed_ticket = 0;
+    out_executor->stats.jobs = 0;
+    out_executor->stats.submits = 0;
+    out_executor->stats.waits = 0;
+
+    VkCommandPoolCreateInfo command_pool_info = {};
+    command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    command_pool_info.pNext = nullptr;
+    command_pool_info.queueFamilyIndex = queue_family_idx;
+    command_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    return vkCreateCommandPool(device, &command_pool_info, host_allocator(), &out_executor->command_pool);
+}
+
+// Moves the oldest in-flight batch back to the free list, lock held. Its callbacks are appended to
+// callbacks so they can run once the lock is released.
+static VkResult retire_oldest(ImmediateExecutor& executor, std::vector<ImmediateCallback>& callbacks)
+{
+    assert(!executor.in_flight.empty());
+    ImmediateBatch* batch = executor.in_flight.front();
+    executor.in_flight.erase(executor.in_flight.begin());
+    VK_THROW(vkResetFences(executor.device, 1, &batch->fence));
+    VK_THROW(vkResetCommandBuffer(batch->command_buffer, 0));
+    callbacks.insert(callbacks.end(), batch->callbacks.begin(), batch->callbacks.end());
+    batch->callbacks.clear();
+    batch->job_count = 0;
+    executor.completed_ticket = batch->ticket;
+    executor.free_batches.push_back(batch);
+    return VK_SUCCESS;
+}
+
+static void run_callbacks(std::vector<ImmediateCallback> const& callbacks)
+{
+    for (size_t cidx = 0; cidx < callbacks.size(); ++cidx)
+    {
+        if (callbacks[cidx])
+        {
+            callbacks[cidx]();
+        }
+    }
+}
+
+void destroy_immediate_executor(ImmediateExecutor& executor)
+{
+    flush_immediate(executor);
+    std::vector<ImmediateCallback> callbacks;
+    {
+        std::lock_guard<std::mutex> guard(executor.lock);
+        while (!executor.in_flight.empty())
+        {
+            ImmediateBatch* batch = executor.in_flight.front();
+            if ((vkWaitForFences(executor.device, 1, &batch->fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) ||
+                (retire_oldest(executor, callbacks) != VK_SUCCESS))
+            {
+                break;
+            }
+        }
+    }
+    run_callbacks(callbacks);
+    for (size_t bidx = 0; bidx < executor.batches.size(); ++bidx)
+    {
+        vkDestroyFence(executor.device, executor.batches[bidx]->fence, host_allocator());
+        delete executor.batches[bidx];
+    }
+    executor.batches.clear();
+    executor.free_batches.clear();
+    executor.in_flight.clear();
+    executor.recording = nullptr;
+    // Frees every command buffer with it.
+    vkDestroyCommandPool(executor.device, executor.command_pool, host_allocator());
+    executor.command_pool = VK_NULL_HANDLE;
+}
+
+// Opens a batch from the free list, allocating one only when every batch is in flight. Lock held.
+static VkResult begin_batch(ImmediateExecutor& executor)
+{
+    if (executor.recording != nullptr)
+    {
+        return VK_SUCCESS;
+    }
+    ImmediateBatch* batch = nullptr;
+    if (!executor.free_batches.empty())
+    {
+        batch = executor.free_batches.back();
+        executor.free_batches.pop_back();
+    }
+    else
+    {
+        batch = new ImmediateBatch();
+        batch->command_buffer = VK_NULL_HANDLE;
+        batch->fence = VK_NULL_HANDLE;
+        batch->job_count = 0;
+        executor.batches.push_back(batch);
+
+        VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+        command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_allocate_info.pNext = nullptr;
+        command_buffer_allocate_info.commandPool = executor.command_pool;
+        command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        command_buffer_allocate_info.commandBufferCount = 1;
+        VkResult err = vkAllocateCommandBuffers(executor.device, &command_buffer_allocate_info, &batch->command_buffer);
+        if (err == VK_SUCCESS)
+        {
+            VkFenceCreateInfo fence_info = {};
+            fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fence_info.pNext = nullptr;
+            fence_info.flags = 0;
+            err = vkCreateFence(executor.device, &fence_info, host_allocator(), &batch->fence);
+        }
+        if (err != VK_SUCCESS)
+        {
+            // Keeps whatever was created, destroy_immediate_executor() releases it.
+            return err;
+        }
+    }
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+    VkResult err = vkBeginCommandBuffer(batch->command_buffer, &begin_info);
+    if (err != VK_SUCCESS)
+    {
+        executor.free_batches.push_back(batch);
+        return err;
+    }
+    batch->ticket = executor.next_ticket++;
+    executor.recording = batch;
+    return VK_SUCCESS;
+}
+
+VkResult immediate_submit(ImmediateExecutor& executor, ImmediateFn const& record, ImmediateCallback const& on_complete, uint64_t* out_ticket)
+{
+    std::lock_guard<std::mutex> guard(executor.lock);
+    VK_THROW(begin_batch(executor));
+    ImmediateBatch* batch = executor.recording;
+    record(batch->command_buffer);
+    if (on_complete)
+    {
+        batch->callbacks.push_back(on_complete);
+    }
+    batch->job_count += 1;
+    executor.stats.jobs += 1;
+    if (out_ticket != nullptr)
+    {
+        *out_ticket = batch->ticket;
+    }
+    return VK_SUCCESS;
+}
+
+// A batch that could not be submitted goes back to the free list, lock held; vkBeginCommandBuffer
+// resets its command buffer on reuse. Its ticket and callbacks move to the newest batch in flight,
+// or complete right away when there is none, so waiters return and what the jobs hold is released.
+static void abandon_batch(ImmediateExecutor& executor, ImmediateBatch* batch, std::vector<ImmediateCallback>& callbacks)
+{
+    if (executor.in_flight.empty())
+    {
+        callbacks.insert(callbacks.end(), batch->callbacks.begin(), batch->callbacks.end());
+        executor.completed_ticket = batch->ticket;
+    }
+    else
+    {
+        ImmediateBatch* newest = executor.in_flight.back();
+        newest->callbacks.insert(newest->callbacks.end(), batch->callbacks.begin(), batch->callbacks.end());
+        newest->ticket = batch->ticket;
+    }
+    batch->callbacks.clear();
+    batch->job_count = 0;
+    executor.free_batches.push_back(batch);
+}
+
+VkResult flush_immediate(ImmediateExecutor& executor)
+{
+    std::vector<ImmediateCallback> callbacks;
+    VkResult err = VK_SUCCESS;
+    {
+        std::lock_guard<std::mutex> guard(executor.lock);
+        ImmediateBatch* batch = executor.recording;
+        if (batch == nullptr)
+        {
+            return VK_SUCCESS;
+        }
+        executor.recording = nullptr;
+        err = vkEndCommandBuffer(batch->command_buffer);
+        if (err == VK_SUCCESS)
+        {
+            VkSubmitInfo submit_info = {};
+            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submit_info.pNext = nullptr;
+            submit_info.waitSemaphoreCount = 0;
+            submit_info.commandBufferCount = 1;
+            submit_info.pCommandBuffers = &batch->command_buffer;
+            submit_info.signalSemaphoreCount = 0;
+            err = vkQueueSubmit(executor.queue, 1, &submit_info, batch->fence);
+        }
+        if (err == VK_SUCCESS)
+        {
+            executor.in_flight.push_back(batch);
+            executor.stats.submits += 1;
+        }
+        else
+        {
+            abandon_batch(executor, batch, callbacks);
+        }
+    }
+    run_callbacks(callbacks);
+    return err;
+}
+
+VkResult poll_immediate(ImmediateExecutor& executor)
+{
+    std::vector<ImmediateCallback> callbacks;
+    VkResult err = VK_SUCCESS;
+    {
+        std::lock_guard<std::mutex> guard(executor.lock);
+        // Oldest first, so completed_ticket only moves forward.
+        while ((err == VK_SUCCESS) && !executor.in_flight.empty())
+        {
+            err = vkGetFenceStatus(executor.device, executor.in_flight.front()->fence);
+            if (err == VK_NOT_READY)
+            {
+                err = VK_SUCCESS;
+                break;
+            }
+            if (err == VK_SUCCESS)
+            {
+                err = retire_oldest(executor, callbacks);
+            }
+        }
+    }
+    run_callbacks(callbacks);
+    return err;
+}
+
+// Lock free, callers may poll from any thread while another one retires batches.
+bool immediate_complete(ImmediateExecutor const& executor, uint64_t ticket)
+{
+    return ticket <= executor.completed_ticket.load();
+}
+
+VkResult wait_immediate(ImmediateExecutor& executor, uint64_t ticket)
+{
+    if (immediate_complete(executor, ticket))
+    {
+        return VK_SUCCESS;
+    }
+    VK_THROW(flush_immediate(executor));
+    std::vector<ImmediateCallback> callbacks;
+    VkResult err = VK_SUCCESS;
+    {
+        std::lock_guard<std::mutex> guard(executor.lock);
+        executor.stats.waits += 1;
+        while ((err == VK_SUCCESS) && (executor.completed_ticket < ticket) && !executor.in_flight.empty())
+        {
+            err = vkWaitForFences(executor.device, 1, &executor.in_flight.front()->fence, VK_TRUE, UINT64_MAX);
+            if (err == VK_SUCCESS)
+            {
+                err = retire_oldest(executor, callbacks);
+            }
+        }
+    }
+    run_callbacks(callbacks);
+    return err;
+}
+
+void print_immediate_stats(ImmediateExecutor const& executor)
+{
+    ImmediateStats const& stats = executor.stats;
+    std::cout << "immediate: " << stats.jobs << " jobs in " << stats.submits << " submits"
+              << " | " << executor.batches.size() << " command buffers"
+              << " | waits " << stats.waits << "\n";
+}
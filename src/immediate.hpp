@@ -0,0 +1,70 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// One-shot GPU work (layout transitions, copies, mip generation) recorded into a shared command
+// buffer and sent with a single vkQueueSubmit per flush, instead of a submit and vkQueueWaitIdle
+// per operation. Completion is tracked with a fence per batch: callers keep the ticket and either
+// poll immediate_complete(), block in wait_immediate() or pass a callback that poll_immediate()
+// runs once the batch has finished.
+//
+// immediate_submit() may be called from any thread. Flushing, polling and waiting submit to or
+// wait on the queue and belong to the thread that owns it.
+
+typedef std::function<void(VkCommandBuffer command_buffer)> ImmediateFn;
+typedef std::function<void()> ImmediateCallback;
+
+struct ImmediateBatch
+{
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    uint64_t ticket;
+    uint32_t job_count;
+    std::vector<ImmediateCallback> callbacks;
+};
+
+struct ImmediateStats
+{
+    uint64_t jobs;
+    uint64_t submits;
+    uint32_t waits;                     // times a caller blocked on a batch
+};
+
+struct ImmediateExecutor
+{
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool command_pool;         // buffers are reset one by one and reused, never freed early
+    std::mutex lock;
+    std::vector<ImmediateBatch*> batches;       // owns every batch
+    std::vector<ImmediateBatch*> free_batches;
+    std::vector<ImmediateBatch*> in_flight;     // submission order
+    ImmediateBatch* recording;          // null until the first job after a flush
+    uint64_t next_ticket;
+    std::atomic<uint64_t> completed_ticket;     // every ticket up to this one has finished on the GPU, written under lock
+    ImmediateStats stats;
+};
+
+VkResult create_immediate_executor(VkDevice device, VkQueue queue, uint32_t queue_family_idx, ImmediateExecutor* out_executor);
+// Waits for everything submitted, callbacks of unfinished batches still run.
+void destroy_immediate_executor(ImmediateExecutor& executor);
+
+// Records record() into the open batch. The work starts on the GPU at the next flush; on_complete
+// (may be empty) runs from poll_immediate() or wait_immediate() after it finished.
+VkResult immediate_submit(ImmediateExecutor& executor, ImmediateFn const& record, ImmediateCallback const& on_complete, uint64_t* out_ticket);
+// Submits the open batch, if any. Later submissions to the same queue are ordered after it. When
+// the submit fails the batch's jobs are dropped: the error is returned, their callbacks still run
+// and their tickets still complete.
+VkResult flush_immediate(ImmediateExecutor& executor);
+// Retires finished batches and runs their callbacks, never blocks.
+VkResult poll_immediate(ImmediateExecutor& executor);
+bool immediate_complete(ImmediateExecutor const& executor, uint64_t ticket);
+// Flushes when the ticket is still being recorded, then blocks until it finished.
+VkResult wait_immediate(ImmediateExecutor& executor, uint64_t ticket);
+void print_immediate_stats(ImmediateExecutor const& executor);
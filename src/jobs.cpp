@@ -0,0 +1,174 @@
+#include "jobs.hpp"
+
+#include <cassert>
+#include <system_error>
+
+#include "profiler.hpp"
+
+static thread_local uint32_t tls_worker_idx = 0;
+
+uint32_t current_worker_idx()
+{
+    return tls_worker_idx;
+}
+
+uint32_t job_worker_count(JobSystem const& jobs)
+{
+    return static_cast<uint32_t>(jobs.queues.size());
+}
+
+static bool pop_local(JobSystem& jobs, uint32_t worker_idx, JobEntry* out_entry)
+{
+    WorkQueue& queue = *jobs.queues[worker_idx];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.jobs.empty())
+    {
+        return false;
+    }
+    *out_entry = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    return true;
+}
+
+static bool steal(JobSystem& jobs, uint32_t worker_idx, JobEntry* out_entry)
+{
+    uint32_t worker_count = job_worker_count(jobs);
+    for (uint32_t offset = 1; offset < worker_count; ++offset)
+    {
+        WorkQueue& victim = *jobs.queues[(worker_idx + offset) % worker_count];
+        std::unique_lock<std::mutex> guard(victim.lock, std::try_to_lock);
+        if (!guard.owns_lock() || victim.jobs.empty())
+        {
+            continue;
+        }
+        *out_entry = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        jobs.steal_count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+static bool run_one(JobSystem& jobs, uint32_t worker_idx)
+{
+    JobEntry entry;
+    if (!pop_local(jobs, worker_idx, &entry) && !steal(jobs, worker_idx, &entry))
+    {
+        return false;
+    }
+    jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+    entry.job(worker_idx);
+    entry.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+static void worker_main(JobSystem* jobs, uint32_t worker_idx)
+{
+    tls_worker_idx = worker_idx;
+    PROFILE_THREAD_NAME("job worker");
+    while (!jobs->quit.load(std::memory_order_acquire))
+    {
+        if (run_one(*jobs, worker_idx))
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(jobs->sleep_lock);
+        jobs->wake.wait(guard, [jobs] { return jobs->quit.load() || (jobs->queued.load() > 0); });
+    }
+}
+
+bool create_job_system(uint32_t worker_count, JobSystem* out_jobs)
+{
+    if (worker_count == 0)
+    {
+        worker_count = std::thread::hardware_concurrency();
+        if (worker_count == 0)
+        {
+            worker_count = 1;
+        }
+    }
+    out_jobs->quit = false;
+    out_jobs->queued = 0;
+    out_jobs->queues.clear();
+    for (uint32_t widx = 0; widx < worker_count; ++widx)
+    {
+        out_jobs->queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    }
+    tls_worker_idx = 0;
+    // Reserved up front, a started thread must not be dropped by a failed push_back.
+    out_jobs->threads.reserve(worker_count - 1);
+    for (uint32_t widx = 1; widx < worker_count; ++widx)
+    {
+        try
+        {
+            out_jobs->threads.push_back(std::thread(worker_main, out_jobs, widx));
+        }
+        catch (std::system_error const&)
+        {
+            destroy_job_system(*out_jobs);
+            return false;
+        }
+    }
+    return true;
+}
+
+void destroy_job_system(JobSystem& jobs)
+{
+    {
+        std::lock_guard<std::mutex> guard(jobs.sleep_lock);
+        jobs.quit = true;
+    }
+    jobs.wake.notify_all();
+    for (size_t tidx = 0; tidx < jobs.threads.size(); ++tidx)
+    {
+        jobs.threads[tidx].join();
+    }
+    jobs.threads.clear();
+    jobs.queues.clear();
+}
+
+void submit_job(JobSystem& jobs, JobCounter& counter, Job job)
+{
+    uint32_t worker_idx = current_worker_idx();
+    assert(worker_idx < job_worker_count(jobs));
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        WorkQueue& queue = *jobs.queues[worker_idx];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        JobEntry entry;
+        entry.job = std::move(job);
+        entry.counter = &counter;
+        queue.jobs.push_back(std::move(entry));
+    }
+    {
+        // Taking the lock orders the increment with a worker checking the predicate before sleeping.
+        std::lock_guard<std::mutex> guard(jobs.sleep_lock);
+        jobs.queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    jobs.wake.notify_one();
+}
+
+void parallel_for(JobSystem& jobs, JobCounter& counter, uint32_t count, uint32_t chunk_size, std::function<void(uint32_t, uint32_t, uint32_t)> fn)
+{
+    if (chunk_size == 0)
+    {
+        chunk_size = 1;
+    }
+    for (uint32_t begin = 0; begin < count; begin += chunk_size)
+    {
+        uint32_t end = (count - begin > chunk_size) ? begin + chunk_size : count;
+        submit_job(jobs, counter, [fn, begin, end](uint32_t worker_idx) { fn(worker_idx, begin, end); });
+    }
+}
+
+void wait_jobs(JobSystem& jobs, JobCounter& counter)
+{
+    uint32_t worker_idx = current_worker_idx();
+    while (counter.pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!run_one(jobs, worker_idx))
+        {
+            std::this_thread::yield();
+        }
+    }
+}
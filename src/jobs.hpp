@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing job system. Worker 0 is the thread that created the system, it runs
+// jobs while it waits in wait_jobs(). Every worker owns a deque: the owner pushes/pops
+// at the back (LIFO, cache warm), idle workers steal from the front of the others.
+
+typedef std::function<void(uint32_t worker_idx)> Job;
+
+struct JobCounter
+{
+    std::atomic<uint32_t> pending;
+    JobCounter() : pending(0) {}
+};
+
+struct JobEntry
+{
+    Job job;
+    JobCounter* counter;
+};
+
+struct WorkQueue
+{
+    std::mutex lock;
+    std::deque<JobEntry> jobs;
+};
+
+struct JobSystem
+{
+    std::vector<std::unique_ptr<WorkQueue>> queues;  // one per worker
+    std::vector<std::thread> threads;                // workers 1..N-1
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    std::atomic<uint32_t> queued;                    // jobs sitting in any queue
+    std::atomic<bool> quit;
+    std::atomic<uint64_t> steal_count;
+
+    JobSystem() : queued(0), quit(false), steal_count(0) {}
+};
+
+// worker_count includes the calling thread, 0 uses the hardware concurrency. False when a worker
+// thread could not be started, the ones that were are stopped again.
+bool create_job_system(uint32_t worker_count, JobSystem* out_jobs);
+void destroy_job_system(JobSystem& jobs);
+uint32_t job_worker_count(JobSystem const& jobs);
+
+// Index of the calling worker, 0 for threads that are not part of the system.
+uint32_t current_worker_idx();
+
+void submit_job(JobSystem& jobs, JobCounter& counter, Job job);
+// Splits [0, count) in chunks of at most chunk_size and runs fn(worker_idx, begin, end) for each.
+void parallel_for(JobSystem& jobs, JobCounter& counter, uint32_t count, uint32_t chunk_size, std::function<void(uint32_t, uint32_t, uint32_t)> fn);
+// Runs jobs (its own or stolen ones) until counter reaches zero.
+void wait_jobs(JobSystem& jobs, JobCounter& counter);
@@ -3,447 +3,1118 @@
 #include <vulkan/vulkan.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include <cstring>
+#include <functional>
+
+#include "culled_mesh.hpp"
+#include "descriptors.hpp"
+#include "device.hpp"
+#include "device_memory.hpp"
+#include "device_select.hpp"
+#include "dispatch.hpp"
 #include "error.hpp"
-#include "win32.hpp"
+#include "frame.hpp"
+#include "frame_allocator.hpp"
+#include "gpu_culling.hpp"
+#include "handles.hpp"
+#include "host_allocator.hpp"
+#include "immediate.hpp"
+#include "jobs.hpp"
+#include "mesh.hpp"
+#include "parallel_record.hpp"
+#include "pipeline_cache.hpp"
+#include "pipeline_manager.hpp"
+#include "platform.hpp"
+#include "profiler.hpp"
+#include "readback.hpp"
+#include "render_graph.hpp"
+#include "startup.hpp"
+#include "swap_chain.hpp"
+#include "texture_streaming.hpp"
+#include "tools.hpp"
+#include "upload.hpp"
 #include <iostream>
 
 #define STD_CALL __stdcall
-bool check_flag(uint32_t flag, uint32_t bit)
+
+// One color attachment, every pixel is cleared by the scene so nothing is loaded. The render graph
+// does the layout changes around the pass.
+VkResult create_scene_render_pass(VkDevice device, VkFormat color_format, VkRenderPass* out_render_pass)
 {
-    return (flag & bit) == bit;
+    VkAttachmentDescription attachment = {};
+    attachment.format = color_format;
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference color_reference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_reference;
+
+    VkRenderPassCreateInfo render_pass_info = {};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.pNext = nullptr;
+    render_pass_info.flags = 0;
+    render_pass_info.attachmentCount = 1;
+    render_pass_info.pAttachments = &attachment;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = 0;
+    render_pass_info.pDependencies = nullptr;
+    return vkCreateRenderPass(device, &render_pass_info, host_allocator(), out_render_pass);
 }
 
-struct SwapChain
+VkResult create_scene_framebuffer(VkDevice device, VkRenderPass render_pass, VkImageView view, VkExtent2D extent, VkFramebuffer* out_framebuffer)
 {
-    HINSTANCE instance;
-    HWND window;
-    VkPhysicalDevice gpu;
-    VkSurfaceKHR surface;
-    VkSurfaceFormatKHR surface_format;
-    VkSwapchainKHR swap_chain;
-    VkQueue present_queue;
-    uint32_t queue_family_idx;
-};
+    VkFramebufferCreateInfo framebuffer_info = {};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.pNext = nullptr;
+    framebuffer_info.flags = 0;
+    framebuffer_info.renderPass = render_pass;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.pAttachments = &view;
+    framebuffer_info.width = extent.width;
+    framebuffer_info.height = extent.height;
+    framebuffer_info.layers = 1;
+    return vkCreateFramebuffer(device, &framebuffer_info, host_allocator(), out_framebuffer);
+}
+
+// The render graph has the image in COLOR_ATTACHMENT_OPTIMAL by the time this runs. highlight in
+// [0, 1] follows the mouse, input latency can be seen on screen.
+VkResult record_scene(JobSystem& jobs, VkDevice device, ThreadCommandPools& thread_pools, FrameLoop const& frame_loop, VkCommandBuffer command_buffer,
+                      VkRenderPass render_pass, VkFramebuffer framebuffer, VkExtent2D extent, float highlight, GpuProfiler* profiler)
+{
+    PROFILE_SCOPE("record scene");
+    uint64_t frame_number = frame_loop.frame_number;
+
+    PROFILE_GPU_SCOPE(profiler, command_buffer, "clear");
+    VkRenderPassBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.renderPass = render_pass;
+    begin_info.framebuffer = framebuffer;
+    begin_info.renderArea.offset.x = 0;
+    begin_info.renderArea.offset.y = 0;
+    begin_info.renderArea.extent = extent;
+    begin_info.clearValueCount = 0;
+    begin_info.pClearValues = nullptr;
+    vkCmdBeginRenderPass(command_buffer, &begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    VkCommandBufferInheritanceInfo inheritance = {};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.pNext = nullptr;
+    inheritance.renderPass = render_pass;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = framebuffer;
+    inheritance.occlusionQueryEnable = VK_FALSE;
+    inheritance.queryFlags = 0;
+    inheritance.pipelineStatistics = 0;
 
-struct DrawCommandBuffer
+    // Scene work is recorded by the workers into secondary buffers, one horizontal band of the
+    // image per worker, executed top to bottom in job order whichever worker recorded a band.
+    uint32_t band_count = std::max(std::min(job_worker_count(jobs), extent.height), 1u);
+    VK_THROW(record_parallel(jobs, device, thread_pools, frame_loop.frame_idx, command_buffer, &inheritance, band_count,
+        [=](VkCommandBuffer secondary, uint32_t job_idx)
+    {
+        // clear screen
+        float pulse = static_cast<float>(frame_number % 256) / 255.0f;
+        VkClearAttachment clear = {};
+        clear.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        clear.colorAttachment = 0;
+        clear.clearValue.color = { { 0.1f + 0.8f * highlight, 0.2f * pulse, 0.4f, 1.0f } };
+        uint32_t top = static_cast<uint32_t>(static_cast<uint64_t>(extent.height) * job_idx / band_count);
+        uint32_t bottom = static_cast<uint32_t>(static_cast<uint64_t>(extent.height) * (job_idx + 1) / band_count);
+        VkClearRect band = {};
+        band.rect.offset.x = 0;
+        band.rect.offset.y = static_cast<int32_t>(top);
+        band.rect.extent.width = extent.width;
+        band.rect.extent.height = bottom - top;
+        band.baseArrayLayer = 0;
+        band.layerCount = 1;
+        vkCmdClearAttachments(secondary, 1, &clear, 1, &band);
+    }));
+    vkCmdEndRenderPass(command_buffer);
+    return VK_SUCCESS;
+}
+
+struct FillPipeline
 {
-    VkQueue draw_queue;
-    uint32_t queue_family_idx;
+    VkDescriptorSetLayout set_layout;   // owned by the layout cache
+    VkPipelineLayout layout;
+    PipelineHandle pipeline;        // compiled in the background, dispatches are skipped until ready
+    VkDescriptorSet descriptor_set;
+    GpuAllocation* target;
+    uint32_t count;
 };
 
-VkResult create_device(VkPhysicalDevice gpu, uint32_t graphics_queue, uint32_t present_queue, VkDevice* out_device)
+// Storage buffer fill: one binding, value and count as push constants.
+VkResult create_fill_pipeline(VkDevice device, DeviceAllocator& allocator, PipelineManager& pipelines, ShaderModuleCache& shader_cache,
+    DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors, FillPipeline* out_pipeline)
 {
-    const float queuePriority = 1.0f;
-    const VkDeviceQueueCreateInfo requested_queues[] =
-    {
-        {
-            VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            NULL,
-            0,
-            graphics_queue,
-            1,
-            &queuePriority
-        },
-        {
-            VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            NULL,
-            0,
-            present_queue,
-            1,
-            &queuePriority
-        }
-    };
-    uint32_t requested_queue_count = (graphics_queue == present_queue) ? 1 : 2;
-
-
-    VkDeviceCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    info.pNext = nullptr;
-    info.flags = 0;
-    info.queueCreateInfoCount = requested_queue_count;
-    info.pQueueCreateInfos = requested_queues;
-    info.enabledLayerCount = 0;
-    info.ppEnabledLayerNames = nullptr;
-    info.enabledExtensionCount = 0;
-    info.ppEnabledExtensionNames = nullptr;
-    info.pEnabledFeatures = nullptr;
-    VK_THROW(vkCreateDevice(gpu, &info, nullptr, out_device));
+    VkShaderModule module = VK_NULL_HANDLE;
+    VK_THROW(load_shader_module(shader_cache, "shaders/fill.comp.spv", &module));
+
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    binding.pImmutableSamplers = nullptr;
+    VK_THROW(get_descriptor_set_layout(layouts, 0, &binding, 1, nullptr, &out_pipeline->set_layout));
+
+    VkPushConstantRange push_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, 2 * sizeof(uint32_t) };
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.pNext = nullptr;
+    layout_info.flags = 0;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &out_pipeline->set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    VK_THROW(vkCreatePipelineLayout(device, &layout_info, host_allocator(), &out_pipeline->layout));
+
+    ComputePipelineDesc pipeline_desc;
+    pipeline_desc.name = "fill";
+    pipeline_desc.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_desc.stage.module = module;
+    pipeline_desc.stage.entry = "main";
+    pipeline_desc.layout = out_pipeline->layout;
+    out_pipeline->pipeline = request_compute_pipeline(pipelines, pipeline_desc, 0);
+
+    out_pipeline->count = 16 * 1024;
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = out_pipeline->count * sizeof(uint32_t);
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    VK_THROW(create_buffer(allocator, buffer_info, MEMORY_GPU_ONLY, &out_pipeline->target));
+
+    VK_THROW(allocate_descriptor_set(descriptors, out_pipeline->set_layout, &out_pipeline->descriptor_set));
+
+    VkDescriptorBufferInfo target_info = { out_pipeline->target->buffer, 0, VK_WHOLE_SIZE };
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext = nullptr;
+    write.dstSet = out_pipeline->descriptor_set;
+    write.dstBinding = 0;
+    write.dstArrayElement = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &target_info;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
     return VK_SUCCESS;
 }
 
-VkResult create_surface(VkInstance vk_instance, VkPhysicalDevice gpu, VkDevice* out_device, DrawCommandBuffer* out_draw_command_buffer, SwapChain* out_swap_chain)
+void destroy_fill_pipeline(VkDevice device, DeviceAllocator& allocator, FillPipeline& pipeline)
 {
-    if ((out_swap_chain == nullptr) || (out_draw_command_buffer == nullptr))
+    // The set goes back with the descriptor allocator, the set layout with the layout cache.
+    destroy_buffer(allocator, pipeline.target);
+    vkDestroyPipelineLayout(device, pipeline.layout, host_allocator());
+}
+
+// Skipped while the pipeline is still compiling, the frame never waits for it. The render graph
+// orders it after the previous frame's fill.
+void record_fill(VkCommandBuffer command_buffer, PipelineManager& pipelines, FillPipeline const& fill, uint32_t value, GpuProfiler* profiler)
+{
+    VkPipeline pipeline = resolve_pipeline(pipelines, fill.pipeline);
+    if (pipeline == VK_NULL_HANDLE)
     {
-        return VK_ERROR_INITIALIZATION_FAILED;
+        return;
     }
-    VkWin32SurfaceCreateInfoKHR surfaceCreateInfo;
-    surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-    surfaceCreateInfo.hinstance = out_swap_chain->instance;
-    surfaceCreateInfo.hwnd = out_swap_chain->window;
-    VK_THROW(vkCreateWin32SurfaceKHR(vk_instance, &surfaceCreateInfo, NULL, &(out_swap_chain->surface)));
+    PROFILE_GPU_STATISTICS_SCOPE(profiler, command_buffer, "fill");
+    uint32_t params[2] = { value, fill.count };
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, fill.layout, 0, 1, &fill.descriptor_set, 0, nullptr);
+    vkCmdPushConstants(command_buffer, fill.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), params);
+    vkCmdDispatch(command_buffer, (fill.count + 63) / 64, 1, 1);
+}
 
+// Teardown of everything created after the device, newest first. Every exit from main() once the
+// device exists goes through it: worker threads are joined and objects destroyed while the device
+// and the allocator they came from are still alive. What the steps refer to is declared ahead of
+// the stack, so it is still there when the destructor runs them.
+struct ShutdownStack
+{
+    VkDevice device;
+    std::vector<std::function<void()> > steps;
 
-    uint32_t queue_count;
-    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &queue_count, nullptr);
-    assert(queue_count > 0);
-    std::vector<VkBool32> support_presentable_swap_chain(queue_count);
-    std::vector<VkQueueFamilyProperties> properties(queue_count);
+    explicit ShutdownStack(VkDevice in_device) : device(in_device) {}
+    ~ShutdownStack();
+};
 
-    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &queue_count, properties.data());
-    for (uint32_t qidx = 0; qidx < queue_count; ++qidx)
+void run_shutdown(ShutdownStack& stack)
+{
+    if (stack.steps.empty())
     {
-        vkGetPhysicalDeviceSurfaceSupportKHR(gpu, qidx, out_swap_chain->surface, &(support_presentable_swap_chain[qidx]));
+        return;
     }
-    uint32_t graphics_queue = UINT32_MAX;
-    uint32_t swap_chain_queue = UINT32_MAX;
-    for (uint32_t qidx = 0; qidx < queue_count; ++qidx)
+    vkDeviceWaitIdle(stack.device);
+    while (!stack.steps.empty())
     {
-        if (check_flag(properties[qidx].queueFlags, VK_QUEUE_GRAPHICS_BIT) && properties[qidx].queueCount > 0)
+        std::function<void()> step = stack.steps.back();
+        stack.steps.pop_back();
+        step();
+    }
+}
+
+ShutdownStack::~ShutdownStack()
+{
+    run_shutdown(*this);
+}
+
+//int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine, int nCmdShow)
+int main(int argc, char *argv[])
+{
+    StartupTimer startup;
+    start_startup_timer(&startup);
+
+    VkInstance vk_instance = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    SwapChain swap_chain;
+    DrawCommandBuffer command_buffer;
+    VkCommandPool draw_command_pool = VK_NULL_HANDLE;
+
+#ifdef PLATFORM_WINDOW
+    SwapChainMode mode = SWAP_CHAIN_WINDOW;
+#else
+    SwapChainMode mode = SWAP_CHAIN_HEADLESS_SURFACE;   // built without a window system
+#endif
+    uint32_t frames_in_flight = 2;
+    uint64_t frame_limit = 0;   // 0 runs until the window is closed
+    uint32_t record_threads = 0;    // 0 uses every core
+    bool use_pipeline_cache = true;
+    char const* trace_path = nullptr;
+    PresentPolicy present_policy = PRESENT_LOW_LATENCY;
+    uint32_t swap_images = 0;   // 0 is one more than frames in flight
+    uint32_t resize_every = 0;  // exercises swap chain recreation without a window
+    bool use_bindless = false;
+    HostAllocatorMode host_mode = HOST_ALLOCATOR_ARENA;
+    char const* capture_path = nullptr;   // directory for images, file or pipe for the raw stream
+    ReadbackFormat capture_format = READBACK_PPM;
+    ReadbackPolicy capture_policy = READBACK_DROP;
+    uint32_t capture_every = 1;
+    uint32_t capture_writers = 2;
+    std::vector<char const*> texture_paths;     // KTX2, streamed
+    VkDeviceSize texture_budget = 0;            // 0 leaves it to the heap budget
+    std::vector<char const*> mesh_paths;        // .vkmesh, from tools/meshpack
+    DeviceSelection selection;
+    init_device_selection(&selection);
+    for (int aidx = 1; aidx < argc; ++aidx)
+    {
+        if ((strcmp(argv[aidx], "--frames-in-flight") == 0) && (aidx + 1 < argc))
         {
-            graphics_queue = qidx;
-            if (support_presentable_swap_chain[qidx])
+            frames_in_flight = static_cast<uint32_t>(atoi(argv[++aidx]));
+            if (frames_in_flight == 0)
             {
-                swap_chain_queue = qidx;
-                break;
+                frames_in_flight = 1;
             }
         }
-    }
-    if (swap_chain_queue == UINT32_MAX)   // Can't find a graphic queue that also support swap chain. Select two different queue.
-    {
-        for (uint32_t qidx = 0; qidx < queue_count; ++qidx)
+        else if ((strcmp(argv[aidx], "--frames") == 0) && (aidx + 1 < argc))
+        {
+            frame_limit = static_cast<uint64_t>(atoll(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--record-threads") == 0) && (aidx + 1 < argc))
         {
-            if (support_presentable_swap_chain[qidx] && (properties[qidx].queueCount > 0))
+            record_threads = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if (strcmp(argv[aidx], "--headless") == 0)
+        {
+            mode = SWAP_CHAIN_HEADLESS_SURFACE;
+        }
+        else if (strcmp(argv[aidx], "--offscreen") == 0)
+        {
+            mode = SWAP_CHAIN_OFFSCREEN;
+        }
+        else if (strcmp(argv[aidx], "--no-pipeline-cache") == 0)
+        {
+            use_pipeline_cache = false;     // forces a cold start, the cache is still written back
+        }
+        else if ((strcmp(argv[aidx], "--gpu") == 0) && (aidx + 1 < argc))
+        {
+            selection.override_device = argv[++aidx];  // index, device UUID or part of the name
+        }
+        else if (strcmp(argv[aidx], "--no-device-profile") == 0)
+        {
+            selection.load_profile = false;     // queries every device, the profile is still written back
+        }
+        else if ((strcmp(argv[aidx], "--trace") == 0) && (aidx + 1 < argc))
+        {
+            trace_path = argv[++aidx];      // Chrome trace of the last frames, written on exit
+        }
+        else if ((strcmp(argv[aidx], "--present") == 0) && (aidx + 1 < argc))
+        {
+            char const* policy = argv[++aidx];
+            if (strcmp(policy, "tear-free") == 0)
             {
-                swap_chain_queue = qidx;
-                break;
+                present_policy = PRESENT_TEAR_FREE;
+            }
+            else if (strcmp(policy, "power-saving") == 0)
+            {
+                present_policy = PRESENT_POWER_SAVING;
+            }
+            else
+            {
+                present_policy = PRESENT_LOW_LATENCY;
             }
         }
+        else if ((strcmp(argv[aidx], "--swap-images") == 0) && (aidx + 1 < argc))
+        {
+            swap_images = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--resize-every") == 0) && (aidx + 1 < argc))
+        {
+            resize_every = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if (strcmp(argv[aidx], "--bindless") == 0)
+        {
+            use_bindless = true;    // needs VK_EXT_descriptor_indexing, ignored without it
+        }
+        else if ((strcmp(argv[aidx], "--host-allocator") == 0) && (aidx + 1 < argc))
+        {
+            char const* name = argv[++aidx];
+            if (strcmp(name, "driver") == 0)
+            {
+                host_mode = HOST_ALLOCATOR_DRIVER;
+            }
+            else if (strcmp(name, "tracking") == 0)
+            {
+                host_mode = HOST_ALLOCATOR_TRACKING;
+            }
+            else
+            {
+                host_mode = HOST_ALLOCATOR_ARENA;
+            }
+        }
+        else if ((strcmp(argv[aidx], "--capture") == 0) && (aidx + 1 < argc))
+        {
+            capture_path = argv[++aidx];
+        }
+        else if ((strcmp(argv[aidx], "--capture-format") == 0) && (aidx + 1 < argc))
+        {
+            char const* name = argv[++aidx];
+            if (strcmp(name, "png") == 0)
+            {
+                capture_format = READBACK_PNG;
+            }
+            else if (strcmp(name, "raw") == 0)
+            {
+                capture_format = READBACK_RAW_STREAM;
+            }
+            else
+            {
+                capture_format = READBACK_PPM;
+            }
+        }
+        else if ((strcmp(argv[aidx], "--capture-policy") == 0) && (aidx + 1 < argc))
+        {
+            capture_policy = (strcmp(argv[++aidx], "block") == 0) ? READBACK_BLOCK : READBACK_DROP;
+        }
+        else if ((strcmp(argv[aidx], "--capture-every") == 0) && (aidx + 1 < argc))
+        {
+            capture_every = static_cast<uint32_t>(atoi(argv[++aidx]));
+            if (capture_every == 0)
+            {
+                capture_every = 1;
+            }
+        }
+        else if ((strcmp(argv[aidx], "--capture-writers") == 0) && (aidx + 1 < argc))
+        {
+            capture_writers = static_cast<uint32_t>(atoi(argv[++aidx]));
+        }
+        else if ((strcmp(argv[aidx], "--texture") == 0) && (aidx + 1 < argc))
+        {
+            texture_paths.push_back(argv[++aidx]);
+        }
+        else if ((strcmp(argv[aidx], "--texture-budget") == 0) && (aidx + 1 < argc))
+        {
+            texture_budget = static_cast<VkDeviceSize>(atoll(argv[++aidx])) * 1024 * 1024;   // MiB
+        }
+        else if ((strcmp(argv[aidx], "--mesh") == 0) && (aidx + 1 < argc))
+        {
+            mesh_paths.push_back(argv[++aidx]);
+        }
     }
+    PROFILE_THREAD_NAME("main");
+    init_host_allocator(host_mode);
 
-    // Generate error if could not find both a graphics and a present queue
-    if ((graphics_queue == UINT32_MAX) || (swap_chain_queue == UINT32_MAX))
+    // Pumped by a thread of its own, this one only renders. Declared ahead of the Vulkan owners so
+    // an early exit destroys the surface before the window.
+    PlatformWindow window;
+    InputState input;
+    init_input_state(800, 600, &input);
+    bool window_open = false;
+    if (mode == SWAP_CHAIN_WINDOW)
     {
-        vkDestroySurfaceKHR(vk_instance, out_swap_chain->surface, nullptr);
-        out_swap_chain->surface = nullptr;
-        return VK_ERROR_INITIALIZATION_FAILED;
+        window_open = create_platform_window(800, 600, "vk_test", &window);
+        if (!window_open)
+        {
+            std::cout << "No window, running headless\n";
+            mode = SWAP_CHAIN_HEADLESS_SURFACE;
+        }
     }
+    init_swap_chain(mode, &swap_chain);
+    swap_chain.window = window_open ? &window : nullptr;
 
-    uint32_t format_count;
-    VK_THROW(vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, out_swap_chain->surface, &format_count, NULL));
+    if (VkResult err = init_Vulkan(vk_instance, selection, &device, &command_buffer, &swap_chain))
+    {
+        print_vk_error_code("Unable to initialize Vulkan: ", err);
+        return 1;
+    }
+    // Destroyed in reverse order on every exit path; the resets at the end of main() spell the
+    // order out before the Vulkan library is unloaded.
+    UniqueInstance instance_owner(vk_instance);
+    UniqueSurface surface_owner(vk_instance, swap_chain.surface);
+    UniqueDevice device_owner(device);
+    UniqueCommandPool draw_pool_owner;
+    mark_startup_phase(startup, "instance and device");
 
-    std::vector<VkSurfaceFormatKHR> surface_formats(format_count);
-    VK_THROW(vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, out_swap_chain->surface, &format_count, surface_formats.data()));
+    PipelineCache pipeline_cache;
+    DeviceAllocator device_allocator;
+    ShaderModuleCache shader_cache;
+    PipelineManager pipelines;
+    DescriptorLayoutCache descriptor_layouts;
+    DescriptorAllocator descriptors;
+    FillPipeline fill_pipeline;
+    BindlessTable bindless;
+    ImmediateExecutor immediate;
+    FrameLoop frame_loop;
+    FrameAllocator frame_allocator;
+    FrameDescriptors frame_descriptors;
+    UploadQueue upload;
+    TextureStreamer textures;
+    std::vector<Mesh> meshes;
+    GpuCulling culling;
+    CulledMeshPass mesh_pass;
+    VkImageView depth_view = VK_NULL_HANDLE;
+    VkRenderPass scene_render_pass = VK_NULL_HANDLE;
+    JobSystem jobs;
+    ThreadCommandPools thread_pools;
+#ifdef ENABLE_PROFILER
+    GpuProfiler gpu_profiler_storage;
+#endif
+    ReadbackRing readback;
+    RenderGraph graph;
+    // Each create pushes its destroy once it succeeded.
+    ShutdownStack shutdown(device);
 
-    // If the format list includes just one entry of VK_FORMAT_UNDEFINED,
-    // the surface has no preferred format. Otherwise, at least one
-    // supported format will be returned
-    if (format_count == 1 && surface_formats[0].format == VK_FORMAT_UNDEFINED)
+    if (VkResult err = create_pipeline_cache(device, command_buffer.gpu_properties, "vk_test.pipeline_cache", use_pipeline_cache, &pipeline_cache))
     {
-        out_swap_chain->surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
-        out_swap_chain->surface_format.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+        print_vk_error_code("Unable to create the pipeline cache: ", err);
+        return 1;
     }
-    else
+    if (pipeline_cache.reject_reason != nullptr)
     {
-        assert(format_count > 0);
-        out_swap_chain->surface_format = surface_formats[0];
+        std::cout << "Pipeline cache ignored: " << pipeline_cache.reject_reason << "\n";
     }
+    shutdown.steps.push_back([&]()
+    {
+        save_pipeline_cache(device, pipeline_cache);
+        destroy_pipeline_cache(device, pipeline_cache);
+    });
+    mark_startup_phase(startup, "pipeline cache load");
 
-    VK_THROW(create_device(gpu, graphics_queue, swap_chain_queue, out_device));
-
-    vkGetDeviceQueue(*out_device, graphics_queue, 0, &out_draw_command_buffer->draw_queue);
-    vkGetDeviceQueue(*out_device, swap_chain_queue, 0, &out_swap_chain->present_queue);
-    out_draw_command_buffer->queue_family_idx = graphics_queue;
-    out_swap_chain->queue_family_idx = swap_chain_queue;
-    out_swap_chain->gpu = gpu;
-
-    return VK_SUCCESS;
-}
+    create_device_allocator(swap_chain.gpu, device, &device_allocator);
+    swap_chain.allocator = &device_allocator;
+    shutdown.steps.push_back([&]() { destroy_device_allocator(device_allocator); });
 
-VkResult init_Vulkan(VkInstance& vk_instance, VkDevice* out_device, DrawCommandBuffer* out_draw_command_buffer, SwapChain* out_swap_chain)
-{
-    if ((out_device == nullptr) || (out_swap_chain == nullptr))
-    {
-        return VK_ERROR_INITIALIZATION_FAILED;
-    }
-    VkApplicationInfo app_info = {};
-    app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    app_info.pNext = nullptr;
-    app_info.pApplicationName = "VT Test";
-    app_info.applicationVersion = 0x00000001;
-    app_info.pEngineName = "Noengine";
-    app_info.engineVersion = 0x00;
-    app_info.apiVersion = VK_MAKE_VERSION(1, 0, 2);
-
-    std::vector<const char *> enabledExtensions = { VK_KHR_SURFACE_EXTENSION_NAME };
-    enabledExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
-
-    VkInstanceCreateInfo instance_info = {};
-    instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    instance_info.pNext = nullptr;
-    instance_info.flags = 0;
-    instance_info.pApplicationInfo = &app_info;
-    instance_info.enabledLayerCount = 0;
-    instance_info.ppEnabledLayerNames = nullptr;
-    instance_info.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
-    instance_info.ppEnabledExtensionNames = enabledExtensions.data();
-
-    VK_THROW(vkCreateInstance(&instance_info, nullptr, &vk_instance)); // Create Vulkan library instance
-
-    out_swap_chain->instance = GetModuleHandle(NULL);
-    out_swap_chain->window = setup_window(out_swap_chain->instance, 800, 600, "vk_test");
-
-    uint32_t gpu_count = 0;
-    // Get number of available physical devices
-    VK_THROW(vkEnumeratePhysicalDevices(vk_instance, &gpu_count, nullptr));
-    assert(gpu_count > 0);
-
-    std::vector<VkPhysicalDevice> physicalDevices(gpu_count); // Enumerate devices
-    VK_THROW(vkEnumeratePhysicalDevices(vk_instance, &gpu_count, physicalDevices.data()));
-    bool surface_created = false;
-    VkPhysicalDeviceProperties gpu_properties;
-    VkPhysicalDeviceFeatures gpu_feature;
-    for (uint32_t gidx = 0; gidx < gpu_count; ++gidx)
-    {
-        VkPhysicalDevice gpu = physicalDevices[gidx];
-        vkGetPhysicalDeviceProperties(gpu, &gpu_properties);
-        std::cout << gidx << "Driver Version: " << gpu_properties.driverVersion << "\n";
-        std::cout << gidx << "Device Name:    " << gpu_properties.deviceName << "\n";
-        std::cout << gidx << "Device Type:    " << gpu_properties.deviceType << "\n";
-        std::cout << gidx << "API Version:    " << VK_VERSION_MAJOR(gpu_properties.apiVersion) << "." << VK_VERSION_MINOR(gpu_properties.apiVersion) << "." << VK_VERSION_PATCH(gpu_properties.apiVersion) << "\n";
-
-        // we can choose a gpu based on the features here.
-        vkGetPhysicalDeviceFeatures(gpu, &gpu_feature);
-
-        VkResult err = create_surface(vk_instance, gpu, out_device, out_draw_command_buffer, out_swap_chain);
-        if (err == VK_SUCCESS)
+    create_shader_module_cache(device, &shader_cache);
+    shutdown.steps.push_back([&]() { destroy_shader_module_cache(shader_cache); });
+    create_pipeline_manager(device, pipeline_cache.cache, 2, &pipelines);
+    shutdown.steps.push_back([&]()
+    {
+        print_pipeline_stats(pipelines);
+        destroy_pipeline_manager(pipelines);
+    });
+    create_descriptor_layout_cache(device, &descriptor_layouts);
+    shutdown.steps.push_back([&]() { destroy_descriptor_layout_cache(descriptor_layouts); });
+    DescriptorPoolRatio const descriptor_ratios[] = {
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f }
+    };
+    // Sets that live as long as what they point at, never reset.
+    create_descriptor_allocator(device, descriptor_ratios, 5, 16, &descriptors);
+    shutdown.steps.push_back([&]()
+    {
+        print_descriptor_stats("descriptors", descriptors);
+        destroy_descriptor_allocator(descriptors);
+    });
+    if (VkResult err = create_fill_pipeline(device, device_allocator, pipelines, shader_cache, descriptor_layouts, descriptors, &fill_pipeline))
+    {
+        print_vk_error_code("Unable to create the fill pipeline: ", err);
+        return 1;
+    }
+    shutdown.steps.push_back([&]() { destroy_fill_pipeline(device, device_allocator, fill_pipeline); });
+    if (use_bindless && !command_buffer.descriptor_indexing)
+    {
+        std::cout << "--bindless ignored, the device has no usable descriptor indexing\n";
+    }
+    else if (use_bindless)
+    {
+        if (VkResult err = create_bindless_table(device, descriptor_layouts, command_buffer.gpu_properties.limits, true, 64 * 1024, 16 * 1024, &bindless))
         {
-            surface_created = true;
-            break;
+            print_vk_error_code("Unable to create the bindless table: ", err);
+            return 1;
         }
+        // Destroyed after the frame loop, whose deferred releases return their indices to the table.
+        shutdown.steps.push_back([&]()
+        {
+            print_bindless_stats(bindless);
+            destroy_bindless_table(bindless);
+        });
+        uint32_t fill_index = register_bindless_buffer(bindless, fill_pipeline.target->buffer, 0, VK_WHOLE_SIZE);
+        std::cout << "bindless: fill target at buffer index " << fill_index << "\n";
     }
-    if (!surface_created)
+    mark_startup_phase(startup, "pipeline requests");
+
+    if (VkResult err = create_command_pool(device, command_buffer.queue_family_idx, &draw_command_pool))
     {
-        return VK_ERROR_INITIALIZATION_FAILED;
+        print_vk_error_code("Unable to create the draw command pool: ", err);
+        return 1;
+    }
+    draw_pool_owner = UniqueCommandPool(device, draw_command_pool);
+    // One-shot work shares the draw queue so the frames are ordered after it.
+    if (VkResult err = create_immediate_executor(device, command_buffer.draw_queue, command_buffer.queue_family_idx, &immediate))
+    {
+        print_vk_error_code("Unable to create the immediate executor: ", err);
+        return 1;
+    }
+    shutdown.steps.push_back([&]()
+    {
+        print_immediate_stats(immediate);
+        destroy_immediate_executor(immediate);
+    });
+    uint32_t w = 800;
+    uint32_t h = 600;
+    // One image more than frames in flight so acquire does not wait for the presentation engine.
+    set_present_policy(swap_chain, present_policy, (swap_images > 0) ? swap_images : frames_in_flight + 1);
+    if (VkResult err = create_swap_chain(device, swap_chain, &w, &h))
+    {
+        print_vk_error_code("Unable to create the swap chain: ", err);
+        return 1;
     }
+    shutdown.steps.push_back([&]()
+    {
+        std::cout << "swap chain recreated " << swap_chain.recreate_count << " times\n";
+        destroy_swap_chain(device, swap_chain);
+    });
+    std::cout << "present: " << present_policy_name(swap_chain.present_policy) << " policy, " << present_mode_name(swap_chain.present_mode)
+              << ", " << swap_chain.images.size() << " images\n";
+    print_memory_stats(device_allocator);
 
-    return VK_SUCCESS;
-}
+    if (VkResult err = create_frame_loop(device, draw_command_pool, frames_in_flight, static_cast<uint32_t>(swap_chain.images.size()), &frame_loop))
+    {
+        print_vk_error_code("Unable to create the frame loop: ", err);
+        return 1;
+    }
+    shutdown.steps.push_back([&]() { destroy_frame_loop(device, draw_command_pool, frame_loop); });
 
-VkResult create_command_pool(VkDevice device, uint32_t queue_family_idx, VkCommandPool* out_command_pool)
-{
-    VkCommandPoolCreateInfo command_pool_info = {};
-    command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    command_pool_info.pNext = nullptr;
-    command_pool_info.queueFamilyIndex = queue_family_idx;
-    command_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    return vkCreateCommandPool(device, &command_pool_info, nullptr, out_command_pool);
-}
+    if (VkResult err = create_frame_allocator(device_allocator, swap_chain.gpu, 4 * 1024 * 1024, frames_in_flight, &frame_allocator))
+    {
+        print_vk_error_code("Unable to create the frame allocator: ", err);
+        return 1;
+    }
+    shutdown.steps.push_back([&]()
+    {
+        print_frame_allocator_stats(frame_allocator);
+        destroy_frame_allocator(device_allocator, frame_allocator);
+    });
 
-VkResult setup(VkDevice device, VkCommandPool command_pool, SwapChain& swap_chain, uint32_t *width, uint32_t *height)
-{
-    VkCommandBuffer setup_command_buffer = VK_NULL_HANDLE;  // command buffer used for setup
-    VkCommandBufferAllocateInfo command_buffer_allocate_info;
-    command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    command_buffer_allocate_info.pNext = nullptr;
-    command_buffer_allocate_info.commandPool = command_pool;
-    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    command_buffer_allocate_info.commandBufferCount = 1;
-    vkAllocateCommandBuffers(device, &command_buffer_allocate_info, &setup_command_buffer);
-
-    VkCommandBufferBeginInfo command_buffer_begin_info = {};
-    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    command_buffer_begin_info.pNext = nullptr;
-    command_buffer_begin_info.flags = 0;
-    command_buffer_begin_info.pInheritanceInfo = nullptr;
-
-    vkBeginCommandBuffer(setup_command_buffer, &command_buffer_begin_info);
-
-    // SWAP CHAIN
-    uint32_t present_mode_count = 0;
-    vkGetPhysicalDeviceSurfacePresentModesKHR(swap_chain.gpu, swap_chain.surface, &present_mode_count, nullptr);
-    std::vector<VkPresentModeKHR> present_modes(present_mode_count);
-    vkGetPhysicalDeviceSurfacePresentModesKHR(swap_chain.gpu, swap_chain.surface, &present_mode_count, present_modes.data());
-
-    // Try to use mailbox mode
-    // Low latency and non-tearing
-    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-    for (uint32_t i = 0; i < present_mode_count; i++)
-    {
-        if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
-        {
-            swapchainPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-            break;
+    // Sets recorded by one frame, handed back in bulk when its slot comes around again.
+    create_frame_descriptors(device, descriptor_ratios, 5, 64, frames_in_flight, &frame_descriptors);
+    shutdown.steps.push_back([&]()
+    {
+        print_frame_descriptor_stats(frame_descriptors);
+        destroy_frame_descriptors(frame_descriptors);
+    });
+
+    if (VkResult err = create_upload_queue(device_allocator, device, swap_chain.gpu, command_buffer, 16 * 1024 * 1024, &upload))
+    {
+        print_vk_error_code("Unable to create the upload queue: ", err);
+        return 1;
+    }
+    shutdown.steps.push_back([&]()
+    {
+        print_upload_stats(upload);
+        destroy_upload_queue(device_allocator, upload);
+    });
+
+    // Textures show up with their mip tail on the first frames and sharpen as the uploads land.
+    create_texture_streamer(device, swap_chain.gpu, device_allocator, upload, frame_loop.deletion_queue, command_buffer.memory_budget,
+                            texture_budget, &textures);
+    shutdown.steps.push_back([&]()
+    {
+        if (!textures.textures.empty())
+        {
+            print_texture_streaming_stats(textures);
         }
-        if ((swapchainPresentMode != VK_PRESENT_MODE_MAILBOX_KHR) && (present_modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR))
+        destroy_texture_streamer(textures);
+    });
+    for (size_t tidx = 0; tidx < texture_paths.size(); ++tidx)
+    {
+        uint32_t texture = 0;
+        if (VkResult err = load_streamed_texture(textures, texture_paths[tidx], &texture))
         {
-            swapchainPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            std::string message = std::string("Unable to stream ") + texture_paths[tidx] + ": ";
+            print_vk_error_code(message.c_str(), err);
         }
     }
 
-    VkSurfaceCapabilitiesKHR surface_cap;
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(swap_chain.gpu, swap_chain.surface, &surface_cap);
-
-    VkExtent2D swapchainExtent = {};
-    // width and height are either both -1, or both not -1.
-    if (surface_cap.currentExtent.width == -1)
+    // Uploaded from the mapped files, usable once their tickets complete.
+    shutdown.steps.push_back([&]()
     {
-        // If the surface size is undefined, the size is set to
-        // the size of the images requested.
-        swapchainExtent.width = *width;
-        swapchainExtent.height = *height;
+        for (size_t midx = 0; midx < meshes.size(); ++midx)
+        {
+            destroy_mesh(meshes[midx]);
+        }
+    });
+    std::chrono::steady_clock::time_point mesh_start = std::chrono::steady_clock::now();
+    for (size_t midx = 0; midx < mesh_paths.size(); ++midx)
+    {
+        Mesh mesh;
+        if (VkResult err = load_mesh(device_allocator, upload, mesh_paths[midx], &mesh))
+        {
+            std::string message = std::string("Unable to load ") + mesh_paths[midx] + ": ";
+            print_vk_error_code(message.c_str(), err);
+            continue;
+        }
+        meshes.push_back(std::move(mesh));
     }
-    else
-    {
-        // If the surface size is defined, the swap chain size must match
-        swapchainExtent = surface_cap.currentExtent;
-        *width = surface_cap.currentExtent.width;
-        *height = surface_cap.currentExtent.height;
+    if (!meshes.empty())
+    {
+        double mesh_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mesh_start).count();
+        uint64_t vertex_count = 0;
+        uint64_t triangle_count = 0;
+        uint64_t file_bytes = 0;
+        for (size_t midx = 0; midx < meshes.size(); ++midx)
+        {
+            vertex_count += meshes[midx].vertex_count;
+            triangle_count += meshes[midx].index_count / 3;
+            file_bytes += meshes[midx].file_bytes;
+        }
+        std::cout << "meshes: " << meshes.size() << ", " << vertex_count << " vertices, " << triangle_count << " triangles, "
+                  << file_bytes / 1024 << " KiB loaded in " << mesh_ms << " ms\n";
     }
 
-    // Determine the number of images
-    uint32_t desired_number_of_swapchain_images = surface_cap.minImageCount + 1;
-    if ((surface_cap.maxImageCount > 0) && (desired_number_of_swapchain_images > surface_cap.maxImageCount))
+    // The first mesh is drawn once per object of a block in front of the camera, culled on the
+    // GPU: the outer columns of the near rows fail the frustum test, most of the far rows the
+    // Hi-Z test against the depth of the frame before.
+    bool draw_meshes = false;
+    VkExtent2D const depth_extent = swap_chain.extent;
+    CullView mesh_cull_view;
+    CulledMeshView mesh_view;
+    if (!meshes.empty())
     {
-        desired_number_of_swapchain_images = surface_cap.maxImageCount;
+        uint32_t const grid = 16;
+        VkResult err = create_gpu_culling(device, command_buffer, device_allocator, pipelines, shader_cache, descriptor_layouts, descriptors,
+                                          grid * grid * grid, depth_extent.width, depth_extent.height, &culling);
+        if (err == VK_ERROR_FEATURE_NOT_PRESENT)
+        {
+            std::cout << "Meshes not drawn, GPU culling needs drawIndirectFirstInstance\n";
+        }
+        else if (err != VK_SUCCESS)
+        {
+            print_vk_error_code("Unable to create the GPU culling: ", err);
+            return 1;
+        }
+        else
+        {
+            shutdown.steps.push_back([&]() { destroy_gpu_culling(device_allocator, culling); });
+            if (VkResult pass_err = create_culled_mesh_pass(device, pipelines, shader_cache, descriptor_layouts, descriptors, culling,
+                                                            swap_chain.surface_format.format, VK_ATTACHMENT_LOAD_OP_LOAD, VK_FORMAT_D32_SFLOAT, &mesh_pass))
+            {
+                print_vk_error_code("Unable to create the culled mesh pass: ", pass_err);
+                return 1;
+            }
+            shutdown.steps.push_back([&]() { destroy_culled_mesh_pass(mesh_pass); });
+
+            Mesh const& mesh = meshes[0];
+            float const origin[3] = { 0.0f, 0.0f, 0.0f };
+            CullObject object;
+            make_mesh_cull_object(mesh, origin, &object);
+            float const spacing = 3.0f * std::max(object.sphere[3], 1e-3f);
+            std::vector<CullObject> objects;
+            for (uint32_t zidx = 0; zidx < grid; ++zidx)
+            {
+                for (uint32_t yidx = 0; yidx < grid; ++yidx)
+                {
+                    for (uint32_t xidx = 0; xidx < grid; ++xidx)
+                    {
+                        float const center[3] = { (xidx + 0.5f - 0.5f * grid) * spacing, (yidx + 0.5f - 0.5f * grid) * spacing, (zidx + 0.6f * grid) * spacing };
+                        make_mesh_cull_object(mesh, center, &object);
+                        objects.push_back(object);
+                    }
+                }
+            }
+            float const identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+            float const aspect = static_cast<float>(depth_extent.width) / static_cast<float>(std::max(depth_extent.height, 1u));
+            make_cull_view(identity, 1.0471976f, aspect, 0.1f * spacing, CULL_FRUSTUM | CULL_OCCLUSION, &mesh_cull_view);
+            make_culled_mesh_view(mesh_cull_view, mesh, &mesh_view);
+            if (VkResult upload_err = upload_cull_objects(culling, device_allocator, immediate, objects.data(), static_cast<uint32_t>(objects.size()), nullptr))
+            {
+                print_vk_error_code("Unable to upload the cull objects: ", upload_err);
+                return 1;
+            }
+            draw_meshes = true;
+            std::cout << "meshes: " << objects.size() << " copies of " << mesh_paths[0] << ", GPU culled, "
+                      << (culling.compact ? "draw indirect count" : (culling.multi_draw ? "multi-draw indirect" : "one indirect draw per object")) << "\n";
+        }
     }
 
-    VkSurfaceTransformFlagsKHR pre_transform;
-    if (check_flag(surface_cap.supportedTransforms, VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR))
+    if (!create_job_system(record_threads, &jobs))
     {
-        pre_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+        std::cout << "Unable to start the job system workers\n";
+        return 1;
     }
-    else
+    shutdown.steps.push_back([&]() { destroy_job_system(jobs); });
+    if (VkResult err = create_thread_command_pools(device, command_buffer.queue_family_idx, job_worker_count(jobs), frames_in_flight, &thread_pools))
     {
-        pre_transform = surface_cap.currentTransform;
+        print_vk_error_code("Unable to create the recording command pools: ", err);
+        return 1;
     }
-	/*
-    VkSwapchainCreateInfoKHR swapchain_creation_info = {};
-    swapchain_creation_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    swapchain_creation_info.pNext = NULL;
-    swapchain_creation_info.surface = surface;
-    swapchain_creation_info.minImageCount = desired_number_of_swapchain_images;
-    swapchain_creation_info.imageFormat = colorFormat;
-    swapchain_creation_info.imageColorSpace = colorSpace;
-    swapchain_creation_info.imageExtent = { swapchainExtent.width, swapchainExtent.height };
-    swapchain_creation_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    swapchain_creation_info.preTransform = (VkSurfaceTransformFlagBitsKHR)preTransform;
-    swapchain_creation_info.imageArrayLayers = 1;
-    swapchain_creation_info.queueFamilyIndexCount = VK_SHARING_MODE_EXCLUSIVE;
-    swapchain_creation_info.queueFamilyIndexCount = 0;
-    swapchain_creation_info.pQueueFamilyIndices = NULL;
-    swapchain_creation_info.presentMode = swapchainPresentMode;
-    swapchain_creation_info.oldSwapchain = VK_NULL_HANDLE;
-    swapchain_creation_info.clipped = true;
-    swapchain_creation_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-
-    vkCreateSwapchainKHR(device, &swapchain_creation_info, nullptr, &swap_chain.swap_chain);
-
-
-    std::vector<VkImage> swap_chain_images(desired_number_of_swapchain_images);
-    vkGetSwapchainImagesKHR(device, swapChain, &desired_number_of_swapchain_images, swap_chain_images.data());
-*/
-/*
-    assert(!err);
-
-    buffers = (SwapChainBuffer*)malloc(sizeof(SwapChainBuffer)*imageCount);
-    assert(buffers);
-    //buffers.resize(imageCount);
-    for (uint32_t i = 0; i < imageCount; i++)
+    shutdown.steps.push_back([&]() { destroy_thread_command_pools(device, thread_pools); });
+    if (VkResult err = create_scene_render_pass(device, swap_chain.surface_format.format, &scene_render_pass))
     {
-        VkImageViewCreateInfo colorAttachmentView = {};
-        colorAttachmentView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        colorAttachmentView.pNext = NULL;
-        colorAttachmentView.format = colorFormat;
-        colorAttachmentView.components = {
-            VK_COMPONENT_SWIZZLE_R,
-            VK_COMPONENT_SWIZZLE_G,
-            VK_COMPONENT_SWIZZLE_B,
-            VK_COMPONENT_SWIZZLE_A
-        };
-        colorAttachmentView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        colorAttachmentView.subresourceRange.baseMipLevel = 0;
-        colorAttachmentView.subresourceRange.levelCount = 1;
-        colorAttachmentView.subresourceRange.baseArrayLayer = 0;
-        colorAttachmentView.subresourceRange.layerCount = 1;
-        colorAttachmentView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        colorAttachmentView.flags = 0;
-
-        buffers[i].image = swapchainImages[i];
+        print_vk_error_code("Unable to create the scene render pass: ", err);
+        return 1;
+    }
+    shutdown.steps.push_back([&]() { vkDestroyRenderPass(device, scene_render_pass, host_allocator()); });
+    GpuProfiler* gpu_profiler = nullptr;
+#ifdef ENABLE_PROFILER
+    if (VkResult err = create_gpu_profiler(device, command_buffer, frames_in_flight, 64, &gpu_profiler_storage))
+    {
+        print_vk_error_code("Unable to create the GPU profiler: ", err);
+        return 1;
+    }
+    gpu_profiler = &gpu_profiler_storage;
+    shutdown.steps.push_back([&]()
+    {
+        flush_gpu_profiler(gpu_profiler_storage);
+        if ((trace_path != nullptr) && !write_chrome_trace(trace_path, &gpu_profiler_storage, 120))
+        {
+            std::cout << "Unable to write the trace to " << trace_path << "\n";
+        }
+        destroy_gpu_profiler(gpu_profiler_storage);
+    });
+#else
+    if (trace_path != nullptr)
+    {
+        std::cout << "--trace ignored, the profiler is compiled out\n";
+    }
+#endif
 
-        vkTools::setImageLayout(
-            cmdBuffer,
-            buffers[i].image,
-            VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-
-        colorAttachmentView.image = buffers[i].image;
-
-        err = vkCreateImageView(device, &colorAttachmentView, nullptr, &buffers[i].view);
-        assert(!err);
-    }
-*/
-    vkEndCommandBuffer(setup_command_buffer);
-
-    VkSubmitInfo submit_info = {};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.pNext = nullptr;
-    submit_info.waitSemaphoreCount = 0;
-    submit_info.pWaitSemaphores = nullptr;
-    submit_info.pWaitDstStageMask = nullptr;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &setup_command_buffer;
-    submit_info.signalSemaphoreCount = 0;
-    submit_info.pSignalSemaphores = nullptr;
-
-    vkQueueSubmit(swap_chain.present_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkQueueWaitIdle(swap_chain.present_queue);
-
-    vkFreeCommandBuffers(device, command_pool, 1, &setup_command_buffer);
-    return VK_SUCCESS;
-}
+    bool capture = false;
+    if ((capture_path != nullptr) && !check_flag(swap_chain.image_usage, VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+    {
+        std::cout << "--capture ignored, the swap chain images can't be copied from\n";
+    }
+    else if ((capture_path != nullptr) && !readback_format_supported(swap_chain.surface_format.format))
+    {
+        std::cout << "--capture ignored, the swap chain format is not 8 bit RGBA or BGRA\n";
+    }
+    else if (capture_path != nullptr)
+    {
+        // Sized for the largest image --resize-every grows to. A slot per frame in flight, one per
+        // writer and a spare: the frame loop never has to wait unless the writers fall behind.
+        VkExtent2D max_extent = swap_chain.extent;
+        if (resize_every > 0)
+        {
+            max_extent.width = std::max(max_extent.width, w + w / 2);
+            max_extent.height = std::max(max_extent.height, h + h / 2);
+        }
+        uint32_t writer_count = std::max<uint32_t>(capture_writers, 1);
+        if (VkResult err = create_readback_ring(device_allocator, swap_chain.gpu, max_extent, frames_in_flight + writer_count + 1,
+                                                capture_format, capture_policy, capture_path, writer_count, &readback))
+        {
+            print_vk_error_code("Unable to create the readback ring: ", err);
+            return 1;
+        }
+        capture = true;
+        shutdown.steps.push_back([&]()
+        {
+            // Writes the frames still in the ring, the device is idle.
+            destroy_readback_ring(readback);
+            print_readback_stats(readback);
+        });
+    }
 
-//int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine, int nCmdShow)
-int main(int argc, char *argv[])
-{
-    VkInstance vk_instance = VK_NULL_HANDLE;
-    VkDevice device = VK_NULL_HANDLE;
-    SwapChain swap_chain;
-    DrawCommandBuffer command_buffer;
-    VkCommandPool swap_chain_command_pool = VK_NULL_HANDLE;
-    VkCommandPool draw_command_pool = VK_NULL_HANDLE;
+    // Frame graph: the fill dispatch and the scene clear into the swap chain image. With --mesh the
+    // cull, the culled meshes drawn over the clear and the depth pyramid for the next cull.
+    init_render_graph(&graph);
+    shutdown.steps.push_back([&]() { destroy_render_graph(device_allocator, graph); });
+    GraphState const fill_written = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT };
+    uint32_t fill_target = import_graph_buffer(graph, "fill target", fill_pipeline.target->buffer, fill_written, fill_written);
+    // Acquired at the stage end_frame() waits on the acquire semaphore, handed back for present or readback.
+    // The scene clears the whole image so its previous contents are discarded: fresh images, from
+    // startup or a recreated swap chain, need no transition of their own.
+    GraphState const acquired = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0 };
+    GraphState const presented = { swap_chain.present_layout, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        static_cast<VkAccessFlags>((swap_chain.mode == SWAP_CHAIN_OFFSCREEN) ? VK_ACCESS_TRANSFER_READ_BIT : 0) };
+    uint32_t backbuffer = import_graph_image(graph, "backbuffer", VK_IMAGE_ASPECT_COLOR_BIT, acquired, presented);
 
-    if (VkResult err = init_Vulkan(vk_instance, &device, &command_buffer, &swap_chain))
+    uint32_t fill_pass = add_graph_pass(graph, "fill", [&](VkCommandBuffer graph_command_buffer)
     {
-        print_vk_error_code("Unable to initialize Vulkan: ", err);
-        return 1;
+        record_fill(graph_command_buffer, pipelines, fill_pipeline, static_cast<uint32_t>(frame_loop.frame_number), gpu_profiler);
+        return VK_SUCCESS;
+    });
+    graph_use(graph, fill_pass, fill_target, GRAPH_STORAGE_WRITE);
+    uint32_t scene_pass = add_graph_pass(graph, "scene", [&](VkCommandBuffer graph_command_buffer) -> VkResult
+    {
+        float highlight = (input.width > 0) ? static_cast<float>(input.mouse_x) / static_cast<float>(input.width) : 0.0f;
+        highlight = std::min(std::max(highlight, 0.0f), 1.0f);
+        // Made every frame, the views change with the swap chain.
+        VkFramebuffer framebuffer = VK_NULL_HANDLE;
+        VK_THROW(create_scene_framebuffer(device, scene_render_pass, swap_chain.views[frame_loop.image_idx], swap_chain.extent, &framebuffer));
+        defer_destroy(frame_loop.deletion_queue, frame_loop.frame_number, [device, framebuffer]()
+        {
+            vkDestroyFramebuffer(device, framebuffer, host_allocator());
+        });
+        return record_scene(jobs, device, thread_pools, frame_loop, graph_command_buffer, scene_render_pass, framebuffer, swap_chain.extent, highlight,
+                            gpu_profiler);
+    });
+    graph_use(graph, scene_pass, backbuffer, GRAPH_COLOR_ATTACHMENT_WRITE);
+    bool meshes_culled = false;
+    bool meshes_drawn = false;
+    uint32_t depth = 0;
+    if (draw_meshes)
+    {
+        GraphState const indirect_read = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0 };
+        uint32_t cull_draws = import_graph_buffer(graph, "cull draws", culling.draws->buffer, indirect_read, indirect_read);
+        uint32_t cull_count = import_graph_buffer(graph, "cull count", culling.count->buffer, indirect_read, indirect_read);
+        depth = create_graph_image(graph, "depth", VK_FORMAT_D32_SFLOAT, depth_extent, VK_IMAGE_ASPECT_DEPTH_BIT);
+        uint32_t cull_pass = add_graph_pass(graph, "cull", [&](VkCommandBuffer graph_command_buffer)
+        {
+            meshes_culled = record_cull(graph_command_buffer, pipelines, culling, mesh_cull_view);
+            return VK_SUCCESS;
+        });
+        graph_use(graph, cull_pass, cull_draws, GRAPH_STORAGE_WRITE);
+        graph_use(graph, cull_pass, cull_count, GRAPH_STORAGE_WRITE);
+        uint32_t draw_pass = add_graph_pass(graph, "culled meshes", [&](VkCommandBuffer graph_command_buffer) -> VkResult
+        {
+            meshes_drawn = false;
+            if (!meshes_culled || !upload_complete(upload, meshes[0].ticket))
+            {
+                return VK_SUCCESS;
+            }
+            // Made every frame, the views change with the swap chain. Past a resize the depth
+            // extent is kept: the pyramid is built for that projection.
+            VkExtent2D extent = { std::min(swap_chain.extent.width, depth_extent.width), std::min(swap_chain.extent.height, depth_extent.height) };
+            VkFramebuffer framebuffer = VK_NULL_HANDLE;
+            VK_THROW(create_culled_mesh_framebuffer(mesh_pass, swap_chain.views[frame_loop.image_idx], depth_view, extent, &framebuffer));
+            defer_destroy(frame_loop.deletion_queue, frame_loop.frame_number, [device, framebuffer]()
+            {
+                vkDestroyFramebuffer(device, framebuffer, host_allocator());
+            });
+            meshes_drawn = record_culled_mesh_pass(graph_command_buffer, pipelines, mesh_pass, culling, meshes[0], mesh_view, framebuffer, extent, depth_extent);
+            return VK_SUCCESS;
+        });
+        graph_use(graph, draw_pass, cull_draws, GRAPH_INDIRECT_READ);
+        graph_use(graph, draw_pass, cull_count, GRAPH_INDIRECT_READ);
+        graph_use(graph, draw_pass, backbuffer, GRAPH_COLOR_ATTACHMENT_WRITE);
+        graph_use(graph, draw_pass, depth, GRAPH_DEPTH_ATTACHMENT_WRITE);
+        uint32_t pyramid_pass = add_graph_pass(graph, "depth pyramid", [&](VkCommandBuffer graph_command_buffer)
+        {
+            // For the next frame's cull. Without a draw the depth was never cleared.
+            if (meshes_drawn)
+            {
+                build_depth_pyramid(graph_command_buffer, pipelines, culling);
+            }
+            return VK_SUCCESS;
+        });
+        graph_use(graph, pyramid_pass, depth, GRAPH_SAMPLED_READ);
+        set_pass_side_effects(graph, pyramid_pass);
     }
-
-    // Swap chain command pool
-    create_command_pool(device, swap_chain.queue_family_idx, &swap_chain_command_pool);
-    if (swap_chain.queue_family_idx == command_buffer.queue_family_idx)
+    if (capture)
     {
-        draw_command_pool = swap_chain_command_pool;
+        uint32_t readback_pass = add_graph_pass(graph, "readback", [&](VkCommandBuffer graph_command_buffer)
+        {
+            if (frame_loop.frame_number % capture_every == 0)
+            {
+                record_readback(readback, graph_command_buffer, graph_image(graph, backbuffer), swap_chain.surface_format.format,
+                                swap_chain.extent, frame_loop.frame_number);
+            }
+            return VK_SUCCESS;
+        });
+        graph_use(graph, readback_pass, backbuffer, GRAPH_TRANSFER_READ);
+        set_pass_side_effects(graph, readback_pass);
     }
-    else
+    if (VkResult err = compile_render_graph(device_allocator, graph))
     {
-        create_command_pool(device, command_buffer.queue_family_idx, &draw_command_pool);
+        print_vk_error_code("Unable to compile the render graph: ", err);
+        return 1;
     }
-    uint32_t w = 800;
-    uint32_t h = 600;
-    setup(device, swap_chain_command_pool, swap_chain, &w, &h);
+    if (draw_meshes)
+    {
+        if (VkResult err = create_image_view(device, graph_image(graph, depth), VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT, &depth_view))
+        {
+            print_vk_error_code("Unable to create the depth view: ", err);
+            return 1;
+        }
+        shutdown.steps.push_back([&]() { vkDestroyImageView(device, depth_view, host_allocator()); });
+        set_cull_depth_source(culling, depth_view);
+    }
+    print_render_graph(graph);
+    mark_startup_phase(startup, "swap chain and frame resources");
+    bool first_frame = true;
 
-    //while (true)
+    while ((frame_limit == 0) || (frame_loop.frame_number < frame_limit))
     {
-        // clear screen
-        // swap chain
+        if (window_open)
+        {
+            // Resize and close, the input is sampled again right before recording.
+            poll_window_events(window, input);
+            if (input.close_requested)
+            {
+                break;
+            }
+            if (input.resized)
+            {
+                input.resized = false;
+                resize_swap_chain(swap_chain, input.width, input.height);
+            }
+        }
+        if ((resize_every > 0) && (frame_loop.frame_number > 0) && (frame_loop.frame_number % resize_every == 0))
+        {
+            bool grow = (swap_chain.extent.width == w);
+            resize_swap_chain(swap_chain, grow ? w + w / 2 : w, grow ? h + h / 2 : h);
+        }
+        PROFILE_FRAME(frame_loop.frame_number);
+        FrameData* frame = nullptr;
+        VkResult err = VK_SUCCESS;
+        {
+            PROFILE_SCOPE("begin frame");
+            err = begin_frame(device, swap_chain, frame_loop, &frame);
+        }
+        if (err == VK_NOT_READY)
+        {
+            // Minimized, there is nothing to render into until the window is restored.
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        if (err == VK_SUCCESS)
+        {
+            // The slot fence has signaled, everything recorded for this slot is done on the GPU.
+            err = reset_thread_command_pools(device, thread_pools, frame_loop.frame_idx);
+            begin_frame_allocations(frame_allocator, frame_loop.frame_idx);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = begin_frame_descriptors(frame_descriptors, frame_loop.frame_idx);
+#ifdef ENABLE_PROFILER
+            begin_gpu_profiler_frame(*gpu_profiler, frame->command_buffer, frame_loop.frame_idx);
+#endif
+        }
+        if ((err == VK_SUCCESS) && capture)
+        {
+            // Frames the slot fence just retired go to the writers.
+            err = poll_readbacks(readback, frame_loop.frames_completed);
+        }
+        if (err == VK_SUCCESS)
+        {
+            // Hand finished uploads over to the graphics queue, never waits for the transfer queue.
+            err = submit_uploads(upload);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = poll_uploads(upload, frame->command_buffer);
+        }
+        if ((err == VK_SUCCESS) && !textures.textures.empty())
+        {
+            // Stand-in for the scene: the textures zoom in and out, each one further away than the last.
+            float zoom = 0.5f + 0.5f * std::sin(static_cast<float>(frame_loop.frame_number) * 0.01f);
+            for (uint32_t tidx = 0; tidx < textures.textures.size(); ++tidx)
+            {
+                note_texture_demand(textures, tidx, zoom * swap_chain.extent.width / (1.0f + tidx), frame_loop.frame_number);
+            }
+            err = update_texture_streaming(textures, frame->command_buffer, frame_loop.frame_number, frame_loop.frames_completed);
+        }
+        if (err == VK_SUCCESS)
+        {
+            // One-shot work queued since the last frame goes ahead of it on the draw queue.
+            err = flush_immediate(immediate);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = poll_immediate(immediate);
+        }
+        if ((err == VK_SUCCESS) && window_open)
+        {
+            // As late as possible: begin_frame() may have waited on the GPU and for an image. A
+            // resize seen here is handled at the top of the next frame.
+            poll_window_events(window, input);
+        }
+        if (err == VK_SUCCESS)
+        {
+            PROFILE_SCOPE("record frame");
+            set_graph_image(graph, backbuffer, swap_chain.images[frame_loop.image_idx]);
+            err = execute_render_graph(graph, frame->command_buffer);
+        }
+        if (err == VK_SUCCESS)
+        {
+            err = end_frame_allocations(device_allocator, frame_allocator);
+        }
+        if (err == VK_SUCCESS)
+        {
+#ifdef ENABLE_PROFILER
+            end_gpu_profiler_frame(*gpu_profiler, frame->command_buffer);
+#endif
+            PROFILE_SCOPE("end frame");
+            err = end_frame(command_buffer.draw_queue, swap_chain, frame_loop, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+        }
+        if (err != VK_SUCCESS)
+        {
+            print_vk_error_code("Frame failed: ", err);
+            break;
+        }
+        if (window_open)
+        {
+            note_input_presented(window, input);
+        }
+        if (first_frame)
+        {
+            mark_startup_phase(startup, "first frame");
+            report_startup(startup, pipeline_cache.loaded_bytes > 0);
+            first_frame = false;
+        }
+        report_frame_stats(frame_loop, 1.0);
     }
 
-    vkDestroyDevice(device, nullptr);
-    vkDestroyInstance(vk_instance, nullptr);
+    // Shutdown only: waits for the device, then everything goes in reverse creation order.
+    run_shutdown(shutdown);
+    draw_pool_owner.reset();
+    device_owner.reset();
+    surface_owner.reset();
+    instance_owner.reset();
+    if (window_open)
+    {
+        print_window_stats(window);
+        destroy_platform_window(window);
+    }
+    report_handle_leaks();
+    print_host_allocator_stats();
+    unload_vulkan_library();
 
     return 0;
 }
\ No newline at end of file
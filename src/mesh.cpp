@@ -0,0 +1,136 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+#include "device_memory.hpp"
+#include "mesh.hpp"
+#include "upload.hpp"
+
+bool parse_mesh_file(MappedFile const& file, MeshFileHeader* out_header)
+{
+    if ((file.data == nullptr) || (file.size < sizeof(MeshFileHeader)))
+    {
+        return false;
+    }
+    MeshFileHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if ((header.magic != MESH_FILE_MAGIC) || (header.version != MESH_FILE_VERSION) || (header.vertex_stride != sizeof(MeshVertex)) ||
+        ((header.index_size != 2) && (header.index_size != 4)) || (header.vertex_count == 0) || (header.index_count == 0) ||
+        (header.index_count % 3 != 0))
+    {
+        return false;
+    }
+    uint64_t table_end = sizeof(MeshFileHeader) + static_cast<uint64_t>(header.submesh_count) * sizeof(MeshSubmesh);
+    if ((header.vertex_bytes != static_cast<uint64_t>(header.vertex_count) * sizeof(MeshVertex)) ||
+        (header.index_bytes != static_cast<uint64_t>(header.index_count) * header.index_size) ||
+        (header.vertex_offset % MESH_FILE_PAGE_SIZE != 0) || (header.index_offset % MESH_FILE_PAGE_SIZE != 0) ||
+        (header.vertex_offset < table_end) || (header.index_offset < header.vertex_offset + header.vertex_bytes) ||
+        (header.index_offset > file.size) || (header.index_bytes > file.size - header.index_offset))
+    {
+        return false;
+    }
+    // Index values aren't checked, that would read the whole section: the tool never writes one
+    // out of range.
+    unsigned char const* table = static_cast<unsigned char const*>(file.data) + sizeof(MeshFileHeader);
+    for (uint32_t sidx = 0; sidx < header.submesh_count; ++sidx)
+    {
+        MeshSubmesh submesh;
+        memcpy(&submesh, table + sidx * sizeof(MeshSubmesh), sizeof(submesh));
+        if ((submesh.first_index > header.index_count) || (submesh.index_count > header.index_count - submesh.first_index) ||
+            (submesh.first_vertex > header.vertex_count) || (submesh.vertex_count > header.vertex_count - submesh.first_vertex))
+        {
+            return false;
+        }
+    }
+    *out_header = header;
+    return true;
+}
+
+VkResult load_mesh(DeviceAllocator& allocator, UploadQueue& upload, char const* path, Mesh* out_mesh)
+{
+    MappedFile file;
+    if (!map_file(path, &file))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    MeshFileHeader header;
+    if (!parse_mesh_file(file, &header))
+    {
+        unmap_file(file);
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    unsigned char const* data = static_cast<unsigned char const*>(file.data);
+    // One buffer for both: a single allocation, and the index range starts where any index
+    // type may be bound.
+    VkDeviceSize index_offset = (header.vertex_bytes + 15) & ~static_cast<VkDeviceSize>(15);
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = index_offset + header.index_bytes;
+    buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    GpuAllocation* allocation = nullptr;
+    if (VkResult err = create_buffer(allocator, buffer_info, MEMORY_GPU_ONLY, &allocation))
+    {
+        unmap_file(file);
+        return err;
+    }
+    UniqueBuffer buffer(&allocator, allocation);
+    // Straight from the mapping into staging: the page cache is the only other copy.
+    uint64_t ticket = 0;
+    VkResult err = upload_buffer(upload, buffer->buffer, 0, data + header.vertex_offset, header.vertex_bytes, &ticket);
+    if (err == VK_SUCCESS)
+    {
+        err = upload_buffer(upload, buffer->buffer, index_offset, data + header.index_offset, header.index_bytes, &ticket);
+    }
+    if (err != VK_SUCCESS)
+    {
+        unmap_file(file);
+        return err;
+    }
+
+    out_mesh->buffer = std::move(buffer);
+    out_mesh->index_offset = index_offset;
+    out_mesh->index_type = (header.index_size == 2) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    out_mesh->vertex_count = header.vertex_count;
+    out_mesh->index_count = header.index_count;
+    memcpy(out_mesh->bounds_min, header.bounds_min, sizeof(out_mesh->bounds_min));
+    memcpy(out_mesh->bounds_max, header.bounds_max, sizeof(out_mesh->bounds_max));
+    out_mesh->submeshes.resize(header.submesh_count);
+    if (header.submesh_count > 0)
+    {
+        memcpy(out_mesh->submeshes.data(), data + sizeof(MeshFileHeader), header.submesh_count * sizeof(MeshSubmesh));
+    }
+    out_mesh->ticket = ticket;
+    out_mesh->file_bytes = file.size;
+    unmap_file(file);
+    return VK_SUCCESS;
+}
+
+void destroy_mesh(Mesh& mesh)
+{
+    mesh.buffer.reset();
+    mesh.submeshes.clear();
+}
+
+void describe_mesh_vertex_input(uint32_t binding, VkVertexInputBindingDescription* out_binding, VkVertexInputAttributeDescription* out_attributes)
+{
+    out_binding->binding = binding;
+    out_binding->stride = sizeof(MeshVertex);
+    out_binding->inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    static VkFormat const formats[MESH_VERTEX_ATTRIBUTE_COUNT] = { VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT };
+    static uint32_t const offsets[MESH_VERTEX_ATTRIBUTE_COUNT] = { offsetof(MeshVertex, position), offsetof(MeshVertex, normal), offsetof(MeshVertex, uv) };
+    for (uint32_t aidx = 0; aidx < MESH_VERTEX_ATTRIBUTE_COUNT; ++aidx)
+    {
+        out_attributes[aidx].location = aidx;
+        out_attributes[aidx].binding = binding;
+        out_attributes[aidx].format = formats[aidx];
+        out_attributes[aidx].offset = offsets[aidx];
+    }
+}
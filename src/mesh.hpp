@@ -0,0 +1,43 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "file_map.hpp"
+#include "handles.hpp"
+#include "mesh_format.hpp"
+
+struct UploadQueue;
+
+// Meshes packed by tools/meshpack. The file is mapped and its vertex and index sections go from
+// the mapping into the staging ring as they are, nothing is parsed or converted on the way.
+
+static const uint32_t MESH_VERTEX_ATTRIBUTE_COUNT = 3;     // position, normal, uv at locations 0, 1, 2
+
+struct Mesh
+{
+    UniqueBuffer buffer;            // vertices at 0, indices at index_offset
+    VkDeviceSize index_offset;
+    VkIndexType index_type;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    float bounds_min[3];            // dequantizes positions, see MeshFileHeader
+    float bounds_max[3];
+    std::vector<MeshSubmesh> submeshes;
+    uint64_t ticket;                // buffer is usable on the graphics queue once upload_complete(ticket)
+    uint64_t file_bytes;
+};
+
+// Checks the header, submesh table and sections against the file size.
+bool parse_mesh_file(MappedFile const& file, MeshFileHeader* out_header);
+
+// Maps path and uploads it, the mapping is released before returning. VK_ERROR_FORMAT_NOT_SUPPORTED
+// when the file is not a mesh this build can read.
+VkResult load_mesh(DeviceAllocator& allocator, UploadQueue& upload, char const* path, Mesh* out_mesh);
+// The device must be done with the buffer.
+void destroy_mesh(Mesh& mesh);
+
+// Vertex input for pipelines drawing meshes, out_attributes has MESH_VERTEX_ATTRIBUTE_COUNT entries.
+void describe_mesh_vertex_input(uint32_t binding, VkVertexInputBindingDescription* out_binding, VkVertexInputAttributeDescription* out_attributes);
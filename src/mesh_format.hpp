@@ -0,0 +1,67 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+
+// .vkmesh, written by tools/meshpack and loaded by load_mesh(). Little endian, laid out so the
+// loader never parses or converts anything:
+//
+//   MeshFileHeader
+//   MeshSubmesh[submesh_count]
+//   vertices    MeshVertex[vertex_count], at vertex_offset
+//   indices     uint16_t or uint32_t[index_count], at index_offset
+//
+// Both sections start on a MESH_FILE_PAGE_SIZE boundary: straight out of the mapping they are
+// page aligned, and a range copied to staging never shares a page with the header.
+//
+// Indices come reordered for the post-transform cache, then in clusters ordered to reduce
+// overdraw; vertices are in the order the indices first use them.
+
+static const uint32_t MESH_FILE_MAGIC = 0x48534d56;    // "VMSH"
+static const uint32_t MESH_FILE_VERSION = 1;
+static const uint32_t MESH_FILE_PAGE_SIZE = 4096;
+
+// 16 bytes against 32 for the float attributes.
+//   position  R16G16B16A16_UNORM   within the header bounds, w is padding: few devices fetch R16G16B16
+//   normal    R16G16_SNORM         octahedral
+//   uv        R16G16_SFLOAT
+struct MeshVertex
+{
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t uv[2];
+};
+
+struct MeshSubmesh
+{
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t first_vertex;      // vertices the submesh indexes fall in [first_vertex, first_vertex + vertex_count)
+    uint32_t vertex_count;
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+struct MeshFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint32_t submesh_count;
+    uint32_t vertex_stride;     // sizeof(MeshVertex)
+    uint32_t index_size;        // 2 up to 65536 vertices, otherwise 4
+    uint32_t cache_size;        // FIFO entries the indices were optimized for
+    // position = bounds_min + unorm * (bounds_max - bounds_min)
+    float bounds_min[3];
+    float bounds_max[3];
+    uint64_t vertex_offset;
+    uint64_t vertex_bytes;
+    uint64_t index_offset;
+    uint64_t index_bytes;
+};
+
+static_assert(sizeof(MeshVertex) == 16, "MeshVertex is stored as is");
+static_assert(sizeof(MeshSubmesh) == 40, "MeshSubmesh is stored as is");
+static_assert(sizeof(MeshFileHeader) == 88, "MeshFileHeader is stored as is");
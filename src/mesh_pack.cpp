@@ -0,0 +1,598 @@
+#include "config.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "mesh_format.hpp"
+#include "mesh_pack.hpp"
+
+static uint32_t const NO_VERTEX = 0xffffffffu;
+
+// Stamps are the miss count at insertion: a vertex is in the FIFO while fewer than cache_size
+// misses came after it. Starting the clock past cache_size makes every vertex a miss.
+struct FifoCache
+{
+    std::vector<uint32_t> stamps;
+    uint32_t time;
+    uint32_t size;
+};
+
+static void init_fifo_cache(uint32_t vertex_count, uint32_t cache_size, FifoCache* out_cache)
+{
+    out_cache->stamps.assign(vertex_count, 0);
+    out_cache->size = cache_size;
+    out_cache->time = cache_size + 1;
+}
+
+// Forgets everything without touching the stamps.
+static void flush_fifo_cache(FifoCache& cache)
+{
+    cache.time += cache.size + 1;
+}
+
+static bool fifo_miss(FifoCache& cache, uint32_t vertex)
+{
+    if (cache.time - cache.stamps[vertex] <= cache.size)
+    {
+        return false;
+    }
+    cache.stamps[vertex] = cache.time;
+    cache.time += 1;
+    return true;
+}
+
+template <typename Index>
+static double shaded_per_triangle(Index const* indices, size_t index_count, uint32_t vertex_count, uint32_t cache_size)
+{
+    size_t triangle_count = index_count / 3;
+    if (triangle_count == 0)
+    {
+        return 0.0;
+    }
+    FifoCache cache;
+    init_fifo_cache(vertex_count, cache_size, &cache);
+    uint64_t misses = 0;
+    for (size_t iidx = 0; iidx < triangle_count * 3; ++iidx)
+    {
+        misses += fifo_miss(cache, indices[iidx]) ? 1 : 0;
+    }
+    return static_cast<double>(misses) / static_cast<double>(triangle_count);
+}
+
+double vertices_shaded_per_triangle(void const* indices, uint32_t index_size, size_t index_count, uint32_t vertex_count, uint32_t cache_size)
+{
+    if (index_size == 2)
+    {
+        return shaded_per_triangle(static_cast<uint16_t const*>(indices), index_count, vertex_count, cache_size);
+    }
+    return shaded_per_triangle(static_cast<uint32_t const*>(indices), index_count, vertex_count, cache_size);
+}
+
+// Next vertex to fan around once the one before ran out of triangles: the most recently used
+// vertex with triangles left, else the first one in vertex order.
+static uint32_t skip_dead_end(std::vector<uint32_t>& dead_end, std::vector<uint32_t> const& live, uint32_t* cursor)
+{
+    while (!dead_end.empty())
+    {
+        uint32_t vertex = dead_end.back();
+        dead_end.pop_back();
+        if (live[vertex] > 0)
+        {
+            return vertex;
+        }
+    }
+    for (; *cursor < live.size(); ++*cursor)
+    {
+        if (live[*cursor] > 0)
+        {
+            return *cursor;
+        }
+    }
+    return NO_VERTEX;
+}
+
+void optimize_vertex_cache(uint32_t* indices, size_t index_count, uint32_t vertex_count, uint32_t cache_size, std::vector<uint32_t>* out_hard_boundaries)
+{
+    uint32_t triangle_count = static_cast<uint32_t>(index_count / 3);
+    if (triangle_count == 0)
+    {
+        return;
+    }
+    // Triangles of every vertex, packed.
+    std::vector<uint32_t> first_adjacent(vertex_count + 1, 0);
+    for (uint32_t iidx = 0; iidx < triangle_count * 3; ++iidx)
+    {
+        first_adjacent[indices[iidx] + 1] += 1;
+    }
+    for (uint32_t vidx = 0; vidx < vertex_count; ++vidx)
+    {
+        first_adjacent[vidx + 1] += first_adjacent[vidx];
+    }
+    std::vector<uint32_t> adjacent(triangle_count * 3);
+    std::vector<uint32_t> live(vertex_count, 0);     // triangles not emitted yet
+    for (uint32_t iidx = 0; iidx < triangle_count * 3; ++iidx)
+    {
+        uint32_t vertex = indices[iidx];
+        adjacent[first_adjacent[vertex] + live[vertex]] = iidx / 3;
+        live[vertex] += 1;
+    }
+
+    std::vector<uint32_t> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> dead_end;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    dead_end.reserve(triangle_count * 3);
+    output.reserve(triangle_count * 3);
+    uint32_t time = cache_size + 1;
+    uint32_t cursor = 0;
+    uint32_t fan = indices[0];
+    if (out_hard_boundaries != nullptr)
+    {
+        out_hard_boundaries->push_back(0);
+    }
+    while (fan != NO_VERTEX)
+    {
+        candidates.clear();
+        for (uint32_t aidx = first_adjacent[fan]; aidx < first_adjacent[fan + 1]; ++aidx)
+        {
+            uint32_t triangle = adjacent[aidx];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+            emitted[triangle] = true;
+            for (uint32_t corner = 0; corner < 3; ++corner)
+            {
+                uint32_t vertex = indices[triangle * 3 + corner];
+                output.push_back(vertex);
+                dead_end.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex] -= 1;
+                if (time - cache_time[vertex] > cache_size)
+                {
+                    cache_time[vertex] = time;
+                    time += 1;
+                }
+            }
+        }
+
+        // The candidate whose remaining triangles still hit the cache, the oldest such: it is
+        // the next to be evicted. Without any, the first candidate with triangles left.
+        uint32_t next = NO_VERTEX;
+        int64_t best_priority = -1;
+        for (size_t cidx = 0; cidx < candidates.size(); ++cidx)
+        {
+            uint32_t vertex = candidates[cidx];
+            if (live[vertex] == 0)
+            {
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cache_time[vertex] + 2 * live[vertex] <= cache_size)
+            {
+                priority = time - cache_time[vertex];
+            }
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                next = vertex;
+            }
+        }
+        if (next == NO_VERTEX)
+        {
+            next = skip_dead_end(dead_end, live, &cursor);
+            if ((next != NO_VERTEX) && (out_hard_boundaries != nullptr))
+            {
+                out_hard_boundaries->push_back(static_cast<uint32_t>(output.size() / 3));
+            }
+        }
+        fan = next;
+    }
+    memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+struct OverdrawCluster
+{
+    uint32_t first_triangle;
+    uint32_t triangle_count;
+    float sort_key;
+};
+
+static void triangle_geometry(uint32_t const* triangle, SourceVertex const* vertices, float* out_centroid, float* out_normal)
+{
+    float const* p0 = vertices[triangle[0]].position;
+    float const* p1 = vertices[triangle[1]].position;
+    float const* p2 = vertices[triangle[2]].position;
+    float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    // Twice the area long, sums weigh every triangle by its area.
+    out_normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    out_normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    out_normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        out_centroid[axis] = (p0[axis] + p1[axis] + p2[axis]) / 3.0f;
+    }
+}
+
+uint32_t optimize_overdraw(uint32_t* indices, size_t index_count, SourceVertex const* vertices, uint32_t vertex_count, uint32_t cache_size,
+                           std::vector<uint32_t> const& hard_boundaries, float threshold)
+{
+    uint32_t triangle_count = static_cast<uint32_t>(index_count / 3);
+    if (triangle_count == 0)
+    {
+        return 0;
+    }
+    double limit = threshold * vertices_shaded_per_triangle(indices, 4, triangle_count * 3, vertex_count, cache_size);
+
+    std::vector<OverdrawCluster> clusters;
+    FifoCache cache;
+    init_fifo_cache(vertex_count, cache_size, &cache);
+    size_t next_hard = 0;
+    uint32_t cluster_misses = 0;
+    for (uint32_t tidx = 0; tidx < triangle_count; ++tidx)
+    {
+        bool hard = (next_hard < hard_boundaries.size()) && (hard_boundaries[next_hard] == tidx);
+        if (hard)
+        {
+            ++next_hard;
+        }
+        bool soft = !clusters.empty() && (cluster_misses <= limit * clusters.back().triangle_count);
+        if (hard || soft || clusters.empty())
+        {
+            // Scored from a cold cache: the cluster will follow any other one.
+            flush_fifo_cache(cache);
+            OverdrawCluster cluster = { tidx, 0, 0.0f };
+            clusters.push_back(cluster);
+            cluster_misses = 0;
+        }
+        for (uint32_t corner = 0; corner < 3; ++corner)
+        {
+            cluster_misses += fifo_miss(cache, indices[tidx * 3 + corner]) ? 1 : 0;
+        }
+        clusters.back().triangle_count += 1;
+    }
+
+    float mesh_centroid[3] = { 0.0f, 0.0f, 0.0f };
+    float mesh_area = 0.0f;
+    for (uint32_t tidx = 0; tidx < triangle_count; ++tidx)
+    {
+        float centroid[3];
+        float normal[3];
+        triangle_geometry(indices + tidx * 3, vertices, centroid, normal);
+        float area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            mesh_centroid[axis] += centroid[axis] * area;
+        }
+        mesh_area += area;
+    }
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        mesh_centroid[axis] = (mesh_area > 0.0f) ? mesh_centroid[axis] / mesh_area : 0.0f;
+    }
+
+    for (size_t cidx = 0; cidx < clusters.size(); ++cidx)
+    {
+        OverdrawCluster& cluster = clusters[cidx];
+        float cluster_centroid[3] = { 0.0f, 0.0f, 0.0f };
+        float cluster_normal[3] = { 0.0f, 0.0f, 0.0f };
+        float cluster_area = 0.0f;
+        for (uint32_t tidx = cluster.first_triangle; tidx < cluster.first_triangle + cluster.triangle_count; ++tidx)
+        {
+            float centroid[3];
+            float normal[3];
+            triangle_geometry(indices + tidx * 3, vertices, centroid, normal);
+            float area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            for (uint32_t axis = 0; axis < 3; ++axis)
+            {
+                cluster_centroid[axis] += centroid[axis] * area;
+                cluster_normal[axis] += normal[axis];
+            }
+            cluster_area += area;
+        }
+        float normal_length = std::sqrt(cluster_normal[0] * cluster_normal[0] + cluster_normal[1] * cluster_normal[1] + cluster_normal[2] * cluster_normal[2]);
+        if ((cluster_area <= 0.0f) || (normal_length <= 0.0f))
+        {
+            continue;
+        }
+        float key = 0.0f;
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            key += (cluster_centroid[axis] / cluster_area - mesh_centroid[axis]) * cluster_normal[axis];
+        }
+        cluster.sort_key = key / normal_length;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(),
+                     [](OverdrawCluster const& a, OverdrawCluster const& b) { return a.sort_key > b.sort_key; });
+
+    std::vector<uint32_t> output;
+    output.reserve(triangle_count * 3);
+    for (size_t cidx = 0; cidx < clusters.size(); ++cidx)
+    {
+        uint32_t const* first = indices + clusters[cidx].first_triangle * 3;
+        output.insert(output.end(), first, first + clusters[cidx].triangle_count * 3);
+    }
+    memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+    return static_cast<uint32_t>(clusters.size());
+}
+
+uint32_t optimize_vertex_fetch(SourceMesh& mesh)
+{
+    std::vector<uint32_t> remap(mesh.vertices.size(), NO_VERTEX);
+    std::vector<SourceVertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    for (size_t iidx = 0; iidx < mesh.indices.size(); ++iidx)
+    {
+        uint32_t& index = mesh.indices[iidx];
+        if (remap[index] == NO_VERTEX)
+        {
+            remap[index] = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+    mesh.vertices.swap(vertices);
+    return static_cast<uint32_t>(mesh.vertices.size());
+}
+
+uint16_t float_to_half(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent == 0xff)
+    {
+        return static_cast<uint16_t>(sign | 0x7c00 | ((mantissa != 0) ? 0x200 : 0));     // inf, nan
+    }
+    int32_t half_exponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if (half_exponent >= 31)
+    {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+    // Rounded to nearest even, a carry out of the mantissa moves to the next exponent as it should.
+    if (half_exponent <= 0)
+    {
+        if (half_exponent < -10)
+        {
+            return static_cast<uint16_t>(sign);
+        }
+        mantissa |= 0x800000;
+        uint32_t shift = static_cast<uint32_t>(14 - half_exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if ((rest > halfway) || ((rest == halfway) && ((half & 1) != 0)))
+        {
+            half += 1;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = (static_cast<uint32_t>(half_exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if ((rest > 0x1000) || ((rest == 0x1000) && ((half & 1) != 0)))
+    {
+        half += 1;
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+static int16_t snorm16(float value)
+{
+    return static_cast<int16_t>(std::lround(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f));
+}
+
+// Onto the octahedron |x| + |y| + |z| = 1, the lower half folded over the diagonals.
+void encode_octahedral(float const* normal, int16_t* out_encoded)
+{
+    float length = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+    if (length <= 0.0f)
+    {
+        out_encoded[0] = 0;
+        out_encoded[1] = 0;
+        return;
+    }
+    float x = normal[0] / length;
+    float y = normal[1] / length;
+    if (normal[2] < 0.0f)
+    {
+        float folded_x = (1.0f - std::fabs(y)) * ((x >= 0.0f) ? 1.0f : -1.0f);
+        float folded_y = (1.0f - std::fabs(x)) * ((y >= 0.0f) ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+    out_encoded[0] = snorm16(x);
+    out_encoded[1] = snorm16(y);
+}
+
+static uint16_t unorm16(float value, float min, float max)
+{
+    if (max <= min)
+    {
+        return 0;
+    }
+    float t = (value - min) / (max - min);
+    return static_cast<uint16_t>(std::lround(std::max(0.0f, std::min(1.0f, t)) * 65535.0f));
+}
+
+static uint64_t align_to_page(uint64_t offset)
+{
+    return (offset + MESH_FILE_PAGE_SIZE - 1) & ~static_cast<uint64_t>(MESH_FILE_PAGE_SIZE - 1);
+}
+
+static void grow_bounds(float const* position, float* bounds_min, float* bounds_max)
+{
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        bounds_min[axis] = std::min(bounds_min[axis], position[axis]);
+        bounds_max[axis] = std::max(bounds_max[axis], position[axis]);
+    }
+}
+
+bool pack_mesh(SourceMesh const& source, uint32_t cache_size, std::vector<unsigned char>* out_file, MeshPackStats* out_stats)
+{
+    if (source.indices.empty() || (source.indices.size() % 3 != 0) || (source.vertices.size() >= NO_VERTEX))
+    {
+        return false;
+    }
+    uint32_t source_vertex_count = static_cast<uint32_t>(source.vertices.size());
+    for (size_t iidx = 0; iidx < source.indices.size(); ++iidx)
+    {
+        if (source.indices[iidx] >= source_vertex_count)
+        {
+            return false;
+        }
+    }
+    SourceMesh mesh = source;
+    if (mesh.submeshes.empty())
+    {
+        SourceSubmesh whole = { 0, static_cast<uint32_t>(mesh.indices.size()) };
+        mesh.submeshes.push_back(whole);
+    }
+    for (size_t sidx = 0; sidx < mesh.submeshes.size(); ++sidx)
+    {
+        SourceSubmesh const& submesh = mesh.submeshes[sidx];
+        if ((submesh.first_index % 3 != 0) || (submesh.index_count % 3 != 0) || (submesh.first_index > mesh.indices.size()) ||
+            (submesh.index_count > mesh.indices.size() - submesh.first_index))
+        {
+            return false;
+        }
+    }
+    out_stats->shaded_before = vertices_shaded_per_triangle(mesh.indices.data(), 4, mesh.indices.size(), source_vertex_count, cache_size);
+    out_stats->clusters = 0;
+
+    // Every submesh on its own, renumbered so the work is proportional to the submesh.
+    std::vector<uint32_t> local_index(source_vertex_count, NO_VERTEX);
+    std::vector<uint32_t> global_index;
+    std::vector<SourceVertex> local_vertices;
+    std::vector<uint32_t> hard_boundaries;
+    for (size_t sidx = 0; sidx < mesh.submeshes.size(); ++sidx)
+    {
+        SourceSubmesh const& submesh = mesh.submeshes[sidx];
+        uint32_t* indices = mesh.indices.data() + submesh.first_index;
+        global_index.clear();
+        local_vertices.clear();
+        for (uint32_t iidx = 0; iidx < submesh.index_count; ++iidx)
+        {
+            uint32_t& local = local_index[indices[iidx]];
+            if (local == NO_VERTEX)
+            {
+                local = static_cast<uint32_t>(global_index.size());
+                global_index.push_back(indices[iidx]);
+                local_vertices.push_back(mesh.vertices[indices[iidx]]);
+            }
+            indices[iidx] = local;
+        }
+        uint32_t local_count = static_cast<uint32_t>(global_index.size());
+        hard_boundaries.clear();
+        optimize_vertex_cache(indices, submesh.index_count, local_count, cache_size, &hard_boundaries);
+        out_stats->clusters += optimize_overdraw(indices, submesh.index_count, local_vertices.data(), local_count, cache_size, hard_boundaries,
+                                                 MESH_OVERDRAW_THRESHOLD);
+        for (uint32_t iidx = 0; iidx < submesh.index_count; ++iidx)
+        {
+            indices[iidx] = global_index[indices[iidx]];
+        }
+        for (uint32_t vidx = 0; vidx < local_count; ++vidx)
+        {
+            local_index[global_index[vidx]] = NO_VERTEX;
+        }
+    }
+    uint32_t vertex_count = optimize_vertex_fetch(mesh);
+
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.vertex_count = vertex_count;
+    header.index_count = static_cast<uint32_t>(mesh.indices.size());
+    header.submesh_count = static_cast<uint32_t>(mesh.submeshes.size());
+    header.vertex_stride = sizeof(MeshVertex);
+    header.index_size = (vertex_count <= 65536) ? 2 : 4;
+    header.cache_size = cache_size;
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        header.bounds_min[axis] = mesh.vertices[0].position[axis];
+        header.bounds_max[axis] = mesh.vertices[0].position[axis];
+    }
+    for (uint32_t vidx = 0; vidx < vertex_count; ++vidx)
+    {
+        grow_bounds(mesh.vertices[vidx].position, header.bounds_min, header.bounds_max);
+    }
+    uint64_t table_end = sizeof(MeshFileHeader) + static_cast<uint64_t>(header.submesh_count) * sizeof(MeshSubmesh);
+    header.vertex_offset = align_to_page(table_end);
+    header.vertex_bytes = static_cast<uint64_t>(vertex_count) * sizeof(MeshVertex);
+    header.index_offset = align_to_page(header.vertex_offset + header.vertex_bytes);
+    header.index_bytes = static_cast<uint64_t>(header.index_count) * header.index_size;
+
+    out_file->assign(static_cast<size_t>(header.index_offset + header.index_bytes), 0);
+    unsigned char* file = out_file->data();
+    memcpy(file, &header, sizeof(header));
+    for (uint32_t sidx = 0; sidx < header.submesh_count; ++sidx)
+    {
+        SourceSubmesh const& source_submesh = mesh.submeshes[sidx];
+        MeshSubmesh submesh;
+        submesh.first_index = source_submesh.first_index;
+        submesh.index_count = source_submesh.index_count;
+        uint32_t first_vertex = NO_VERTEX;
+        uint32_t last_vertex = 0;
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            submesh.bounds_min[axis] = 0.0f;
+            submesh.bounds_max[axis] = 0.0f;
+        }
+        for (uint32_t iidx = 0; iidx < source_submesh.index_count; ++iidx)
+        {
+            uint32_t vertex = mesh.indices[source_submesh.first_index + iidx];
+            float const* position = mesh.vertices[vertex].position;
+            if (first_vertex == NO_VERTEX)
+            {
+                memcpy(submesh.bounds_min, position, sizeof(submesh.bounds_min));
+                memcpy(submesh.bounds_max, position, sizeof(submesh.bounds_max));
+            }
+            grow_bounds(position, submesh.bounds_min, submesh.bounds_max);
+            first_vertex = std::min(first_vertex, vertex);
+            last_vertex = std::max(last_vertex, vertex);
+        }
+        submesh.first_vertex = (first_vertex == NO_VERTEX) ? 0 : first_vertex;
+        submesh.vertex_count = (first_vertex == NO_VERTEX) ? 0 : last_vertex - first_vertex + 1;
+        memcpy(file + sizeof(header) + sidx * sizeof(MeshSubmesh), &submesh, sizeof(submesh));
+    }
+
+    MeshVertex* vertices = reinterpret_cast<MeshVertex*>(file + header.vertex_offset);
+    for (uint32_t vidx = 0; vidx < vertex_count; ++vidx)
+    {
+        SourceVertex const& source_vertex = mesh.vertices[vidx];
+        MeshVertex& vertex = vertices[vidx];
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            vertex.position[axis] = unorm16(source_vertex.position[axis], header.bounds_min[axis], header.bounds_max[axis]);
+        }
+        vertex.position[3] = 0;
+        encode_octahedral(source_vertex.normal, vertex.normal);
+        vertex.uv[0] = float_to_half(source_vertex.uv[0]);
+        vertex.uv[1] = float_to_half(source_vertex.uv[1]);
+    }
+    unsigned char* indices = file + header.index_offset;
+    for (uint32_t iidx = 0; iidx < header.index_count; ++iidx)
+    {
+        if (header.index_size == 2)
+        {
+            uint16_t index = static_cast<uint16_t>(mesh.indices[iidx]);
+            memcpy(indices + iidx * 2, &index, sizeof(index));
+        }
+        else
+        {
+            memcpy(indices + iidx * 4, &mesh.indices[iidx], sizeof(uint32_t));
+        }
+    }
+
+    out_stats->shaded_after = vertices_shaded_per_triangle(indices, header.index_size, header.index_count, vertex_count, cache_size);
+    out_stats->vertex_count = vertex_count;
+    out_stats->triangle_count = header.index_count / 3;
+    out_stats->file_bytes = out_file->size();
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+// Offline half of the mesh pipeline, shared by tools/meshpack and vk_bench. No Vulkan in here:
+// triangle order for the post-transform cache and overdraw, vertex order for fetch, quantization
+// and the .vkmesh layout (mesh_format.hpp).
+
+static const uint32_t MESH_CACHE_SIZE = 16;             // FIFO entries optimized for, small enough to help larger caches too
+static const float MESH_OVERDRAW_THRESHOLD = 1.05f;     // cache cost overdraw ordering may add
+
+struct SourceVertex
+{
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+
+struct SourceSubmesh
+{
+    uint32_t first_index;
+    uint32_t index_count;
+};
+
+// Triangle lists. No submeshes is one covering every index.
+struct SourceMesh
+{
+    std::vector<SourceVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<SourceSubmesh> submeshes;
+};
+
+struct MeshPackStats
+{
+    double shaded_before;       // vertices shaded per triangle in a FIFO of cache_size, source order
+    double shaded_after;
+    uint32_t clusters;          // overdraw clusters over every submesh
+    uint32_t vertex_count;      // unused vertices are dropped
+    uint32_t triangle_count;
+    uint64_t file_bytes;
+};
+
+// Tipsify (Sander, Nehab and Barczak, "Fast triangle reordering for vertex locality and reduced
+// overdraw"): fans out of the vertex that stays in a FIFO of cache_size, linear in the triangle
+// count. out_hard_boundaries, when not null, gets the first triangle of every run that had to
+// start over from a dead end.
+void optimize_vertex_cache(uint32_t* indices, size_t index_count, uint32_t vertex_count, uint32_t cache_size, std::vector<uint32_t>* out_hard_boundaries);
+// Splits the cache ordered triangles into clusters, at the hard boundaries and wherever the
+// cluster so far, started with a cold cache, shades at most threshold times what the whole mesh
+// does. Clusters facing away from the mesh centroid go first: they are the ones in front.
+// Returns the cluster count.
+uint32_t optimize_overdraw(uint32_t* indices, size_t index_count, SourceVertex const* vertices, uint32_t vertex_count, uint32_t cache_size,
+                           std::vector<uint32_t> const& hard_boundaries, float threshold);
+// Vertices in the order the indices first use them, unused ones dropped. Returns the new count.
+uint32_t optimize_vertex_fetch(SourceMesh& mesh);
+
+// Average cache misses per triangle in a FIFO of cache_size, 0.5 at best for a regular grid and
+// 3 at worst. index_size is 2 or 4.
+double vertices_shaded_per_triangle(void const* indices, uint32_t index_size, size_t index_count, uint32_t vertex_count, uint32_t cache_size);
+
+uint16_t float_to_half(float value);
+void encode_octahedral(float const* normal, int16_t* out_encoded);
+
+// Optimizes a copy of mesh and lays out the whole .vkmesh file. False when the mesh is empty, an
+// index is out of range or a submesh does not cover whole triangles.
+bool pack_mesh(SourceMesh const& mesh, uint32_t cache_size, std::vector<unsigned char>* out_file, MeshPackStats* out_stats);
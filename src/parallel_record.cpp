@@ -0,0 +1,147 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cassert>
+
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "jobs.hpp"
+#include "parallel_record.hpp"
+#include "profiler.hpp"
+
+VkResult create_thread_command_pools(VkDevice device, uint32_t queue_family_idx, uint32_t worker_count, uint32_t frame_count, ThreadCommandPools* out_pools)
+{
+    out_pools->worker_count = worker_count;
+    out_pools->frame_count = frame_count;
+    uint32_t pool_count = worker_count * frame_count;
+    out_pools->pools.assign(pool_count, VK_NULL_HANDLE);
+    out_pools->buffers.assign(pool_count, std::vector<VkCommandBuffer>());
+    out_pools->used.assign(pool_count, 0);
+
+    VkCommandPoolCreateInfo command_pool_info = {};
+    command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    command_pool_info.pNext = nullptr;
+    command_pool_info.queueFamilyIndex = queue_family_idx;
+    // Buffers are only ever reset through their pool.
+    command_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    for (uint32_t pidx = 0; pidx < pool_count; ++pidx)
+    {
+        VK_THROW(vkCreateCommandPool(device, &command_pool_info, host_allocator(), &out_pools->pools[pidx]));
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_thread_command_pools(VkDevice device, ThreadCommandPools& pools)
+{
+    for (size_t pidx = 0; pidx < pools.pools.size(); ++pidx)
+    {
+        // Destroying the pool frees its buffers.
+        vkDestroyCommandPool(device, pools.pools[pidx], host_allocator());
+    }
+    pools.pools.clear();
+    pools.buffers.clear();
+    pools.used.clear();
+}
+
+VkResult reset_thread_command_pools(VkDevice device, ThreadCommandPools& pools, uint32_t frame_idx)
+{
+    assert(frame_idx < pools.frame_count);
+    for (uint32_t widx = 0; widx < pools.worker_count; ++widx)
+    {
+        uint32_t pidx = frame_idx * pools.worker_count + widx;
+        VK_THROW(vkResetCommandPool(device, pools.pools[pidx], 0));
+        pools.used[pidx] = 0;
+    }
+    return VK_SUCCESS;
+}
+
+static VkResult next_secondary(VkDevice device, ThreadCommandPools& pools, uint32_t pidx, VkCommandBuffer* out_command_buffer)
+{
+    std::vector<VkCommandBuffer>& buffers = pools.buffers[pidx];
+    if (pools.used[pidx] == buffers.size())
+    {
+        VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+        command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_allocate_info.pNext = nullptr;
+        command_buffer_allocate_info.commandPool = pools.pools[pidx];
+        command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        command_buffer_allocate_info.commandBufferCount = 1;
+        VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+        VK_THROW(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, &command_buffer));
+        buffers.push_back(command_buffer);
+    }
+    *out_command_buffer = buffers[pools.used[pidx]++];
+    return VK_SUCCESS;
+}
+
+VkResult record_parallel(JobSystem& jobs, VkDevice device, ThreadCommandPools& pools, uint32_t frame_idx,
+    VkCommandBuffer primary, VkCommandBufferInheritanceInfo const* inheritance, uint32_t job_count, RecordFn record)
+{
+    if (job_count == 0)
+    {
+        return VK_SUCCESS;
+    }
+    assert(job_worker_count(jobs) <= pools.worker_count);
+
+    VkCommandBufferInheritanceInfo outside_render_pass = {};
+    outside_render_pass.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    outside_render_pass.pNext = nullptr;
+    outside_render_pass.renderPass = VK_NULL_HANDLE;
+    outside_render_pass.subpass = 0;
+    outside_render_pass.framebuffer = VK_NULL_HANDLE;
+    outside_render_pass.occlusionQueryEnable = VK_FALSE;
+    outside_render_pass.queryFlags = 0;
+    outside_render_pass.pipelineStatistics = 0;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = &outside_render_pass;
+    if (inheritance != nullptr)
+    {
+        begin_info.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        begin_info.pInheritanceInfo = inheritance;
+    }
+
+    std::vector<VkCommandBuffer> secondaries(job_count, VK_NULL_HANDLE);
+    std::atomic<int32_t> first_error(VK_SUCCESS);
+    JobCounter counter;
+    for (uint32_t jidx = 0; jidx < job_count; ++jidx)
+    {
+        submit_job(jobs, counter, [&, jidx](uint32_t worker_idx)
+        {
+            PROFILE_SCOPE("record secondary");
+            uint32_t pidx = frame_idx * pools.worker_count + worker_idx;
+            VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+            VkResult err = next_secondary(device, pools, pidx, &command_buffer);
+            if (err == VK_SUCCESS)
+            {
+                err = vkBeginCommandBuffer(command_buffer, &begin_info);
+            }
+            if (err == VK_SUCCESS)
+            {
+                record(command_buffer, jidx);
+                err = vkEndCommandBuffer(command_buffer);
+            }
+            if (err != VK_SUCCESS)
+            {
+                int32_t expected = VK_SUCCESS;
+                first_error.compare_exchange_strong(expected, err);
+                return;
+            }
+            secondaries[jidx] = command_buffer;
+        });
+    }
+    {
+        PROFILE_SCOPE("wait record jobs");
+        wait_jobs(jobs, counter);
+    }
+
+    VK_THROW(static_cast<VkResult>(first_error.load()));
+    // Deterministic submission order: job index, not completion order.
+    vkCmdExecuteCommands(primary, job_count, secondaries.data());
+    return VK_SUCCESS;
+}
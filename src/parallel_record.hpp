@@ -0,0 +1,35 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <vector>
+
+struct JobSystem;
+
+// One command pool per (frame in flight, worker). A pool is only touched by its worker
+// while recording and reset as a whole once the frame fence says the GPU is done with it,
+// so no locking and no per-buffer reset is needed.
+struct ThreadCommandPools
+{
+    uint32_t worker_count;
+    uint32_t frame_count;
+    std::vector<VkCommandPool> pools;                   // [frame_idx * worker_count + worker_idx]
+    std::vector<std::vector<VkCommandBuffer> > buffers; // secondary buffers allocated from each pool
+    std::vector<uint32_t> used;                         // buffers handed out since the last reset
+};
+
+typedef std::function<void(VkCommandBuffer command_buffer, uint32_t job_idx)> RecordFn;
+
+VkResult create_thread_command_pools(VkDevice device, uint32_t queue_family_idx, uint32_t worker_count, uint32_t frame_count, ThreadCommandPools* out_pools);
+void destroy_thread_command_pools(VkDevice device, ThreadCommandPools& pools);
+
+// Call after the fence of frame_idx has signaled.
+VkResult reset_thread_command_pools(VkDevice device, ThreadCommandPools& pools, uint32_t frame_idx);
+
+// Records job_count secondary command buffers in parallel on the job system, then executes them
+// from primary in job index order, whatever worker recorded them. inheritance may be null when
+// recording outside of a render pass.
+VkResult record_parallel(JobSystem& jobs, VkDevice device, ThreadCommandPools& pools, uint32_t frame_idx,
+    VkCommandBuffer primary, VkCommandBufferInheritanceInfo const* inheritance, uint32_t job_count, RecordFn record);
@@ -0,0 +1,193 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <cstring>
+#include <iostream>
+
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "file_map.hpp"
+#include "host_allocator.hpp"
+#include "pipeline_cache.hpp"
+
+// Layout of the header every implementation puts in front of its pipeline cache data.
+static const size_t CACHE_HEADER_SIZE = 16 + VK_UUID_SIZE;
+
+static uint32_t read_u32(unsigned char const* bytes)
+{
+    uint32_t v;
+    memcpy(&v, bytes, sizeof(v));
+    return v;
+}
+
+static char const* validate_cache_header(VkPhysicalDeviceProperties const& properties, void const* data, size_t size)
+{
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+    if (size < CACHE_HEADER_SIZE)
+    {
+        return "truncated header";
+    }
+    if ((read_u32(bytes) < CACHE_HEADER_SIZE) || (read_u32(bytes) > size))
+    {
+        return "bad header length";
+    }
+    if (read_u32(bytes + 4) != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+    {
+        return "unknown header version";
+    }
+    if (read_u32(bytes + 8) != properties.vendorID)
+    {
+        return "vendor changed";
+    }
+    if (read_u32(bytes + 12) != properties.deviceID)
+    {
+        return "device changed";
+    }
+    if (memcmp(bytes + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+        return "driver changed (pipelineCacheUUID)";
+    }
+    return nullptr;
+}
+
+VkResult create_pipeline_cache(VkDevice device, VkPhysicalDeviceProperties const& properties, char const* path, bool load, PipelineCache* out_cache)
+{
+    out_cache->cache = VK_NULL_HANDLE;
+    out_cache->path = path;
+    out_cache->loaded_bytes = 0;
+    out_cache->reject_reason = nullptr;
+
+    VkPipelineCacheCreateInfo cache_info = {};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.pNext = nullptr;
+    cache_info.flags = 0;
+    cache_info.initialDataSize = 0;
+    cache_info.pInitialData = nullptr;
+
+    // Drivers are supposed to reject foreign blobs themselves, not all of them do it gracefully.
+    MappedFile file;
+    bool mapped = load && map_file(path, &file);
+    if (mapped)
+    {
+        out_cache->reject_reason = validate_cache_header(properties, file.data, file.size);
+        if (out_cache->reject_reason == nullptr)
+        {
+            cache_info.initialDataSize = file.size;
+            cache_info.pInitialData = file.data;
+        }
+    }
+    VkResult err = vkCreatePipelineCache(device, &cache_info, host_allocator(), &out_cache->cache);
+    if ((err != VK_SUCCESS) && (cache_info.initialDataSize > 0))
+    {
+        out_cache->reject_reason = "refused by the driver";
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = nullptr;
+        err = vkCreatePipelineCache(device, &cache_info, host_allocator(), &out_cache->cache);
+    }
+    out_cache->loaded_bytes = cache_info.initialDataSize;
+    if (mapped)
+    {
+        unmap_file(file);
+    }
+    return err;
+}
+
+VkResult save_pipeline_cache(VkDevice device, PipelineCache const& cache)
+{
+    size_t size = 0;
+    VK_THROW(vkGetPipelineCacheData(device, cache.cache, &size, nullptr));
+    std::vector<char> data(size);
+    VK_THROW(vkGetPipelineCacheData(device, cache.cache, &size, data.data()));
+    if (!write_file_atomic(cache.path.c_str(), data.data(), size))
+    {
+        std::cout << "Unable to write the pipeline cache to " << cache.path << "\n";
+        return VK_INCOMPLETE;
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_pipeline_cache(VkDevice device, PipelineCache& cache)
+{
+    vkDestroyPipelineCache(device, cache.cache, host_allocator());
+    cache.cache = VK_NULL_HANDLE;
+}
+
+uint64_t hash_bytes(void const* data, size_t size)
+{
+    // FNV-1a, fast enough for a few hundred KiB of SPIR-V at startup.
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t bidx = 0; bidx < size; ++bidx)
+    {
+        hash ^= bytes[bidx];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void create_shader_module_cache(VkDevice device, ShaderModuleCache* out_cache)
+{
+    out_cache->device = device;
+    out_cache->modules.clear();
+    out_cache->hits = 0;
+    out_cache->misses = 0;
+}
+
+void destroy_shader_module_cache(ShaderModuleCache& cache)
+{
+    for (std::unordered_map<uint64_t, ShaderModuleEntry>::iterator it = cache.modules.begin(); it != cache.modules.end(); ++it)
+    {
+        vkDestroyShaderModule(cache.device, it->second.module, host_allocator());
+    }
+    cache.modules.clear();
+}
+
+VkResult get_shader_module(ShaderModuleCache& cache, uint32_t const* code, size_t size, VkShaderModule* out_module)
+{
+    uint64_t hash = hash_bytes(code, size);
+    std::unordered_map<uint64_t, ShaderModuleEntry>::iterator it = cache.modules.find(hash);
+    while ((it != cache.modules.end()) &&
+           ((it->second.code.size() * sizeof(uint32_t) != size) || (memcmp(it->second.code.data(), code, size) != 0)))
+    {
+        // Collision, probe the next key.
+        it = cache.modules.find(++hash);
+    }
+    if (it != cache.modules.end())
+    {
+        cache.hits += 1;
+        *out_module = it->second.module;
+        return VK_SUCCESS;
+    }
+
+    VkShaderModuleCreateInfo module_info = {};
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.pNext = nullptr;
+    module_info.flags = 0;
+    module_info.codeSize = size;
+    module_info.pCode = code;
+    ShaderModuleEntry entry;
+    VK_THROW(vkCreateShaderModule(cache.device, &module_info, host_allocator(), &entry.module));
+    entry.code.assign(code, code + size / sizeof(uint32_t));
+    cache.modules[hash] = entry;
+    cache.misses += 1;
+    *out_module = entry.module;
+    return VK_SUCCESS;
+}
+
+VkResult load_shader_module(ShaderModuleCache& cache, char const* path, VkShaderModule* out_module)
+{
+    MappedFile file;
+    if (!map_file(path, &file))
+    {
+        std::cout << "Unable to open shader " << path << "\n";
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    VkResult err = VK_ERROR_INITIALIZATION_FAILED;
+    if ((file.size > 0) && (file.size % sizeof(uint32_t) == 0))
+    {
+        // SPIR-V is word aligned, mappings are page aligned.
+        err = get_shader_module(cache, static_cast<uint32_t const*>(file.data), file.size, out_module);
+    }
+    unmap_file(file);
+    return err;
+}
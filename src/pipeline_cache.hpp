@@ -0,0 +1,49 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// VkPipelineCache persisted between runs. The blob is memory mapped at startup and only handed
+// to the driver when its header matches this device; it is written back atomically on shutdown.
+struct PipelineCache
+{
+    VkPipelineCache cache;
+    std::string path;
+    size_t loaded_bytes;        // size of the blob the cache was seeded with, 0 on a cold start
+    char const* reject_reason;  // why the blob on disk was ignored, nullptr when accepted or absent
+};
+
+// A missing or mismatching file is not an error, the cache simply starts empty. load false
+// skips reading path (cold start) but save_pipeline_cache() still writes it.
+VkResult create_pipeline_cache(VkDevice device, VkPhysicalDeviceProperties const& properties, char const* path, bool load, PipelineCache* out_cache);
+// Writes everything the driver put in the cache back to path.
+VkResult save_pipeline_cache(VkDevice device, PipelineCache const& cache);
+void destroy_pipeline_cache(VkDevice device, PipelineCache& cache);
+
+// Shader modules keyed by a hash of their SPIR-V, loading the same code twice returns the same
+// module. Modules live until the cache is destroyed.
+struct ShaderModuleEntry
+{
+    VkShaderModule module;
+    std::vector<uint32_t> code;     // compared on hit, a hash collision must not alias two shaders
+};
+
+struct ShaderModuleCache
+{
+    VkDevice device;
+    std::unordered_map<uint64_t, ShaderModuleEntry> modules;
+    uint32_t hits;
+    uint32_t misses;
+};
+
+uint64_t hash_bytes(void const* data, size_t size);
+
+void create_shader_module_cache(VkDevice device, ShaderModuleCache* out_cache);
+void destroy_shader_module_cache(ShaderModuleCache& cache);
+VkResult get_shader_module(ShaderModuleCache& cache, uint32_t const* code, size_t size, VkShaderModule* out_module);
+// Maps a .spv file and goes through get_shader_module().
+VkResult load_shader_module(ShaderModuleCache& cache, char const* path, VkShaderModule* out_module);
@@ -0,0 +1,295 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "dispatch.hpp"
+#include "host_allocator.hpp"
+#include "pipeline_manager.hpp"
+
+typedef std::chrono::steady_clock pipeline_clock;
+
+static double elapsed_ms(pipeline_clock::time_point from, pipeline_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+void init_graphics_pipeline_desc(GraphicsPipelineDesc* out_desc)
+{
+    out_desc->name.clear();
+    out_desc->stages.clear();
+    out_desc->vertex_bindings.clear();
+    out_desc->vertex_attributes.clear();
+
+    out_desc->input_assembly = VkPipelineInputAssemblyStateCreateInfo();
+    out_desc->input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    out_desc->input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    out_desc->rasterization = VkPipelineRasterizationStateCreateInfo();
+    out_desc->rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    out_desc->rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    out_desc->rasterization.cullMode = VK_CULL_MODE_BACK_BIT;
+    out_desc->rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    out_desc->rasterization.lineWidth = 1.0f;
+
+    out_desc->multisample = VkPipelineMultisampleStateCreateInfo();
+    out_desc->multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    out_desc->multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    out_desc->depth_stencil = VkPipelineDepthStencilStateCreateInfo();
+    out_desc->depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    out_desc->depth_stencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
+    VkPipelineColorBlendAttachmentState blend = {};
+    blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    out_desc->blend_attachments.assign(1, blend);
+    out_desc->dynamic_states.clear();
+    out_desc->layout = VK_NULL_HANDLE;
+    out_desc->render_pass = VK_NULL_HANDLE;
+    out_desc->subpass = 0;
+}
+
+static VkPipelineShaderStageCreateInfo stage_info(ShaderStageDesc const& desc)
+{
+    VkPipelineShaderStageCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.flags = 0;
+    info.stage = desc.stage;
+    info.module = desc.module;
+    info.pName = desc.entry.c_str();
+    info.pSpecializationInfo = nullptr;
+    return info;
+}
+
+static VkResult compile_graphics(VkDevice device, VkPipelineCache cache, GraphicsPipelineDesc const& desc, VkPipeline* out_pipeline)
+{
+    std::vector<VkPipelineShaderStageCreateInfo> stages;
+    for (size_t sidx = 0; sidx < desc.stages.size(); ++sidx)
+    {
+        stages.push_back(stage_info(desc.stages[sidx]));
+    }
+
+    VkPipelineVertexInputStateCreateInfo vertex_input = {};
+    vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.vertex_bindings.size());
+    vertex_input.pVertexBindingDescriptions = desc.vertex_bindings.data();
+    vertex_input.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertex_attributes.size());
+    vertex_input.pVertexAttributeDescriptions = desc.vertex_attributes.data();
+
+    VkPipelineViewportStateCreateInfo viewport = {};
+    viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+
+    VkPipelineColorBlendStateCreateInfo blend = {};
+    blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    blend.attachmentCount = static_cast<uint32_t>(desc.blend_attachments.size());
+    blend.pAttachments = desc.blend_attachments.data();
+
+    std::vector<VkDynamicState> dynamic_states(desc.dynamic_states);
+    dynamic_states.push_back(VK_DYNAMIC_STATE_VIEWPORT);
+    dynamic_states.push_back(VK_DYNAMIC_STATE_SCISSOR);
+    VkPipelineDynamicStateCreateInfo dynamic = {};
+    dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
+    dynamic.pDynamicStates = dynamic_states.data();
+
+    VkGraphicsPipelineCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.flags = 0;
+    info.stageCount = static_cast<uint32_t>(stages.size());
+    info.pStages = stages.data();
+    info.pVertexInputState = &vertex_input;
+    info.pInputAssemblyState = &desc.input_assembly;
+    info.pTessellationState = nullptr;
+    info.pViewportState = &viewport;
+    info.pRasterizationState = &desc.rasterization;
+    info.pMultisampleState = &desc.multisample;
+    info.pDepthStencilState = &desc.depth_stencil;
+    info.pColorBlendState = &blend;
+    info.pDynamicState = &dynamic;
+    info.layout = desc.layout;
+    info.renderPass = desc.render_pass;
+    info.subpass = desc.subpass;
+    info.basePipelineHandle = VK_NULL_HANDLE;
+    info.basePipelineIndex = -1;
+    return vkCreateGraphicsPipelines(device, cache, 1, &info, host_allocator(), out_pipeline);
+}
+
+static VkResult compile_compute(VkDevice device, VkPipelineCache cache, ComputePipelineDesc const& desc, VkPipeline* out_pipeline)
+{
+    VkComputePipelineCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.flags = 0;
+    info.stage = stage_info(desc.stage);
+    info.layout = desc.layout;
+    info.basePipelineHandle = VK_NULL_HANDLE;
+    info.basePipelineIndex = -1;
+    return vkCreateComputePipelines(device, cache, 1, &info, host_allocator(), out_pipeline);
+}
+
+static void compile_thread(PipelineManager* manager)
+{
+    for (;;)
+    {
+        CompileRequest request;
+        {
+            std::unique_lock<std::mutex> guard(manager->lock);
+            manager->wake.wait(guard, [manager] { return manager->quit || !manager->requests.empty(); });
+            if (manager->quit)
+            {
+                return;
+            }
+            request = std::move(manager->requests.front());
+            manager->requests.pop_front();
+            manager->stats.queue_depth = static_cast<uint32_t>(manager->requests.size());
+        }
+
+        pipeline_clock::time_point start = pipeline_clock::now();
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkResult err = request.compute ? compile_compute(manager->device, manager->cache, request.compute_desc, &pipeline)
+                                       : compile_graphics(manager->device, manager->cache, request.graphics, &pipeline);
+        pipeline_clock::time_point done = pipeline_clock::now();
+
+        PipelineEntry* entry = request.entry;
+        if (err != VK_SUCCESS)
+        {
+            std::cout << "Pipeline " << entry->name << " failed to compile (" << err << ")\n";
+        }
+        {
+            std::lock_guard<std::mutex> guard(manager->lock);
+            PipelineStats& stats = manager->stats;
+            double compile_ms = elapsed_ms(start, done);
+            stats.compiled += (err == VK_SUCCESS) ? 1 : 0;
+            stats.failed += (err == VK_SUCCESS) ? 0 : 1;
+            stats.total_compile_ms += compile_ms;
+            stats.max_compile_ms = std::max(stats.max_compile_ms, compile_ms);
+            stats.max_latency_ms = std::max(stats.max_latency_ms, elapsed_ms(entry->requested, done));
+        }
+        entry->pipeline = pipeline;
+        entry->state.store((err == VK_SUCCESS) ? PIPELINE_READY : PIPELINE_FAILED, std::memory_order_release);
+    }
+}
+
+void create_pipeline_manager(VkDevice device, VkPipelineCache cache, uint32_t thread_count, PipelineManager* out_manager)
+{
+    out_manager->device = device;
+    out_manager->cache = cache;
+    out_manager->quit = false;
+    out_manager->stats = PipelineStats();
+    for (uint32_t tidx = 0; tidx < std::max<uint32_t>(thread_count, 1); ++tidx)
+    {
+        out_manager->threads.push_back(std::thread(compile_thread, out_manager));
+    }
+}
+
+void destroy_pipeline_manager(PipelineManager& manager)
+{
+    {
+        std::lock_guard<std::mutex> guard(manager.lock);
+        manager.quit = true;
+        manager.requests.clear();
+    }
+    manager.wake.notify_all();
+    for (size_t tidx = 0; tidx < manager.threads.size(); ++tidx)
+    {
+        manager.threads[tidx].join();
+    }
+    manager.threads.clear();
+    for (size_t eidx = 0; eidx < manager.entries.size(); ++eidx)
+    {
+        if (manager.entries[eidx]->state.load() == PIPELINE_READY)
+        {
+            vkDestroyPipeline(manager.device, manager.entries[eidx]->pipeline, host_allocator());
+        }
+    }
+    manager.entries.clear();
+}
+
+static PipelineHandle enqueue(PipelineManager& manager, CompileRequest& request, std::string const& name, PipelineHandle fallback)
+{
+    assert(fallback <= manager.entries.size());
+    PipelineEntry* entry = new PipelineEntry();
+    entry->name = name;
+    entry->fallback = fallback;
+    entry->requested = pipeline_clock::now();
+    manager.entries.push_back(std::unique_ptr<PipelineEntry>(entry));
+    request.entry = entry;
+    {
+        std::lock_guard<std::mutex> guard(manager.lock);
+        manager.requests.push_back(std::move(request));
+        manager.stats.requested += 1;
+        manager.stats.queue_depth = static_cast<uint32_t>(manager.requests.size());
+        manager.stats.max_queue_depth = std::max(manager.stats.max_queue_depth, manager.stats.queue_depth);
+    }
+    manager.wake.notify_one();
+    return static_cast<PipelineHandle>(manager.entries.size());
+}
+
+PipelineHandle request_graphics_pipeline(PipelineManager& manager, GraphicsPipelineDesc const& desc, PipelineHandle fallback)
+{
+    CompileRequest request;
+    request.compute = false;
+    request.graphics = desc;
+    return enqueue(manager, request, desc.name, fallback);
+}
+
+PipelineHandle request_compute_pipeline(PipelineManager& manager, ComputePipelineDesc const& desc, PipelineHandle fallback)
+{
+    CompileRequest request;
+    request.compute = true;
+    request.compute_desc = desc;
+    return enqueue(manager, request, desc.name, fallback);
+}
+
+PipelineState pipeline_state(PipelineManager const& manager, PipelineHandle handle)
+{
+    assert((handle > 0) && (handle <= manager.entries.size()));
+    return static_cast<PipelineState>(manager.entries[handle - 1]->state.load(std::memory_order_acquire));
+}
+
+VkPipeline resolve_pipeline(PipelineManager& manager, PipelineHandle handle)
+{
+    bool fallback = false;
+    // Fallbacks are requested before the pipelines that use them, the chain always terminates.
+    for (; handle != 0; handle = manager.entries[handle - 1]->fallback)
+    {
+        PipelineEntry const& entry = *manager.entries[handle - 1];
+        if (entry.state.load(std::memory_order_acquire) == PIPELINE_READY)
+        {
+            if (fallback)
+            {
+                manager.fallback_resolves.fetch_add(1, std::memory_order_relaxed);
+            }
+            return entry.pipeline;
+        }
+        fallback = true;
+    }
+    manager.skipped_resolves.fetch_add(1, std::memory_order_relaxed);
+    return VK_NULL_HANDLE;
+}
+
+void get_pipeline_stats(PipelineManager& manager, PipelineStats* out_stats)
+{
+    std::lock_guard<std::mutex> guard(manager.lock);
+    *out_stats = manager.stats;
+    out_stats->fallback_resolves = manager.fallback_resolves.load(std::memory_order_relaxed);
+    out_stats->skipped_resolves = manager.skipped_resolves.load(std::memory_order_relaxed);
+}
+
+void print_pipeline_stats(PipelineManager& manager)
+{
+    PipelineStats stats;
+    get_pipeline_stats(manager, &stats);
+    double average_ms = (stats.compiled + stats.failed > 0) ? stats.total_compile_ms / (stats.compiled + stats.failed) : 0.0;
+    std::cout << "pipelines: " << stats.compiled << "/" << stats.requested << " compiled, " << stats.failed << " failed"
+              << " | compile avg " << average_ms << " ms, max " << stats.max_compile_ms << " ms"
+              << " | latency max " << stats.max_latency_ms << " ms"
+              << " | queue depth " << stats.queue_depth << " (max " << stats.max_queue_depth << ")"
+              << " | fallback " << stats.fallback_resolves << ", skipped " << stats.skipped_resolves << "\n";
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pipelines are compiled on background threads. Requests return a handle immediately; the
+// render thread resolves it every frame and gets VK_NULL_HANDLE (skip the draw) or the
+// fallback pipeline until the real one is ready. Nothing on the render thread ever waits.
+
+typedef uint32_t PipelineHandle;    // 0 is "no pipeline"
+
+enum PipelineState
+{
+    PIPELINE_PENDING,
+    PIPELINE_READY,
+    PIPELINE_FAILED
+};
+
+struct ShaderStageDesc
+{
+    VkShaderStageFlagBits stage;
+    VkShaderModule module;
+    std::string entry;
+};
+
+// Owning copy of everything VkGraphicsPipelineCreateInfo points to, the request outlives the
+// caller's stack.
+struct GraphicsPipelineDesc
+{
+    std::string name;
+    std::vector<ShaderStageDesc> stages;
+    std::vector<VkVertexInputBindingDescription> vertex_bindings;
+    std::vector<VkVertexInputAttributeDescription> vertex_attributes;
+    VkPipelineInputAssemblyStateCreateInfo input_assembly;
+    VkPipelineRasterizationStateCreateInfo rasterization;
+    VkPipelineMultisampleStateCreateInfo multisample;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil;
+    std::vector<VkPipelineColorBlendAttachmentState> blend_attachments;
+    std::vector<VkDynamicState> dynamic_states;     // viewport and scissor are always dynamic
+    VkPipelineLayout layout;
+    VkRenderPass render_pass;
+    uint32_t subpass;
+};
+
+struct ComputePipelineDesc
+{
+    std::string name;
+    ShaderStageDesc stage;
+    VkPipelineLayout layout;
+};
+
+// Opaque triangles, no depth, one color attachment without blending.
+void init_graphics_pipeline_desc(GraphicsPipelineDesc* out_desc);
+
+struct PipelineEntry
+{
+    std::string name;
+    std::atomic<uint32_t> state;        // PipelineState, pipeline is valid once READY is observed
+    VkPipeline pipeline;
+    PipelineHandle fallback;
+    std::chrono::steady_clock::time_point requested;
+
+    PipelineEntry() : state(PIPELINE_PENDING), pipeline(VK_NULL_HANDLE), fallback(0) {}
+};
+
+struct CompileRequest
+{
+    PipelineEntry* entry;
+    bool compute;
+    GraphicsPipelineDesc graphics;
+    ComputePipelineDesc compute_desc;
+};
+
+struct PipelineStats
+{
+    uint32_t requested;
+    uint32_t compiled;
+    uint32_t failed;
+    uint32_t queue_depth;               // requests not picked up by a compile thread yet
+    uint32_t max_queue_depth;
+    double total_compile_ms;            // driver time in vkCreate*Pipelines
+    double max_compile_ms;
+    double max_latency_ms;              // request to ready, includes queueing
+    uint64_t fallback_resolves;         // resolve_pipeline() calls answered with the fallback
+    uint64_t skipped_resolves;          // resolve_pipeline() calls answered with VK_NULL_HANDLE
+};
+
+struct PipelineManager
+{
+    VkDevice device;
+    VkPipelineCache cache;              // internally synchronized, shared by every compile thread
+
+    std::vector<std::unique_ptr<PipelineEntry>> entries;   // handle - 1, render thread only
+
+    std::mutex lock;                    // guards requests and stats
+    std::condition_variable wake;
+    std::deque<CompileRequest> requests;
+    std::vector<std::thread> threads;
+    bool quit;
+    PipelineStats stats;                // fallback/skipped counts live in the atomics below
+
+    // Bumped by resolve_pipeline() on the render thread without taking lock.
+    std::atomic<uint64_t> fallback_resolves;
+    std::atomic<uint64_t> skipped_resolves;
+
+    PipelineManager() : fallback_resolves(0), skipped_resolves(0) {}
+};
+
+void create_pipeline_manager(VkDevice device, VkPipelineCache cache, uint32_t thread_count, PipelineManager* out_manager);
+// Drops queued requests, waits for the compiles in progress and destroys every pipeline.
+void destroy_pipeline_manager(PipelineManager& manager);
+
+PipelineHandle request_graphics_pipeline(PipelineManager& manager, GraphicsPipelineDesc const& desc, PipelineHandle fallback);
+PipelineHandle request_compute_pipeline(PipelineManager& manager, ComputePipelineDesc const& desc, PipelineHandle fallback);
+
+PipelineState pipeline_state(PipelineManager const& manager, PipelineHandle handle);
+// Never blocks: the pipeline when ready, else the (ready) fallback chain, else VK_NULL_HANDLE.
+VkPipeline resolve_pipeline(PipelineManager& manager, PipelineHandle handle);
+
+void get_pipeline_stats(PipelineManager& manager, PipelineStats* out_stats);
+void print_pipeline_stats(PipelineManager& manager);
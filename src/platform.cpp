@@ -0,0 +1,206 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "platform.hpp"
+
+static double elapsed_ms(platform_clock::time_point from, platform_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+PlatformWindow::PlatformWindow() : stopping(false), dropped_moves(0), full_waits(0), create_state(0), width(0), height(0), title(nullptr)
+{
+    memset(&stats, 0, sizeof(stats));
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+    instance = nullptr;
+    window = nullptr;
+#endif
+#ifdef VK_USE_PLATFORM_XLIB_KHR
+    display = nullptr;
+    surface_display = nullptr;
+    window = 0;
+    wake_pipe[0] = -1;
+    wake_pipe[1] = -1;
+#endif
+}
+
+PlatformWindow::~PlatformWindow()
+{
+    destroy_platform_window(*this);
+}
+
+#ifndef PLATFORM_WINDOW
+// No window system on this platform, the swap chain runs headless or offscreen.
+bool create_platform_window(uint32_t width, uint32_t height, char const* title, PlatformWindow* out_window)
+{
+    return false;
+}
+
+void destroy_platform_window(PlatformWindow& window)
+{
+}
+
+char const* window_surface_extension()
+{
+    return nullptr;
+}
+
+VkResult create_window_surface(VkInstance instance, PlatformWindow& window, VkSurfaceKHR* out_surface)
+{
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+#endif
+
+void init_input_state(uint32_t width, uint32_t height, InputState* out_input)
+{
+    out_input->mouse_x = 0;
+    out_input->mouse_y = 0;
+    out_input->mouse_buttons = 0;
+    memset(out_input->keys, 0, sizeof(out_input->keys));
+    out_input->focused = true;
+    out_input->close_requested = false;
+    out_input->resized = false;
+    out_input->width = width;
+    out_input->height = height;
+    out_input->oldest_input = platform_clock::time_point();
+}
+
+void poll_window_events(PlatformWindow& window, InputState& input)
+{
+    // Only what was queued on entry: a flood can't keep the frame here, and every event drained
+    // was stamped before now.
+    uint32_t count = window.events.size();
+    platform_clock::time_point now = platform_clock::now();
+    WindowStats& stats = window.stats;
+    WindowEvent event;
+    for (uint32_t eidx = 0; (eidx < count) && window.events.pop(&event); ++eidx)
+    {
+        stats.events += 1;
+        switch (event.type)
+        {
+        case WINDOW_EVENT_RESIZE:
+            input.width = event.width;
+            input.height = event.height;
+            input.resized = true;
+            break;
+        case WINDOW_EVENT_CLOSE:
+            input.close_requested = true;
+            break;
+        case WINDOW_EVENT_FOCUS:
+            input.focused = event.down;
+            if (!event.down)
+            {
+                // Releases happen in another window while we are not focused.
+                input.mouse_buttons = 0;
+                memset(input.keys, 0, sizeof(input.keys));
+            }
+            break;
+        case WINDOW_EVENT_KEY:
+            input.keys[event.code & 0xff] = event.down ? 1 : 0;
+            break;
+        case WINDOW_EVENT_MOUSE_MOVE:
+            input.mouse_x = event.x;
+            input.mouse_y = event.y;
+            break;
+        case WINDOW_EVENT_MOUSE_BUTTON:
+            if (event.down)
+            {
+                input.mouse_buttons |= 1u << event.code;
+            }
+            else
+            {
+                input.mouse_buttons &= ~(1u << event.code);
+            }
+            break;
+        }
+        if (event.type < WINDOW_EVENT_KEY)
+        {
+            continue;
+        }
+        double latency_ms = elapsed_ms(event.time, now);
+        stats.input_events += 1;
+        stats.sample_latency_ms += latency_ms;
+        stats.sample_latency_max_ms = std::max(stats.sample_latency_max_ms, latency_ms);
+        if ((input.oldest_input == platform_clock::time_point()) || (event.time < input.oldest_input))
+        {
+            input.oldest_input = event.time;
+        }
+    }
+}
+
+void note_input_presented(PlatformWindow& window, InputState& input)
+{
+    if (input.oldest_input == platform_clock::time_point())
+    {
+        return;
+    }
+    // Up to the present call: the presentation engine's own queue comes on top and can't be seen
+    // from here.
+    double latency_ms = elapsed_ms(input.oldest_input, platform_clock::now());
+    WindowStats& stats = window.stats;
+    stats.presented_frames += 1;
+    stats.present_latency_ms += latency_ms;
+    stats.present_latency_max_ms = std::max(stats.present_latency_max_ms, latency_ms);
+    input.oldest_input = platform_clock::time_point();
+}
+
+void print_window_stats(PlatformWindow const& window)
+{
+    WindowStats const& stats = window.stats;
+    std::cout << "window: " << stats.events << " events, " << stats.input_events << " input, "
+              << window.dropped_moves.load(std::memory_order_relaxed) << " mouse moves dropped, "
+              << window.full_waits.load(std::memory_order_relaxed) << " waits on a full queue\n";
+    if (stats.input_events > 0)
+    {
+        std::cout << "input latency: sampled after " << stats.sample_latency_ms / static_cast<double>(stats.input_events)
+                  << " ms (max " << stats.sample_latency_max_ms << ")";
+        if (stats.presented_frames > 0)
+        {
+            std::cout << ", presented after " << stats.present_latency_ms / static_cast<double>(stats.presented_frames)
+                      << " ms (max " << stats.present_latency_max_ms << ")";
+        }
+        std::cout << "\n";
+    }
+}
+
+WindowEvent make_window_event(WindowEventType type)
+{
+    WindowEvent event;
+    event.type = type;
+    event.time = platform_clock::now();
+    event.width = 0;
+    event.height = 0;
+    event.x = 0;
+    event.y = 0;
+    event.code = 0;
+    event.down = false;
+    return event;
+}
+
+void push_window_event(PlatformWindow& window, WindowEvent const& event)
+{
+    if (window.events.push(event))
+    {
+        return;
+    }
+    if (event.type == WINDOW_EVENT_MOUSE_MOVE)
+    {
+        // Only the latest position matters to the render thread.
+        window.dropped_moves.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // Anything else can't be lost: the render thread is behind, the pump waits for it to drain.
+    window.full_waits.fetch_add(1, std::memory_order_relaxed);
+    while (!window.events.push(event))
+    {
+        if (window.stopping.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "spsc_queue.hpp"
+
+// The OS window lives on a thread of its own. The pump blocks in the OS message loop, including
+// the modal loops of a resize or a drag, and never holds up frame submission. Events go to the
+// render thread through a lock-free single producer / single consumer queue, each stamped when
+// the pump received it: the render thread drains the queue right before recording, and the time
+// from the OS handing an input over to the present of the frame that used it is measured.
+//
+// Backends: win32.cpp, xlib.cpp (make WINDOW=xlib). Without one there is no window and
+// create_platform_window() fails.
+
+#if defined(VK_USE_PLATFORM_WIN32_KHR) || defined(VK_USE_PLATFORM_XLIB_KHR)
+#define PLATFORM_WINDOW
+#endif
+
+typedef std::chrono::steady_clock platform_clock;
+
+enum WindowEventType
+{
+    WINDOW_EVENT_RESIZE,            // client area size, 0x0 while minimized
+    WINDOW_EVENT_CLOSE,             // the user asked, the window stays until destroy_platform_window()
+    WINDOW_EVENT_FOCUS,
+    // Input from here on, counted in the latency stats.
+    WINDOW_EVENT_KEY,
+    WINDOW_EVENT_MOUSE_MOVE,
+    WINDOW_EVENT_MOUSE_BUTTON
+};
+
+struct WindowEvent
+{
+    WindowEventType type;
+    platform_clock::time_point time;    // when the pump received it from the OS
+    uint32_t width;                 // RESIZE
+    uint32_t height;
+    int32_t x;                      // MOUSE_MOVE, in client area pixels
+    int32_t y;
+    uint32_t code;                  // KEY: platform key code, MOUSE_BUTTON: 0 left, 1 right, 2 middle
+    bool down;                      // KEY, MOUSE_BUTTON pressed, FOCUS gained
+};
+
+// What the render thread knows of the window, updated by poll_window_events().
+struct InputState
+{
+    int32_t mouse_x;
+    int32_t mouse_y;
+    uint32_t mouse_buttons;         // bit per button
+    uint8_t keys[256];              // 1 while held, by platform key code
+    bool focused;
+    bool close_requested;
+    bool resized;                   // a resize came in, cleared by the caller once handled
+    uint32_t width;
+    uint32_t height;
+    platform_clock::time_point oldest_input;   // oldest input sampled since the last present, zero when none
+};
+
+struct WindowStats
+{
+    uint64_t events;
+    uint64_t input_events;
+    uint64_t presented_frames;      // frames presented with input in them
+    double sample_latency_ms;       // received to sampled by the render thread, summed over the input events
+    double sample_latency_max_ms;
+    double present_latency_ms;      // oldest input of a frame to its present, summed over the frames
+    double present_latency_max_ms;
+};
+
+struct PlatformWindow
+{
+    std::thread pump;
+    SpscQueue<WindowEvent, 1024> events;    // pump to render thread
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> dropped_moves;    // mouse moves dropped with the queue full, a later one supersedes them
+    std::atomic<uint64_t> full_waits;       // other events that waited for room
+
+    std::mutex lock;                // creation handshake
+    std::condition_variable created;
+    int create_state;               // 0 pending, 1 created, -1 failed
+    uint32_t width;                 // initial size
+    uint32_t height;
+    char const* title;
+
+    WindowStats stats;              // render thread only
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+    HINSTANCE instance;
+    HWND window;
+#endif
+#ifdef VK_USE_PLATFORM_XLIB_KHR
+    Display* display;               // pump thread connection, events
+    Display* surface_display;       // render thread connection, the surface and the presents
+    Window window;
+    int wake_pipe[2];               // wakes the pump out of poll() to stop
+#endif
+
+    PlatformWindow();
+    ~PlatformWindow();              // destroys a window still open, for the early exits of main()
+};
+
+// Starts the pump thread, which creates the window and shows it. False when there is no window
+// system or the window can't be created.
+bool create_platform_window(uint32_t width, uint32_t height, char const* title, PlatformWindow* out_window);
+// Stops the pump and closes the window. Every surface of the window must be gone already.
+void destroy_platform_window(PlatformWindow& window);
+
+// Instance extension the surface needs besides VK_KHR_surface, nullptr without a window system.
+char const* window_surface_extension();
+VkResult create_window_surface(VkInstance instance, PlatformWindow& window, VkSurfaceKHR* out_surface);
+
+void init_input_state(uint32_t width, uint32_t height, InputState* out_input);
+// Render thread: drains the queue into input, never waits. Once at the top of the frame for
+// resize and close, and again right before recording so the frame sees the newest input.
+void poll_window_events(PlatformWindow& window, InputState& input);
+// Right after the present of a frame recorded with input.
+void note_input_presented(PlatformWindow& window, InputState& input);
+void print_window_stats(PlatformWindow const& window);
+
+// Pump thread side, for the backends. Time stamped now.
+WindowEvent make_window_event(WindowEventType type);
+void push_window_event(PlatformWindow& window, WindowEvent const& event);
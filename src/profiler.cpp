@@ -0,0 +1,407 @@
+#include "profiler.hpp"
+
+#ifdef ENABLE_PROFILER
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "device.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "file_map.hpp"
+#include "host_allocator.hpp"
+
+static size_t const cpu_ring_size = 16 * 1024;     // events per thread
+static size_t const gpu_ring_size = 16 * 1024;
+static size_t const frame_ring_size = 1024;
+
+struct CpuEvent
+{
+    char const* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+// Only its own thread writes to it, the registry just keeps it alive for the export.
+struct ThreadTrace
+{
+    uint32_t thread_id;
+    char const* name;
+    std::vector<CpuEvent> events;
+    uint64_t count;
+};
+
+struct FrameMark
+{
+    uint64_t frame_number;
+    uint64_t ns;
+};
+
+struct ProfilerRegistry
+{
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex lock;
+    std::vector<std::unique_ptr<ThreadTrace> > threads;
+    std::vector<FrameMark> frames;      // ring
+    uint64_t frame_count;
+};
+
+static ProfilerRegistry& registry()
+{
+    static ProfilerRegistry instance = { std::chrono::steady_clock::now() };
+    return instance;
+}
+
+static thread_local ThreadTrace* tls_trace = nullptr;
+
+static ThreadTrace& thread_trace()
+{
+    if (tls_trace == nullptr)
+    {
+        ProfilerRegistry& reg = registry();
+        std::unique_ptr<ThreadTrace> trace(new ThreadTrace());
+        trace->name = nullptr;
+        trace->events.resize(cpu_ring_size);
+        trace->count = 0;
+        std::lock_guard<std::mutex> guard(reg.lock);
+        trace->thread_id = static_cast<uint32_t>(reg.threads.size());
+        tls_trace = trace.get();
+        reg.threads.push_back(std::move(trace));
+    }
+    return *tls_trace;
+}
+
+uint64_t profiler_now_ns()
+{
+    std::chrono::steady_clock::duration since = std::chrono::steady_clock::now() - registry().epoch;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(since).count());
+}
+
+void profiler_thread_name(char const* name)
+{
+    thread_trace().name = name;
+}
+
+void profiler_frame_mark(uint64_t frame_number)
+{
+    FrameMark mark = { frame_number, profiler_now_ns() };
+    ProfilerRegistry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    if (reg.frames.size() < frame_ring_size)
+    {
+        reg.frames.push_back(mark);
+    }
+    else
+    {
+        reg.frames[reg.frame_count % frame_ring_size] = mark;
+    }
+    ++reg.frame_count;
+}
+
+void push_cpu_event(char const* name, uint64_t begin_ns, uint64_t end_ns)
+{
+    ThreadTrace& trace = thread_trace();
+    CpuEvent event = { name, begin_ns, end_ns };
+    trace.events[trace.count % cpu_ring_size] = event;
+    ++trace.count;
+}
+
+VkResult create_gpu_profiler(VkDevice device, DrawCommandBuffer const& draw, uint32_t frames_in_flight, uint32_t max_scopes_per_frame, GpuProfiler* out_profiler)
+{
+    out_profiler->device = device;
+    out_profiler->timestamps = VK_NULL_HANDLE;
+    out_profiler->statistics = VK_NULL_HANDLE;
+    out_profiler->queries_per_frame = 2 * (max_scopes_per_frame + 1);  // + the whole frame
+    out_profiler->timestamp_mask = (draw.timestamp_valid_bits >= 64) ? ~0ull : ((1ull << draw.timestamp_valid_bits) - 1);
+    out_profiler->timestamp_period = draw.gpu_properties.limits.timestampPeriod;
+    out_profiler->frame_idx = 0;
+    out_profiler->frames.resize(frames_in_flight);
+    for (size_t fidx = 0; fidx < out_profiler->frames.size(); ++fidx)
+    {
+        out_profiler->frames[fidx].query_count = 0;
+        out_profiler->frames[fidx].cpu_begin_ns = 0;
+        out_profiler->frames[fidx].statistics_used = false;
+        out_profiler->frames[fidx].pending = false;
+    }
+    out_profiler->events.resize(gpu_ring_size);
+    out_profiler->event_count = 0;
+    out_profiler->dropped_scopes = 0;
+    if (draw.timestamp_valid_bits == 0)
+    {
+        return VK_SUCCESS;
+    }
+
+    VkQueryPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = 0;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = out_profiler->queries_per_frame * frames_in_flight;
+    pool_info.pipelineStatistics = 0;
+    VK_THROW(vkCreateQueryPool(device, &pool_info, host_allocator(), &out_profiler->timestamps));
+
+    if (draw.enabled_features.pipelineStatisticsQuery)
+    {
+        // Ascending bit order, matches PipelineStatistic.
+        pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        pool_info.queryCount = frames_in_flight;
+        pool_info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+        VK_THROW(vkCreateQueryPool(device, &pool_info, host_allocator(), &out_profiler->statistics));
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_gpu_profiler(GpuProfiler& profiler)
+{
+    if (profiler.statistics != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(profiler.device, profiler.statistics, host_allocator());
+    }
+    if (profiler.timestamps != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(profiler.device, profiler.timestamps, host_allocator());
+    }
+    profiler.statistics = VK_NULL_HANDLE;
+    profiler.timestamps = VK_NULL_HANDLE;
+}
+
+// Without calibrated timestamps the GPU clock is lined up with the CPU by pinning the frame's first
+// timestamp to the time the frame started recording, so GPU scopes show up slightly early.
+static void resolve_frame(GpuProfiler& profiler, uint32_t frame_idx)
+{
+    GpuProfilerFrame& frame = profiler.frames[frame_idx];
+    frame.pending = false;
+    uint32_t first_query = frame_idx * profiler.queries_per_frame;
+    std::vector<uint64_t> ticks(frame.query_count);
+    VkResult err = vkGetQueryPoolResults(profiler.device, profiler.timestamps, first_query, frame.query_count,
+        ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (err != VK_SUCCESS)
+    {
+        return;     // VK_NOT_READY can't happen after the slot fence, drop the frame if it does
+    }
+    uint64_t statistics[STAT_COUNT] = {};
+    bool has_statistics = frame.statistics_used &&
+        (vkGetQueryPoolResults(profiler.device, profiler.statistics, frame_idx, 1, sizeof(statistics), statistics,
+            sizeof(statistics), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS);
+
+    uint64_t base = ticks[0];
+    for (size_t sidx = 0; sidx < frame.scopes.size(); ++sidx)
+    {
+        GpuScopeRecord const& scope = frame.scopes[sidx];
+        uint64_t begin = (ticks[scope.begin_query] - base) & profiler.timestamp_mask;
+        uint64_t end = (ticks[scope.begin_query + 1] - base) & profiler.timestamp_mask;
+        GpuEvent& event = profiler.events[profiler.event_count % gpu_ring_size];
+        event.name = scope.name;
+        event.begin_ns = frame.cpu_begin_ns + static_cast<uint64_t>(begin * profiler.timestamp_period);
+        event.end_ns = frame.cpu_begin_ns + static_cast<uint64_t>(end * profiler.timestamp_period);
+        event.has_statistics = scope.statistics && has_statistics;
+        for (uint32_t stat = 0; stat < STAT_COUNT; ++stat)
+        {
+            event.statistics[stat] = event.has_statistics ? statistics[stat] : 0;
+        }
+        ++profiler.event_count;
+    }
+}
+
+void begin_gpu_profiler_frame(GpuProfiler& profiler, VkCommandBuffer command_buffer, uint32_t frame_idx)
+{
+    profiler.frame_idx = frame_idx;
+    if (profiler.timestamps == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    GpuProfilerFrame& frame = profiler.frames[frame_idx];
+    if (frame.pending)
+    {
+        resolve_frame(profiler, frame_idx);
+    }
+    frame.scopes.clear();
+    frame.query_count = 0;
+    frame.statistics_used = false;
+    frame.cpu_begin_ns = profiler_now_ns();
+
+    vkCmdResetQueryPool(command_buffer, profiler.timestamps, frame_idx * profiler.queries_per_frame, profiler.queries_per_frame);
+    if (profiler.statistics != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(command_buffer, profiler.statistics, frame_idx, 1);
+    }
+    begin_gpu_scope(&profiler, command_buffer, "gpu frame", false);
+}
+
+void end_gpu_profiler_frame(GpuProfiler& profiler, VkCommandBuffer command_buffer)
+{
+    if (profiler.timestamps == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    end_gpu_scope(&profiler, command_buffer, 0);
+    profiler.frames[profiler.frame_idx].pending = true;
+}
+
+void flush_gpu_profiler(GpuProfiler& profiler)
+{
+    // Oldest slot first so the event ring stays in time order.
+    uint32_t frame_count = static_cast<uint32_t>(profiler.frames.size());
+    for (uint32_t fidx = 1; fidx <= frame_count; ++fidx)
+    {
+        uint32_t slot = (profiler.frame_idx + fidx) % frame_count;
+        if (profiler.frames[slot].pending)
+        {
+            resolve_frame(profiler, slot);
+        }
+    }
+}
+
+uint32_t begin_gpu_scope(GpuProfiler* profiler, VkCommandBuffer command_buffer, char const* name, bool statistics)
+{
+    if ((profiler == nullptr) || (profiler->timestamps == VK_NULL_HANDLE))
+    {
+        return UINT32_MAX;
+    }
+    GpuProfilerFrame& frame = profiler->frames[profiler->frame_idx];
+    if (frame.query_count + 2 > profiler->queries_per_frame)
+    {
+        ++profiler->dropped_scopes;
+        return UINT32_MAX;
+    }
+    GpuScopeRecord scope = { name, frame.query_count, false };
+    if (statistics && (profiler->statistics != VK_NULL_HANDLE) && !frame.statistics_used)
+    {
+        vkCmdBeginQuery(command_buffer, profiler->statistics, profiler->frame_idx, 0);
+        scope.statistics = true;
+        frame.statistics_used = true;
+    }
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->timestamps,
+        profiler->frame_idx * profiler->queries_per_frame + scope.begin_query);
+    frame.query_count += 2;
+    frame.scopes.push_back(scope);
+    return static_cast<uint32_t>(frame.scopes.size() - 1);
+}
+
+void end_gpu_scope(GpuProfiler* profiler, VkCommandBuffer command_buffer, uint32_t scope_idx)
+{
+    if ((profiler == nullptr) || (scope_idx == UINT32_MAX))
+    {
+        return;
+    }
+    GpuScopeRecord const& scope = profiler->frames[profiler->frame_idx].scopes[scope_idx];
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->timestamps,
+        profiler->frame_idx * profiler->queries_per_frame + scope.begin_query + 1);
+    if (scope.statistics)
+    {
+        vkCmdEndQuery(command_buffer, profiler->statistics, profiler->frame_idx);
+    }
+}
+
+// Chrome trace timestamps are microseconds.
+static void append_event(std::string& json, char const* name, char const* phase, uint64_t begin_ns, uint64_t end_ns, uint32_t pid, uint32_t tid)
+{
+    char line[256];
+    if (phase[0] == 'X')
+    {
+        snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u",
+            name, begin_ns / 1000.0, (end_ns - begin_ns) / 1000.0, pid, tid);
+    }
+    else
+    {
+        snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"s\":\"g\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u",
+            name, phase, begin_ns / 1000.0, pid, tid);
+    }
+    json += line;
+}
+
+static void append_metadata(std::string& json, char const* kind, char const* name, uint32_t pid, uint32_t tid)
+{
+    char line[256];
+    snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", kind, pid, tid, name);
+    json += line;
+}
+
+bool write_chrome_trace(char const* path, GpuProfiler const* gpu, uint32_t frame_count)
+{
+    uint32_t const cpu_pid = 1;
+    uint32_t const gpu_pid = 2;
+    ProfilerRegistry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+
+    // Window: from the frame_count-th last frame mark on.
+    uint64_t first_frame = 0;
+    uint64_t available = (reg.frame_count < frame_ring_size) ? reg.frame_count : frame_ring_size;
+    if (frame_count < available)
+    {
+        first_frame = reg.frame_count - frame_count;
+    }
+    else
+    {
+        first_frame = reg.frame_count - available;
+    }
+    uint64_t window_begin_ns = (available > 0) ? reg.frames[first_frame % frame_ring_size].ns : 0;
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}}";
+    append_metadata(json, "process_name", "GPU", gpu_pid, 0);
+    for (uint64_t fidx = first_frame; fidx < reg.frame_count; ++fidx)
+    {
+        FrameMark const& mark = reg.frames[fidx % frame_ring_size];
+        char name[32];
+        snprintf(name, sizeof(name), "frame %llu", static_cast<unsigned long long>(mark.frame_number));
+        append_event(json, name, "i", mark.ns, mark.ns, cpu_pid, 0);
+        json += "}";
+    }
+
+    for (size_t tidx = 0; tidx < reg.threads.size(); ++tidx)
+    {
+        ThreadTrace const& trace = *reg.threads[tidx];
+        if (trace.name != nullptr)
+        {
+            append_metadata(json, "thread_name", trace.name, cpu_pid, trace.thread_id);
+        }
+        uint64_t first = (trace.count > cpu_ring_size) ? trace.count - cpu_ring_size : 0;
+        for (uint64_t eidx = first; eidx < trace.count; ++eidx)
+        {
+            CpuEvent const& event = trace.events[eidx % cpu_ring_size];
+            if (event.end_ns >= window_begin_ns)
+            {
+                append_event(json, event.name, "X", event.begin_ns, event.end_ns, cpu_pid, trace.thread_id);
+                json += "}";
+            }
+        }
+    }
+
+    if (gpu != nullptr)
+    {
+        append_metadata(json, "thread_name", "graphics queue", gpu_pid, 0);
+        uint64_t first = (gpu->event_count > gpu_ring_size) ? gpu->event_count - gpu_ring_size : 0;
+        for (uint64_t eidx = first; eidx < gpu->event_count; ++eidx)
+        {
+            GpuEvent const& event = gpu->events[eidx % gpu_ring_size];
+            if (event.end_ns < window_begin_ns)
+            {
+                continue;
+            }
+            append_event(json, event.name, "X", event.begin_ns, event.end_ns, gpu_pid, 0);
+            if (event.has_statistics)
+            {
+                char args[256];
+                snprintf(args, sizeof(args), ",\"args\":{\"ia_vertices\":%llu,\"vs_invocations\":%llu,\"clipping_primitives\":%llu,\"fs_invocations\":%llu,\"cs_invocations\":%llu}",
+                    static_cast<unsigned long long>(event.statistics[STAT_INPUT_ASSEMBLY_VERTICES]),
+                    static_cast<unsigned long long>(event.statistics[STAT_VERTEX_INVOCATIONS]),
+                    static_cast<unsigned long long>(event.statistics[STAT_CLIPPING_PRIMITIVES]),
+                    static_cast<unsigned long long>(event.statistics[STAT_FRAGMENT_INVOCATIONS]),
+                    static_cast<unsigned long long>(event.statistics[STAT_COMPUTE_INVOCATIONS]));
+                json += args;
+            }
+            json += "}";
+        }
+    }
+    json += "\n]}\n";
+    return write_file_atomic(path, json.data(), json.size());
+}
+
+#endif
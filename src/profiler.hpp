@@ -0,0 +1,129 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+#include <vector>
+
+// CPU scopes are written into per-thread rings, GPU scopes into timestamp queries that are read
+// back when their frame slot comes around again. write_chrome_trace() dumps the last frames as
+// chrome://tracing / Perfetto JSON.
+// Everything compiles to nothing unless ENABLE_PROFILER is defined (the makefile sets it unless
+// RELEASE=1). Scope names must be string literals, only the pointer is kept.
+
+struct GpuProfiler;
+struct DrawCommandBuffer;
+
+#ifdef ENABLE_PROFILER
+
+enum PipelineStatistic
+{
+    STAT_INPUT_ASSEMBLY_VERTICES,
+    STAT_VERTEX_INVOCATIONS,
+    STAT_CLIPPING_PRIMITIVES,
+    STAT_FRAGMENT_INVOCATIONS,
+    STAT_COMPUTE_INVOCATIONS,
+    STAT_COUNT
+};
+
+struct GpuScopeRecord
+{
+    char const* name;
+    uint32_t begin_query;       // end is begin_query + 1
+    bool statistics;            // wrapped in the frame's pipeline statistics query
+};
+
+struct GpuProfilerFrame
+{
+    std::vector<GpuScopeRecord> scopes;
+    uint32_t query_count;
+    uint64_t cpu_begin_ns;      // lines the GPU clock up with the CPU one, see resolve_frame()
+    bool statistics_used;
+    bool pending;               // recorded and not read back yet
+};
+
+struct GpuEvent
+{
+    char const* name;
+    uint64_t begin_ns;          // CPU time base
+    uint64_t end_ns;
+    bool has_statistics;
+    uint64_t statistics[STAT_COUNT];
+};
+
+struct GpuProfiler
+{
+    VkDevice device;
+    VkQueryPool timestamps;     // queries_per_frame per frame slot
+    VkQueryPool statistics;     // one per frame slot, VK_NULL_HANDLE without pipelineStatisticsQuery
+    uint32_t queries_per_frame;
+    uint64_t timestamp_mask;
+    double timestamp_period;    // ns per tick
+    uint32_t frame_idx;
+    std::vector<GpuProfilerFrame> frames;
+    std::vector<GpuEvent> events;   // ring of resolved scopes
+    uint64_t event_count;
+    uint64_t dropped_scopes;        // ran out of queries
+};
+
+// Leaves out_profiler->timestamps null (and every GPU scope a no-op) when the graphics family
+// can't write timestamps.
+VkResult create_gpu_profiler(VkDevice device, DrawCommandBuffer const& draw, uint32_t frames_in_flight, uint32_t max_scopes_per_frame, GpuProfiler* out_profiler);
+void destroy_gpu_profiler(GpuProfiler& profiler);
+
+// Call once the slot fence has signaled: reads the slot's previous results back then resets it.
+void begin_gpu_profiler_frame(GpuProfiler& profiler, VkCommandBuffer command_buffer, uint32_t frame_idx);
+void end_gpu_profiler_frame(GpuProfiler& profiler, VkCommandBuffer command_buffer);
+// Reads back every submitted frame, call after vkDeviceWaitIdle() before exporting.
+void flush_gpu_profiler(GpuProfiler& profiler);
+
+// Only one statistics scope per frame, it can't be nested and secondaries can't be executed inside it.
+uint32_t begin_gpu_scope(GpuProfiler* profiler, VkCommandBuffer command_buffer, char const* name, bool statistics);
+void end_gpu_scope(GpuProfiler* profiler, VkCommandBuffer command_buffer, uint32_t scope_idx);
+
+struct GpuScope
+{
+    GpuScope(GpuProfiler* profiler, VkCommandBuffer command_buffer, char const* name, bool statistics)
+        : profiler(profiler), command_buffer(command_buffer), scope_idx(begin_gpu_scope(profiler, command_buffer, name, statistics)) {}
+    ~GpuScope() { end_gpu_scope(profiler, command_buffer, scope_idx); }
+    GpuProfiler* profiler;
+    VkCommandBuffer command_buffer;
+    uint32_t scope_idx;
+};
+
+uint64_t profiler_now_ns();
+// Names the calling thread in the trace.
+void profiler_thread_name(char const* name);
+void profiler_frame_mark(uint64_t frame_number);
+void push_cpu_event(char const* name, uint64_t begin_ns, uint64_t end_ns);
+
+struct CpuScope
+{
+    explicit CpuScope(char const* name) : name(name), begin_ns(profiler_now_ns()) {}
+    ~CpuScope() { push_cpu_event(name, begin_ns, profiler_now_ns()); }
+    char const* name;
+    uint64_t begin_ns;
+};
+
+// The last frame_count frames (or fewer if the rings already wrapped). Call while no thread is
+// recording scopes, e.g. after the job system is idle.
+bool write_chrome_trace(char const* path, GpuProfiler const* gpu, uint32_t frame_count);
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) CpuScope PROFILE_CONCAT(cpu_scope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(profiler, command_buffer, name) GpuScope PROFILE_CONCAT(gpu_scope_, __LINE__)(profiler, command_buffer, name, false)
+#define PROFILE_GPU_STATISTICS_SCOPE(profiler, command_buffer, name) GpuScope PROFILE_CONCAT(gpu_scope_, __LINE__)(profiler, command_buffer, name, true)
+#define PROFILE_THREAD_NAME(name) profiler_thread_name(name)
+#define PROFILE_FRAME(frame_number) profiler_frame_mark(frame_number)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_GPU_SCOPE(profiler, command_buffer, name) ((void)0)
+#define PROFILE_GPU_STATISTICS_SCOPE(profiler, command_buffer, name) ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#define PROFILE_FRAME(frame_number) ((void)0)
+
+#endif
@@ -0,0 +1,522 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "readback.hpp"
+
+static VkDeviceSize align_up(VkDeviceSize v, VkDeviceSize alignment)
+{
+    return ((v + alignment - 1) / alignment) * alignment;
+}
+
+static double elapsed_ms(readback_clock::time_point from, readback_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+bool readback_format_supported(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_bgra(VkFormat format)
+{
+    return (format == VK_FORMAT_B8G8R8A8_UNORM) || (format == VK_FORMAT_B8G8R8A8_SRGB);
+}
+
+// One row of 4 byte texels to 3 byte RGB, the only copy the image file formats make.
+static void swizzle_row(unsigned char const* src, uint32_t width, bool bgra, unsigned char* dst)
+{
+    uint32_t r = bgra ? 2 : 0;
+    uint32_t b = bgra ? 0 : 2;
+    for (uint32_t x = 0; x < width; ++x)
+    {
+        dst[0] = src[r];
+        dst[1] = src[1];
+        dst[2] = src[b];
+        src += 4;
+        dst += 3;
+    }
+}
+
+static bool write_ppm(FILE* file, ReadbackSlot const& slot, unsigned char const* pixels, std::vector<unsigned char>& row)
+{
+    uint32_t width = slot.extent.width;
+    if (fprintf(file, "P6\n%u %u\n255\n", width, slot.extent.height) < 0)
+    {
+        return false;
+    }
+    row.resize(width * 3);
+    for (uint32_t y = 0; y < slot.extent.height; ++y)
+    {
+        swizzle_row(pixels + static_cast<size_t>(y) * width * 4, width, is_bgra(slot.format), row.data());
+        if (fwrite(row.data(), 1, row.size(), file) != row.size())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct CrcTable
+{
+    uint32_t entries[256];
+    CrcTable()
+    {
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (uint32_t k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+            }
+            entries[n] = c;
+        }
+    }
+};
+
+// A PNG is written as it goes: the size of stored deflate blocks is known up front, so the single
+// IDAT chunk length is too and nothing has to be buffered. crc covers the chunk, adler the image data.
+struct PngStream
+{
+    FILE* file;
+    uint32_t crc;
+    uint32_t adler_a;
+    uint32_t adler_b;
+    uint64_t data_left;         // image bytes not written yet
+    uint32_t block_left;        // image bytes left in the current stored block
+    bool ok;
+};
+
+static uint32_t const PNG_BLOCK_MAX = 65535;
+
+static void png_raw(PngStream& png, void const* data, size_t size)
+{
+    static CrcTable const table;
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+    uint32_t crc = png.crc;
+    for (size_t bidx = 0; bidx < size; ++bidx)
+    {
+        crc = table.entries[(crc ^ bytes[bidx]) & 0xff] ^ (crc >> 8);
+    }
+    png.crc = crc;
+    png.ok = png.ok && (fwrite(data, 1, size, png.file) == size);
+}
+
+static void png_be32(PngStream& png, uint32_t value)
+{
+    unsigned char bytes[4] = { static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+                               static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value) };
+    png_raw(png, bytes, 4);
+}
+
+static void png_begin_chunk(PngStream& png, char const* type, uint32_t size)
+{
+    png_be32(png, size);
+    png.crc = 0xffffffffu;
+    png_raw(png, type, 4);
+}
+
+static void png_end_chunk(PngStream& png)
+{
+    png_be32(png, png.crc ^ 0xffffffffu);
+}
+
+static void png_data(PngStream& png, unsigned char const* data, size_t size)
+{
+    while (size > 0)
+    {
+        if (png.block_left == 0)
+        {
+            uint32_t block = static_cast<uint32_t>(std::min<uint64_t>(png.data_left, PNG_BLOCK_MAX));
+            unsigned char header[5] = { static_cast<unsigned char>((block == png.data_left) ? 1 : 0),
+                                        static_cast<unsigned char>(block), static_cast<unsigned char>(block >> 8),
+                                        static_cast<unsigned char>(~block), static_cast<unsigned char>(~block >> 8) };
+            png_raw(png, header, sizeof(header));
+            png.block_left = block;
+        }
+        size_t count = std::min<size_t>(size, png.block_left);
+        // 5552 bytes is the most adler32 can sum before the 32 bit accumulators overflow.
+        for (size_t first = 0; first < count; first += 5552)
+        {
+            size_t last = std::min<size_t>(count, first + 5552);
+            for (size_t bidx = first; bidx < last; ++bidx)
+            {
+                png.adler_a += data[bidx];
+                png.adler_b += png.adler_a;
+            }
+            png.adler_a %= 65521;
+            png.adler_b %= 65521;
+        }
+        png_raw(png, data, count);
+        png.block_left -= static_cast<uint32_t>(count);
+        png.data_left -= count;
+        data += count;
+        size -= count;
+    }
+}
+
+static bool write_png(FILE* file, ReadbackSlot const& slot, unsigned char const* pixels, std::vector<unsigned char>& row)
+{
+    uint32_t width = slot.extent.width;
+    uint32_t height = slot.extent.height;
+    PngStream png = { file, 0, 1, 0, 0, 0, true };
+    static unsigned char const signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    png_raw(png, signature, sizeof(signature));
+
+    png_begin_chunk(png, "IHDR", 13);
+    png_be32(png, width);
+    png_be32(png, height);
+    unsigned char const header[5] = { 8, 2, 0, 0, 0 };     // 8 bit RGB, deflate, no filter, no interlace
+    png_raw(png, header, sizeof(header));
+    png_end_chunk(png);
+
+    // Every row starts with its filter type, 0 is none.
+    uint64_t data_size = static_cast<uint64_t>(height) * (1 + static_cast<uint64_t>(width) * 3);
+    uint64_t block_count = (data_size + PNG_BLOCK_MAX - 1) / PNG_BLOCK_MAX;
+    uint64_t idat_size = 2 + block_count * 5 + data_size + 4;
+    if (idat_size > 0x7fffffffu)
+    {
+        return false;
+    }
+    png_begin_chunk(png, "IDAT", static_cast<uint32_t>(idat_size));
+    unsigned char const zlib_header[2] = { 0x78, 0x01 };
+    png_raw(png, zlib_header, sizeof(zlib_header));
+    png.data_left = data_size;
+    row.resize(1 + width * 3);
+    row[0] = 0;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        swizzle_row(pixels + static_cast<size_t>(y) * width * 4, width, is_bgra(slot.format), row.data() + 1);
+        png_data(png, row.data(), row.size());
+    }
+    png_be32(png, (png.adler_b << 16) | png.adler_a);
+    png_end_chunk(png);
+
+    png_begin_chunk(png, "IEND", 0);
+    png_end_chunk(png);
+    return png.ok;
+}
+
+static bool write_slot(ReadbackRing& ring, ReadbackSlot const& slot, std::vector<unsigned char>& row)
+{
+    unsigned char const* pixels = reinterpret_cast<unsigned char const*>(ring.mapped + slot.offset);
+    size_t size = static_cast<size_t>(slot.extent.width) * slot.extent.height * 4;
+    if (ring.format == READBACK_RAW_STREAM)
+    {
+        // Straight from the mapped buffer, the stream never sees another copy.
+        return (fwrite(pixels, 1, size, ring.stream) == size) && (fflush(ring.stream) == 0);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/frame_%06llu.%s", static_cast<unsigned long long>(slot.frame_number),
+             (ring.format == READBACK_PNG) ? "png" : "ppm");
+    std::string file_path = ring.path + name;
+    FILE* file = fopen(file_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool written = (ring.format == READBACK_PNG) ? write_png(file, slot, pixels, row) : write_ppm(file, slot, pixels, row);
+    written = (fclose(file) == 0) && written;
+    if (!written)
+    {
+        remove(file_path.c_str());     // no truncated images left behind for a comparison to pick up
+    }
+    return written;
+}
+
+static void run_readback_writer(ReadbackRing* ring)
+{
+    std::vector<unsigned char> row;
+    for (;;)
+    {
+        uint32_t slot_idx = 0;
+        {
+            std::unique_lock<std::mutex> guard(ring->lock);
+            ring->work_ready.wait(guard, [ring]() { return ring->stopping || !ring->queue.empty(); });
+            if (ring->queue.empty())
+            {
+                return;
+            }
+            slot_idx = ring->queue.front();
+            ring->queue.pop_front();
+        }
+        // The slot belongs to this writer until it is marked free again.
+        ReadbackSlot const& slot = ring->slots[slot_idx];
+        readback_clock::time_point start = readback_clock::now();
+        bool written = write_slot(*ring, slot, row);
+        readback_clock::time_point done = readback_clock::now();
+        {
+            std::lock_guard<std::mutex> guard(ring->lock);
+            ReadbackStats& stats = ring->stats;
+            if (written)
+            {
+                double latency = elapsed_ms(slot.recorded_at, done);
+                stats.frames_written += 1;
+                stats.bytes_written += static_cast<uint64_t>(slot.extent.width) * slot.extent.height * 4;
+                stats.gpu_latency_ms += elapsed_ms(slot.recorded_at, slot.completed_at);
+                stats.latency_ms += latency;
+                stats.latency_max_ms = std::max(stats.latency_max_ms, latency);
+            }
+            else
+            {
+                stats.frames_failed += 1;
+            }
+            stats.write_ms += elapsed_ms(start, done);
+            stats.last_written = done;
+            ring->slots[slot_idx].state = READBACK_SLOT_FREE;
+        }
+        ring->slot_freed.notify_one();
+    }
+}
+
+VkResult create_readback_ring(DeviceAllocator& allocator, VkPhysicalDevice gpu, VkExtent2D max_extent, uint32_t slot_count,
+                              ReadbackFormat format, ReadbackPolicy policy, char const* path, uint32_t writer_count, ReadbackRing* out_ring)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+
+    out_ring->allocator = &allocator;
+    out_ring->buffer.reset();
+    out_ring->mapped = nullptr;
+    out_ring->format = format;
+    out_ring->policy = policy;
+    out_ring->path = path;
+    out_ring->stream = nullptr;
+    out_ring->stream_extent.width = 0;
+    out_ring->stream_extent.height = 0;
+    out_ring->stopping = false;
+    out_ring->stats = ReadbackStats();
+    // Slots start on a non coherent atom so invalidating one never touches its neighbours.
+    VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.optimalBufferCopyOffsetAlignment, 16);
+    alignment = std::max<VkDeviceSize>(alignment, properties.limits.nonCoherentAtomSize);
+    out_ring->slot_size = align_up(static_cast<VkDeviceSize>(max_extent.width) * max_extent.height * 4, alignment);
+    slot_count = std::max<uint32_t>(slot_count, 1);
+
+    if (format == READBACK_RAW_STREAM)
+    {
+        out_ring->stream = fopen(path, "wb");
+        if (out_ring->stream == nullptr)
+        {
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        writer_count = 1;
+    }
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = out_ring->slot_size * slot_count;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    GpuAllocation* allocation = nullptr;
+    VK_THROW(create_buffer(allocator, buffer_info, MEMORY_GPU_TO_CPU, &allocation));
+    out_ring->buffer = UniqueBuffer(&allocator, allocation);
+    out_ring->mapped = static_cast<char const*>(allocation->mapped);
+
+    out_ring->slots.resize(slot_count);
+    for (uint32_t sidx = 0; sidx < slot_count; ++sidx)
+    {
+        ReadbackSlot& slot = out_ring->slots[sidx];
+        slot.offset = out_ring->slot_size * sidx;
+        slot.state = READBACK_SLOT_FREE;
+        slot.frame_number = 0;
+        slot.format = VK_FORMAT_UNDEFINED;
+        slot.extent.width = 0;
+        slot.extent.height = 0;
+    }
+    for (uint32_t widx = 0; widx < std::max<uint32_t>(writer_count, 1); ++widx)
+    {
+        out_ring->writers.push_back(std::thread(run_readback_writer, out_ring));
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_readback_ring(ReadbackRing& ring)
+{
+    if (ring.buffer)
+    {
+        poll_readbacks(ring, UINT64_MAX);
+    }
+    {
+        std::lock_guard<std::mutex> guard(ring.lock);
+        ring.stopping = true;
+    }
+    ring.work_ready.notify_all();
+    for (size_t widx = 0; widx < ring.writers.size(); ++widx)
+    {
+        ring.writers[widx].join();
+    }
+    ring.writers.clear();
+    if (ring.stream != nullptr)
+    {
+        fclose(ring.stream);
+        ring.stream = nullptr;
+    }
+    ring.buffer.reset();
+    ring.slots.clear();
+}
+
+// Called with the lock held. Free slots are taken lowest first, any one will do.
+static int32_t find_free_slot(ReadbackRing const& ring, bool* out_writing)
+{
+    *out_writing = false;
+    for (size_t sidx = 0; sidx < ring.slots.size(); ++sidx)
+    {
+        if (ring.slots[sidx].state == READBACK_SLOT_FREE)
+        {
+            return static_cast<int32_t>(sidx);
+        }
+        *out_writing = *out_writing || (ring.slots[sidx].state == READBACK_SLOT_WRITING);
+    }
+    return -1;
+}
+
+bool record_readback(ReadbackRing& ring, VkCommandBuffer command_buffer, VkImage image, VkFormat format, VkExtent2D extent, uint64_t frame_number)
+{
+    readback_clock::time_point now = readback_clock::now();
+    std::unique_lock<std::mutex> guard(ring.lock);
+    if (ring.stats.first_recorded == readback_clock::time_point())
+    {
+        ring.stats.first_recorded = now;
+    }
+    bool fits = readback_format_supported(format) && (static_cast<VkDeviceSize>(extent.width) * extent.height * 4 <= ring.slot_size);
+    if (fits && (ring.format == READBACK_RAW_STREAM))
+    {
+        // An encoder reading rawvideo has a single frame size.
+        if (ring.stream_extent.width == 0)
+        {
+            ring.stream_extent = extent;
+        }
+        fits = (ring.stream_extent.width == extent.width) && (ring.stream_extent.height == extent.height);
+    }
+    if (!fits)
+    {
+        ring.stats.frames_skipped += 1;
+        return false;
+    }
+
+    bool writing = false;
+    int32_t slot_idx = find_free_slot(ring, &writing);
+    if ((slot_idx < 0) && writing && (ring.policy == READBACK_BLOCK))
+    {
+        // Only the writers can free a slot now, the recorded ones wait on frames not submitted yet.
+        ring.slot_freed.wait(guard, [&]() { return ((slot_idx = find_free_slot(ring, &writing)) >= 0) || !writing; });
+        ring.stats.blocks += 1;
+        ring.stats.block_ms += elapsed_ms(now, readback_clock::now());
+    }
+    if (slot_idx < 0)
+    {
+        ring.stats.frames_dropped += 1;
+        return false;
+    }
+    ReadbackSlot& slot = ring.slots[slot_idx];
+    slot.state = READBACK_SLOT_RECORDED;
+    slot.frame_number = frame_number;
+    slot.format = format;
+    slot.extent = extent;
+    slot.recorded_at = readback_clock::now();
+    guard.unlock();
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = slot.offset;
+    region.bufferRowLength = 0;         // tightly packed
+    region.bufferImageHeight = 0;
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = { extent.width, extent.height, 1 };
+    vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ring.buffer->buffer, 1, &region);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = ring.buffer->buffer;
+    barrier.offset = slot.offset;
+    barrier.size = ring.slot_size;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    return true;
+}
+
+VkResult poll_readbacks(ReadbackRing& ring, uint64_t frames_completed)
+{
+    readback_clock::time_point now = readback_clock::now();
+    std::vector<uint32_t> ready;
+    {
+        std::lock_guard<std::mutex> guard(ring.lock);
+        for (size_t sidx = 0; sidx < ring.slots.size(); ++sidx)
+        {
+            ReadbackSlot const& slot = ring.slots[sidx];
+            if ((slot.state == READBACK_SLOT_RECORDED) && (slot.frame_number < frames_completed))
+            {
+                ready.push_back(static_cast<uint32_t>(sidx));
+            }
+        }
+    }
+    if (ready.empty())
+    {
+        return VK_SUCCESS;
+    }
+    std::sort(ready.begin(), ready.end(), [&ring](uint32_t a, uint32_t b) { return ring.slots[a].frame_number < ring.slots[b].frame_number; });
+    // Host cached memory: the writers only see the copy once the range is invalidated.
+    for (size_t ridx = 0; ridx < ready.size(); ++ridx)
+    {
+        VK_THROW(invalidate_allocation(*ring.allocator, ring.buffer.get(), ring.slots[ready[ridx]].offset, ring.slot_size));
+    }
+    {
+        std::lock_guard<std::mutex> guard(ring.lock);
+        for (size_t ridx = 0; ridx < ready.size(); ++ridx)
+        {
+            ReadbackSlot& slot = ring.slots[ready[ridx]];
+            slot.state = READBACK_SLOT_WRITING;
+            slot.completed_at = now;
+            ring.queue.push_back(ready[ridx]);
+        }
+    }
+    ring.work_ready.notify_all();
+    return VK_SUCCESS;
+}
+
+void get_readback_stats(ReadbackRing& ring, ReadbackStats* out_stats)
+{
+    std::lock_guard<std::mutex> guard(ring.lock);
+    *out_stats = ring.stats;
+}
+
+void print_readback_stats(ReadbackRing& ring)
+{
+    ReadbackStats stats;
+    get_readback_stats(ring, &stats);
+    double mib = static_cast<double>(stats.bytes_written) / (1024.0 * 1024.0);
+    double frames = static_cast<double>(std::max<uint64_t>(stats.frames_written, 1));
+    double wall_ms = (stats.frames_written > 0) ? elapsed_ms(stats.first_recorded, stats.last_written) : 0.0;
+    std::cout << "readback: " << stats.frames_written << " frames (" << mib << " MiB)"
+              << " | dropped " << stats.frames_dropped << " | skipped " << stats.frames_skipped << " | failed " << stats.frames_failed
+              << " | blocked " << stats.blocks << " times (" << stats.block_ms << " ms)\n";
+    std::cout << "  latency gpu " << stats.gpu_latency_ms / frames << " ms, written " << stats.latency_ms / frames
+              << " ms (max " << stats.latency_max_ms << ")"
+              << " | throughput " << ((wall_ms > 0.0) ? mib * 1000.0 / wall_ms : 0.0) << " MiB/s"
+              << ", writers " << ((stats.write_ms > 0.0) ? mib * 1000.0 / stats.write_ms : 0.0) << " MiB/s busy\n";
+}
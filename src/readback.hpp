@@ -0,0 +1,114 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handles.hpp"
+
+struct DeviceAllocator;
+
+// Gets rendered frames off the GPU without slowing the frame loop down. record_readback() copies
+// an image into a slot of one persistently mapped, host cached buffer. The frame fence is the
+// readback fence: once the frame that recorded a slot is complete, poll_readbacks() hands the slot
+// to the writer threads, which encode straight from the mapped memory and give the slot back.
+
+typedef std::chrono::steady_clock readback_clock;
+
+enum ReadbackFormat
+{
+    READBACK_PPM,               // one binary P6 file per frame
+    READBACK_PNG,               // one file per frame, stored deflate blocks: no compression cost
+    READBACK_RAW_STREAM         // frames appended in order to one file or pipe, raw BGRA / RGBA for an encoder
+};
+
+enum ReadbackPolicy
+{
+    READBACK_DROP,              // skip the frame when every slot is taken
+    READBACK_BLOCK              // wait for a writer to hand a slot back
+};
+
+enum ReadbackSlotState
+{
+    READBACK_SLOT_FREE,
+    READBACK_SLOT_RECORDED,     // copy recorded, its frame is not known to be complete
+    READBACK_SLOT_WRITING       // owned by the writers
+};
+
+struct ReadbackSlot
+{
+    VkDeviceSize offset;        // in the ring buffer
+    ReadbackSlotState state;
+    uint64_t frame_number;
+    VkFormat format;
+    VkExtent2D extent;
+    readback_clock::time_point recorded_at;
+    readback_clock::time_point completed_at;    // when poll_readbacks() saw the frame complete
+};
+
+struct ReadbackStats
+{
+    uint64_t frames_written;
+    uint64_t frames_dropped;    // every slot taken under READBACK_DROP
+    uint64_t frames_skipped;    // bigger than a slot, or a stream frame of another size
+    uint64_t frames_failed;     // write errors
+    uint64_t bytes_written;     // pixel bytes read from the mapped buffer
+    uint32_t blocks;            // times record_readback() waited under READBACK_BLOCK
+    double block_ms;
+    double gpu_latency_ms;      // recorded to complete, summed over the written frames
+    double latency_ms;          // recorded to written, summed
+    double latency_max_ms;
+    double write_ms;            // writer busy time, summed over the writers
+    readback_clock::time_point first_recorded;
+    readback_clock::time_point last_written;
+};
+
+struct ReadbackRing
+{
+    DeviceAllocator* allocator;
+    UniqueBuffer buffer;
+    char const* mapped;
+    VkDeviceSize slot_size;
+    ReadbackFormat format;
+    ReadbackPolicy policy;
+    std::string path;           // directory for PPM and PNG, file for the stream
+    FILE* stream;               // READBACK_RAW_STREAM only
+    VkExtent2D stream_extent;   // size of the first streamed frame, every later one must match
+
+    std::mutex lock;            // slot states, queue and stats
+    std::condition_variable work_ready;
+    std::condition_variable slot_freed;
+    std::vector<ReadbackSlot> slots;
+    std::deque<uint32_t> queue; // slots to write, oldest frame first
+    std::vector<std::thread> writers;
+    bool stopping;
+    ReadbackStats stats;
+};
+
+// 8 bit RGBA and BGRA, the formats the writers know how to encode.
+bool readback_format_supported(VkFormat format);
+
+// slot_count has to be more than the frames in flight, a slot only comes back once its frame is
+// complete and written. max_extent sizes the slots. The stream is written by a single writer so
+// the frames stay in order, whatever writer_count says.
+VkResult create_readback_ring(DeviceAllocator& allocator, VkPhysicalDevice gpu, VkExtent2D max_extent, uint32_t slot_count,
+                              ReadbackFormat format, ReadbackPolicy policy, char const* path, uint32_t writer_count, ReadbackRing* out_ring);
+// Writes whatever is still queued. Every recorded frame must be complete (device idle).
+void destroy_readback_ring(ReadbackRing& ring);
+
+// image must be in TRANSFER_SRC_OPTIMAL. Records the copy and the barrier making it visible to the
+// host reads. False when the frame is not captured: dropped by the policy or skipped.
+bool record_readback(ReadbackRing& ring, VkCommandBuffer command_buffer, VkImage image, VkFormat format, VkExtent2D extent, uint64_t frame_number);
+// Hands the slots of the frames before frames_completed to the writers, never waits.
+VkResult poll_readbacks(ReadbackRing& ring, uint64_t frames_completed);
+
+void get_readback_stats(ReadbackRing& ring, ReadbackStats* out_stats);
+void print_readback_stats(ReadbackRing& ring);
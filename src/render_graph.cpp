@@ -0,0 +1,666 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "render_graph.hpp"
+
+struct AccessInfo
+{
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;       // images only
+    VkImageUsageFlags usage;    // what transient images are created with
+    bool write;
+    char const* name;
+};
+
+static AccessInfo const access_info[GRAPH_ACCESS_COUNT] =
+{
+    { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true, "color attachment write" },
+    { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true, "depth write" },
+    { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false, "depth read" },
+    { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false, "sampled read" },
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false, "storage read" },
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true, "storage write" },
+    { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_UNIFORM_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 0, false, "uniform read" },
+    { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 0, false, "vertex read" },
+    { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 0, false, "indirect read" },
+    { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false, "transfer read" },
+    { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true, "transfer write" },
+};
+
+// Hazard tracking for one resource while walking the passes.
+struct ResourceState
+{
+    VkImageLayout layout;
+    VkPipelineStageFlags write_stage;   // last write or layout transition
+    VkAccessFlags write_access;         // still to be made visible
+    VkPipelineStageFlags read_stage;    // reads since then
+    VkAccessFlags read_access;
+};
+
+// All uses of one resource in one pass, merged.
+struct PassUse
+{
+    uint32_t resource;
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    bool write;
+};
+
+void init_render_graph(RenderGraph* out_graph)
+{
+    out_graph->resources.clear();
+    out_graph->passes.clear();
+    out_graph->slots.clear();
+    out_graph->final_barriers = BarrierBatch();
+    out_graph->compiled = false;
+    out_graph->barrier_calls = 0;
+    out_graph->transitions = 0;
+}
+
+void destroy_render_graph(DeviceAllocator& allocator, RenderGraph& graph)
+{
+    for (size_t ridx = 0; ridx < graph.resources.size(); ++ridx)
+    {
+        GraphResource& resource = graph.resources[ridx];
+        if (!resource.imported && (resource.image != VK_NULL_HANDLE))
+        {
+            vkDestroyImage(allocator.device, resource.image, host_allocator());
+        }
+    }
+    for (size_t sidx = 0; sidx < graph.slots.size(); ++sidx)
+    {
+        free_memory(allocator, graph.slots[sidx].memory);
+    }
+    init_render_graph(&graph);
+}
+
+static uint32_t add_resource(RenderGraph& graph, char const* name, bool is_image, bool imported)
+{
+    assert(!graph.compiled);
+    GraphResource resource = {};
+    resource.name = name;
+    resource.is_image = is_image;
+    resource.imported = imported;
+    resource.image = VK_NULL_HANDLE;
+    resource.buffer = VK_NULL_HANDLE;
+    resource.slot = UINT32_MAX;
+    resource.first_pass = UINT32_MAX;
+    resource.last_pass = 0;
+    graph.resources.push_back(resource);
+    return static_cast<uint32_t>(graph.resources.size() - 1);
+}
+
+uint32_t import_graph_image(RenderGraph& graph, char const* name, VkImageAspectFlags aspect, GraphState const& initial, GraphState const& final)
+{
+    uint32_t ridx = add_resource(graph, name, true, true);
+    graph.resources[ridx].aspect = aspect;
+    graph.resources[ridx].initial = initial;
+    graph.resources[ridx].final = final;
+    return ridx;
+}
+
+uint32_t import_graph_buffer(RenderGraph& graph, char const* name, VkBuffer buffer, GraphState const& initial, GraphState const& final)
+{
+    uint32_t ridx = add_resource(graph, name, false, true);
+    graph.resources[ridx].buffer = buffer;
+    graph.resources[ridx].initial = initial;
+    graph.resources[ridx].final = final;
+    return ridx;
+}
+
+void set_graph_image(RenderGraph& graph, uint32_t resource, VkImage image)
+{
+    assert(graph.resources[resource].imported && graph.resources[resource].is_image);
+    graph.resources[resource].image = image;
+}
+
+uint32_t create_graph_image(RenderGraph& graph, char const* name, VkFormat format, VkExtent2D extent, VkImageAspectFlags aspect)
+{
+    uint32_t ridx = add_resource(graph, name, true, false);
+    graph.resources[ridx].format = format;
+    graph.resources[ridx].extent = extent;
+    graph.resources[ridx].aspect = aspect;
+    return ridx;
+}
+
+VkImage graph_image(RenderGraph const& graph, uint32_t resource)
+{
+    return graph.resources[resource].image;
+}
+
+uint32_t add_graph_pass(RenderGraph& graph, char const* name, PassFn record)
+{
+    assert(!graph.compiled);
+    GraphPass pass;
+    pass.name = name;
+    pass.record = record;
+    pass.side_effects = false;
+    pass.culled = false;
+    pass.refcount = 0;
+    pass.barriers = BarrierBatch();
+    graph.passes.push_back(pass);
+    return static_cast<uint32_t>(graph.passes.size() - 1);
+}
+
+void graph_use(RenderGraph& graph, uint32_t pass, uint32_t resource, GraphAccess access)
+{
+    assert(!graph.compiled);
+    GraphUse use = { resource, access };
+    graph.passes[pass].uses.push_back(use);
+    graph.resources[resource].usage |= access_info[access].usage;
+}
+
+void set_pass_side_effects(RenderGraph& graph, uint32_t pass)
+{
+    graph.passes[pass].side_effects = true;
+}
+
+// Resources read by nobody and not imported are dead, so is a pass whose outputs are all dead.
+static void cull_passes(RenderGraph& graph)
+{
+    std::vector<std::vector<uint32_t> > writers(graph.resources.size());
+    for (size_t ridx = 0; ridx < graph.resources.size(); ++ridx)
+    {
+        graph.resources[ridx].refcount = graph.resources[ridx].imported ? 1 : 0;
+    }
+    for (uint32_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        GraphPass& pass = graph.passes[pidx];
+        pass.refcount = 0;
+        for (size_t uidx = 0; uidx < pass.uses.size(); ++uidx)
+        {
+            GraphUse const& use = pass.uses[uidx];
+            if (access_info[use.access].write)
+            {
+                ++pass.refcount;
+                writers[use.resource].push_back(pidx);
+            }
+            else
+            {
+                ++graph.resources[use.resource].refcount;
+            }
+        }
+    }
+
+    std::vector<uint32_t> dead;
+    for (uint32_t ridx = 0; ridx < graph.resources.size(); ++ridx)
+    {
+        if (graph.resources[ridx].refcount == 0)
+        {
+            dead.push_back(ridx);
+        }
+    }
+    std::vector<uint32_t> culled;
+    for (uint32_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        if ((graph.passes[pidx].refcount == 0) && !graph.passes[pidx].side_effects)
+        {
+            culled.push_back(pidx);
+        }
+    }
+    while (!dead.empty() || !culled.empty())
+    {
+        if (!culled.empty())
+        {
+            GraphPass& pass = graph.passes[culled.back()];
+            culled.pop_back();
+            pass.culled = true;
+            for (size_t uidx = 0; uidx < pass.uses.size(); ++uidx)
+            {
+                GraphUse const& use = pass.uses[uidx];
+                if (!access_info[use.access].write && (--graph.resources[use.resource].refcount == 0))
+                {
+                    dead.push_back(use.resource);
+                }
+            }
+            continue;
+        }
+        uint32_t ridx = dead.back();
+        dead.pop_back();
+        for (size_t widx = 0; widx < writers[ridx].size(); ++widx)
+        {
+            GraphPass& pass = graph.passes[writers[ridx][widx]];
+            if (!pass.culled && !pass.side_effects && (--pass.refcount == 0))
+            {
+                culled.push_back(writers[ridx][widx]);
+            }
+        }
+    }
+}
+
+static std::vector<PassUse> merge_uses(RenderGraph const& graph, GraphPass const& pass)
+{
+    std::vector<PassUse> merged;
+    for (size_t uidx = 0; uidx < pass.uses.size(); ++uidx)
+    {
+        GraphUse const& use = pass.uses[uidx];
+        AccessInfo const& info = access_info[use.access];
+        VkImageLayout layout = graph.resources[use.resource].is_image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+        size_t midx = 0;
+        while ((midx < merged.size()) && (merged[midx].resource != use.resource))
+        {
+            ++midx;
+        }
+        if (midx == merged.size())
+        {
+            PassUse first = { use.resource, info.stage, info.access, layout, info.write };
+            merged.push_back(first);
+            continue;
+        }
+        assert(merged[midx].layout == layout);  // one layout per resource and pass
+        merged[midx].stage |= info.stage;
+        merged[midx].access |= info.access;
+        merged[midx].write = merged[midx].write || info.write;
+    }
+    return merged;
+}
+
+static void add_dependency(RenderGraph& graph, BarrierBatch& batch, GraphResource const& resource, uint32_t ridx,
+    VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access,
+    VkImageLayout old_layout, VkImageLayout new_layout)
+{
+    batch.src_stage |= src_stage;
+    batch.dst_stage |= dst_stage;
+    ++graph.transitions;
+    if (resource.is_image && (old_layout != new_layout))
+    {
+        ImageTransition transition = { ridx, old_layout, new_layout, src_access, dst_access };
+        batch.images.push_back(transition);
+    }
+    else if ((src_access != 0) || (dst_access != 0))
+    {
+        // No layout to change: a global memory barrier covers it, and every other resource in the batch.
+        batch.memory_barrier = true;
+        batch.memory_src_access |= src_access;
+        batch.memory_dst_access |= dst_access;
+    }
+}
+
+static void transition(RenderGraph& graph, BarrierBatch& batch, uint32_t ridx, ResourceState& state, PassUse const& use)
+{
+    GraphResource const& resource = graph.resources[ridx];
+    bool layout_change = resource.is_image && (state.layout != use.layout);
+    if (use.write || layout_change)
+    {
+        // WAW, WAR or a layout transition: wait for everything since the last write.
+        add_dependency(graph, batch, resource, ridx, state.write_stage | state.read_stage, state.write_access,
+            use.stage, use.access, state.layout, use.layout);
+        state.layout = use.layout;
+        state.write_stage = use.stage;
+        state.write_access = use.write ? use.access : 0;
+        state.read_stage = use.write ? 0 : use.stage;
+        state.read_access = use.write ? 0 : use.access;
+        return;
+    }
+    // RAW: once per stage and access type, later readers of the same kind ride along.
+    if ((state.write_stage != 0) && (((use.stage & ~state.read_stage) != 0) || ((use.access & ~state.read_access) != 0)))
+    {
+        add_dependency(graph, batch, resource, ridx, state.write_stage, state.write_access, use.stage, use.access, state.layout, state.layout);
+    }
+    state.read_stage |= use.stage;
+    state.read_access |= use.access;
+}
+
+// First pass whose barrier may carry a dependency on ridx: right after whatever last touched the
+// resource, or its memory for a transient that is about to take over an alias.
+static uint32_t earliest_batch(RenderGraph const& graph, std::vector<uint32_t> const& last_touch, uint32_t ridx, uint32_t pidx)
+{
+    if (last_touch[ridx] != UINT32_MAX)
+    {
+        return last_touch[ridx] + 1;
+    }
+    GraphResource const& resource = graph.resources[ridx];
+    uint32_t earliest = 0;
+    if (resource.slot != UINT32_MAX)
+    {
+        TransientSlot const& slot = graph.slots[resource.slot];
+        for (size_t oidx = 0; oidx < slot.resources.size(); ++oidx)
+        {
+            GraphResource const& other = graph.resources[slot.resources[oidx]];
+            if ((slot.resources[oidx] != ridx) && (other.last_pass < pidx))
+            {
+                earliest = std::max(earliest, other.last_pass + 1);
+            }
+        }
+    }
+    return earliest;
+}
+
+// Walks the live passes from the given states, filling the per-pass batches when record is set.
+// A dependency joins the earliest barrier already needed between its previous use and the pass,
+// so independent transitions share one vkCmdPipelineBarrier instead of each adding their own.
+static void walk_passes(RenderGraph& graph, std::vector<ResourceState>& states, bool record)
+{
+    std::vector<BarrierBatch> batches(graph.passes.size());
+    std::vector<uint32_t> last_touch(graph.resources.size(), UINT32_MAX);
+    for (uint32_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        GraphPass const& pass = graph.passes[pidx];
+        if (pass.culled)
+        {
+            continue;
+        }
+        std::vector<PassUse> uses = merge_uses(graph, pass);
+        for (size_t uidx = 0; uidx < uses.size(); ++uidx)
+        {
+            uint32_t ridx = uses[uidx].resource;
+            uint32_t target = earliest_batch(graph, last_touch, ridx, pidx);
+            while ((target < pidx) && (graph.passes[target].culled || (batches[target].dst_stage == 0)))
+            {
+                ++target;
+            }
+            transition(graph, batches[target], ridx, states[ridx], uses[uidx]);
+        }
+        for (size_t uidx = 0; uidx < uses.size(); ++uidx)
+        {
+            last_touch[uses[uidx].resource] = pidx;
+        }
+    }
+    for (size_t pidx = 0; record && (pidx < graph.passes.size()); ++pidx)
+    {
+        graph.passes[pidx].barriers = batches[pidx];
+    }
+}
+
+static VkResult place_transients(DeviceAllocator& allocator, RenderGraph& graph)
+{
+    std::vector<uint32_t> transients;
+    for (uint32_t ridx = 0; ridx < graph.resources.size(); ++ridx)
+    {
+        GraphResource& resource = graph.resources[ridx];
+        if (resource.imported || (resource.first_pass == UINT32_MAX))
+        {
+            continue;
+        }
+        VkImageCreateInfo image_info = {};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.pNext = nullptr;
+        image_info.flags = 0;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = resource.format;
+        image_info.extent.width = resource.extent.width;
+        image_info.extent.height = resource.extent.height;
+        image_info.extent.depth = 1;
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = resource.usage;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.queueFamilyIndexCount = 0;
+        image_info.pQueueFamilyIndices = nullptr;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VK_THROW(vkCreateImage(allocator.device, &image_info, host_allocator(), &resource.image));
+        vkGetImageMemoryRequirements(allocator.device, resource.image, &resource.requirements);
+        transients.push_back(ridx);
+    }
+
+    // Largest first, each goes into the first slot it fits in time and memory type.
+    std::sort(transients.begin(), transients.end(), [&graph](uint32_t a, uint32_t b)
+    {
+        return graph.resources[a].requirements.size > graph.resources[b].requirements.size;
+    });
+    for (size_t tidx = 0; tidx < transients.size(); ++tidx)
+    {
+        GraphResource& resource = graph.resources[transients[tidx]];
+        size_t sidx = 0;
+        for (; sidx < graph.slots.size(); ++sidx)
+        {
+            TransientSlot const& slot = graph.slots[sidx];
+            bool fits = (slot.requirements.memoryTypeBits & resource.requirements.memoryTypeBits) != 0;
+            for (size_t oidx = 0; fits && (oidx < slot.resources.size()); ++oidx)
+            {
+                GraphResource const& other = graph.resources[slot.resources[oidx]];
+                fits = (other.last_pass < resource.first_pass) || (resource.last_pass < other.first_pass);
+            }
+            if (fits)
+            {
+                break;
+            }
+        }
+        if (sidx == graph.slots.size())
+        {
+            TransientSlot slot;
+            slot.memory = nullptr;
+            slot.requirements = resource.requirements;
+            graph.slots.push_back(slot);
+        }
+        TransientSlot& slot = graph.slots[sidx];
+        slot.requirements.size = std::max(slot.requirements.size, resource.requirements.size);
+        slot.requirements.alignment = std::max(slot.requirements.alignment, resource.requirements.alignment);
+        slot.requirements.memoryTypeBits &= resource.requirements.memoryTypeBits;
+        slot.resources.push_back(transients[tidx]);
+        resource.slot = static_cast<uint32_t>(sidx);
+    }
+
+    for (size_t sidx = 0; sidx < graph.slots.size(); ++sidx)
+    {
+        TransientSlot& slot = graph.slots[sidx];
+        VK_THROW(allocate_memory(allocator, slot.requirements, MEMORY_GPU_ONLY, RESOURCE_OPTIMAL, &slot.memory));
+        for (size_t oidx = 0; oidx < slot.resources.size(); ++oidx)
+        {
+            VK_THROW(vkBindImageMemory(allocator.device, graph.resources[slot.resources[oidx]].image, slot.memory->memory, slot.memory->offset));
+        }
+    }
+    return VK_SUCCESS;
+}
+
+VkResult compile_render_graph(DeviceAllocator& allocator, RenderGraph& graph)
+{
+    assert(!graph.compiled);
+    cull_passes(graph);
+    for (uint32_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        GraphPass const& pass = graph.passes[pidx];
+        for (size_t uidx = 0; !pass.culled && (uidx < pass.uses.size()); ++uidx)
+        {
+            GraphResource& resource = graph.resources[pass.uses[uidx].resource];
+            resource.first_pass = std::min(resource.first_pass, pidx);
+            resource.last_pass = std::max(resource.last_pass, pidx);
+        }
+    }
+    VK_THROW(place_transients(allocator, graph));
+
+    // A first dry run from scratch gives the state every resource is left in at the end of the frame.
+    ResourceState const fresh = { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0, 0, 0 };
+    std::vector<ResourceState> end_states(graph.resources.size(), fresh);
+    walk_passes(graph, end_states, false);
+    graph.transitions = 0;
+
+    // Imported resources start where the caller says. A transient starts undefined (its contents
+    // are dropped) but after whatever last touched its memory: itself in the previous frame or an
+    // alias, so it waits on every occupant of its slot.
+    std::vector<ResourceState> states(graph.resources.size(), fresh);
+    for (size_t ridx = 0; ridx < graph.resources.size(); ++ridx)
+    {
+        GraphResource const& resource = graph.resources[ridx];
+        if (resource.imported)
+        {
+            states[ridx].layout = resource.initial.layout;
+            states[ridx].write_stage = resource.initial.stage;
+            states[ridx].write_access = resource.initial.access;
+        }
+        else if (resource.slot != UINT32_MAX)
+        {
+            TransientSlot const& slot = graph.slots[resource.slot];
+            for (size_t oidx = 0; oidx < slot.resources.size(); ++oidx)
+            {
+                ResourceState const& last = end_states[slot.resources[oidx]];
+                states[ridx].write_stage |= last.write_stage | last.read_stage;
+                states[ridx].write_access |= last.write_access;
+            }
+        }
+    }
+    walk_passes(graph, states, true);
+
+    // Imported images go back in the layout the caller expects.
+    for (uint32_t ridx = 0; ridx < graph.resources.size(); ++ridx)
+    {
+        GraphResource const& resource = graph.resources[ridx];
+        if (resource.imported && resource.is_image && (states[ridx].layout != resource.final.layout))
+        {
+            add_dependency(graph, graph.final_barriers, resource, ridx, states[ridx].write_stage | states[ridx].read_stage,
+                states[ridx].write_access, resource.final.stage, resource.final.access, states[ridx].layout, resource.final.layout);
+        }
+    }
+
+    graph.barrier_calls = (graph.final_barriers.dst_stage != 0) ? 1 : 0;
+    for (size_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        graph.barrier_calls += (graph.passes[pidx].barriers.dst_stage != 0) ? 1 : 0;
+    }
+    graph.compiled = true;
+    return VK_SUCCESS;
+}
+
+static void record_barriers(RenderGraph const& graph, BarrierBatch const& batch, VkCommandBuffer command_buffer)
+{
+    if (batch.dst_stage == 0)
+    {
+        return;
+    }
+    VkMemoryBarrier memory = {};
+    memory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory.pNext = nullptr;
+    memory.srcAccessMask = batch.memory_src_access;
+    memory.dstAccessMask = batch.memory_dst_access;
+
+    VkImageMemoryBarrier images[16];
+    std::vector<VkImageMemoryBarrier> overflow;
+    VkImageMemoryBarrier* image_barriers = images;
+    if (batch.images.size() > 16)
+    {
+        overflow.resize(batch.images.size());
+        image_barriers = overflow.data();
+    }
+    for (size_t iidx = 0; iidx < batch.images.size(); ++iidx)
+    {
+        ImageTransition const& transition = batch.images[iidx];
+        GraphResource const& resource = graph.resources[transition.resource];
+        VkImageMemoryBarrier& barrier = image_barriers[iidx];
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = transition.src_access;
+        barrier.dstAccessMask = transition.dst_access;
+        barrier.oldLayout = transition.old_layout;
+        barrier.newLayout = transition.new_layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange.aspectMask = resource.aspect;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    }
+    VkPipelineStageFlags src_stage = (batch.src_stage != 0) ? batch.src_stage : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    vkCmdPipelineBarrier(command_buffer, src_stage, batch.dst_stage, 0,
+        batch.memory_barrier ? 1 : 0, &memory, 0, nullptr, static_cast<uint32_t>(batch.images.size()), image_barriers);
+}
+
+VkResult execute_render_graph(RenderGraph& graph, VkCommandBuffer command_buffer)
+{
+    assert(graph.compiled);
+    for (size_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        GraphPass& pass = graph.passes[pidx];
+        if (pass.culled)
+        {
+            continue;
+        }
+        record_barriers(graph, pass.barriers, command_buffer);
+        VK_THROW(pass.record(command_buffer));
+    }
+    record_barriers(graph, graph.final_barriers, command_buffer);
+    return VK_SUCCESS;
+}
+
+static void print_batch(RenderGraph const& graph, BarrierBatch const& batch)
+{
+    if (batch.dst_stage == 0)
+    {
+        return;
+    }
+    std::cout << std::hex << "    barrier stages 0x" << batch.src_stage << " -> 0x" << batch.dst_stage << std::dec;
+    if (batch.memory_barrier)
+    {
+        std::cout << std::hex << ", memory 0x" << batch.memory_src_access << " -> 0x" << batch.memory_dst_access << std::dec;
+    }
+    std::cout << "\n";
+    for (size_t iidx = 0; iidx < batch.images.size(); ++iidx)
+    {
+        ImageTransition const& transition = batch.images[iidx];
+        std::cout << "      " << graph.resources[transition.resource].name << ": layout "
+                  << transition.old_layout << " -> " << transition.new_layout << "\n";
+    }
+}
+
+void print_render_graph(RenderGraph const& graph)
+{
+    uint32_t culled = 0;
+    for (size_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        culled += graph.passes[pidx].culled ? 1 : 0;
+    }
+    std::cout << "render graph: " << graph.passes.size() << " passes (" << culled << " culled), "
+              << graph.transitions << " dependencies in " << graph.barrier_calls << " barrier calls\n";
+    for (size_t pidx = 0; pidx < graph.passes.size(); ++pidx)
+    {
+        GraphPass const& pass = graph.passes[pidx];
+        std::cout << "  pass " << pidx << " " << pass.name << (pass.culled ? " [culled]" : "") << "\n";
+        if (!pass.culled)
+        {
+            print_batch(graph, pass.barriers);
+        }
+        for (size_t uidx = 0; uidx < pass.uses.size(); ++uidx)
+        {
+            std::cout << "    " << access_info[pass.uses[uidx].access].name << " " << graph.resources[pass.uses[uidx].resource].name << "\n";
+        }
+    }
+    if (graph.final_barriers.dst_stage != 0)
+    {
+        std::cout << "  end of frame\n";
+        print_batch(graph, graph.final_barriers);
+    }
+
+    VkDeviceSize transient_bytes = 0;
+    VkDeviceSize slot_bytes = 0;
+    for (size_t sidx = 0; sidx < graph.slots.size(); ++sidx)
+    {
+        TransientSlot const& slot = graph.slots[sidx];
+        slot_bytes += slot.requirements.size;
+        std::cout << "  transient memory " << sidx << ": " << slot.requirements.size / 1024 << " KiB,";
+        for (size_t oidx = 0; oidx < slot.resources.size(); ++oidx)
+        {
+            GraphResource const& resource = graph.resources[slot.resources[oidx]];
+            transient_bytes += resource.requirements.size;
+            std::cout << " " << resource.name << " [" << resource.first_pass << "-" << resource.last_pass << "]";
+        }
+        std::cout << "\n";
+    }
+    if (!graph.slots.empty())
+    {
+        std::cout << "  transients: " << slot_bytes / 1024 << " KiB allocated, " << transient_bytes / 1024 << " KiB without aliasing\n";
+    }
+}
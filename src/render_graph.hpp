@@ -0,0 +1,142 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <vector>
+
+struct DeviceAllocator;
+struct GpuAllocation;
+
+// Frame graph: passes declare what they read and write, compile_render_graph() culls passes
+// nothing depends on, works out one batched vkCmdPipelineBarrier per pass (layouts included) and
+// places transient images whose lifetimes don't overlap in the same memory.
+// Build and compile once, then execute every frame; imported images can change between frames
+// through set_graph_image(). Passes run in declaration order.
+
+enum GraphAccess
+{
+    GRAPH_COLOR_ATTACHMENT_WRITE,
+    GRAPH_DEPTH_ATTACHMENT_WRITE,
+    GRAPH_DEPTH_ATTACHMENT_READ,
+    GRAPH_SAMPLED_READ,         // fragment and compute shaders
+    GRAPH_STORAGE_READ,         // compute shaders
+    GRAPH_STORAGE_WRITE,
+    GRAPH_UNIFORM_READ,
+    GRAPH_VERTEX_READ,          // vertex and index buffers
+    GRAPH_INDIRECT_READ,
+    GRAPH_TRANSFER_READ,
+    GRAPH_TRANSFER_WRITE,
+    GRAPH_ACCESS_COUNT
+};
+
+// Where an imported resource comes from / has to be left in. layout is ignored for buffers, access
+// is the writes still to be made visible (0 when it was only read).
+struct GraphState
+{
+    VkImageLayout layout;
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+};
+
+struct GraphUse
+{
+    uint32_t resource;
+    GraphAccess access;
+};
+
+struct ImageTransition
+{
+    uint32_t resource;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+    VkAccessFlags src_access;
+    VkAccessFlags dst_access;
+};
+
+// Everything a pass needs before it runs, recorded as a single vkCmdPipelineBarrier. Buffer
+// hazards are folded into one global memory barrier.
+struct BarrierBatch
+{
+    VkPipelineStageFlags src_stage;
+    VkPipelineStageFlags dst_stage;
+    VkAccessFlags memory_src_access;
+    VkAccessFlags memory_dst_access;
+    bool memory_barrier;
+    std::vector<ImageTransition> images;
+};
+
+typedef std::function<VkResult(VkCommandBuffer command_buffer)> PassFn;
+
+struct GraphPass
+{
+    char const* name;
+    PassFn record;
+    std::vector<GraphUse> uses;
+    bool side_effects;          // never culled, e.g. writes something outside the graph
+    bool culled;
+    uint32_t refcount;
+    BarrierBatch barriers;
+};
+
+struct GraphResource
+{
+    char const* name;
+    bool is_image;
+    bool imported;
+    VkImage image;
+    VkBuffer buffer;
+    VkImageAspectFlags aspect;
+    // transient images
+    VkFormat format;
+    VkExtent2D extent;
+    VkImageUsageFlags usage;
+    VkMemoryRequirements requirements;
+    uint32_t slot;
+    // imported resources
+    GraphState initial;
+    GraphState final;
+    // compile results
+    uint32_t first_pass;        // UINT32_MAX when no live pass uses it
+    uint32_t last_pass;
+    uint32_t refcount;
+};
+
+// Memory shared by transient images with disjoint lifetimes.
+struct TransientSlot
+{
+    GpuAllocation* memory;
+    VkMemoryRequirements requirements;
+    std::vector<uint32_t> resources;
+};
+
+struct RenderGraph
+{
+    std::vector<GraphResource> resources;
+    std::vector<GraphPass> passes;
+    std::vector<TransientSlot> slots;
+    BarrierBatch final_barriers;    // hands imported resources back in their final state
+    bool compiled;
+    uint32_t barrier_calls;
+    uint32_t transitions;           // image + buffer hazards before batching
+};
+
+void init_render_graph(RenderGraph* out_graph);
+void destroy_render_graph(DeviceAllocator& allocator, RenderGraph& graph);
+
+uint32_t import_graph_image(RenderGraph& graph, char const* name, VkImageAspectFlags aspect, GraphState const& initial, GraphState const& final);
+uint32_t import_graph_buffer(RenderGraph& graph, char const* name, VkBuffer buffer, GraphState const& initial, GraphState const& final);
+void set_graph_image(RenderGraph& graph, uint32_t resource, VkImage image);
+// Contents don't survive the frame, the memory may be shared with other transients.
+uint32_t create_graph_image(RenderGraph& graph, char const* name, VkFormat format, VkExtent2D extent, VkImageAspectFlags aspect);
+VkImage graph_image(RenderGraph const& graph, uint32_t resource);
+
+uint32_t add_graph_pass(RenderGraph& graph, char const* name, PassFn record);
+void graph_use(RenderGraph& graph, uint32_t pass, uint32_t resource, GraphAccess access);
+void set_pass_side_effects(RenderGraph& graph, uint32_t pass);
+
+VkResult compile_render_graph(DeviceAllocator& allocator, RenderGraph& graph);
+VkResult execute_render_graph(RenderGraph& graph, VkCommandBuffer command_buffer);
+// Debug dump of the compiled graph: passes, barriers and transient memory.
+void print_render_graph(RenderGraph const& graph);
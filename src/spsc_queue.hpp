@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free ring for exactly one producer thread and one consumer thread. Each side owns one index
+// and only reads the other's, so push and pop are a copy and a release store, plus an acquire load
+// when the cached copy of the other index says the ring looks full or empty. The two sides' indices
+// are padded a cache line apart so they don't bounce the same line between the cores.
+template <typename T, uint32_t Capacity>
+class SpscQueue
+{
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+    SpscQueue() : tail(0), cached_head(0), head(0), cached_tail(0) {}
+    SpscQueue(SpscQueue const&) = delete;
+    SpscQueue& operator=(SpscQueue const&) = delete;
+
+    // Producer only, false when the ring is full.
+    bool push(T const& value)
+    {
+        uint32_t write = tail.load(std::memory_order_relaxed);
+        if (write - cached_head == Capacity)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (write - cached_head == Capacity)
+            {
+                return false;
+            }
+        }
+        slots[write & (Capacity - 1)] = value;
+        tail.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only, false when the ring is empty.
+    bool pop(T* out_value)
+    {
+        uint32_t read = head.load(std::memory_order_relaxed);
+        if (read == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (read == cached_tail)
+            {
+                return false;
+            }
+        }
+        *out_value = slots[read & (Capacity - 1)];
+        head.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side, already stale by the time it returns.
+    uint32_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    // Written by the producer.
+    std::atomic<uint32_t> tail;
+    uint32_t cached_head;
+    char producer_pad[64];
+    // Written by the consumer.
+    std::atomic<uint32_t> head;
+    uint32_t cached_tail;
+    char consumer_pad[64];
+    T slots[Capacity];
+};
@@ -0,0 +1,32 @@
+#include <iostream>
+
+#include "startup.hpp"
+
+static double elapsed_ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+void start_startup_timer(StartupTimer* out_timer)
+{
+    out_timer->start = std::chrono::steady_clock::now();
+    out_timer->last = out_timer->start;
+    out_timer->phases.clear();
+}
+
+void mark_startup_phase(StartupTimer& timer, char const* name)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    StartupPhase phase = { name, elapsed_ms(timer.last, now) };
+    timer.phases.push_back(phase);
+    timer.last = now;
+}
+
+void report_startup(StartupTimer const& timer, bool warm)
+{
+    std::cout << "startup (" << (warm ? "warm" : "cold") << "): " << elapsed_ms(timer.start, timer.last) << " ms\n";
+    for (size_t pidx = 0; pidx < timer.phases.size(); ++pidx)
+    {
+        std::cout << "  " << timer.phases[pidx].name << ": " << timer.phases[pidx].ms << " ms\n";
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+// Wall clock breakdown of the time from main() to the first frame.
+struct StartupPhase
+{
+    char const* name;
+    double ms;
+};
+
+struct StartupTimer
+{
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+    std::vector<StartupPhase> phases;
+};
+
+void start_startup_timer(StartupTimer* out_timer);
+// Closes the phase that started at the previous mark.
+void mark_startup_phase(StartupTimer& timer, char const* name);
+// warm: the pipeline cache was seeded from disk.
+void report_startup(StartupTimer const& timer, bool warm);
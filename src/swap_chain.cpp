@@ -0,0 +1,459 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "deletion_queue.hpp"
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "swap_chain.hpp"
+#include "tools.hpp"
+
+void init_swap_chain(SwapChainMode mode, SwapChain* out_swap_chain)
+{
+    out_swap_chain->window = nullptr;
+    out_swap_chain->mode = mode;
+    out_swap_chain->gpu = VK_NULL_HANDLE;
+    out_swap_chain->surface = VK_NULL_HANDLE;
+    out_swap_chain->surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
+    out_swap_chain->surface_format.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+    out_swap_chain->swap_chain.reset();
+    out_swap_chain->present_queue = VK_NULL_HANDLE;
+    out_swap_chain->queue_family_idx = UINT32_MAX;
+    out_swap_chain->extent.width = 0;
+    out_swap_chain->extent.height = 0;
+    out_swap_chain->present_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    out_swap_chain->image_usage = 0;
+    out_swap_chain->present_policy = PRESENT_LOW_LATENCY;
+    out_swap_chain->requested_image_count = 0;
+    out_swap_chain->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    out_swap_chain->requested_extent.width = 0;
+    out_swap_chain->requested_extent.height = 0;
+    out_swap_chain->out_of_date = false;
+    out_swap_chain->recreate_count = 0;
+    out_swap_chain->allocator = nullptr;
+    out_swap_chain->offscreen_next = 0;
+}
+
+char const* swap_chain_mode_name(SwapChainMode mode)
+{
+    switch (mode)
+    {
+    case SWAP_CHAIN_WINDOW: return "window";
+    case SWAP_CHAIN_HEADLESS_SURFACE: return "headless surface";
+    case SWAP_CHAIN_OFFSCREEN: return "offscreen";
+    default: return "unknown";
+    }
+}
+
+char const* present_policy_name(PresentPolicy policy)
+{
+    switch (policy)
+    {
+    case PRESENT_LOW_LATENCY: return "low latency";
+    case PRESENT_TEAR_FREE: return "tear free";
+    case PRESENT_POWER_SAVING: return "power saving";
+    default: return "unknown";
+    }
+}
+
+char const* present_mode_name(VkPresentModeKHR mode)
+{
+    switch (mode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo relaxed";
+    default: return "unknown";
+    }
+}
+
+void set_present_policy(SwapChain& swap_chain, PresentPolicy policy, uint32_t image_count)
+{
+    swap_chain.present_policy = policy;
+    swap_chain.requested_image_count = image_count;
+    swap_chain.out_of_date = !swap_chain.images.empty();
+}
+
+void resize_swap_chain(SwapChain& swap_chain, uint32_t width, uint32_t height)
+{
+    swap_chain.requested_extent.width = width;
+    swap_chain.requested_extent.height = height;
+    if ((swap_chain.extent.width != width) || (swap_chain.extent.height != height))
+    {
+        swap_chain.out_of_date = !swap_chain.images.empty();
+    }
+}
+
+static VkPresentModeKHR choose_present_mode(PresentPolicy policy, std::vector<VkPresentModeKHR> const& modes)
+{
+    VkPresentModeKHR preferred[3];
+    uint32_t preferred_count = 0;
+    switch (policy)
+    {
+    case PRESENT_LOW_LATENCY:
+        // Mailbox doesn't tear, immediate and relaxed FIFO only tear when a frame is late.
+        preferred[preferred_count++] = VK_PRESENT_MODE_MAILBOX_KHR;
+        preferred[preferred_count++] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        preferred[preferred_count++] = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        break;
+    case PRESENT_TEAR_FREE:
+        preferred[preferred_count++] = VK_PRESENT_MODE_MAILBOX_KHR;
+        break;
+    case PRESENT_POWER_SAVING:
+        break;
+    }
+    for (uint32_t pidx = 0; pidx < preferred_count; ++pidx)
+    {
+        if (std::find(modes.begin(), modes.end(), preferred[pidx]) != modes.end())
+        {
+            return preferred[pidx];
+        }
+    }
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// max_count 0 means no upper limit.
+static uint32_t choose_image_count(SwapChain const& swap_chain, uint32_t min_count, uint32_t max_count)
+{
+    uint32_t count = swap_chain.requested_image_count;
+    if (count == 0)
+    {
+        // One spare image lets acquire return without waiting for the presentation engine.
+        count = (swap_chain.present_policy == PRESENT_POWER_SAVING) ? min_count : min_count + 1;
+    }
+    count = std::max(count, min_count);
+    if ((max_count > 0) && (count > max_count))
+    {
+        count = max_count;
+    }
+    return count;
+}
+
+static void destroy_image_views(VkDevice device, std::vector<VkImageView> const& views)
+{
+    for (size_t i = 0; i < views.size(); ++i)
+    {
+        vkDestroyImageView(device, views[i], host_allocator());
+    }
+}
+
+// The views, offscreen images and swap chain go to deletion_queue in that order, swap chain images
+// are owned by the swap chain.
+static void retire_swap_chain(VkDevice device, SwapChain& swap_chain, DeletionQueue& deletion_queue, uint64_t last_use_frame)
+{
+    std::vector<VkImageView> views;
+    views.swap(swap_chain.views);
+    defer_destroy(deletion_queue, last_use_frame, [device, views]()
+    {
+        destroy_image_views(device, views);
+    });
+    for (size_t i = 0; i < swap_chain.offscreen_images.size(); ++i)
+    {
+        swap_chain.offscreen_images[i].defer(deletion_queue, last_use_frame);
+    }
+    swap_chain.offscreen_images.clear();
+    swap_chain.images.clear();
+    swap_chain.swap_chain.defer(deletion_queue, last_use_frame);
+}
+
+static VkResult create_image_views(VkDevice device, SwapChain& swap_chain)
+{
+    swap_chain.views.assign(swap_chain.images.size(), VK_NULL_HANDLE);
+    for (size_t i = 0; i < swap_chain.images.size(); ++i)
+    {
+        VkImageViewCreateInfo color_attachment_view = {};
+        color_attachment_view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        color_attachment_view.pNext = nullptr;
+        color_attachment_view.flags = 0;
+        color_attachment_view.image = swap_chain.images[i];
+        color_attachment_view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        color_attachment_view.format = swap_chain.surface_format.format;
+        color_attachment_view.components = {
+            VK_COMPONENT_SWIZZLE_R,
+            VK_COMPONENT_SWIZZLE_G,
+            VK_COMPONENT_SWIZZLE_B,
+            VK_COMPONENT_SWIZZLE_A
+        };
+        color_attachment_view.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        color_attachment_view.subresourceRange.baseMipLevel = 0;
+        color_attachment_view.subresourceRange.levelCount = 1;
+        color_attachment_view.subresourceRange.baseArrayLayer = 0;
+        color_attachment_view.subresourceRange.layerCount = 1;
+        VK_THROW(vkCreateImageView(device, &color_attachment_view, host_allocator(), &swap_chain.views[i]));
+    }
+    return VK_SUCCESS;
+}
+
+// deletion_queue, when set, gets the current images before the new ones are made.
+static VkResult create_offscreen_images(VkDevice device, SwapChain& swap_chain, uint32_t width, uint32_t height, DeletionQueue* deletion_queue,
+    uint64_t last_use_frame)
+{
+    assert(swap_chain.allocator != nullptr);
+    if ((width == 0) || (height == 0))
+    {
+        return VK_NOT_READY;
+    }
+    if (deletion_queue != nullptr)
+    {
+        retire_swap_chain(device, swap_chain, *deletion_queue, last_use_frame);
+    }
+    uint32_t image_count = choose_image_count(swap_chain, 2, 0);
+    swap_chain.extent.width = width;
+    swap_chain.extent.height = height;
+    // Nothing presents these images, leave them ready to be read back.
+    swap_chain.present_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    swap_chain.image_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    swap_chain.images.assign(image_count, VK_NULL_HANDLE);
+    swap_chain.offscreen_images.resize(image_count);
+    swap_chain.offscreen_next = 0;
+
+    for (uint32_t i = 0; i < image_count; ++i)
+    {
+        VkImageCreateInfo image_info = {};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.pNext = nullptr;
+        image_info.flags = 0;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = swap_chain.surface_format.format;
+        image_info.extent = { width, height, 1 };
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = swap_chain.image_usage;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.queueFamilyIndexCount = 0;
+        image_info.pQueueFamilyIndices = nullptr;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        ImageMemory memory = { swap_chain.allocator, nullptr };
+        VK_THROW(create_image(*swap_chain.allocator, image_info, MEMORY_GPU_ONLY, &swap_chain.images[i], &memory.allocation));
+        swap_chain.offscreen_images[i] = UniqueImage(memory, swap_chain.images[i]);
+    }
+    return create_image_views(device, swap_chain);
+}
+
+// The current swap chain is passed as oldSwapchain, and goes to deletion_queue (when set) once
+// vkCreateSwapchainKHR() returned, whether it succeeded or not.
+static VkResult create_surface_swap_chain(VkDevice device, SwapChain& swap_chain, uint32_t* width, uint32_t* height, DeletionQueue* deletion_queue,
+    uint64_t last_use_frame)
+{
+    VkSurfaceCapabilitiesKHR surface_cap;
+    VK_THROW(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(swap_chain.gpu, swap_chain.surface, &surface_cap));
+
+    VkExtent2D swapchainExtent = {};
+    // width and height are either both -1, or both not -1.
+    if (surface_cap.currentExtent.width == UINT32_MAX)
+    {
+        // If the surface size is undefined, the size is set to
+        // the size of the images requested.
+        swapchainExtent.width = *width;
+        swapchainExtent.height = *height;
+    }
+    else
+    {
+        // If the surface size is defined, the swap chain size must match
+        swapchainExtent = surface_cap.currentExtent;
+        *width = surface_cap.currentExtent.width;
+        *height = surface_cap.currentExtent.height;
+    }
+    if ((swapchainExtent.width == 0) || (swapchainExtent.height == 0))
+    {
+        // Minimized window, no swap chain can be created until it is restored.
+        return VK_NOT_READY;
+    }
+
+    uint32_t present_mode_count = 0;
+    VK_THROW(vkGetPhysicalDeviceSurfacePresentModesKHR(swap_chain.gpu, swap_chain.surface, &present_mode_count, nullptr));
+    std::vector<VkPresentModeKHR> present_modes(present_mode_count);
+    VK_THROW(vkGetPhysicalDeviceSurfacePresentModesKHR(swap_chain.gpu, swap_chain.surface, &present_mode_count, present_modes.data()));
+    VkPresentModeKHR swapchainPresentMode = choose_present_mode(swap_chain.present_policy, present_modes);
+
+    // Determine the number of images
+    uint32_t desired_number_of_swapchain_images = choose_image_count(swap_chain, surface_cap.minImageCount, surface_cap.maxImageCount);
+
+    VkSurfaceTransformFlagBitsKHR pre_transform;
+    if (check_flag(surface_cap.supportedTransforms, VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR))
+    {
+        pre_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    }
+    else
+    {
+        pre_transform = surface_cap.currentTransform;
+    }
+
+    VkImageUsageFlags image_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    image_usage |= surface_cap.supportedUsageFlags & (VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    swap_chain.image_usage = image_usage;
+
+    VkSwapchainCreateInfoKHR swapchain_creation_info = {};
+    swapchain_creation_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapchain_creation_info.pNext = nullptr;
+    swapchain_creation_info.flags = 0;
+    swapchain_creation_info.surface = swap_chain.surface;
+    swapchain_creation_info.minImageCount = desired_number_of_swapchain_images;
+    swapchain_creation_info.imageFormat = swap_chain.surface_format.format;
+    swapchain_creation_info.imageColorSpace = swap_chain.surface_format.colorSpace;
+    swapchain_creation_info.imageExtent = swapchainExtent;
+    swapchain_creation_info.imageUsage = image_usage;
+    swapchain_creation_info.preTransform = pre_transform;
+    swapchain_creation_info.imageArrayLayers = 1;
+    swapchain_creation_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    swapchain_creation_info.queueFamilyIndexCount = 0;
+    swapchain_creation_info.pQueueFamilyIndices = nullptr;
+    swapchain_creation_info.presentMode = swapchainPresentMode;
+    swapchain_creation_info.oldSwapchain = swap_chain.swap_chain.get();   // lets the driver hand resources over
+    swapchain_creation_info.clipped = VK_TRUE;
+    swapchain_creation_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!check_flag(surface_cap.supportedCompositeAlpha, VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR))
+    {
+        // Headless surfaces commonly only advertise inherit.
+        swapchain_creation_info.compositeAlpha = VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+    }
+
+    VkSwapchainKHR new_swap_chain = VK_NULL_HANDLE;
+    VkResult result = vkCreateSwapchainKHR(device, &swapchain_creation_info, host_allocator(), &new_swap_chain);
+    if (deletion_queue != nullptr)
+    {
+        // oldSwapchain is retired even when the creation fails, it can't present anymore.
+        retire_swap_chain(device, swap_chain, *deletion_queue, last_use_frame);
+    }
+    swap_chain.swap_chain = UniqueSwapChain(device, new_swap_chain);
+    VK_THROW(result);
+    swap_chain.present_mode = swapchainPresentMode;
+
+    uint32_t image_count = 0;
+    VK_THROW(vkGetSwapchainImagesKHR(device, swap_chain.swap_chain.get(), &image_count, nullptr));
+    swap_chain.images.resize(image_count);
+    VK_THROW(vkGetSwapchainImagesKHR(device, swap_chain.swap_chain.get(), &image_count, swap_chain.images.data()));
+
+    swap_chain.extent = swapchainExtent;
+    swap_chain.present_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    return create_image_views(device, swap_chain);
+}
+
+VkResult create_swap_chain(VkDevice device, SwapChain& swap_chain, uint32_t* width, uint32_t* height)
+{
+    swap_chain.requested_extent.width = *width;
+    swap_chain.requested_extent.height = *height;
+    swap_chain.out_of_date = false;
+    if (swap_chain.mode == SWAP_CHAIN_OFFSCREEN)
+    {
+        return create_offscreen_images(device, swap_chain, *width, *height, nullptr, 0);
+    }
+    return create_surface_swap_chain(device, swap_chain, width, height, nullptr, 0);
+}
+
+VkResult recreate_swap_chain(VkDevice device, SwapChain& swap_chain, DeletionQueue& deletion_queue, uint64_t last_use_frame)
+{
+    uint32_t width = swap_chain.requested_extent.width;
+    uint32_t height = swap_chain.requested_extent.height;
+    if (swap_chain.mode == SWAP_CHAIN_OFFSCREEN)
+    {
+        VK_THROW(create_offscreen_images(device, swap_chain, width, height, &deletion_queue, last_use_frame));
+    }
+    else
+    {
+        VK_THROW(create_surface_swap_chain(device, swap_chain, &width, &height, &deletion_queue, last_use_frame));
+    }
+    swap_chain.out_of_date = false;
+    swap_chain.recreate_count += 1;
+    return VK_SUCCESS;
+}
+
+void destroy_swap_chain(VkDevice device, SwapChain& swap_chain)
+{
+    destroy_image_views(device, swap_chain.views);
+    swap_chain.views.clear();
+    swap_chain.offscreen_images.clear();
+    swap_chain.images.clear();
+    swap_chain.swap_chain.reset();
+}
+
+VkResult acquire_next_image(VkDevice device, SwapChain& swap_chain, VkSemaphore image_acquired, uint32_t* out_image_idx)
+{
+    if (swap_chain.mode != SWAP_CHAIN_OFFSCREEN)
+    {
+        VkResult err = vkAcquireNextImageKHR(device, swap_chain.swap_chain.get(), UINT64_MAX, image_acquired, VK_NULL_HANDLE, out_image_idx);
+        if (err == VK_SUBOPTIMAL_KHR)
+        {
+            // The image is acquired and the semaphore will signal, render this frame and recreate after.
+            swap_chain.out_of_date = true;
+            return VK_SUCCESS;
+        }
+        if (err == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            swap_chain.out_of_date = true;
+        }
+        return err;
+    }
+
+    assert(!swap_chain.images.empty());
+    *out_image_idx = swap_chain.offscreen_next;
+    swap_chain.offscreen_next = (swap_chain.offscreen_next + 1) % static_cast<uint32_t>(swap_chain.images.size());
+    if (image_acquired == VK_NULL_HANDLE)
+    {
+        return VK_SUCCESS;
+    }
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = nullptr;
+    submit_info.pWaitDstStageMask = nullptr;
+    submit_info.commandBufferCount = 0;
+    submit_info.pCommandBuffers = nullptr;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &image_acquired;
+    return vkQueueSubmit(swap_chain.present_queue, 1, &submit_info, VK_NULL_HANDLE);
+}
+
+VkResult queue_present(SwapChain& swap_chain, VkSemaphore render_done, uint32_t image_idx)
+{
+    uint32_t wait_count = (render_done != VK_NULL_HANDLE) ? 1 : 0;
+    if (swap_chain.mode != SWAP_CHAIN_OFFSCREEN)
+    {
+        VkSwapchainKHR presented = swap_chain.swap_chain.get();
+        VkPresentInfoKHR present_info = {};
+        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        present_info.pNext = nullptr;
+        present_info.waitSemaphoreCount = wait_count;
+        present_info.pWaitSemaphores = &render_done;
+        present_info.swapchainCount = 1;
+        present_info.pSwapchains = &presented;
+        present_info.pImageIndices = &image_idx;
+        present_info.pResults = nullptr;
+        VkResult err = vkQueuePresentKHR(swap_chain.present_queue, &present_info);
+        if ((err == VK_SUBOPTIMAL_KHR) || (err == VK_ERROR_OUT_OF_DATE_KHR))
+        {
+            // The frame is done either way, the next begin_frame() recreates the swap chain.
+            swap_chain.out_of_date = true;
+            return VK_SUCCESS;
+        }
+        return err;
+    }
+
+    if (wait_count == 0)
+    {
+        return VK_SUCCESS;
+    }
+    // Consume the semaphore so it can be signaled again next time this frame slot is used.
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitSemaphores = &render_done;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.commandBufferCount = 0;
+    submit_info.pCommandBuffers = nullptr;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = nullptr;
+    return vkQueueSubmit(swap_chain.present_queue, 1, &submit_info, VK_NULL_HANDLE);
+}
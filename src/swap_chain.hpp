@@ -0,0 +1,85 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "handles.hpp"
+
+struct PlatformWindow;
+
+enum SwapChainMode
+{
+    SWAP_CHAIN_WINDOW,              // surface created from the OS window
+    SWAP_CHAIN_HEADLESS_SURFACE,    // VK_EXT_headless_surface, real VkSwapchainKHR but nothing is shown
+    SWAP_CHAIN_OFFSCREEN            // ring of plain color images, no presentation engine at all
+};
+
+// How present modes and image counts are picked, FIFO is the fallback of every policy since it is
+// the only mode every driver supports.
+enum PresentPolicy
+{
+    PRESENT_LOW_LATENCY,            // mailbox, else immediate or FIFO relaxed, may tear
+    PRESENT_TEAR_FREE,              // mailbox, else FIFO
+    PRESENT_POWER_SAVING            // FIFO with as few images as the surface allows, the CPU sleeps on vsync
+};
+
+struct SwapChain
+{
+    PlatformWindow* window;         // SWAP_CHAIN_WINDOW only, owned by the caller
+    SwapChainMode mode;
+    VkPhysicalDevice gpu;
+    VkSurfaceKHR surface;
+    VkSurfaceFormatKHR surface_format;
+    UniqueSwapChain swap_chain;
+    VkQueue present_queue;
+    uint32_t queue_family_idx;
+
+    VkExtent2D extent;
+    VkImageLayout present_layout;   // layout an image must be in when handed back by queue_present()
+    VkImageUsageFlags image_usage;  // TRANSFER_SRC is needed to read the images back
+    std::vector<VkImage> images;    // owned by swap_chain, or by offscreen_images
+    std::vector<VkImageView> views;
+
+    PresentPolicy present_policy;
+    uint32_t requested_image_count; // 0 lets the policy choose
+    VkPresentModeKHR present_mode;  // picked by the last (re)creation
+    VkExtent2D requested_extent;    // used when the surface leaves the size to us, and offscreen
+    bool out_of_date;               // recreate before the next acquire
+    uint32_t recreate_count;
+
+    // SWAP_CHAIN_OFFSCREEN only, the images are suballocated from allocator
+    DeviceAllocator* allocator;
+    std::vector<UniqueImage> offscreen_images;
+    uint32_t offscreen_next;
+};
+
+// Fills the mode independent defaults, call before init_Vulkan(). Window mode needs window set
+// before init_Vulkan(), offscreen mode allocator before create_swap_chain().
+void init_swap_chain(SwapChainMode mode, SwapChain* out_swap_chain);
+
+// Takes effect at the next (re)creation, flags an existing swap chain out of date.
+void set_present_policy(SwapChain& swap_chain, PresentPolicy policy, uint32_t image_count);
+// New size for offscreen images and surfaces that don't impose their own, e.g. after a resize.
+void resize_swap_chain(SwapChain& swap_chain, uint32_t width, uint32_t height);
+
+// Creates the images for the swap chain. For surface based modes width/height are updated
+// with the extent the surface imposes.
+VkResult create_swap_chain(VkDevice device, SwapChain& swap_chain, uint32_t* width, uint32_t* height);
+// Builds a new swap chain from the current one (passed as oldSwapchain) without waiting for the
+// device. The old images, views and handle go to deletion_queue, last used by last_use_frame.
+// VK_NOT_READY while the surface has a zero extent (minimized), the current swap chain is kept then.
+VkResult recreate_swap_chain(VkDevice device, SwapChain& swap_chain, DeletionQueue& deletion_queue, uint64_t last_use_frame);
+void destroy_swap_chain(VkDevice device, SwapChain& swap_chain);
+
+// In offscreen mode there is no presentation engine to signal / consume the semaphores,
+// an empty submit on the present queue does it so callers do not need to care about the mode.
+// VK_SUBOPTIMAL_KHR is reported as success with out_of_date set; acquire still returns
+// VK_ERROR_OUT_OF_DATE_KHR since no image was acquired, present only flags it.
+VkResult acquire_next_image(VkDevice device, SwapChain& swap_chain, VkSemaphore image_acquired, uint32_t* out_image_idx);
+VkResult queue_present(SwapChain& swap_chain, VkSemaphore render_done, uint32_t image_idx);
+
+char const* swap_chain_mode_name(SwapChainMode mode);
+char const* present_policy_name(PresentPolicy policy);
+char const* present_mode_name(VkPresentModeKHR mode);
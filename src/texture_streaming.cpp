@@ -0,0 +1,550 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "deletion_queue.hpp"
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "texture_streaming.hpp"
+#include "tools.hpp"
+#include "upload.hpp"
+
+static uint32_t const KTX2_HEADER_SIZE = 80;        // identifier, header and index
+static uint32_t const KTX2_LEVEL_ENTRY_SIZE = 24;   // byteOffset, byteLength, uncompressedByteLength
+
+static uint32_t read_u32(unsigned char const* bytes)
+{
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+static uint64_t read_u64(unsigned char const* bytes)
+{
+    return static_cast<uint64_t>(read_u32(bytes)) | (static_cast<uint64_t>(read_u32(bytes + 4)) << 32);
+}
+
+// Only what streaming needs: the level index. The data format descriptor and key/values are
+// skipped, vkFormat says everything the upload has to know.
+static bool parse_ktx2(MappedFile const& file, StreamedTexture* out_texture)
+{
+    static unsigned char const identifier[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+    unsigned char const* data = static_cast<unsigned char const*>(file.data);
+    if ((data == nullptr) || (file.size < KTX2_HEADER_SIZE) || (memcmp(data, identifier, sizeof(identifier)) != 0))
+    {
+        return false;
+    }
+    uint32_t format = read_u32(data + 12);
+    uint32_t width = read_u32(data + 20);
+    uint32_t height = read_u32(data + 24);
+    uint32_t depth = read_u32(data + 28);
+    uint32_t layer_count = read_u32(data + 32);
+    uint32_t face_count = read_u32(data + 36);
+    uint32_t level_count = std::max<uint32_t>(read_u32(data + 40), 1);
+    uint32_t supercompression = read_u32(data + 44);
+    // VK_FORMAT_UNDEFINED is a Basis Universal payload, it would need transcoding first.
+    if ((format == VK_FORMAT_UNDEFINED) || (width == 0) || (height == 0) || (depth != 0) || (layer_count > 1) || (face_count != 1) ||
+        (supercompression != 0))
+    {
+        return false;
+    }
+    uint32_t max_levels = 1;
+    while ((std::max(width, height) >> max_levels) > 0)
+    {
+        ++max_levels;
+    }
+    if ((level_count > max_levels) || (KTX2_HEADER_SIZE + static_cast<uint64_t>(level_count) * KTX2_LEVEL_ENTRY_SIZE > file.size))
+    {
+        return false;
+    }
+
+    out_texture->format = static_cast<VkFormat>(format);
+    out_texture->extent.width = width;
+    out_texture->extent.height = height;
+    out_texture->levels.resize(level_count);
+    for (uint32_t lidx = 0; lidx < level_count; ++lidx)
+    {
+        unsigned char const* entry = data + KTX2_HEADER_SIZE + lidx * KTX2_LEVEL_ENTRY_SIZE;
+        Ktx2Level& level = out_texture->levels[lidx];
+        level.offset = read_u64(entry);
+        level.size = read_u64(entry + 8);
+        if ((level.size == 0) || (level.offset > file.size) || (level.size > file.size - level.offset))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static VkExtent2D mip_extent(StreamedTexture const& texture, uint32_t mip)
+{
+    VkExtent2D extent = { std::max<uint32_t>(texture.extent.width >> mip, 1), std::max<uint32_t>(texture.extent.height >> mip, 1) };
+    return extent;
+}
+
+// Levels are stored coarsest first, the chain from first_mip down is one contiguous range.
+static void chain_range(StreamedTexture const& texture, uint32_t first_mip, VkDeviceSize* out_base, VkDeviceSize* out_size)
+{
+    VkDeviceSize base = texture.levels[first_mip].offset;
+    VkDeviceSize end = base;
+    for (uint32_t mip = first_mip; mip < texture.levels.size(); ++mip)
+    {
+        base = std::min(base, texture.levels[mip].offset);
+        end = std::max(end, texture.levels[mip].offset + texture.levels[mip].size);
+    }
+    *out_base = base;
+    *out_size = end - base;
+}
+
+static VkResult create_texture_view(VkDevice device, VkImage image, VkFormat format, uint32_t level_count, VkImageView* out_view)
+{
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.pNext = nullptr;
+    view_info.flags = 0;
+    view_info.image = image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = format;
+    view_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.baseMipLevel = 0;
+    view_info.subresourceRange.levelCount = level_count;
+    view_info.subresourceRange.baseArrayLayer = 0;
+    view_info.subresourceRange.layerCount = 1;
+    return vkCreateImageView(device, &view_info, host_allocator(), out_view);
+}
+
+// Image for file levels first_mip and below. Chains are copy sources for the evictions.
+static VkResult create_chain_image(TextureStreamer& streamer, StreamedTexture const& texture, uint32_t first_mip, VkImage* out_image,
+                                   GpuAllocation** out_memory)
+{
+    uint32_t level_count = static_cast<uint32_t>(texture.levels.size()) - first_mip;
+    VkExtent2D extent = mip_extent(texture, first_mip);
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.pNext = nullptr;
+    image_info.flags = 0;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = texture.format;
+    image_info.extent = { extent.width, extent.height, 1 };
+    image_info.mipLevels = level_count;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.queueFamilyIndexCount = 0;
+    image_info.pQueueFamilyIndices = nullptr;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    return create_image(*streamer.allocator, image_info, MEMORY_GPU_ONLY, out_image, out_memory);
+}
+
+// New image with file levels first_mip and below, uploaded straight from the mapping.
+static VkResult start_chain(TextureStreamer& streamer, StreamedTexture& texture, uint32_t first_mip)
+{
+    uint32_t level_count = static_cast<uint32_t>(texture.levels.size()) - first_mip;
+    VkImage image = VK_NULL_HANDLE;
+    GpuAllocation* memory = nullptr;
+    VK_THROW(create_chain_image(streamer, texture, first_mip, &image, &memory));
+
+    VkDeviceSize base = 0;
+    VkDeviceSize size = 0;
+    chain_range(texture, first_mip, &base, &size);
+    std::vector<VkBufferImageCopy> regions(level_count);
+    for (uint32_t lidx = 0; lidx < level_count; ++lidx)
+    {
+        VkExtent2D level_extent = mip_extent(texture, first_mip + lidx);
+        VkBufferImageCopy& region = regions[lidx];
+        region.bufferOffset = texture.levels[first_mip + lidx].offset - base;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, lidx, 0, 1 };
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { level_extent.width, level_extent.height, 1 };
+    }
+    VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, level_count, 0, 1 };
+    uint64_t ticket = 0;
+    VkImageView view = VK_NULL_HANDLE;
+    VkResult err = upload_image(*streamer.upload, image, range, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                static_cast<char const*>(texture.file.data) + base, size, regions.data(), level_count, &ticket);
+    if (err == VK_SUCCESS)
+    {
+        err = create_texture_view(streamer.device, image, texture.format, level_count, &view);
+    }
+    if (err != VK_SUCCESS)
+    {
+        destroy_image(*streamer.allocator, image, memory);
+        return err;
+    }
+    texture.pending_image = image;
+    texture.pending_memory = memory;
+    texture.pending_view = view;
+    texture.pending_mip = first_mip;
+    texture.pending_ticket = ticket;
+    streamer.stats.uploaded_bytes += size;
+    streamer.stats.uploads += 1;
+    streamer.stats.resident_bytes += memory->size;
+    return VK_SUCCESS;
+}
+
+void create_texture_streamer(VkDevice device, VkPhysicalDevice gpu, DeviceAllocator& allocator, UploadQueue& upload, DeletionQueue& deletion_queue,
+                             bool memory_budget, VkDeviceSize budget_limit, TextureStreamer* out_streamer)
+{
+    out_streamer->device = device;
+    out_streamer->gpu = gpu;
+    out_streamer->allocator = &allocator;
+    out_streamer->upload = &upload;
+    out_streamer->deletion_queue = &deletion_queue;
+    out_streamer->memory_budget = memory_budget;
+    uint32_t memory_type = select_memory_type(allocator, UINT32_MAX, MEMORY_GPU_ONLY);
+    out_streamer->heap_idx = (memory_type != UINT32_MAX) ? allocator.memory_properties.memoryTypes[memory_type].heapIndex : 0;
+    out_streamer->budget_limit = budget_limit;
+    out_streamer->frame_upload_limit = 8 * 1024 * 1024;
+    out_streamer->tail_size = 64;
+    out_streamer->textures.clear();
+    out_streamer->retiring.clear();
+    out_streamer->stats = TextureStreamingStats();
+}
+
+static void release_chain(TextureStreamer& streamer, VkImage image, GpuAllocation* memory, VkImageView view)
+{
+    if (image == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    streamer.stats.resident_bytes -= memory->size;
+    vkDestroyImageView(streamer.device, view, host_allocator());
+    destroy_image(*streamer.allocator, image, memory);
+}
+
+// The frames up to frame_number may still sample the chain. Its memory stays in resident_bytes,
+// and so in the budget, until those frames have completed.
+static void retire_chain(TextureStreamer& streamer, VkImage image, GpuAllocation* memory, VkImageView view, uint64_t frame_number)
+{
+    VkDevice device = streamer.device;
+    DeviceAllocator* allocator = streamer.allocator;
+    defer_destroy(*streamer.deletion_queue, frame_number, [device, allocator, image, memory, view]()
+    {
+        vkDestroyImageView(device, view, host_allocator());
+        destroy_image(*allocator, image, memory);
+    });
+    RetiringChain retiring = { frame_number, memory->size };
+    streamer.retiring.push_back(retiring);
+}
+
+// Drops the finest resident mip: the levels kept are copied from the current image into a new
+// one on the GPU, recorded into command_buffer, and the new chain replaces it right away.
+static VkResult evict_chain(TextureStreamer& streamer, StreamedTexture& texture, VkCommandBuffer command_buffer, uint64_t frame_number)
+{
+    uint32_t first_mip = texture.resident_mip + 1;
+    uint32_t level_count = static_cast<uint32_t>(texture.levels.size()) - first_mip;
+    VkImage image = VK_NULL_HANDLE;
+    GpuAllocation* memory = nullptr;
+    VK_THROW(create_chain_image(streamer, texture, first_mip, &image, &memory));
+    VkImageView view = VK_NULL_HANDLE;
+    if (VkResult err = create_texture_view(streamer.device, image, texture.format, level_count, &view))
+    {
+        destroy_image(*streamer.allocator, image, memory);
+        return err;
+    }
+
+    std::vector<VkImageCopy> regions(level_count);
+    for (uint32_t lidx = 0; lidx < level_count; ++lidx)
+    {
+        VkExtent2D level_extent = mip_extent(texture, first_mip + lidx);
+        VkImageCopy& region = regions[lidx];
+        region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, lidx + 1, 0, 1 };
+        region.srcOffset = { 0, 0, 0 };
+        region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, lidx, 0, 1 };
+        region.dstOffset = { 0, 0, 0 };
+        region.extent = { level_extent.width, level_extent.height, 1 };
+    }
+    set_image_layout(command_buffer, texture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    set_image_layout(command_buffer, image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    vkCmdCopyImage(command_buffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, level_count,
+                   regions.data());
+    // The old image goes back too, descriptors written before this frame may still point at it.
+    set_image_layout(command_buffer, texture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    set_image_layout(command_buffer, image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    retire_chain(streamer, texture.image, texture.memory, texture.view, frame_number);
+    texture.image = image;
+    texture.memory = memory;
+    texture.view = view;
+    texture.resident_mip = first_mip;
+    texture.view_generation += 1;
+    streamer.stats.resident_bytes += memory->size;
+    return VK_SUCCESS;
+}
+
+void destroy_texture_streamer(TextureStreamer& streamer)
+{
+    for (size_t tidx = 0; tidx < streamer.textures.size(); ++tidx)
+    {
+        StreamedTexture& texture = streamer.textures[tidx];
+        release_chain(streamer, texture.pending_image, texture.pending_memory, texture.pending_view);
+        release_chain(streamer, texture.image, texture.memory, texture.view);
+        unmap_file(texture.file);
+    }
+    streamer.textures.clear();
+    streamer.retiring.clear();      // the deletion queue destroys them
+}
+
+VkResult load_streamed_texture(TextureStreamer& streamer, char const* path, uint32_t* out_texture)
+{
+    StreamedTexture texture;
+    texture.path = path;
+    if (!map_file(path, &texture.file))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    VkFormatProperties format_properties = {};
+    bool usable = parse_ktx2(texture.file, &texture);
+    if (usable)
+    {
+        vkGetPhysicalDeviceFormatProperties(streamer.gpu, texture.format, &format_properties);
+        usable = (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+    }
+    if (!usable)
+    {
+        unmap_file(texture.file);
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    uint32_t level_count = static_cast<uint32_t>(texture.levels.size());
+    texture.tail_mip = 0;
+    while ((texture.tail_mip + 1 < level_count) && (std::max(texture.extent.width, texture.extent.height) >> texture.tail_mip > streamer.tail_size))
+    {
+        ++texture.tail_mip;
+    }
+    texture.image = VK_NULL_HANDLE;
+    texture.memory = nullptr;
+    texture.view = VK_NULL_HANDLE;
+    texture.resident_mip = level_count;
+    texture.view_generation = 0;
+    texture.pending_image = VK_NULL_HANDLE;
+    texture.pending_memory = nullptr;
+    texture.pending_view = VK_NULL_HANDLE;
+    texture.pending_mip = level_count;
+    texture.pending_ticket = 0;
+    texture.wanted_mip = texture.tail_mip;
+    texture.last_demand_frame = 0;
+
+    // The tail goes regardless of the budget: every texture has to show something.
+    if (VkResult err = start_chain(streamer, texture, texture.tail_mip))
+    {
+        unmap_file(texture.file);
+        return err;
+    }
+    *out_texture = static_cast<uint32_t>(streamer.textures.size());
+    streamer.textures.push_back(texture);
+    return VK_SUCCESS;
+}
+
+void note_texture_demand(TextureStreamer& streamer, uint32_t texture_idx, float screen_size, uint64_t frame_number)
+{
+    StreamedTexture& texture = streamer.textures[texture_idx];
+    // One texel per pixel: every halving of the screen size needs one level less.
+    float texels = static_cast<float>(std::max(texture.extent.width, texture.extent.height));
+    uint32_t mip = 0;
+    if (screen_size < texels)
+    {
+        mip = static_cast<uint32_t>(std::floor(std::log2(texels / std::max(screen_size, 1.0f))));
+    }
+    mip = std::min(mip, static_cast<uint32_t>(texture.levels.size()) - 1);
+    if (texture.last_demand_frame != frame_number)
+    {
+        texture.wanted_mip = mip;
+        texture.last_demand_frame = frame_number;
+    }
+    else
+    {
+        texture.wanted_mip = std::min(texture.wanted_mip, mip);
+    }
+}
+
+// A texture nobody asked for since the last frame only wants its tail.
+static uint32_t wanted_mip(StreamedTexture const& texture, uint64_t frame_number)
+{
+    return (texture.last_demand_frame + 1 >= frame_number) ? texture.wanted_mip : texture.tail_mip;
+}
+
+static VkDeviceSize chain_bytes(StreamedTexture const& texture)
+{
+    if (texture.pending_image != VK_NULL_HANDLE)
+    {
+        return texture.pending_memory->size;
+    }
+    return (texture.image != VK_NULL_HANDLE) ? texture.memory->size : 0;
+}
+
+static VkDeviceSize texture_budget(TextureStreamer& streamer)
+{
+    HeapBudget heaps[VK_MAX_MEMORY_HEAPS];
+    get_memory_budget(*streamer.allocator, streamer.gpu, streamer.memory_budget, heaps);
+    HeapBudget const& heap = heaps[streamer.heap_idx];
+    // What the rest of the process and the driver use is not ours to take.
+    VkDeviceSize others = heap.usage - std::min(heap.usage, streamer.stats.resident_bytes);
+    VkDeviceSize budget = (heap.budget > others) ? heap.budget - others : 0;
+    if (streamer.budget_limit > 0)
+    {
+        budget = std::min(budget, streamer.budget_limit);
+    }
+    return budget;
+}
+
+VkResult update_texture_streaming(TextureStreamer& streamer, VkCommandBuffer command_buffer, uint64_t frame_number, uint64_t frames_completed)
+{
+    TextureStreamingStats& stats = streamer.stats;
+    // Same test as flush_deletion_queue(): these chains are destroyed or about to be.
+    size_t kept = 0;
+    for (size_t ridx = 0; ridx < streamer.retiring.size(); ++ridx)
+    {
+        if (streamer.retiring[ridx].last_use_frame < frames_completed)
+        {
+            stats.resident_bytes -= streamer.retiring[ridx].bytes;
+        }
+        else
+        {
+            streamer.retiring[kept++] = streamer.retiring[ridx];
+        }
+    }
+    streamer.retiring.resize(kept);
+
+    for (size_t tidx = 0; tidx < streamer.textures.size(); ++tidx)
+    {
+        StreamedTexture& texture = streamer.textures[tidx];
+        if ((texture.pending_image == VK_NULL_HANDLE) || !upload_complete(*streamer.upload, texture.pending_ticket))
+        {
+            continue;
+        }
+        if (texture.image != VK_NULL_HANDLE)
+        {
+            retire_chain(streamer, texture.image, texture.memory, texture.view, frame_number);
+        }
+        texture.image = texture.pending_image;
+        texture.memory = texture.pending_memory;
+        texture.view = texture.pending_view;
+        texture.resident_mip = texture.pending_mip;
+        texture.view_generation += 1;
+        texture.pending_image = VK_NULL_HANDLE;
+        texture.pending_memory = nullptr;
+        texture.pending_view = VK_NULL_HANDLE;
+    }
+
+    // Sizes once everything in flight has landed and the chains being replaced are gone. Evictions
+    // go by it: each one holds its old and new chain for a few frames, but it is the only way back
+    // under the budget.
+    stats.budget_bytes = texture_budget(streamer);
+    VkDeviceSize settled = 0;
+    for (size_t tidx = 0; tidx < streamer.textures.size(); ++tidx)
+    {
+        settled += chain_bytes(streamer.textures[tidx]);
+    }
+
+    // Evict from the textures holding more than they are asked for first, then the least recently
+    // wanted, then the smallest on screen.
+    while (settled > stats.budget_bytes)
+    {
+        StreamedTexture* victim = nullptr;
+        for (size_t tidx = 0; tidx < streamer.textures.size(); ++tidx)
+        {
+            StreamedTexture& texture = streamer.textures[tidx];
+            if ((texture.pending_image != VK_NULL_HANDLE) || (texture.resident_mip >= texture.tail_mip))
+            {
+                continue;
+            }
+            bool surplus = texture.resident_mip < wanted_mip(texture, frame_number);
+            bool victim_surplus = (victim != nullptr) && (victim->resident_mip < wanted_mip(*victim, frame_number));
+            uint64_t victim_demand = (victim != nullptr) ? victim->last_demand_frame : 0;
+            uint32_t victim_wanted = (victim != nullptr) ? wanted_mip(*victim, frame_number) : 0;
+            bool older = texture.last_demand_frame < victim_demand;
+            bool smaller = (texture.last_demand_frame == victim_demand) && (wanted_mip(texture, frame_number) > victim_wanted);
+            if ((victim == nullptr) || (surplus && !victim_surplus) || ((surplus == victim_surplus) && (older || smaller)))
+            {
+                victim = &texture;
+            }
+        }
+        if (victim == nullptr)
+        {
+            break;
+        }
+        VkDeviceSize before = chain_bytes(*victim);
+        VK_THROW(evict_chain(streamer, *victim, command_buffer, frame_number));
+        settled = settled - before + chain_bytes(*victim);
+        stats.evictions += 1;
+    }
+
+    // Raises, one level at a time so every texture sharpens coarsest first; the furthest behind go first.
+    std::vector<uint32_t> candidates;
+    for (size_t tidx = 0; tidx < streamer.textures.size(); ++tidx)
+    {
+        StreamedTexture const& texture = streamer.textures[tidx];
+        if ((texture.pending_image == VK_NULL_HANDLE) && (texture.image != VK_NULL_HANDLE) && (wanted_mip(texture, frame_number) < texture.resident_mip))
+        {
+            candidates.push_back(static_cast<uint32_t>(tidx));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [&streamer, frame_number](uint32_t a, uint32_t b)
+    {
+        StreamedTexture const& ta = streamer.textures[a];
+        StreamedTexture const& tb = streamer.textures[b];
+        return (ta.resident_mip - wanted_mip(ta, frame_number)) > (tb.resident_mip - wanted_mip(tb, frame_number));
+    });
+    VkDeviceSize started = 0;
+    for (size_t cidx = 0; (cidx < candidates.size()) && (started < streamer.frame_upload_limit); ++cidx)
+    {
+        StreamedTexture& texture = streamer.textures[candidates[cidx]];
+        uint32_t target = texture.resident_mip - 1;
+        VkDeviceSize base = 0;
+        VkDeviceSize size = 0;
+        chain_range(texture, target, &base, &size);
+        if (size > streamer.upload->staging_capacity)
+        {
+            stats.staging_limited += 1;
+            continue;
+        }
+        // The image size is only known once it exists: scale the file size of the chain by what
+        // the current chain takes on the device over its file size, tiling and alignment included.
+        VkDeviceSize current = chain_bytes(texture);
+        VkDeviceSize current_base = 0;
+        VkDeviceSize current_size = 0;
+        chain_range(texture, texture.resident_mip, &current_base, &current_size);
+        VkDeviceSize estimate = static_cast<VkDeviceSize>(static_cast<double>(size) * current / current_size);
+        // The current chain stays allocated until the frames sampling it complete: the new one
+        // has to fit next to everything resident now, replaced chains included.
+        if (stats.resident_bytes + estimate > stats.budget_bytes)
+        {
+            stats.budget_limited += 1;
+            continue;
+        }
+        VK_THROW(start_chain(streamer, texture, target));
+        started += size;
+        stats.raises += 1;
+    }
+    return VK_SUCCESS;
+}
+
+VkImageView texture_view(TextureStreamer const& streamer, uint32_t texture)
+{
+    return streamer.textures[texture].view;
+}
+
+void print_texture_streaming_stats(TextureStreamer const& streamer)
+{
+    TextureStreamingStats const& stats = streamer.stats;
+    double const mib = 1.0 / (1024.0 * 1024.0);
+    std::cout << "texture streaming: " << streamer.textures.size() << " textures, " << stats.resident_bytes * mib << " MiB resident"
+              << " (budget " << stats.budget_bytes * mib << " MiB, " << (streamer.memory_budget ? "VK_EXT_memory_budget" : "heap size") << ")"
+              << " | " << stats.uploads << " uploads, " << stats.uploaded_bytes * mib << " MiB"
+              << " | raises " << stats.raises << " | evictions " << stats.evictions
+              << " | held back: budget " << stats.budget_limited << ", staging " << stats.staging_limited << "\n";
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+#include "file_map.hpp"
+
+struct DeletionQueue;
+struct DeviceAllocator;
+struct GpuAllocation;
+struct UploadQueue;
+
+// Mip chains streamed from memory mapped KTX2 files. A texture loads with its small mip tail only,
+// so large sets show up at low resolution right away, then the resident mip is raised one level
+// at a time, coarsest first, toward what the screen space demand asks for.
+//
+// Vulkan images can't grow levels, so a change of resident mip is a new image holding the new
+// chain, uploaded straight from the mapping through the staging ring: the old one is released
+// through the deletion queue once the new one landed, and counts against the budget until the
+// frames sampling it completed. Over the budget the least wanted textures drop their finest mip,
+// the levels they keep are copied image to image on the GPU.
+
+struct Ktx2Level
+{
+    VkDeviceSize offset;            // in the file
+    VkDeviceSize size;
+};
+
+struct StreamedTexture
+{
+    std::string path;
+    MappedFile file;
+    VkFormat format;
+    VkExtent2D extent;              // of level 0
+    std::vector<Ktx2Level> levels;  // level 0 is the full resolution
+    uint32_t tail_mip;              // finest level loaded with the texture, never evicted
+
+    // image holds file levels resident_mip and below, its level 0 is file level resident_mip.
+    VkImage image;
+    GpuAllocation* memory;
+    VkImageView view;               // null until the tail has landed
+    uint32_t resident_mip;          // levels.size() while nothing is resident
+    uint32_t view_generation;       // bumped on every view change, descriptors using the view must be rewritten
+
+    VkImage pending_image;          // VK_NULL_HANDLE when no change is in flight
+    GpuAllocation* pending_memory;
+    VkImageView pending_view;
+    uint32_t pending_mip;
+    uint64_t pending_ticket;
+
+    uint32_t wanted_mip;            // finest level any demand asked for during last_demand_frame
+    uint64_t last_demand_frame;
+};
+
+struct TextureStreamingStats
+{
+    uint64_t uploaded_bytes;
+    uint32_t uploads;
+    uint32_t raises;                // resident mip moved to a finer level
+    uint32_t evictions;             // finest mip dropped to stay in budget
+    uint32_t budget_limited;        // raises held back by the budget
+    uint32_t staging_limited;       // raises held back by a chain bigger than the staging ring
+    VkDeviceSize resident_bytes;    // images in use, being uploaded or replaced in frames still in flight
+    VkDeviceSize budget_bytes;      // from the last update
+};
+
+// A replaced chain waiting in the deletion queue.
+struct RetiringChain
+{
+    uint64_t last_use_frame;
+    VkDeviceSize bytes;
+};
+
+struct TextureStreamer
+{
+    VkDevice device;
+    VkPhysicalDevice gpu;
+    DeviceAllocator* allocator;
+    UploadQueue* upload;
+    DeletionQueue* deletion_queue;
+    bool memory_budget;             // VK_EXT_memory_budget is enabled
+    uint32_t heap_idx;              // heap the textures live in
+    VkDeviceSize budget_limit;      // 0 leaves it to the heap budget
+    VkDeviceSize frame_upload_limit;    // bytes of raises started per update, at least one raise
+    uint32_t tail_size;             // levels up to this many texels wide load with the texture
+
+    std::vector<StreamedTexture> textures;
+    std::vector<RetiringChain> retiring;
+    TextureStreamingStats stats;
+};
+
+// budget_limit caps the textures below the heap budget, 0 for no cap.
+void create_texture_streamer(VkDevice device, VkPhysicalDevice gpu, DeviceAllocator& allocator, UploadQueue& upload, DeletionQueue& deletion_queue,
+                             bool memory_budget, VkDeviceSize budget_limit, TextureStreamer* out_streamer);
+// The device must be idle.
+void destroy_texture_streamer(TextureStreamer& streamer);
+
+// 2D KTX2 files, one layer and face, no supercompression, in a format the device can sample.
+// Maps the file and starts the upload of the mip tail, VK_ERROR_FORMAT_NOT_SUPPORTED when the
+// file is none of that.
+VkResult load_streamed_texture(TextureStreamer& streamer, char const* path, uint32_t* out_texture);
+
+// screen_size: the texture's largest dimension as projected on screen, in pixels. Every call
+// during a frame can only ask for more detail.
+void note_texture_demand(TextureStreamer& streamer, uint32_t texture, float screen_size, uint64_t frame_number);
+// Once per frame, after poll_uploads(): swaps in the chains that landed, evicts to get under the
+// budget, then starts raises. Evictions are recorded into command_buffer, the frame's graphics
+// command buffer, ahead of anything sampling the textures. frame_number is the frame being
+// recorded, the last one that may still use a replaced view; frames_completed is what the
+// deletion queue is flushed with.
+VkResult update_texture_streaming(TextureStreamer& streamer, VkCommandBuffer command_buffer, uint64_t frame_number, uint64_t frames_completed);
+
+VkImageView texture_view(TextureStreamer const& streamer, uint32_t texture);
+
+void print_texture_streaming_stats(TextureStreamer const& streamer);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+bool check_flag(uint32_t flag, uint32_t bit);
+
+// Returns UINT32_MAX when no memory type matches.
+uint32_t find_memory_type(VkPhysicalDeviceMemoryProperties const& memory_properties, uint32_t type_bits, VkMemoryPropertyFlags required);
+
+// Records a single image barrier moving the whole color/depth image from old_layout to new_layout.
+void set_image_layout(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout);
+// Same transition for every image, in one barrier.
+void set_image_layouts(VkCommandBuffer command_buffer, VkImage const* images, uint32_t image_count, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout);
+
+VkAccessFlags access_mask_for_layout(VkImageLayout layout);
+VkPipelineStageFlags stage_mask_for_layout(VkImageLayout layout);
+
+// 2D view of the first level and layer of the image.
+VkResult create_image_view(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspect, VkImageView* out_view);
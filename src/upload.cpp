@@ -0,0 +1,347 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "device.hpp"
+#include "device_memory.hpp"
+#include "dispatch.hpp"
+#include "error.hpp"
+#include "host_allocator.hpp"
+#include "upload.hpp"
+
+static const uint32_t UPLOAD_BATCH_COUNT = 4;
+
+static VkDeviceSize align_up(VkDeviceSize v, VkDeviceSize alignment)
+{
+    return ((v + alignment - 1) / alignment) * alignment;
+}
+
+VkResult create_upload_queue(DeviceAllocator& allocator, VkDevice device, VkPhysicalDevice gpu, DrawCommandBuffer const& queues, VkDeviceSize staging_size, UploadQueue* out_upload)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+
+    out_upload->device = device;
+    out_upload->transfer_queue = queues.transfer_queue;
+    out_upload->transfer_family_idx = queues.transfer_family_idx;
+    out_upload->graphics_family_idx = queues.queue_family_idx;
+    out_upload->ownership_transfer = (queues.transfer_family_idx != queues.queue_family_idx);
+    // 16 covers the 4 byte rule and every texel / compressed block size.
+    out_upload->staging_alignment = std::max<VkDeviceSize>(properties.limits.optimalBufferCopyOffsetAlignment, 16);
+    out_upload->staging_capacity = align_up(staging_size, out_upload->staging_alignment);
+    out_upload->head = 0;
+    out_upload->tail = 0;
+    out_upload->batch_first = 0;
+    out_upload->batch_count = 0;
+    out_upload->recording = -1;
+    out_upload->next_ticket = 1;
+    out_upload->retired_ticket = 0;
+    out_upload->completed_ticket = 0;
+    out_upload->stats.bytes = 0;
+    out_upload->stats.uploads = 0;
+    out_upload->stats.batches = 0;
+    out_upload->stats.staging_stalls = 0;
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = out_upload->staging_capacity;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+    VK_THROW(create_buffer(allocator, buffer_info, MEMORY_CPU_ONLY, &out_upload->staging));
+    out_upload->staging_mapped = static_cast<char*>(out_upload->staging->mapped);
+
+    VK_THROW(create_command_pool(device, queues.transfer_family_idx, &out_upload->command_pool));
+    std::vector<VkCommandBuffer> command_buffers(UPLOAD_BATCH_COUNT);
+    VkCommandBufferAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.commandPool = out_upload->command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = UPLOAD_BATCH_COUNT;
+    VK_THROW(vkAllocateCommandBuffers(device, &allocate_info, command_buffers.data()));
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+    out_upload->batches.resize(UPLOAD_BATCH_COUNT);
+    for (uint32_t bidx = 0; bidx < UPLOAD_BATCH_COUNT; ++bidx)
+    {
+        UploadBatch& batch = out_upload->batches[bidx];
+        batch.command_buffer = command_buffers[bidx];
+        batch.ticket = 0;
+        batch.staging_end = 0;
+        VK_THROW(vkCreateFence(device, &fence_info, host_allocator(), &batch.fence));
+    }
+    return VK_SUCCESS;
+}
+
+// Frees the staging range and queues the acquire barriers of the oldest submitted batch.
+// VK_NOT_READY when wait is false and the batch has not finished.
+static VkResult retire_oldest(UploadQueue& upload, bool wait)
+{
+    assert(upload.batch_count > 0);
+    UploadBatch& batch = upload.batches[upload.batch_first];
+    VkResult signaled = vkWaitForFences(upload.device, 1, &batch.fence, VK_TRUE, wait ? UINT64_MAX : 0);
+    if (signaled == VK_TIMEOUT)
+    {
+        return VK_NOT_READY;
+    }
+    VK_THROW(signaled);
+    VK_THROW(vkResetFences(upload.device, 1, &batch.fence));
+
+    upload.tail = batch.staging_end;
+    upload.retired_ticket = batch.ticket;
+    upload.pending_buffer_acquires.insert(upload.pending_buffer_acquires.end(), batch.buffer_acquires.begin(), batch.buffer_acquires.end());
+    upload.pending_image_acquires.insert(upload.pending_image_acquires.end(), batch.image_acquires.begin(), batch.image_acquires.end());
+    batch.buffer_acquires.clear();
+    batch.image_acquires.clear();
+    upload.batch_first = (upload.batch_first + 1) % upload.batches.size();
+    upload.batch_count -= 1;
+    return VK_SUCCESS;
+}
+
+void destroy_upload_queue(DeviceAllocator& allocator, UploadQueue& upload)
+{
+    submit_uploads(upload);
+    while (upload.batch_count > 0)
+    {
+        if (retire_oldest(upload, true) != VK_SUCCESS)
+        {
+            break;
+        }
+    }
+    for (size_t bidx = 0; bidx < upload.batches.size(); ++bidx)
+    {
+        vkDestroyFence(upload.device, upload.batches[bidx].fence, host_allocator());
+    }
+    upload.batches.clear();
+    vkDestroyCommandPool(upload.device, upload.command_pool, host_allocator());
+    destroy_buffer(allocator, upload.staging);
+    upload.staging = nullptr;
+}
+
+// Reserves size bytes of staging, submitting and waiting for older batches when the ring is full.
+// Must run before begin_batch(): it may submit the batch being recorded.
+static VkResult allocate_staging(UploadQueue& upload, VkDeviceSize size, VkDeviceSize* out_offset)
+{
+    VkDeviceSize const capacity = upload.staging_capacity;
+    if (size > capacity)
+    {
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+    for (;;)
+    {
+        VkDeviceSize offset = align_up(upload.head, upload.staging_alignment);
+        if ((offset % capacity) + size > capacity)
+        {
+            offset = align_up(offset, capacity);
+        }
+        if (offset + size - upload.tail <= capacity)
+        {
+            upload.head = offset + size;
+            *out_offset = offset % capacity;
+            return VK_SUCCESS;
+        }
+        VK_THROW(submit_uploads(upload));
+        assert(upload.batch_count > 0);
+        upload.stats.staging_stalls += 1;
+        VK_THROW(retire_oldest(upload, true));
+    }
+}
+
+static VkResult begin_batch(UploadQueue& upload, UploadBatch** out_batch)
+{
+    if (upload.recording < 0)
+    {
+        if (upload.batch_count == upload.batches.size())
+        {
+            upload.stats.staging_stalls += 1;
+            VK_THROW(retire_oldest(upload, true));
+        }
+        uint32_t bidx = (upload.batch_first + upload.batch_count) % upload.batches.size();
+        UploadBatch& batch = upload.batches[bidx];
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.pNext = nullptr;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        begin_info.pInheritanceInfo = nullptr;
+        VK_THROW(vkBeginCommandBuffer(batch.command_buffer, &begin_info));
+        batch.ticket = upload.next_ticket++;
+        upload.recording = static_cast<int32_t>(bidx);
+    }
+    *out_batch = &upload.batches[upload.recording];
+    return VK_SUCCESS;
+}
+
+VkResult submit_uploads(UploadQueue& upload)
+{
+    if (upload.recording < 0)
+    {
+        return VK_SUCCESS;
+    }
+    UploadBatch& batch = upload.batches[upload.recording];
+    upload.recording = -1;
+    VK_THROW(vkEndCommandBuffer(batch.command_buffer));
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.command_buffer;
+    submit_info.signalSemaphoreCount = 0;
+    VK_THROW(vkQueueSubmit(upload.transfer_queue, 1, &submit_info, batch.fence));
+    batch.staging_end = upload.head;
+    upload.batch_count += 1;
+    upload.stats.batches += 1;
+    return VK_SUCCESS;
+}
+
+VkResult upload_buffer(UploadQueue& upload, VkBuffer dst, VkDeviceSize dst_offset, void const* data, VkDeviceSize size, uint64_t* out_ticket)
+{
+    char const* bytes = static_cast<char const*>(data);
+    for (VkDeviceSize done = 0; done < size;)
+    {
+        VkDeviceSize piece = std::min(size - done, upload.staging_capacity);
+        VkDeviceSize staging_offset;
+        VK_THROW(allocate_staging(upload, piece, &staging_offset));
+        memcpy(upload.staging_mapped + staging_offset, bytes + done, static_cast<size_t>(piece));
+
+        UploadBatch* batch = nullptr;
+        VK_THROW(begin_batch(upload, &batch));
+        VkBufferCopy region = { staging_offset, dst_offset + done, piece };
+        vkCmdCopyBuffer(batch->command_buffer, upload.staging->buffer, dst, 1, &region);
+
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.buffer = dst;
+        barrier.offset = dst_offset + done;
+        barrier.size = piece;
+        if (upload.ownership_transfer)
+        {
+            // Release here, the matching acquire is recorded on the graphics queue by poll_uploads().
+            barrier.dstAccessMask = 0;
+            barrier.srcQueueFamilyIndex = upload.transfer_family_idx;
+            barrier.dstQueueFamilyIndex = upload.graphics_family_idx;
+            vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            batch->buffer_acquires.push_back(barrier);
+        }
+        else
+        {
+            // Same family means the same VkQueue, later submissions are ordered after this barrier.
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+        }
+        *out_ticket = batch->ticket;
+        done += piece;
+    }
+    upload.stats.bytes += size;
+    upload.stats.uploads += 1;
+    return VK_SUCCESS;
+}
+
+VkResult upload_image(UploadQueue& upload, VkImage dst, VkImageSubresourceRange const& range, VkImageLayout final_layout,
+                      void const* data, VkDeviceSize size, VkBufferImageCopy const* regions, uint32_t region_count, uint64_t* out_ticket)
+{
+    VkDeviceSize staging_offset;
+    VK_THROW(allocate_staging(upload, size, &staging_offset));
+    memcpy(upload.staging_mapped + staging_offset, data, static_cast<size_t>(size));
+
+    UploadBatch* batch = nullptr;
+    VK_THROW(begin_batch(upload, &batch));
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = dst;
+    barrier.subresourceRange = range;
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    std::vector<VkBufferImageCopy> staged(regions, regions + region_count);
+    for (size_t ridx = 0; ridx < staged.size(); ++ridx)
+    {
+        staged[ridx].bufferOffset += staging_offset;
+    }
+    vkCmdCopyBufferToImage(batch->command_buffer, upload.staging->buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, region_count, staged.data());
+
+    // The layout transition is part of the ownership transfer: release and acquire both name it.
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = final_layout;
+    if (upload.ownership_transfer)
+    {
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = upload.transfer_family_idx;
+        barrier.dstQueueFamilyIndex = upload.graphics_family_idx;
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        batch->image_acquires.push_back(barrier);
+    }
+    else
+    {
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    *out_ticket = batch->ticket;
+    upload.stats.bytes += size;
+    upload.stats.uploads += 1;
+    return VK_SUCCESS;
+}
+
+VkResult poll_uploads(UploadQueue& upload, VkCommandBuffer graphics_cmd)
+{
+    while (upload.batch_count > 0)
+    {
+        VkResult retired = retire_oldest(upload, false);
+        if (retired == VK_NOT_READY)
+        {
+            break;
+        }
+        VK_THROW(retired);
+    }
+    if (!upload.pending_buffer_acquires.empty() || !upload.pending_image_acquires.empty())
+    {
+        vkCmdPipelineBarrier(graphics_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+                             static_cast<uint32_t>(upload.pending_buffer_acquires.size()), upload.pending_buffer_acquires.data(),
+                             static_cast<uint32_t>(upload.pending_image_acquires.size()), upload.pending_image_acquires.data());
+        upload.pending_buffer_acquires.clear();
+        upload.pending_image_acquires.clear();
+    }
+    upload.completed_ticket = upload.retired_ticket;
+    return VK_SUCCESS;
+}
+
+bool upload_complete(UploadQueue const& upload, uint64_t ticket)
+{
+    return ticket <= upload.completed_ticket;
+}
+
+void print_upload_stats(UploadQueue const& upload)
+{
+    UploadStats const& stats = upload.stats;
+    std::cout << "uploads: " << stats.uploads << " (" << stats.bytes / (1024 * 1024) << " MiB) in " << stats.batches << " batches"
+              << " | staging stalls " << stats.staging_stalls
+              << " | " << (upload.ownership_transfer ? "dedicated transfer family" : "graphics family") << "\n";
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+struct DeviceAllocator;
+struct DrawCommandBuffer;
+struct GpuAllocation;
+
+// Streams data through a staging ring on the transfer queue. Resources written by an upload
+// belong to the graphics family only once poll_uploads() has recorded their acquire barriers
+// into a graphics command buffer and upload_complete() reports the ticket.
+//
+// The transfer side never waits on rendering and rendering never waits on the transfer side:
+// the graphics queue picks a batch up on the first frame after its fence signaled.
+
+struct UploadBatch
+{
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    uint64_t ticket;
+    VkDeviceSize staging_end;           // staging head once the batch was recorded
+    // Acquire half of the queue family ownership transfers, replayed on the graphics queue.
+    std::vector<VkBufferMemoryBarrier> buffer_acquires;
+    std::vector<VkImageMemoryBarrier> image_acquires;
+};
+
+struct UploadStats
+{
+    uint64_t bytes;
+    uint64_t uploads;
+    uint64_t batches;
+    uint32_t staging_stalls;            // times the CPU blocked because the staging ring was full
+};
+
+struct UploadQueue
+{
+    VkDevice device;
+    VkQueue transfer_queue;
+    uint32_t transfer_family_idx;
+    uint32_t graphics_family_idx;
+    bool ownership_transfer;            // transfer and graphics families differ
+
+    GpuAllocation* staging;
+    char* staging_mapped;
+    VkDeviceSize staging_capacity;
+    VkDeviceSize staging_alignment;
+    VkDeviceSize head;                  // monotonic byte counters, like FrameAllocator
+    VkDeviceSize tail;
+
+    VkCommandPool command_pool;
+    std::vector<UploadBatch> batches;   // ring, oldest in flight at batch_first
+    uint32_t batch_first;
+    uint32_t batch_count;               // submitted batches not yet retired
+    int32_t recording;                  // batch being recorded, -1 when none
+    uint64_t next_ticket;
+    uint64_t retired_ticket;            // last batch whose fence has been seen signaled
+    uint64_t completed_ticket;          // every ticket up to this one is usable on the graphics queue
+
+    // Retired batches whose acquire barriers still have to be recorded by poll_uploads().
+    std::vector<VkBufferMemoryBarrier> pending_buffer_acquires;
+    std::vector<VkImageMemoryBarrier> pending_image_acquires;
+
+    UploadStats stats;
+};
+
+VkResult create_upload_queue(DeviceAllocator& allocator, VkDevice device, VkPhysicalDevice gpu, DrawCommandBuffer const& queues, VkDeviceSize staging_size, UploadQueue* out_upload);
+// Waits for everything in flight.
+void destroy_upload_queue(DeviceAllocator& allocator, UploadQueue& upload);
+
+// Copies data into staging and records the copy. Buffers bigger than the staging ring are split.
+// dst must not be used by the graphics queue before upload_complete(*out_ticket).
+VkResult upload_buffer(UploadQueue& upload, VkBuffer dst, VkDeviceSize dst_offset, void const* data, VkDeviceSize size, uint64_t* out_ticket);
+// regions[].bufferOffset are relative to data and must respect the transfer family
+// granularity (DrawCommandBuffer::transfer_granularity, whole mips are always fine). The image
+// goes from UNDEFINED to final_layout, the whole upload has to fit in the staging ring.
+VkResult upload_image(UploadQueue& upload, VkImage dst, VkImageSubresourceRange const& range, VkImageLayout final_layout,
+                      void const* data, VkDeviceSize size, VkBufferImageCopy const* regions, uint32_t region_count, uint64_t* out_ticket);
+
+// Submits the batch being recorded, if any. Nothing waits for it.
+VkResult submit_uploads(UploadQueue& upload);
+// Retires finished batches without blocking and records their acquire barriers into
+// graphics_cmd, which must be submitted on the graphics queue before the resources are used.
+VkResult poll_uploads(UploadQueue& upload, VkCommandBuffer graphics_cmd);
+bool upload_complete(UploadQueue const& upload, uint64_t ticket);
+
+void print_upload_stats(UploadQueue const& upload);
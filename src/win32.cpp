@@ -1,16 +1,109 @@
-#include <Windows.h>
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <windowsx.h>
+#include <stdint.h>
 #include <iostream>
 
+#include "dispatch.hpp"
+#include "host_allocator.hpp"
+#include "platform.hpp"
+#include "profiler.hpp"
+
+// Posted by destroy_platform_window(), the window has to be destroyed by the thread that created it.
+static UINT const WM_PLATFORM_DESTROY = WM_APP + 1;
+static char const* const window_class_name = "vk_test";
+
+static void push_mouse_button(PlatformWindow& window, uint32_t button, bool down)
+{
+    WindowEvent event = make_window_event(WINDOW_EVENT_MOUSE_BUTTON);
+    event.code = button;
+    event.down = down;
+    push_window_event(window, event);
+}
+
 LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
-    /*if (vulkanExample != NULL)
+    if (uMsg == WM_NCCREATE)
+    {
+        CREATESTRUCT const* create = reinterpret_cast<CREATESTRUCT const*>(lParam);
+        SetWindowLongPtr(hWnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(create->lpCreateParams));
+    }
+    PlatformWindow* window = reinterpret_cast<PlatformWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+    if (window == nullptr)
     {
-        vulkanExample->handleMessages(hWnd, uMsg, wParam, lParam);
-    }*/
+        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    }
+    switch (uMsg)
+    {
+    case WM_CLOSE:
+    {
+        // The render thread decides when to stop, the window goes with destroy_platform_window().
+        push_window_event(*window, make_window_event(WINDOW_EVENT_CLOSE));
+        return 0;
+    }
+    case WM_PLATFORM_DESTROY:
+        DestroyWindow(hWnd);
+        return 0;
+    case WM_DESTROY:
+        PostQuitMessage(0);
+        return 0;
+    case WM_SIZE:
+    {
+        // Minimizing reports 0x0, the swap chain waits for the restore. Sent from inside the modal
+        // sizing loop as well, which only blocks this thread.
+        WindowEvent event = make_window_event(WINDOW_EVENT_RESIZE);
+        event.width = LOWORD(lParam);
+        event.height = HIWORD(lParam);
+        push_window_event(*window, event);
+        return 0;
+    }
+    case WM_SETFOCUS:
+    case WM_KILLFOCUS:
+    {
+        WindowEvent event = make_window_event(WINDOW_EVENT_FOCUS);
+        event.down = (uMsg == WM_SETFOCUS);
+        push_window_event(*window, event);
+        break;
+    }
+    case WM_KEYDOWN:
+    case WM_SYSKEYDOWN:
+    case WM_KEYUP:
+    case WM_SYSKEYUP:
+    {
+        WindowEvent event = make_window_event(WINDOW_EVENT_KEY);
+        event.code = static_cast<uint32_t>(wParam) & 0xff;
+        event.down = (uMsg == WM_KEYDOWN) || (uMsg == WM_SYSKEYDOWN);
+        push_window_event(*window, event);
+        break;
+    }
+    case WM_MOUSEMOVE:
+    {
+        WindowEvent event = make_window_event(WINDOW_EVENT_MOUSE_MOVE);
+        event.x = GET_X_LPARAM(lParam);
+        event.y = GET_Y_LPARAM(lParam);
+        push_window_event(*window, event);
+        return 0;
+    }
+    case WM_LBUTTONDOWN:
+    case WM_LBUTTONUP:
+        push_mouse_button(*window, 0, uMsg == WM_LBUTTONDOWN);
+        return 0;
+    case WM_RBUTTONDOWN:
+    case WM_RBUTTONUP:
+        push_mouse_button(*window, 1, uMsg == WM_RBUTTONDOWN);
+        return 0;
+    case WM_MBUTTONDOWN:
+    case WM_MBUTTONUP:
+        push_mouse_button(*window, 2, uMsg == WM_MBUTTONDOWN);
+        return 0;
+    default:
+        break;
+    }
     return (DefWindowProc(hWnd, uMsg, wParam, lParam));
 }
 
-HWND setup_window(HINSTANCE hinstance, UINT width, UINT height, const char* win_name)
+static HWND setup_window(PlatformWindow* platform_window)
 {
     WNDCLASSEX wndClass;
 
@@ -19,12 +112,12 @@ HWND setup_window(HINSTANCE hinstance, UINT width, UINT height, const char* win_
     wndClass.lpfnWndProc = WndProc;
     wndClass.cbClsExtra = 0;
     wndClass.cbWndExtra = 0;
-    wndClass.hInstance = hinstance;
+    wndClass.hInstance = platform_window->instance;
     wndClass.hIcon = LoadIcon(NULL, IDI_APPLICATION);
     wndClass.hCursor = LoadCursor(NULL, IDC_ARROW);
     wndClass.hbrBackground = (HBRUSH)GetStockObject(WHITE_BRUSH);
     wndClass.lpszMenuName = NULL;
-    wndClass.lpszClassName = win_name;
+    wndClass.lpszClassName = window_class_name;
     wndClass.hIconSm = LoadIcon(NULL, IDI_WINLOGO);
 
     if (!RegisterClassEx(&wndClass))
@@ -42,6 +135,8 @@ HWND setup_window(HINSTANCE hinstance, UINT width, UINT height, const char* win_
     dwExStyle = WS_EX_APPWINDOW | WS_EX_WINDOWEDGE;
     dwStyle = WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS | WS_CLIPCHILDREN;
 
+    UINT width = platform_window->width;
+    UINT height = platform_window->height;
     RECT windowRect;
 
     windowRect.left = (long)screenWidth / 2 - width / 2;
@@ -52,9 +147,8 @@ HWND setup_window(HINSTANCE hinstance, UINT width, UINT height, const char* win_
     AdjustWindowRectEx(&windowRect, dwStyle, FALSE, dwExStyle);
 
     HWND window = CreateWindowEx(0,
-		win_name,
-		win_name,
-        //      WS_OVERLAPPEDWINDOW | WS_VISIBLE | WS_SYSMENU,
+        window_class_name,
+        platform_window->title,
         dwStyle | WS_CLIPSIBLINGS | WS_CLIPCHILDREN,
         windowRect.left,
         windowRect.top,
@@ -62,12 +156,13 @@ HWND setup_window(HINSTANCE hinstance, UINT width, UINT height, const char* win_
         windowRect.bottom,
         NULL,
         NULL,
-        hinstance,
-        NULL);
+        platform_window->instance,
+        platform_window);
 
     if (!window)
     {
         std::cout << "Could not create window!\n";
+        UnregisterClass(window_class_name, platform_window->instance);
         return 0;
     }
 
@@ -76,4 +171,80 @@ HWND setup_window(HINSTANCE hinstance, UINT width, UINT height, const char* win_
     SetFocus(window);
 
     return window;
-}
\ No newline at end of file
+}
+
+// The window belongs to this thread: its messages, the modal move and size loops included, are
+// dispatched here and nowhere near the frame loop.
+static void pump_window(PlatformWindow* window)
+{
+    PROFILE_THREAD_NAME("window");
+    HWND hwnd = setup_window(window);
+    {
+        std::lock_guard<std::mutex> guard(window->lock);
+        window->window = hwnd;
+        window->create_state = (hwnd != NULL) ? 1 : -1;
+    }
+    window->created.notify_all();
+    if (hwnd == NULL)
+    {
+        return;
+    }
+    MSG msg;
+    while (GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    UnregisterClass(window_class_name, window->instance);
+}
+
+bool create_platform_window(uint32_t width, uint32_t height, char const* title, PlatformWindow* out_window)
+{
+    out_window->instance = GetModuleHandle(NULL);
+    out_window->width = width;
+    out_window->height = height;
+    out_window->title = title;
+    out_window->create_state = 0;
+    out_window->stopping.store(false);
+    out_window->pump = std::thread(pump_window, out_window);
+
+    std::unique_lock<std::mutex> guard(out_window->lock);
+    out_window->created.wait(guard, [out_window]() { return out_window->create_state != 0; });
+    bool created = (out_window->create_state > 0);
+    guard.unlock();
+    if (!created)
+    {
+        out_window->pump.join();
+    }
+    return created;
+}
+
+void destroy_platform_window(PlatformWindow& window)
+{
+    if (!window.pump.joinable())
+    {
+        return;
+    }
+    // Unblocks a pump waiting for room in the queue, then ends its message loop.
+    window.stopping.store(true, std::memory_order_release);
+    if (window.window != NULL)
+    {
+        PostMessage(window.window, WM_PLATFORM_DESTROY, 0, 0);
+    }
+    window.pump.join();
+    window.window = NULL;
+}
+
+char const* window_surface_extension()
+{
+    return VK_KHR_WIN32_SURFACE_EXTENSION_NAME;
+}
+
+VkResult create_window_surface(VkInstance instance, PlatformWindow& window, VkSurfaceKHR* out_surface)
+{
+    VkWin32SurfaceCreateInfoKHR surfaceCreateInfo = {};
+    surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+    surfaceCreateInfo.hinstance = window.instance;
+    surfaceCreateInfo.hwnd = window.window;
+    return vkCreateWin32SurfaceKHR(instance, &surfaceCreateInfo, host_allocator(), out_surface);
+}
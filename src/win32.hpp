@@ -1,3 +0,0 @@
-#pragma once
-
-HWND setup_window(HINSTANCE hinstance, UINT width, UINT height, const char* win_name);
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "config.hpp"
+#include <vulkan/vulkan.h>
+
+#include <X11/Xlib.h>
+#include <X11/XKBlib.h>
+#include <poll.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "dispatch.hpp"
+#include "host_allocator.hpp"
+#include "platform.hpp"
+#include "profiler.hpp"
+
+// Each thread talks to the X server over its own connection, so neither Xlib nor the driver has to
+// lock around the other: the pump reads events on display, the surface and the presents use
+// surface_display. Window ids are server wide, the surface connection only needs the id.
+
+static void push_mouse_button(PlatformWindow& window, unsigned int x_button, bool down)
+{
+    // Button4/5 are the wheel, reported as press/release pairs: not buttons.
+    uint32_t button = 0;
+    switch (x_button)
+    {
+    case Button1:
+        button = 0;
+        break;
+    case Button3:
+        button = 1;
+        break;
+    case Button2:
+        button = 2;
+        break;
+    default:
+        return;
+    }
+    WindowEvent event = make_window_event(WINDOW_EVENT_MOUSE_BUTTON);
+    event.code = button;
+    event.down = down;
+    push_window_event(window, event);
+}
+
+// Only a new size is an event: ConfigureNotify comes for moves and restacking too.
+static void push_resize(PlatformWindow& window, uint32_t width, uint32_t height, uint32_t* last_width, uint32_t* last_height)
+{
+    if ((width == *last_width) && (height == *last_height))
+    {
+        return;
+    }
+    *last_width = width;
+    *last_height = height;
+    WindowEvent event = make_window_event(WINDOW_EVENT_RESIZE);
+    event.width = width;
+    event.height = height;
+    push_window_event(window, event);
+}
+
+static void translate_event(PlatformWindow& window, XEvent const& x_event, Atom delete_message, uint32_t* last_width, uint32_t* last_height)
+{
+    switch (x_event.type)
+    {
+    case ConfigureNotify:
+        push_resize(window, static_cast<uint32_t>(x_event.xconfigure.width), static_cast<uint32_t>(x_event.xconfigure.height), last_width, last_height);
+        break;
+    case UnmapNotify:
+        // Iconified: the same as the 0x0 of a minimized Win32 window.
+        push_resize(window, 0, 0, last_width, last_height);
+        break;
+    case MapNotify:
+    {
+        XWindowAttributes attributes;
+        if (XGetWindowAttributes(x_event.xmap.display, x_event.xmap.window, &attributes))
+        {
+            push_resize(window, static_cast<uint32_t>(attributes.width), static_cast<uint32_t>(attributes.height), last_width, last_height);
+        }
+        break;
+    }
+    case ClientMessage:
+        if (static_cast<Atom>(x_event.xclient.data.l[0]) == delete_message)
+        {
+            // The render thread decides when to stop, the window goes with destroy_platform_window().
+            push_window_event(window, make_window_event(WINDOW_EVENT_CLOSE));
+        }
+        break;
+    case FocusIn:
+    case FocusOut:
+    {
+        WindowEvent event = make_window_event(WINDOW_EVENT_FOCUS);
+        event.down = (x_event.type == FocusIn);
+        push_window_event(window, event);
+        break;
+    }
+    case KeyPress:
+    case KeyRelease:
+    {
+        WindowEvent event = make_window_event(WINDOW_EVENT_KEY);
+        event.code = x_event.xkey.keycode & 0xff;
+        event.down = (x_event.type == KeyPress);
+        push_window_event(window, event);
+        break;
+    }
+    case MotionNotify:
+    {
+        WindowEvent event = make_window_event(WINDOW_EVENT_MOUSE_MOVE);
+        event.x = x_event.xmotion.x;
+        event.y = x_event.xmotion.y;
+        push_window_event(window, event);
+        break;
+    }
+    case ButtonPress:
+    case ButtonRelease:
+        push_mouse_button(window, x_event.xbutton.button, x_event.type == ButtonPress);
+        break;
+    default:
+        break;
+    }
+}
+
+static Window setup_window(PlatformWindow* platform_window, Atom* out_delete_message)
+{
+    Display* display = platform_window->display;
+    int screen = DefaultScreen(display);
+    XSetWindowAttributes attributes;
+    attributes.background_pixel = BlackPixel(display, screen);
+    attributes.event_mask = StructureNotifyMask | FocusChangeMask | KeyPressMask | KeyReleaseMask
+                          | PointerMotionMask | ButtonPressMask | ButtonReleaseMask;
+    Window window = XCreateWindow(display, RootWindow(display, screen), 0, 0, platform_window->width, platform_window->height, 0,
+                                  CopyFromParent, InputOutput, CopyFromParent, CWBackPixel | CWEventMask, &attributes);
+    if (window == 0)
+    {
+        return 0;
+    }
+    XStoreName(display, window, platform_window->title);
+    // Closing from the window manager becomes a message instead of a dropped connection.
+    *out_delete_message = XInternAtom(display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(display, window, out_delete_message, 1);
+    // Held keys repeat as presses only, without the fake release in between.
+    XkbSetDetectableAutoRepeat(display, True, nullptr);
+    XMapWindow(display, window);
+    // The window has to exist on the server before the render thread makes a surface of it over
+    // the other connection.
+    XSync(display, False);
+    return window;
+}
+
+// Sleeps in poll() on the connection and the wake pipe, events are translated the moment they
+// arrive whatever the frame loop is doing.
+static void pump_window(PlatformWindow* window)
+{
+    PROFILE_THREAD_NAME("window");
+    Atom delete_message = 0;
+    Window x_window = setup_window(window, &delete_message);
+    {
+        std::lock_guard<std::mutex> guard(window->lock);
+        window->window = x_window;
+        window->create_state = (x_window != 0) ? 1 : -1;
+    }
+    window->created.notify_all();
+    if (x_window == 0)
+    {
+        return;
+    }
+    Display* display = window->display;
+    uint32_t last_width = window->width;
+    uint32_t last_height = window->height;
+    while (!window->stopping.load(std::memory_order_acquire))
+    {
+        while (XPending(display) > 0)
+        {
+            XEvent x_event;
+            XNextEvent(display, &x_event);
+            translate_event(*window, x_event, delete_message, &last_width, &last_height);
+        }
+        pollfd fds[2];
+        fds[0].fd = ConnectionNumber(display);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = window->wake_pipe[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        poll(fds, 2, -1);
+    }
+    XDestroyWindow(display, x_window);
+    XSync(display, False);
+}
+
+bool create_platform_window(uint32_t width, uint32_t height, char const* title, PlatformWindow* out_window)
+{
+    out_window->display = XOpenDisplay(nullptr);
+    if (out_window->display == nullptr)
+    {
+        std::cout << "Could not open the X display\n";
+        return false;
+    }
+    out_window->surface_display = XOpenDisplay(nullptr);
+    if ((out_window->surface_display == nullptr) || (pipe(out_window->wake_pipe) != 0))
+    {
+        std::cout << "Could not set up the window\n";
+        if (out_window->surface_display != nullptr)
+        {
+            XCloseDisplay(out_window->surface_display);
+            out_window->surface_display = nullptr;
+        }
+        XCloseDisplay(out_window->display);
+        out_window->display = nullptr;
+        return false;
+    }
+    out_window->width = width;
+    out_window->height = height;
+    out_window->title = title;
+    out_window->create_state = 0;
+    out_window->stopping.store(false);
+    out_window->pump = std::thread(pump_window, out_window);
+
+    std::unique_lock<std::mutex> guard(out_window->lock);
+    out_window->created.wait(guard, [out_window]() { return out_window->create_state != 0; });
+    bool created = (out_window->create_state > 0);
+    guard.unlock();
+    if (!created)
+    {
+        std::cout << "Could not create window!\n";
+        destroy_platform_window(*out_window);
+    }
+    return created;
+}
+
+void destroy_platform_window(PlatformWindow& window)
+{
+    if (window.pump.joinable())
+    {
+        // Unblocks a pump waiting for room in the queue, then wakes it out of poll().
+        window.stopping.store(true, std::memory_order_release);
+        char wake = 1;
+        ssize_t written = write(window.wake_pipe[1], &wake, 1);
+        (void)written;
+        window.pump.join();
+    }
+    window.window = 0;
+    if (window.wake_pipe[0] >= 0)
+    {
+        close(window.wake_pipe[0]);
+        close(window.wake_pipe[1]);
+        window.wake_pipe[0] = -1;
+        window.wake_pipe[1] = -1;
+    }
+    if (window.surface_display != nullptr)
+    {
+        XCloseDisplay(window.surface_display);
+        window.surface_display = nullptr;
+    }
+    if (window.display != nullptr)
+    {
+        XCloseDisplay(window.display);
+        window.display = nullptr;
+    }
+}
+
+char const* window_surface_extension()
+{
+    return VK_KHR_XLIB_SURFACE_EXTENSION_NAME;
+}
+
+VkResult create_window_surface(VkInstance instance, PlatformWindow& window, VkSurfaceKHR* out_surface)
+{
+    VkXlibSurfaceCreateInfoKHR surface_info = {};
+    surface_info.sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR;
+    surface_info.pNext = nullptr;
+    surface_info.flags = 0;
+    surface_info.dpy = window.surface_display;
+    surface_info.window = window.window;
+    return vkCreateXlibSurfaceKHR(instance, &surface_info, host_allocator(), out_surface);
+}
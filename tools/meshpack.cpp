@@ -0,0 +1,339 @@
+#include "config.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "file_map.hpp"
+#include "mesh_format.hpp"
+#include "mesh_pack.hpp"
+
+// meshpack [--cache <entries>] <input.obj> <output.vkmesh>
+//
+// Wavefront OBJ in: v, vt, vn and f (polygons are fanned, negative indices count back), every g,
+// o or usemtl starts a submesh. Without vn the normals are the area weighted face normals around
+// each position.
+
+struct ObjCorner
+{
+    int32_t position;
+    int32_t uv;
+    int32_t normal;
+
+    bool operator<(ObjCorner const& other) const
+    {
+        if (position != other.position)
+        {
+            return position < other.position;
+        }
+        if (uv != other.uv)
+        {
+            return uv < other.uv;
+        }
+        return normal < other.normal;
+    }
+};
+
+struct ObjReader
+{
+    std::vector<float> positions;
+    std::vector<float> uvs;
+    std::vector<float> normals;
+    std::map<ObjCorner, uint32_t> corners;     // of the current submesh, vertices are not shared across submeshes
+    std::vector<uint32_t> vertex_positions;    // position of every vertex, for generated normals
+    SourceMesh mesh;
+};
+
+static bool read_text_file(char const* path, std::vector<char>* out_text)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    char buffer[65536];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        out_text->insert(out_text->end(), buffer, buffer + read);
+    }
+    bool ok = (ferror(file) == 0);
+    fclose(file);
+    out_text->push_back('\0');
+    return ok;
+}
+
+static char const* skip_spaces(char const* text)
+{
+    while ((*text == ' ') || (*text == '\t'))
+    {
+        ++text;
+    }
+    return text;
+}
+
+static char const* read_floats(char const* text, uint32_t count, std::vector<float>& out_values)
+{
+    for (uint32_t fidx = 0; fidx < count; ++fidx)
+    {
+        char* end = nullptr;
+        float value = strtof(text, &end);
+        out_values.push_back((end != text) ? value : 0.0f);
+        text = end;
+    }
+    return text;
+}
+
+// 1 based, negative counts back from the last element read; -1 when absent or out of range.
+static int32_t resolve_index(long value, size_t count)
+{
+    long resolved = (value < 0) ? static_cast<long>(count) + value : value - 1;
+    return ((resolved >= 0) && (resolved < static_cast<long>(count))) ? static_cast<int32_t>(resolved) : -1;
+}
+
+static char const* read_corner(ObjReader const& reader, char const* text, ObjCorner* out_corner)
+{
+    char* end = nullptr;
+    out_corner->position = resolve_index(strtol(text, &end, 10), reader.positions.size() / 3);
+    out_corner->uv = -1;
+    out_corner->normal = -1;
+    text = end;
+    if (*text == '/')
+    {
+        ++text;
+        if (*text != '/')
+        {
+            out_corner->uv = resolve_index(strtol(text, &end, 10), reader.uvs.size() / 2);
+            text = end;
+        }
+        if (*text == '/')
+        {
+            ++text;
+            out_corner->normal = resolve_index(strtol(text, &end, 10), reader.normals.size() / 3);
+            text = end;
+        }
+    }
+    while ((*text != '\0') && (*text != ' ') && (*text != '\t') && (*text != '\n') && (*text != '\r'))
+    {
+        ++text;
+    }
+    return text;
+}
+
+static uint32_t corner_vertex(ObjReader& reader, ObjCorner const& corner)
+{
+    std::map<ObjCorner, uint32_t>::const_iterator found = reader.corners.find(corner);
+    if (found != reader.corners.end())
+    {
+        return found->second;
+    }
+    SourceVertex vertex;
+    memcpy(vertex.position, &reader.positions[corner.position * 3], sizeof(vertex.position));
+    vertex.normal[0] = 0.0f;
+    vertex.normal[1] = 0.0f;
+    vertex.normal[2] = 0.0f;
+    if (corner.normal >= 0)
+    {
+        memcpy(vertex.normal, &reader.normals[corner.normal * 3], sizeof(vertex.normal));
+    }
+    vertex.uv[0] = 0.0f;
+    vertex.uv[1] = 0.0f;
+    if (corner.uv >= 0)
+    {
+        // OBJ has v going up, images start at the top row.
+        vertex.uv[0] = reader.uvs[corner.uv * 2];
+        vertex.uv[1] = 1.0f - reader.uvs[corner.uv * 2 + 1];
+    }
+    uint32_t index = static_cast<uint32_t>(reader.mesh.vertices.size());
+    reader.mesh.vertices.push_back(vertex);
+    reader.vertex_positions.push_back(static_cast<uint32_t>(corner.position));
+    reader.corners[corner] = index;
+    return index;
+}
+
+static void start_submesh(ObjReader& reader)
+{
+    reader.corners.clear();
+    uint32_t first_index = static_cast<uint32_t>(reader.mesh.indices.size());
+    if (!reader.mesh.submeshes.empty() && (reader.mesh.submeshes.back().first_index == first_index))
+    {
+        return;     // nothing went into the last one
+    }
+    if (!reader.mesh.submeshes.empty())
+    {
+        reader.mesh.submeshes.back().index_count = first_index - reader.mesh.submeshes.back().first_index;
+    }
+    SourceSubmesh submesh = { first_index, 0 };
+    reader.mesh.submeshes.push_back(submesh);
+}
+
+static void read_face(ObjReader& reader, char const* text, uint32_t line)
+{
+    std::vector<uint32_t> polygon;
+    for (text = skip_spaces(text); (*text != '\0') && (*text != '\n') && (*text != '\r'); text = skip_spaces(text))
+    {
+        ObjCorner corner;
+        text = read_corner(reader, text, &corner);
+        if (corner.position < 0)
+        {
+            std::cout << "line " << line << ": face corner without a valid position, face skipped\n";
+            return;
+        }
+        polygon.push_back(corner_vertex(reader, corner));
+    }
+    for (size_t cidx = 2; cidx < polygon.size(); ++cidx)
+    {
+        reader.mesh.indices.push_back(polygon[0]);
+        reader.mesh.indices.push_back(polygon[cidx - 1]);
+        reader.mesh.indices.push_back(polygon[cidx]);
+    }
+}
+
+static bool read_obj(char const* path, ObjReader* out_reader)
+{
+    std::vector<char> text;
+    if (!read_text_file(path, &text))
+    {
+        return false;
+    }
+    ObjReader& reader = *out_reader;
+    start_submesh(reader);
+    uint32_t line = 1;
+    for (char const* cursor = text.data(); *cursor != '\0'; ++line)
+    {
+        char const* start = skip_spaces(cursor);
+        if ((start[0] == 'v') && ((start[1] == ' ') || (start[1] == '\t')))
+        {
+            read_floats(start + 2, 3, reader.positions);
+        }
+        else if ((start[0] == 'v') && (start[1] == 't'))
+        {
+            read_floats(start + 2, 2, reader.uvs);
+        }
+        else if ((start[0] == 'v') && (start[1] == 'n'))
+        {
+            read_floats(start + 2, 3, reader.normals);
+        }
+        else if ((start[0] == 'f') && ((start[1] == ' ') || (start[1] == '\t')))
+        {
+            read_face(reader, start + 2, line);
+        }
+        else if (((start[0] == 'g') || (start[0] == 'o')) && ((start[1] == ' ') || (start[1] == '\t')))
+        {
+            start_submesh(reader);
+        }
+        else if (strncmp(start, "usemtl", 6) == 0)
+        {
+            start_submesh(reader);
+        }
+        cursor = strchr(start, '\n');
+        if (cursor == nullptr)
+        {
+            break;
+        }
+        ++cursor;
+    }
+    SourceSubmesh& last = reader.mesh.submeshes.back();
+    last.index_count = static_cast<uint32_t>(reader.mesh.indices.size()) - last.first_index;
+    if (last.index_count == 0)
+    {
+        reader.mesh.submeshes.pop_back();
+    }
+    return true;
+}
+
+// Summed per position so splits for uvs or submeshes don't show as creases.
+static void generate_normals(ObjReader& reader)
+{
+    std::vector<float> sums(reader.positions.size(), 0.0f);
+    SourceMesh& mesh = reader.mesh;
+    for (size_t iidx = 0; iidx + 2 < mesh.indices.size(); iidx += 3)
+    {
+        float const* p0 = mesh.vertices[mesh.indices[iidx]].position;
+        float const* p1 = mesh.vertices[mesh.indices[iidx + 1]].position;
+        float const* p2 = mesh.vertices[mesh.indices[iidx + 2]].position;
+        float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float normal[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        for (uint32_t corner = 0; corner < 3; ++corner)
+        {
+            float* sum = &sums[reader.vertex_positions[mesh.indices[iidx + corner]] * 3];
+            sum[0] += normal[0];
+            sum[1] += normal[1];
+            sum[2] += normal[2];
+        }
+    }
+    for (size_t vidx = 0; vidx < mesh.vertices.size(); ++vidx)
+    {
+        float const* sum = &sums[reader.vertex_positions[vidx] * 3];
+        float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            mesh.vertices[vidx].normal[axis] = (length > 0.0f) ? sum[axis] / length : 0.0f;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t cache_size = MESH_CACHE_SIZE;
+    char const* input_path = nullptr;
+    char const* output_path = nullptr;
+    for (int aidx = 1; aidx < argc; ++aidx)
+    {
+        if ((strcmp(argv[aidx], "--cache") == 0) && (aidx + 1 < argc))
+        {
+            cache_size = static_cast<uint32_t>(atoi(argv[++aidx]));
+            if (cache_size < 3)
+            {
+                cache_size = 3;     // a whole triangle has to fit
+            }
+        }
+        else if (input_path == nullptr)
+        {
+            input_path = argv[aidx];
+        }
+        else
+        {
+            output_path = argv[aidx];
+        }
+    }
+    if ((input_path == nullptr) || (output_path == nullptr))
+    {
+        std::cout << "usage: meshpack [--cache <entries>] <input.obj> <output.vkmesh>\n";
+        return 1;
+    }
+
+    ObjReader reader;
+    if (!read_obj(input_path, &reader))
+    {
+        std::cout << "Unable to read " << input_path << "\n";
+        return 1;
+    }
+    if (reader.normals.empty())
+    {
+        generate_normals(reader);
+    }
+    std::vector<unsigned char> file;
+    MeshPackStats stats;
+    if (!pack_mesh(reader.mesh, cache_size, &file, &stats))
+    {
+        std::cout << input_path << ": no triangles\n";
+        return 1;
+    }
+    if (!write_file_atomic(output_path, file.data(), file.size()))
+    {
+        std::cout << "Unable to write " << output_path << "\n";
+        return 1;
+    }
+    std::cout << output_path << ": " << stats.vertex_count << " vertices, " << stats.triangle_count << " triangles, "
+              << reader.mesh.submeshes.size() << " submeshes, " << file.size() / 1024 << " KiB\n";
+    std::cout << "  vertices shaded per triangle (FIFO " << cache_size << "): " << stats.shaded_before << " -> " << stats.shaded_after
+              << ", " << stats.clusters << " overdraw clusters\n";
+    std::cout << "  " << sizeof(MeshVertex) << " bytes per vertex, " << sizeof(SourceVertex) << " as floats\n";
+    return 0;
+}